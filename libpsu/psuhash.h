@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2017, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * Simple, non-cryptographic hashing, for when we need a fingerprint
+ * of some data and don't want to drag in libcrypto.
+ */
+
+#ifndef LIBPSU_PSUHASH_H
+#define LIBPSU_PSUHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint64_t psu_hash_t;
+
+/* FNV-1a, 64 bit flavor */
+#define PSU_HASH_INIT	0xcbf29ce484222325ull /* FNV offset basis */
+#define PSU_HASH_PRIME	0x100000001b3ull      /* FNV prime */
+
+/**
+ * Add data to a running FNV-1a hash.  Start with PSU_HASH_INIT.
+ *
+ * @param[in] hash Hash value so far
+ * @param[in] buf Data to hash
+ * @param[in] len Length of data
+ * @return New hash value
+ */
+static inline psu_hash_t
+psu_hash_add (psu_hash_t hash, const void *buf, size_t len)
+{
+    const uint8_t *cp = buf;
+    const uint8_t *ep = cp + len;
+
+    for (; cp < ep; cp++) {
+	hash ^= *cp;
+	hash *= PSU_HASH_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Hash a NUL-terminated string into a running hash.  The terminating
+ * NUL is included, so "ab" + "c" differs from "a" + "bc".
+ *
+ * @param[in] hash Hash value so far
+ * @param[in] str String to hash (NULL is treated as empty)
+ * @return New hash value
+ */
+static inline psu_hash_t
+psu_hash_add_string (psu_hash_t hash, const char *str)
+{
+    const uint8_t *cp = (const uint8_t *) (str ?: "");
+
+    for (;;) {
+	hash ^= *cp;
+	hash *= PSU_HASH_PRIME;
+	if (*cp++ == '\0')
+	    break;
+    }
+
+    return hash;
+}
+
+/**
+ * Fold a 64-bit value into a running hash, for combining hashes
+ * (of children, say) into a parent's hash.
+ *
+ * @param[in] hash Hash value so far
+ * @param[in] value Value to add
+ * @return New hash value
+ */
+static inline psu_hash_t
+psu_hash_add_value (psu_hash_t hash, uint64_t value)
+{
+    return psu_hash_add(hash, &value, sizeof(value));
+}
+
+#endif /* LIBPSU_PSUHASH_H */
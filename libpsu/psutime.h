@@ -14,6 +14,7 @@
 
 #include <time.h>
 #include <sys/time.h>
+#include <stdint.h>
 
 #include <libpsu/psucommon.h>
 
@@ -24,6 +25,12 @@
  */
 typedef unsigned long psu_time_usecs_t;
 
+/**
+ * @typedef psu_time_nsecs_t
+ * A type for holding nanoseconds, for measuring intervals.
+ */
+typedef uint64_t psu_time_nsecs_t;
+
 /* Useful time-related constants */
 #define NSEC_PER_SEC 1000000000ull
 #define NSEC_PER_MSEC 1000000ull
@@ -45,6 +52,23 @@ psu_timeval_to_usecs (struct timeval *tvp)
     return tvp->tv_sec * USEC_PER_SEC + tvp->tv_usec;
 }
 
+/**
+ * Return the current time, in nanoseconds, from a clock that never
+ * goes backward.  Only differences between values mean anything.
+ *
+ * @return Number of nanoseconds
+ */
+static inline psu_time_nsecs_t
+psu_time_now_nsecs (void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+	return 0;
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
 /**
  * Return an ISO-style formatted time string, as an ISO compatible
  * replacement for ctime(3).  NOTE: takes time_t by pointer, not
@@ -0,0 +1,799 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Writing and reading the binary form of xi trees (see xibinary.h).
+ *
+ * Writing is two passes over the tree: the first gives each node its
+ * index in document order, and the second builds the node records,
+ * pulling names, namespaces, and text into their own tables as we
+ * meet them.  The whole thing then goes out in one writev().
+ *
+ * Reading is just mmap() and some sanity checks; the accessors in
+ * xibinary.h do the rest.  If the caller wants a real xi tree (to
+ * run rules or XPath against it), xi_binary_import() rebuilds one in
+ * a workspace, which is a straight copy with no parsing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "slaxconfig.h"
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+#include <libxi/xibinary.h>
+
+#define XI_BINARY_MIN	256	/* Minimum number of entries for tables */
+
+/*
+ * Round up to the next multiple of XI_BINARY_ALIGN
+ */
+static inline uint64_t
+xi_binary_align (uint64_t off)
+{
+    return (off + XI_BINARY_ALIGN - 1) & ~((uint64_t) XI_BINARY_ALIGN - 1);
+}
+
+/*
+ * A growable table, used for everything we're building
+ */
+typedef struct xi_binary_table_s {
+    void *xbt_base;		/* Base of the table */
+    size_t xbt_count;		/* Number of entries in use */
+    size_t xbt_max;		/* Number of entries allocated */
+} xi_binary_table_t;
+
+/*
+ * Make sure the table has room for "need" entries, returning NULL on
+ * failure.  New entries are zeroed.
+ */
+static void *
+xi_binary_grow (xi_binary_table_t *tp, size_t need, size_t size)
+{
+    size_t max;
+    char *cp;
+
+    if (need <= tp->xbt_max)
+	return tp->xbt_base;
+
+    for (max = tp->xbt_max ?: XI_BINARY_MIN; max < need; max <<= 1)
+	continue;
+
+    cp = realloc(tp->xbt_base, max * size);
+    if (cp == NULL)
+	return NULL;
+
+    bzero(cp + tp->xbt_max * size, (max - tp->xbt_max) * size);
+    tp->xbt_base = cp;
+    tp->xbt_max = max;
+    return cp;
+}
+
+typedef struct xi_binary_writer_s {
+    xi_workspace_t *xbw_workspace; /* Workspace we're writing from */
+    xi_binary_table_t xbw_node_map; /* Node atom -> node index */
+    xi_binary_table_t xbw_name_map; /* Name atom -> name index */
+    xi_binary_table_t xbw_ns_map; /* Namespace atom -> ns index */
+    xi_binary_table_t xbw_atoms; /* Node index -> node atom */
+    xi_binary_table_t xbw_names; /* Name offsets (uint32_t) */
+    xi_binary_table_t xbw_strings; /* Name strings (char) */
+    xi_binary_table_t xbw_ns;	/* Namespace table (xi_binary_ns_t) */
+    xi_binary_table_t xbw_nodes; /* Node records (xi_binary_node_t) */
+    xi_binary_table_t xbw_text;	/* Text blob (char) */
+    xi_depth_t xbw_max_depth;	/* Max depth seen */
+} xi_binary_writer_t;
+
+/*
+ * Find the slot in a map table for the given atom
+ */
+static xi_binary_index_t *
+xi_binary_map_slot (xi_binary_table_t *tp, pa_atom_t atom)
+{
+    xi_binary_index_t *map;
+
+    map = xi_binary_grow(tp, (size_t) atom + 1, sizeof(*map));
+    return map ? &map[atom] : NULL;
+}
+
+/*
+ * Append data to a byte table, returning its offset or -1
+ */
+static int64_t
+xi_binary_append (xi_binary_table_t *tp, const char *data, size_t len)
+{
+    size_t off = tp->xbt_count;
+    char *cp = xi_binary_grow(tp, off + len, 1);
+
+    if (cp == NULL)
+	return -1;
+
+    memcpy(cp + off, data, len);
+    tp->xbt_count += len;
+    return off;
+}
+
+/*
+ * Return the index for a name atom, adding it to the table if needed
+ */
+static xi_binary_index_t
+xi_binary_add_name (xi_binary_writer_t *xbwp, pa_atom_t atom)
+{
+    xi_binary_index_t *slotp, idx;
+    uint32_t *names;
+    const char *str;
+    int64_t off;
+
+    if (atom == PA_NULL_ATOM)
+	return XI_BINARY_NONE;
+
+    slotp = xi_binary_map_slot(&xbwp->xbw_name_map, atom);
+    if (slotp == NULL)
+	return XI_BINARY_NONE;
+
+    if (*slotp != XI_BINARY_NONE)
+	return *slotp;
+
+    str = xi_namepool_string(xbwp->xbw_workspace, atom);
+    if (str == NULL)
+	return XI_BINARY_NONE;
+
+    off = xi_binary_append(&xbwp->xbw_strings, str, strlen(str) + 1);
+    if (off < 0)
+	return XI_BINARY_NONE;
+
+    idx = xbwp->xbw_names.xbt_count;
+    names = xi_binary_grow(&xbwp->xbw_names, idx + 1, sizeof(*names));
+    if (names == NULL)
+	return XI_BINARY_NONE;
+
+    names[idx] = off;
+    xbwp->xbw_names.xbt_count += 1;
+
+    *slotp = idx;
+    return idx;
+}
+
+/*
+ * Return the index for a namespace atom, adding it if needed
+ */
+static xi_binary_index_t
+xi_binary_add_ns (xi_binary_writer_t *xbwp, pa_atom_t atom)
+{
+    xi_binary_index_t *slotp, idx;
+    xi_binary_ns_t *nsp;
+    xi_ns_map_t *ns_map;
+
+    if (atom == PA_NULL_ATOM)
+	return XI_BINARY_NONE;
+
+    slotp = xi_binary_map_slot(&xbwp->xbw_ns_map, atom);
+    if (slotp == NULL)
+	return XI_BINARY_NONE;
+
+    if (*slotp != XI_BINARY_NONE)
+	return *slotp;
+
+    ns_map = xi_ns_map_addr(xbwp->xbw_workspace, atom);
+    if (ns_map == NULL)
+	return XI_BINARY_NONE;
+
+    idx = xbwp->xbw_ns.xbt_count;
+    nsp = xi_binary_grow(&xbwp->xbw_ns, idx + 1, sizeof(*nsp));
+    if (nsp == NULL)
+	return XI_BINARY_NONE;
+
+    nsp[idx].xbns_prefix = xi_binary_add_name(xbwp, ns_map->xnm_prefix);
+    nsp[idx].xbns_uri = xi_binary_add_name(xbwp, ns_map->xnm_uri);
+    xbwp->xbw_ns.xbt_count += 1;
+
+    *slotp = idx;
+    return idx;
+}
+
+/*
+ * Find the next node in document order, or PA_NULL_ATOM when we're
+ * done.  Elements (and the root) have their children as contents;
+ * the last child's "next" points back to the parent, which we've
+ * already visited, so we keep climbing until we find a sibling.
+ */
+static pa_atom_t
+xi_binary_walk_next (xi_workspace_t *xwp, xi_node_t *nodep)
+{
+    xi_node_t *nextp;
+    pa_atom_t next;
+
+    if ((nodep->xn_type == XI_TYPE_ELT || nodep->xn_type == XI_TYPE_ROOT)
+	&& nodep->xn_contents != PA_NULL_ATOM)
+	return nodep->xn_contents;
+
+    for (;;) {
+	next = nodep->xn_next;
+	if (next == PA_NULL_ATOM)
+	    return PA_NULL_ATOM;
+
+	nextp = xi_node_addr(xwp, next);
+	if (nextp == NULL)
+	    return PA_NULL_ATOM;
+
+	if (nextp->xn_depth >= nodep->xn_depth)
+	    return next;	/* A sibling */
+
+	nodep = nextp;		/* Our parent; keep climbing */
+    }
+}
+
+static void
+xi_binary_writer_cleanup (xi_binary_writer_t *xbwp)
+{
+    free(xbwp->xbw_node_map.xbt_base);
+    free(xbwp->xbw_name_map.xbt_base);
+    free(xbwp->xbw_ns_map.xbt_base);
+    free(xbwp->xbw_atoms.xbt_base);
+    free(xbwp->xbw_names.xbt_base);
+    free(xbwp->xbw_strings.xbt_base);
+    free(xbwp->xbw_ns.xbt_base);
+    free(xbwp->xbw_nodes.xbt_base);
+    free(xbwp->xbw_text.xbt_base);
+}
+
+/*
+ * Build all the tables for the tree
+ */
+static int
+xi_binary_build (xi_binary_writer_t *xbwp, pa_atom_t root_atom)
+{
+    xi_workspace_t *xwp = xbwp->xbw_workspace;
+    xi_binary_index_t *slotp, idx, count;
+    xi_binary_node_t *bnp;
+    pa_atom_t *atoms, atom;
+    xi_node_t *nodep;
+    const char *str;
+    int64_t off;
+    uint32_t *names;
+    xi_binary_ns_t *nsp;
+    xi_binary_index_t *node_map;
+    size_t node_map_max;
+
+    /* Index zero is "none" in every table; text offset zero is "" */
+    names = xi_binary_grow(&xbwp->xbw_names, 1, sizeof(*names));
+    nsp = xi_binary_grow(&xbwp->xbw_ns, 1, sizeof(*nsp));
+    atoms = xi_binary_grow(&xbwp->xbw_atoms, 1, sizeof(*atoms));
+    if (names == NULL || nsp == NULL || atoms == NULL
+	|| xi_binary_append(&xbwp->xbw_strings, "", 1) < 0
+	|| xi_binary_append(&xbwp->xbw_text, "", 1) < 0)
+	return -1;
+    xbwp->xbw_names.xbt_count = xbwp->xbw_ns.xbt_count = 1;
+    xbwp->xbw_atoms.xbt_count = 1;
+
+    /* Pass one: number the nodes in document order */
+    for (atom = root_atom; atom != PA_NULL_ATOM;
+	 atom = xi_binary_walk_next(xwp, nodep)) {
+	nodep = xi_node_addr(xwp, atom);
+	if (nodep == NULL)
+	    return -1;
+
+	idx = xbwp->xbw_atoms.xbt_count;
+	atoms = xi_binary_grow(&xbwp->xbw_atoms, idx + 1, sizeof(*atoms));
+	slotp = xi_binary_map_slot(&xbwp->xbw_node_map, atom);
+	if (atoms == NULL || slotp == NULL)
+	    return -1;
+
+	atoms[idx] = atom;
+	*slotp = idx;
+	xbwp->xbw_atoms.xbt_count += 1;
+
+	if (nodep->xn_depth > xbwp->xbw_max_depth)
+	    xbwp->xbw_max_depth = nodep->xn_depth;
+    }
+
+    /* Pass two: build the node records */
+    count = xbwp->xbw_atoms.xbt_count;
+    bnp = xi_binary_grow(&xbwp->xbw_nodes, count, sizeof(*bnp));
+    if (bnp == NULL)
+	return -1;
+    xbwp->xbw_nodes.xbt_count = count;
+
+    node_map = xbwp->xbw_node_map.xbt_base;
+    node_map_max = xbwp->xbw_node_map.xbt_max;
+
+    atoms = xbwp->xbw_atoms.xbt_base;
+    for (idx = XI_BINARY_ROOT; idx < count; idx++) {
+	nodep = xi_node_addr(xwp, atoms[idx]);
+
+	bnp[idx].xbn_type = nodep->xn_type;
+	bnp[idx].xbn_depth = nodep->xn_depth;
+	/*
+	 * Interning and attribute directories are properties of the
+	 * workspace, not the document
+	 */
+	bnp[idx].xbn_flags = nodep->xn_flags
+	    & ~(XNF_INTERNED | XNF_ATTRIBS_INDEXED);
+	bnp[idx].xbn_name = xi_binary_add_name(xbwp, nodep->xn_name);
+	bnp[idx].xbn_ns = xi_binary_add_ns(xbwp, nodep->xn_ns_map);
+	bnp[idx].xbn_next = (nodep->xn_next < node_map_max)
+	    ? node_map[nodep->xn_next] : XI_BINARY_NONE;
+
+	switch (nodep->xn_type) {
+	case XI_TYPE_ROOT:
+	case XI_TYPE_ELT:
+	    bnp[idx].xbn_contents = (nodep->xn_contents < node_map_max)
+		? node_map[nodep->xn_contents] : XI_BINARY_NONE;
+	    break;
+
+	case XI_TYPE_TEXT:
+	case XI_TYPE_UNESC:
+	case XI_TYPE_ATSTR:
+	case XI_TYPE_ATTRIB:
+	    /* Text is written as stored; XNF_ESCAPED comes along */
+	    str = xi_node_stored_string(xwp, nodep);
+	    if (str == NULL || *str == '\0')
+		break;
+
+	    off = xi_binary_append(&xbwp->xbw_text, str, strlen(str) + 1);
+	    if (off < 0)
+		return -1;
+	    bnp[idx].xbn_contents = off;
+	    break;
+
+	case XI_TYPE_NS:
+	    bnp[idx].xbn_contents = xi_binary_add_ns(xbwp, nodep->xn_contents);
+	    break;
+	}
+    }
+
+    return 0;
+}
+
+/*
+ * Write an iovec, coping with short writes
+ */
+static int
+xi_binary_writev (int fd, struct iovec *iov, int cnt)
+{
+    ssize_t rc;
+
+    while (cnt > 0) {
+	rc = writev(fd, iov, cnt);
+	if (rc < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+
+	while (cnt > 0 && (size_t) rc >= iov->iov_len) {
+	    rc -= iov->iov_len;
+	    iov += 1;
+	    cnt -= 1;
+	}
+
+	if (cnt > 0) {
+	    iov->iov_base = (char *) iov->iov_base + rc;
+	    iov->iov_len -= rc;
+	}
+    }
+
+    return 0;
+}
+
+int
+xi_binary_write_fd (xi_parse_t *parsep, int fd)
+{
+    static char zeros[XI_BINARY_ALIGN];
+    xi_binary_writer_t xbw;
+    xi_binary_header_t hdr;
+    struct iovec iov[12];
+    int cnt = 0, rc = -1;
+    uint64_t off, end;
+
+    bzero(&xbw, sizeof(xbw));
+    xbw.xbw_workspace = xi_parse_workspace(parsep);
+
+    if (xi_binary_build(&xbw, parsep->xp_insert->xi_tree->xt_root) < 0) {
+	xi_source_failure(NULL, 0, "binary: could not build tables");
+	goto done;
+    }
+
+    bzero(&hdr, sizeof(hdr));
+    hdr.xbh_magic = XI_BINARY_MAGIC;
+    hdr.xbh_version = XI_BINARY_VERSION;
+    hdr.xbh_endian = XI_BINARY_ENDIAN;
+    hdr.xbh_max_depth = xbw.xbw_max_depth;
+    hdr.xbh_name_count = xbw.xbw_names.xbt_count;
+    hdr.xbh_ns_count = xbw.xbw_ns.xbt_count;
+    hdr.xbh_node_count = xbw.xbw_nodes.xbt_count;
+    hdr.xbh_strings_size = xbw.xbw_strings.xbt_count;
+    hdr.xbh_text_size = xbw.xbw_text.xbt_count;
+
+    /* Lay out the sections, adding padding entries as we go */
+#define XI_BINARY_SECTION(_field, _base, _len)				\
+    do {								\
+	end = xi_binary_align(off);					\
+	if (end != off) {						\
+	    iov[cnt].iov_base = zeros;					\
+	    iov[cnt++].iov_len = end - off;				\
+	}								\
+	hdr._field = off = end;						\
+	iov[cnt].iov_base = (_base);					\
+	iov[cnt++].iov_len = (_len);					\
+	off += (_len);							\
+    } while (0)
+
+    off = 0;
+    iov[cnt].iov_base = &hdr;
+    iov[cnt++].iov_len = sizeof(hdr);
+    off += sizeof(hdr);
+
+    XI_BINARY_SECTION(xbh_names_offset, xbw.xbw_names.xbt_base,
+		      hdr.xbh_name_count * sizeof(uint32_t));
+    XI_BINARY_SECTION(xbh_strings_offset, xbw.xbw_strings.xbt_base,
+		      hdr.xbh_strings_size);
+    XI_BINARY_SECTION(xbh_ns_offset, xbw.xbw_ns.xbt_base,
+		      hdr.xbh_ns_count * sizeof(xi_binary_ns_t));
+    XI_BINARY_SECTION(xbh_nodes_offset, xbw.xbw_nodes.xbt_base,
+		      hdr.xbh_node_count * sizeof(xi_binary_node_t));
+    XI_BINARY_SECTION(xbh_text_offset, xbw.xbw_text.xbt_base,
+		      hdr.xbh_text_size);
+
+#undef XI_BINARY_SECTION
+
+    hdr.xbh_file_size = off;
+
+    if (xi_binary_writev(fd, iov, cnt) < 0) {
+	xi_source_failure(NULL, errno, "binary: write failed");
+	goto done;
+    }
+
+    rc = 0;
+
+ done:
+    xi_binary_writer_cleanup(&xbw);
+    return rc;
+}
+
+int
+xi_binary_write (xi_parse_t *parsep, const char *filename)
+{
+    int fd, rc;
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	xi_source_failure(NULL, errno, "binary: cannot open '%s'", filename);
+	return -1;
+    }
+
+    rc = xi_binary_write_fd(parsep, fd);
+
+    if (close(fd) < 0 && rc == 0) {
+	xi_source_failure(NULL, errno, "binary: close failed for '%s'",
+			  filename);
+	rc = -1;
+    }
+
+    return rc;
+}
+
+/*
+ * Is [off, off + len) inside the file?
+ */
+static inline int
+xi_binary_in_bounds (xi_binary_t *xbp, uint64_t off, uint64_t len)
+{
+    return (off <= xbp->xb_size && len <= xbp->xb_size - off);
+}
+
+/*
+ * Check that the file is one of ours, and that nothing points
+ * outside of it.  We don't validate every node; the accessors
+ * bounds-check indices.
+ */
+static int
+xi_binary_check (xi_binary_t *xbp)
+{
+    xi_binary_header_t *hdr = xbp->xb_header;
+    uint32_t i;
+
+    if (xbp->xb_size < sizeof(*hdr) || hdr->xbh_magic != XI_BINARY_MAGIC)
+	return -1;
+
+    if (hdr->xbh_endian != XI_BINARY_ENDIAN
+	|| hdr->xbh_version != XI_BINARY_VERSION
+	|| hdr->xbh_file_size > xbp->xb_size)
+	return -1;
+
+    if (!xi_binary_in_bounds(xbp, hdr->xbh_names_offset,
+			     hdr->xbh_name_count * (uint64_t) sizeof(uint32_t))
+	|| !xi_binary_in_bounds(xbp, hdr->xbh_strings_offset,
+				hdr->xbh_strings_size)
+	|| !xi_binary_in_bounds(xbp, hdr->xbh_ns_offset,
+			hdr->xbh_ns_count * (uint64_t) sizeof(xi_binary_ns_t))
+	|| !xi_binary_in_bounds(xbp, hdr->xbh_nodes_offset,
+		hdr->xbh_node_count * (uint64_t) sizeof(xi_binary_node_t))
+	|| !xi_binary_in_bounds(xbp, hdr->xbh_text_offset,
+				hdr->xbh_text_size))
+	return -1;
+
+    if ((hdr->xbh_names_offset | hdr->xbh_ns_offset
+	 | hdr->xbh_nodes_offset) & (XI_BINARY_ALIGN - 1))
+	return -1;
+
+    /* Strings must be terminated, so the accessors can't run off */
+    if (hdr->xbh_strings_size == 0 || hdr->xbh_text_size == 0
+	|| xbp->xb_strings[hdr->xbh_strings_size - 1] != '\0'
+	|| xbp->xb_text[hdr->xbh_text_size - 1] != '\0')
+	return -1;
+
+    for (i = 0; i < hdr->xbh_name_count; i++)
+	if (xbp->xb_names[i] >= hdr->xbh_strings_size)
+	    return -1;
+
+    if (hdr->xbh_node_count <= XI_BINARY_ROOT
+	|| xbp->xb_nodes[XI_BINARY_ROOT].xbn_type != XI_TYPE_ROOT)
+	return -1;
+
+    return 0;
+}
+
+xi_binary_t *
+xi_binary_open (const char *filename)
+{
+    xi_binary_t *xbp;
+    struct stat st;
+    void *addr;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+	xi_source_failure(NULL, errno, "binary: cannot open '%s'", filename);
+	return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(xi_binary_header_t)) {
+	xi_source_failure(NULL, 0, "binary: '%s' is too short", filename);
+	close(fd);
+	return NULL;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);		/* The mapping keeps the file */
+    if (addr == MAP_FAILED) {
+	xi_source_failure(NULL, errno, "binary: mmap failed for '%s'",
+			  filename);
+	return NULL;
+    }
+
+    xbp = calloc(1, sizeof(*xbp));
+    if (xbp == NULL) {
+	munmap(addr, st.st_size);
+	return NULL;
+    }
+
+    xbp->xb_addr = addr;
+    xbp->xb_size = st.st_size;
+    xbp->xb_header = addr;
+
+    if (xbp->xb_header->xbh_magic == XI_BINARY_MAGIC
+	&& xbp->xb_header->xbh_endian == XI_BINARY_ENDIAN
+	&& xbp->xb_header->xbh_file_size <= xbp->xb_size) {
+	xi_binary_header_t *hdr = xbp->xb_header;
+	char *base = addr;
+
+	xbp->xb_names = (const uint32_t *) (base + hdr->xbh_names_offset);
+	xbp->xb_strings = base + hdr->xbh_strings_offset;
+	xbp->xb_ns = (const xi_binary_ns_t *) (base + hdr->xbh_ns_offset);
+	xbp->xb_nodes = (const xi_binary_node_t *)
+	    (base + hdr->xbh_nodes_offset);
+	xbp->xb_text = base + hdr->xbh_text_offset;
+    }
+
+    if (xbp->xb_names == NULL || xi_binary_check(xbp) < 0) {
+	xi_source_failure(NULL, 0, "binary: '%s' is not a valid xi file",
+			  filename);
+	xi_binary_close(xbp);
+	return NULL;
+    }
+
+    return xbp;
+}
+
+void
+xi_binary_close (xi_binary_t *xbp)
+{
+    if (xbp == NULL)
+	return;
+
+    if (xbp->xb_addr)
+	munmap(xbp->xb_addr, xbp->xb_size);
+    free(xbp);
+}
+
+/*
+ * Rebuild a binary tree as a real xi tree, in the given workspace,
+ * and return a parse handle attached to it.  Every node is allocated
+ * up front, so links can be resolved in a single pass over the
+ * records.
+ *
+ * XXX On failure, the nodes we've allocated are left in the
+ * workspace.
+ */
+xi_parse_t *
+xi_binary_import (xi_binary_t *xbp, pa_mmap_t *pmp, xi_workspace_t *xwp,
+		  const char *name)
+{
+    xi_binary_header_t *hdr = xbp->xb_header;
+    pa_atom_t *atoms = NULL, *names = NULL, *nss = NULL;
+    pa_arb_atom_t text_atom;
+    const xi_binary_node_t *bnp;
+    xi_tree_info_t *infop;
+    xi_parse_t *parsep = NULL;
+    xi_node_t *nodep;
+    const char *str;
+    char *cp;
+    size_t len;
+    uint32_t i, sp, open[XI_DEPTH_MAX + 1];
+    xi_node_order_t *orderp;
+    char namebuf[PA_MMAP_HEADER_NAME_LEN];
+
+    atoms = calloc(hdr->xbh_node_count, sizeof(*atoms));
+    names = calloc(hdr->xbh_name_count, sizeof(*names));
+    nss = calloc(hdr->xbh_ns_count, sizeof(*nss));
+    if (atoms == NULL || names == NULL || nss == NULL)
+	goto done;
+
+    for (i = XI_BINARY_ROOT; i < hdr->xbh_node_count; i++) {
+	if (xi_node_alloc(xwp, &atoms[i]) == NULL)
+	    goto done;
+    }
+
+    XI_WORKSPACE_STAT(xwp, xws_nodes, hdr->xbh_node_count - XI_BINARY_ROOT);
+
+    for (i = 1; i < hdr->xbh_name_count; i++) {
+	names[i] = xi_namepool_atom(xwp, xi_binary_name(xbp, i), TRUE);
+	if (names[i] == PA_NULL_ATOM)
+	    goto done;
+    }
+
+    for (i = 1; i < hdr->xbh_ns_count; i++) {
+	nss[i] = xi_ns_find(xwp, xi_binary_name(xbp, xbp->xb_ns[i].xbns_prefix),
+			    xi_binary_name(xbp, xbp->xb_ns[i].xbns_uri), TRUE);
+    }
+
+#define XI_BINARY_MAP(_map, _count, _idx) \
+    (((_idx) < (_count)) ? (_map)[_idx] : PA_NULL_ATOM)
+
+    for (i = XI_BINARY_ROOT; i < hdr->xbh_node_count; i++) {
+	bnp = &xbp->xb_nodes[i];
+	nodep = xi_node_addr(xwp, atoms[i]);
+	if (nodep == NULL)
+	    goto done;
+
+	nodep->xn_type = bnp->xbn_type;
+	nodep->xn_depth = bnp->xbn_depth;
+	nodep->xn_flags = bnp->xbn_flags
+	    & ~(XNF_INTERNED | XNF_ATTRIBS_INDEXED);
+	nodep->xn_name = XI_BINARY_MAP(names, hdr->xbh_name_count,
+				       bnp->xbn_name);
+	nodep->xn_ns_map = XI_BINARY_MAP(nss, hdr->xbh_ns_count, bnp->xbn_ns);
+	nodep->xn_next = XI_BINARY_MAP(atoms, hdr->xbh_node_count,
+				       bnp->xbn_next);
+	nodep->xn_contents = PA_NULL_ATOM;
+
+	switch (bnp->xbn_type) {
+	case XI_TYPE_ROOT:
+	case XI_TYPE_ELT:
+	    nodep->xn_contents = XI_BINARY_MAP(atoms, hdr->xbh_node_count,
+					       bnp->xbn_contents);
+	    break;
+
+	case XI_TYPE_TEXT:
+	case XI_TYPE_UNESC:
+	case XI_TYPE_ATSTR:
+	case XI_TYPE_ATTRIB:
+	    str = xi_binary_text(xbp, bnp->xbn_contents) ?: "";
+	    len = strlen(str);
+
+	    if ((xwp->xw_flags & XWF_INTERN_TEXT)
+		&& !(nodep->xn_flags & XNF_ESCAPED)) {
+		nodep->xn_contents = xi_valuepool_atom(xwp, str, len);
+		if (nodep->xn_contents != PA_NULL_ATOM) {
+		    nodep->xn_flags |= XNF_INTERNED;
+		    XI_WORKSPACE_STAT(xwp, xws_interned, 1);
+		    break;
+		}
+	    }
+
+	    text_atom = pa_arb_alloc(xwp->xw_textpool, len + 1);
+	    cp = pa_arb_atom_addr(xwp->xw_textpool, text_atom);
+	    if (cp == NULL)
+		goto done;
+
+	    memcpy(cp, str, len + 1);
+	    nodep->xn_contents = pa_arb_atom_of(text_atom);
+	    XI_WORKSPACE_STAT(xwp, xws_text, 1);
+	    XI_WORKSPACE_STAT(xwp, xws_text_bytes, len + 1);
+	    break;
+
+	case XI_TYPE_NS:
+	    nodep->xn_contents = XI_BINARY_MAP(nss, hdr->xbh_ns_count,
+					       bnp->xbn_contents);
+	    break;
+	}
+    }
+
+#undef XI_BINARY_MAP
+
+    /*
+     * Nodes are stored in document order, so preorder numbers are
+     * just indices, and a subtree ends just before the next node at
+     * its own depth or shallower.  "open" is the stack of elements
+     * whose subtrees haven't ended yet.
+     */
+    for (i = XI_BINARY_ROOT, sp = 0; i < hdr->xbh_node_count; i++) {
+	bnp = &xbp->xb_nodes[i];
+	if (bnp->xbn_depth > XI_DEPTH_MAX)
+	    goto done;
+
+	while (sp > 0 && xbp->xb_nodes[open[sp - 1]].xbn_depth
+	       >= bnp->xbn_depth) {
+	    orderp = xi_node_order(xwp, atoms[open[--sp]]);
+	    if (orderp)
+		orderp->xno_end = i - 2;
+	}
+
+	xi_node_order_set(xwp, atoms[i], i - 1, i - 1);
+	open[sp++] = i;
+    }
+
+    while (sp > 0) {
+	orderp = xi_node_order(xwp, atoms[open[--sp]]);
+	if (orderp)
+	    orderp->xno_end = hdr->xbh_node_count - 2;
+    }
+
+    /* Hang the tree on a header, so we can attach to it */
+    infop = pa_mmap_header(pmp, xi_mk_name(namebuf, name, "tree"),
+			   PA_TYPE_TREE, 0, sizeof(*infop));
+    if (infop == NULL)
+	goto done;
+
+    infop->xti_root = atoms[XI_BINARY_ROOT];
+    infop->xti_max_depth = hdr->xbh_max_depth;
+    infop->xti_next_pre = hdr->xbh_node_count - 2;
+
+    parsep = xi_parse_attach(pmp, xwp, name);
+
+ done:
+    free(atoms);
+    free(names);
+    free(nss);
+    return parsep;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * A compact binary form of an xi tree, for handing a parsed document
+ * to another process without re-parsing it.  Everything is an
+ * offset or an index, so the file can be mmap'd and used in place.
+ *
+ * The file looks like:
+ *
+ *    xi_binary_header_t
+ *    name offsets (uint32_t per name, plus one for the end)
+ *    name strings (NUL-terminated)
+ *    namespace table (xi_binary_ns_t per namespace)
+ *    node records (xi_binary_node_t per node)
+ *    text blob (NUL-terminated strings)
+ *
+ * with each section aligned to XI_BINARY_ALIGN.  Index zero of the
+ * name, namespace, and node tables is reserved to mean "none", just
+ * like PA_NULL_ATOM, and offset zero of the text blob is an empty
+ * string.  Nodes are stored in document order, so the root is
+ * always node one.  Values are in native byte order; the header's
+ * xbh_endian lets readers spot a foreign file.
+ */
+
+#ifndef LIBSLAX_XI_BINARY_H
+#define LIBSLAX_XI_BINARY_H
+
+#define XI_BINARY_MAGIC		0x78696231 /* "xib1" */
+#define XI_BINARY_VERSION	1
+#define XI_BINARY_ENDIAN	0x01020304 /* Reads differently if swapped */
+#define XI_BINARY_ALIGN		8	   /* Alignment of sections */
+
+#define XI_BINARY_NONE		0 /* Null index */
+#define XI_BINARY_ROOT		1 /* Index of the root node */
+
+typedef uint32_t xi_binary_index_t; /* Index into a table */
+
+typedef struct xi_binary_header_s {
+    uint32_t xbh_magic;		/* XI_BINARY_MAGIC */
+    uint32_t xbh_version;	/* XI_BINARY_VERSION */
+    uint32_t xbh_endian;	/* XI_BINARY_ENDIAN */
+    uint32_t xbh_max_depth;	/* Max depth of the tree */
+    uint32_t xbh_name_count;	/* Number of names (including zero) */
+    uint32_t xbh_ns_count;	/* Number of namespaces (including zero) */
+    uint32_t xbh_node_count;	/* Number of nodes (including zero) */
+    uint32_t xbh_pad;		/* Padding (zero) */
+    uint64_t xbh_names_offset;	/* Offset of name offsets */
+    uint64_t xbh_strings_offset; /* Offset of name strings */
+    uint64_t xbh_strings_size;	/* Size of name strings */
+    uint64_t xbh_ns_offset;	/* Offset of namespace table */
+    uint64_t xbh_nodes_offset;	/* Offset of node records */
+    uint64_t xbh_text_offset;	/* Offset of text blob */
+    uint64_t xbh_text_size;	/* Size of text blob */
+    uint64_t xbh_file_size;	/* Total size of the file */
+} xi_binary_header_t;
+
+typedef struct xi_binary_ns_s {
+    xi_binary_index_t xbns_prefix; /* Name index of the prefix */
+    xi_binary_index_t xbns_uri;	/* Name index of the URI */
+} xi_binary_ns_t;
+
+/*
+ * A node, mirroring xi_node_t.  xbn_next is the next sibling or, for
+ * the last child, the parent.  xbn_contents is the first child (for
+ * elements and the root), a text offset (for text and attributes),
+ * or a namespace index (for XI_TYPE_NS).
+ */
+typedef struct xi_binary_node_s {
+    xi_node_type_t xbn_type;	/* Type of this node (XI_TYPE_*) */
+    xi_depth_t xbn_depth;	/* Depth of this node */
+    xi_node_flags_t xbn_flags;	/* Flags (XNF_*) */
+    xi_binary_index_t xbn_name;	/* Name (index in name table) */
+    xi_binary_index_t xbn_ns;	/* Namespace (index in ns table) */
+    xi_binary_index_t xbn_next;	/* Next node (or parent if last) */
+    uint64_t xbn_contents;	/* Child node, text offset, or ns index */
+} xi_binary_node_t;
+
+/*
+ * An open (mmap'd) binary file
+ */
+typedef struct xi_binary_s {
+    void *xb_addr;		/* Base address of the mapping */
+    size_t xb_size;		/* Size of the mapping */
+    xi_binary_header_t *xb_header; /* File header */
+    const uint32_t *xb_names;	/* Name offsets */
+    const char *xb_strings;	/* Name strings */
+    const xi_binary_ns_t *xb_ns; /* Namespace table */
+    const xi_binary_node_t *xb_nodes; /* Node records */
+    const char *xb_text;	/* Text blob */
+} xi_binary_t;
+
+int
+xi_binary_write_fd (xi_parse_t *parsep, int fd);
+
+int
+xi_binary_write (xi_parse_t *parsep, const char *filename);
+
+xi_binary_t *
+xi_binary_open (const char *filename);
+
+void
+xi_binary_close (xi_binary_t *xbp);
+
+xi_parse_t *
+xi_binary_import (xi_binary_t *xbp, pa_mmap_t *pmp, xi_workspace_t *xwp,
+		  const char *name);
+
+static inline const xi_binary_node_t *
+xi_binary_node (xi_binary_t *xbp, xi_binary_index_t idx)
+{
+    return (idx == XI_BINARY_NONE || idx >= xbp->xb_header->xbh_node_count)
+	? NULL : &xbp->xb_nodes[idx];
+}
+
+static inline const char *
+xi_binary_name (xi_binary_t *xbp, xi_binary_index_t idx)
+{
+    return (idx == XI_BINARY_NONE || idx >= xbp->xb_header->xbh_name_count)
+	? NULL : xbp->xb_strings + xbp->xb_names[idx];
+}
+
+static inline const char *
+xi_binary_text (xi_binary_t *xbp, uint64_t offset)
+{
+    return (offset >= xbp->xb_header->xbh_text_size)
+	? NULL : xbp->xb_text + offset;
+}
+
+#endif /* LIBSLAX_XI_BINARY_H */
@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Parsing the same large file over and over is a waste, since the
+ * result of a parse is a parrotdb database that we could just mmap
+ * again.  So we keep one database per input file in a cache
+ * directory, named by a hash of the input's real path, with an
+ * xi_cache_info_t header recording the identity of the input.  If
+ * the identity still matches, we reattach to the tree; otherwise we
+ * toss the old database and parse into a new one.
+ *
+ * Content hashing (XCF_HASH_CONTENT) is for files rewritten within
+ * the granularity of their mtime.  Like git's "racy" index entries,
+ * only files whose mtime isn't older than the last time we checked
+ * them can have changed without changing their stat info, so those
+ * are the only ones we reread.
+ *
+ * LRU is done cheaply: a hit touches the cache file's mtime, and
+ * eviction removes the files with the oldest mtimes until the
+ * directory fits into its budget.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include "slaxconfig.h"
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <libpsu/psuhash.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+#include <libxi/xicache.h>
+
+#define XI_CACHE_SUFFIX	".xic"	/* Suffix for cache files */
+#define XI_CACHE_NAME	"doc"	/* Name of workspace/tree in the database */
+#define XI_CACHE_BUFSIZ	(64 * 1024) /* Read size for content hashing */
+
+/*
+ * Source flags that change the tree we build.  The rest only change
+ * how the input is read, so a document parsed with them is still a
+ * hit for callers that read it differently.
+ */
+#define XI_CACHE_SOURCE_FLAGS \
+    (XPSF_IGNORE_WS | XPSF_TRIM_WS | XPSF_VALIDATE | XPSF_IGNORE_COMMENTS \
+     | XPSF_IGNORE_DTD | XPSF_JSON | XPSF_DECOMPRESS)
+
+xi_cache_t *
+xi_cache_open (const char *dir, size_t max_bytes, xi_cache_flags_t flags)
+{
+    xi_cache_t *xcp;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+	xi_source_failure(NULL, errno, "cannot create cache directory '%s'",
+			  dir);
+	return NULL;
+    }
+
+    xcp = calloc(1, sizeof(*xcp));
+    if (xcp == NULL)
+	return NULL;
+
+    xcp->xc_dir = strdup(dir);
+    if (xcp->xc_dir == NULL) {
+	free(xcp);
+	return NULL;
+    }
+
+    xcp->xc_max_bytes = max_bytes;
+    xcp->xc_flags = flags;
+
+    return xcp;
+}
+
+void
+xi_cache_close (xi_cache_t *xcp)
+{
+    if (xcp == NULL)
+	return;
+
+    free(xcp->xc_dir);
+    free(xcp);
+}
+
+/*
+ * Hash the contents of the file, for callers that don't trust mtime
+ * (e.g. files rewritten in place within the same second)
+ */
+static int
+xi_cache_hash_content (const char *path, psu_hash_t *hashp)
+{
+    psu_hash_t hash = PSU_HASH_INIT;
+    char *buf;
+    ssize_t len;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+	return -1;
+
+    buf = malloc(XI_CACHE_BUFSIZ);
+    if (buf == NULL) {
+	close(fd);
+	return -1;
+    }
+
+    while ((len = read(fd, buf, XI_CACHE_BUFSIZ)) > 0)
+	hash = psu_hash_add(hash, buf, len);
+
+    free(buf);
+    close(fd);
+
+    if (len < 0)
+	return -1;
+
+    *hashp = hash;
+    return 0;
+}
+
+/*
+ * Build the identity key for a file parsed with the given flags.
+ * The content hash is left for the caller, since it's rarely needed.
+ */
+static int
+xi_cache_make_key (const char *path, xi_source_flags_t flags,
+		   xi_cache_key_t *keyp)
+{
+    char real[PATH_MAX];
+    struct stat st;
+
+    /* Different spellings of the same file should find the same entry */
+    if (realpath(path, real) == NULL || stat(real, &st) < 0)
+	return -1;
+
+    bzero(keyp, sizeof(*keyp));
+    keyp->xck_path = psu_hash_add_string(PSU_HASH_INIT, real);
+    keyp->xck_size = st.st_size;
+    keyp->xck_flags = flags & XI_CACHE_SOURCE_FLAGS;
+
+#if HAVE_MTIMESPEC
+    keyp->xck_mtime_sec = st.st_mtimespec.tv_sec;
+    keyp->xck_mtime_nsec = st.st_mtimespec.tv_nsec;
+#else /* HAVE_MTIMESPEC */
+    keyp->xck_mtime_sec = st.st_mtime;
+#endif /* HAVE_MTIMESPEC */
+
+    return 0;
+}
+
+/*
+ * Could the file have been rewritten since "checked" without its
+ * stat info changing?  Only if it was modified in the same second.
+ */
+static inline xi_boolean_t
+xi_cache_racy (xi_cache_key_t *keyp, int64_t checked)
+{
+    return (keyp->xck_mtime_sec >= checked);
+}
+
+static void
+xi_cache_filename (xi_cache_t *xcp, xi_cache_key_t *keyp,
+		   char *buf, size_t bufsiz)
+{
+    snprintf(buf, bufsiz, "%s/%016llx%s", xcp->xc_dir,
+	     (unsigned long long) keyp->xck_path, XI_CACHE_SUFFIX);
+}
+
+static xi_boolean_t
+xi_cache_key_match (xi_cache_key_t *ap, xi_cache_key_t *bp)
+{
+    return (ap->xck_path == bp->xck_path
+	    && ap->xck_size == bp->xck_size
+	    && ap->xck_mtime_sec == bp->xck_mtime_sec
+	    && ap->xck_mtime_nsec == bp->xck_mtime_nsec
+	    && ap->xck_flags == bp->xck_flags);
+}
+
+/*
+ * Make sure a racy entry's contents match what we parsed.  On a
+ * match, we record the time, so once the file's mtime falls behind
+ * it, we'll stop checking.
+ */
+static xi_boolean_t
+xi_cache_content_match (xi_cache_info_t *infop, const char *path)
+{
+    int64_t now = time(NULL);
+    psu_hash_t hash;
+
+    if (!xi_cache_racy(&infop->xci_key, infop->xci_checked))
+	return TRUE;
+
+    if (!(infop->xci_flags & XCIF_CONTENT)
+	    || xi_cache_hash_content(path, &hash) < 0
+	    || hash != infop->xci_key.xck_content)
+	return FALSE;
+
+    infop->xci_checked = now;
+    return TRUE;
+}
+
+/*
+ * Try to reattach to an existing cache file.  Returns TRUE if the
+ * doc is ready to use; otherwise the caller should rebuild it.
+ */
+static xi_boolean_t
+xi_cache_attach (xi_cache_t *xcp, xi_cache_doc_t *docp, const char *filename,
+		 const char *path, xi_cache_key_t *keyp)
+{
+    xi_cache_info_t *infop;
+
+    if (access(filename, R_OK | W_OK) < 0)
+	return FALSE;
+
+    docp->xcd_mmap = pa_mmap_open(filename, "xi-cache", 0, 0644);
+    if (docp->xcd_mmap == NULL)
+	return FALSE;
+
+    /* A zero size means we only want it if it's already there */
+    infop = pa_mmap_header(docp->xcd_mmap, "cache.info", PA_TYPE_OPAQUE, 0, 0);
+    if (infop == NULL || infop->xci_magic != XI_CACHE_MAGIC
+	    || !(infop->xci_flags & XCIF_COMPLETE)
+	    || !xi_cache_key_match(&infop->xci_key, keyp))
+	goto fail;
+
+    if ((xcp->xc_flags & XCF_HASH_CONTENT)
+	    && !xi_cache_content_match(infop, path))
+	goto fail;
+
+    docp->xcd_workspace = xi_workspace_open(docp->xcd_mmap, XI_CACHE_NAME);
+    if (docp->xcd_workspace == NULL)
+	goto fail;
+
+    docp->xcd_parse = xi_parse_attach(docp->xcd_mmap, docp->xcd_workspace,
+				      XI_CACHE_NAME);
+    if (docp->xcd_parse == NULL)
+	goto fail;
+
+    /* Touch the file, so eviction sees this entry as recently used */
+    utimes(filename, NULL);
+
+    docp->xcd_hit = TRUE;
+    return TRUE;
+
+ fail:
+    xi_workspace_close(docp->xcd_workspace);
+    docp->xcd_workspace = NULL;
+    pa_mmap_close(docp->xcd_mmap);
+    docp->xcd_mmap = NULL;
+    return FALSE;
+}
+
+/*
+ * Parse the input into a fresh cache file
+ */
+static xi_boolean_t
+xi_cache_build (xi_cache_t *xcp, xi_cache_doc_t *docp, const char *filename,
+		const char *path, xi_cache_key_t *keyp,
+		xi_source_flags_t flags)
+{
+    xi_cache_info_t *infop;
+
+    unlink(filename);
+
+    docp->xcd_mmap = pa_mmap_open(filename, "xi-cache", 0, 0644);
+    if (docp->xcd_mmap == NULL)
+	return FALSE;
+
+    infop = pa_mmap_header(docp->xcd_mmap, "cache.info", PA_TYPE_OPAQUE,
+			   0, sizeof(*infop));
+    if (infop == NULL)
+	goto fail;
+
+    /* Record the key now, but don't mark it complete until we're done */
+    infop->xci_magic = XI_CACHE_MAGIC;
+    infop->xci_flags = 0;
+    infop->xci_key = *keyp;
+    infop->xci_checked = time(NULL);
+
+    /*
+     * A file modified this second could change again under the same
+     * stat info, so record its contents as well.  Anything older
+     * can't, and isn't worth the extra read.
+     */
+    if ((xcp->xc_flags & XCF_HASH_CONTENT)
+	    && xi_cache_racy(keyp, infop->xci_checked)) {
+	if (xi_cache_hash_content(path, &infop->xci_key.xck_content) < 0)
+	    goto fail;
+	infop->xci_flags |= XCIF_CONTENT;
+    }
+
+    docp->xcd_workspace = xi_workspace_open(docp->xcd_mmap, XI_CACHE_NAME);
+    if (docp->xcd_workspace == NULL)
+	goto fail;
+
+    docp->xcd_parse = xi_parse_open(docp->xcd_mmap, docp->xcd_workspace,
+				    XI_CACHE_NAME, path, flags);
+    if (docp->xcd_parse == NULL)
+	goto fail;
+
+    if (xi_parse(docp->xcd_parse) != 0)
+	goto fail;
+
+    infop->xci_flags |= XCIF_COMPLETE;
+    docp->xcd_hit = FALSE;
+    return TRUE;
+
+ fail:
+    if (docp->xcd_parse) {
+	xi_parse_destroy(docp->xcd_parse);
+	docp->xcd_parse = NULL;
+    }
+    xi_workspace_close(docp->xcd_workspace);
+    docp->xcd_workspace = NULL;
+    pa_mmap_close(docp->xcd_mmap);
+    docp->xcd_mmap = NULL;
+    unlink(filename);
+    return FALSE;
+}
+
+static void
+xi_cache_evict_keep (xi_cache_t *xcp, size_t max_bytes, const char *keep);
+
+/*
+ * Return the parsed document for "path", either from the cache or
+ * by parsing it (and adding it to the cache).
+ */
+xi_cache_doc_t *
+xi_cache_load (xi_cache_t *xcp, const char *path, xi_source_flags_t flags)
+{
+    xi_cache_doc_t *docp;
+    xi_cache_key_t key;
+    char filename[PATH_MAX];
+
+    if (xi_cache_make_key(path, flags, &key) < 0) {
+	xi_source_failure(NULL, errno, "cannot stat input file '%s'", path);
+	return NULL;
+    }
+
+    xi_cache_filename(xcp, &key, filename, sizeof(filename));
+
+    docp = calloc(1, sizeof(*docp));
+    if (docp == NULL)
+	return NULL;
+
+    if (xi_cache_attach(xcp, docp, filename, path, &key)) {
+	psu_log("xi_cache_load: hit for '%s' (%s)", path, filename);
+	return docp;
+    }
+
+    psu_log("xi_cache_load: miss for '%s' (%s)", path, filename);
+
+    if (!xi_cache_build(xcp, docp, filename, path, &key, flags)) {
+	free(docp);
+	return NULL;
+    }
+
+    /* Whatever else goes, the entry we just built stays */
+    if (!(xcp->xc_flags & XCF_NO_EVICT))
+	xi_cache_evict_keep(xcp, xcp->xc_max_bytes, filename);
+
+    return docp;
+}
+
+void
+xi_cache_doc_close (xi_cache_doc_t *docp)
+{
+    if (docp == NULL)
+	return;
+
+    if (docp->xcd_parse)
+	xi_parse_destroy(docp->xcd_parse);
+    xi_workspace_close(docp->xcd_workspace);
+    if (docp->xcd_mmap)
+	pa_mmap_close(docp->xcd_mmap);
+
+    free(docp);
+}
+
+typedef struct xi_cache_entry_s {
+    char *xce_name;		/* File name (in xc_dir) */
+    off_t xce_size;		/* File size */
+    time_t xce_mtime;		/* Last use */
+} xi_cache_entry_t;
+
+static int
+xi_cache_entry_compare (const void *ap, const void *bp)
+{
+    const xi_cache_entry_t *xap = ap, *xbp = bp;
+
+    if (xap->xce_mtime != xbp->xce_mtime)
+	return (xap->xce_mtime < xbp->xce_mtime) ? -1 : 1;
+    return strcmp(xap->xce_name, xbp->xce_name);
+}
+
+/*
+ * Remove the least recently used cache files until the directory
+ * holds no more than max_bytes, sparing the file "keep" (if not NULL).
+ * A max_bytes of zero means "no limit".  Note that we'll happily
+ * remove a file someone else has mapped; the mapping stays valid
+ * until they close it.
+ */
+static void
+xi_cache_evict_keep (xi_cache_t *xcp, size_t max_bytes, const char *keep)
+{
+    static const size_t suflen = sizeof(XI_CACHE_SUFFIX) - 1;
+    xi_cache_entry_t *entries = NULL, *newp;
+    unsigned count = 0, max = 0, i;
+    size_t total = 0, len;
+    struct dirent *dep;
+    struct stat st;
+    char path[PATH_MAX];
+    DIR *dirp;
+
+    if (max_bytes == 0)
+	return;
+
+    if (keep) {
+	const char *cp = strrchr(keep, '/');
+	if (cp)
+	    keep = cp + 1;
+    }
+
+    dirp = opendir(xcp->xc_dir);
+    if (dirp == NULL)
+	return;
+
+    while ((dep = readdir(dirp)) != NULL) {
+	len = strlen(dep->d_name);
+	if (len <= suflen
+		|| strcmp(dep->d_name + len - suflen, XI_CACHE_SUFFIX) != 0)
+	    continue;
+
+	snprintf(path, sizeof(path), "%s/%s", xcp->xc_dir, dep->d_name);
+	if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+	    continue;
+
+	if (count >= max) {
+	    max = max ? max * 2 : 32;
+	    newp = realloc(entries, max * sizeof(*entries));
+	    if (newp == NULL)
+		goto done;
+	    entries = newp;
+	}
+
+	entries[count].xce_name = strdup(dep->d_name);
+	if (entries[count].xce_name == NULL)
+	    goto done;
+	entries[count].xce_size = st.st_size;
+	entries[count].xce_mtime = st.st_mtime;
+	total += st.st_size;
+	count += 1;
+    }
+
+    if (total <= max_bytes)
+	goto done;
+
+    qsort(entries, count, sizeof(*entries), xi_cache_entry_compare);
+
+    for (i = 0; i < count && total > max_bytes; i++) {
+	if (keep && strcmp(entries[i].xce_name, keep) == 0)
+	    continue;
+
+	snprintf(path, sizeof(path), "%s/%s",
+		 xcp->xc_dir, entries[i].xce_name);
+	if (unlink(path) == 0) {
+	    psu_log("xi_cache_evict: removed %s (%lu bytes)", path,
+		    (unsigned long) entries[i].xce_size);
+	    total -= entries[i].xce_size;
+	}
+    }
+
+ done:
+    for (i = 0; i < count; i++)
+	free(entries[i].xce_name);
+    free(entries);
+    closedir(dirp);
+}
+
+void
+xi_cache_evict (xi_cache_t *xcp, size_t max_bytes)
+{
+    xi_cache_evict_keep(xcp, max_bytes, NULL);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * A parsed-document cache.  Since a workspace lives in a parrotdb
+ * database, a parsed document is already a file on disk; we just
+ * need to remember which input it came from so we can hand it back
+ * the next time someone asks for the same file.  Entries are keyed
+ * on the file's identity (real path, size, and mtime, plus a content
+ * hash for recently modified files) and the flags it was parsed
+ * with, and live in a cache directory, one database per document,
+ * with the oldest entries evicted to keep the directory under a byte
+ * budget.
+ */
+
+#ifndef LIBSLAX_XI_CACHE_H
+#define LIBSLAX_XI_CACHE_H
+
+#include <libpsu/psuhash.h>
+
+/*
+ * The identity of an input file, and how it was parsed.  If any of
+ * this changes, the cached document is stale.
+ */
+typedef struct xi_cache_key_s {
+    psu_hash_t xck_path;	/* Hash of the real path */
+    uint64_t xck_size;		/* File size */
+    int64_t xck_mtime_sec;	/* Modification time (seconds) */
+    int64_t xck_mtime_nsec;	/* Modification time (nanoseconds) */
+    psu_hash_t xck_content;	/* Hash of contents (if XCIF_CONTENT) */
+    xi_source_flags_t xck_flags; /* Source flags that shape the tree */
+} xi_cache_key_t;
+
+/*
+ * The information we keep inside each cache database
+ */
+typedef struct xi_cache_info_s {
+    uint32_t xci_magic;		/* XI_CACHE_MAGIC */
+    uint32_t xci_flags;		/* Flags (XCIF_*) */
+    xi_cache_key_t xci_key;	/* Identity of the input file */
+    int64_t xci_checked;	/* Last time the key matched the contents */
+} xi_cache_info_t;
+
+#define XI_CACHE_MAGIC	0x78696333 /* "xic3" */
+
+/* Flags for xci_flags */
+#define XCIF_COMPLETE	(1<<0)	/* Parse ran to completion */
+#define XCIF_CONTENT	(1<<1)	/* xck_content is set */
+
+typedef uint32_t xi_cache_flags_t; /* Flags for xi_cache_t */
+
+/* Flags for xc_flags */
+#define XCF_HASH_CONTENT (1<<0)	/* Hash file contents, not just stat info */
+#define XCF_NO_EVICT	(1<<1)	/* Don't evict after adding entries */
+
+/*
+ * The cache handle
+ */
+typedef struct xi_cache_s {
+    char *xc_dir;		/* Cache directory */
+    size_t xc_max_bytes;	/* Size budget for the directory */
+    xi_cache_flags_t xc_flags;	/* Flags (XCF_*) */
+} xi_cache_t;
+
+/*
+ * A cached document, either found in the cache or freshly parsed
+ * into it.  The parse handle is attached to the tree, so it can be
+ * walked or emitted as usual.
+ */
+typedef struct xi_cache_doc_s {
+    pa_mmap_t *xcd_mmap;	/* Database holding the document */
+    xi_workspace_t *xcd_workspace; /* Workspace for the document */
+    xi_parse_t *xcd_parse;	/* Parse handle (attached or fresh) */
+    xi_boolean_t xcd_hit;	/* Found in the cache? */
+} xi_cache_doc_t;
+
+xi_cache_t *
+xi_cache_open (const char *dir, size_t max_bytes, xi_cache_flags_t flags);
+
+void
+xi_cache_close (xi_cache_t *xcp);
+
+xi_cache_doc_t *
+xi_cache_load (xi_cache_t *xcp, const char *path, xi_source_flags_t flags);
+
+void
+xi_cache_doc_close (xi_cache_doc_t *docp);
+
+void
+xi_cache_evict (xi_cache_t *xcp, size_t max_bytes);
+
+#endif /* LIBSLAX_XI_CACHE_H */
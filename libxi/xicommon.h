@@ -24,6 +24,7 @@ typedef uint16_t xi_node_flags_t; /* Flags for a node (XNF_*) */
  */
 typedef pa_atom_t xi_name_id_t;	/* Element name identifier */
 typedef pa_atom_t xi_ns_id_t;	/* Namespace identifier */
+typedef pa_atom_t xi_node_id_t;	/* Node identifier (in xw_nodes) */
 
 /* Wrapper for our "name" atom */
 PA_ATOM_TYPE(xi_name_atom_t, xi_name_atom_s, xna_atom,
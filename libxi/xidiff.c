@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Hashing is a bottom-up walk that stores each node's hash in
+ * xw_hash, a paged array running parallel to the nodes.  Names and
+ * values are hashed as strings, not atoms, so trees in different
+ * workspaces (with different atom numbers) can still be compared.
+ *
+ * Diffing starts at the two roots.  Nodes with matching hashes are
+ * done.  Otherwise we line up their children: runs of identical
+ * children are skipped, a child whose hash doesn't appear anywhere in
+ * the rest of the other list is a delete (or insert), and a pair of
+ * children that are both unmatched but have the same name is a
+ * change, which we recurse into.  We keep counts of the hashes
+ * remaining on each side in a small hash table, so lining up a list
+ * costs time linear in its length.  Only changed subtrees are ever
+ * entered, which makes the cost follow the size of the change, not
+ * the size of the documents.
+ *
+ * This isn't a minimal edit script (a moved subtree shows up as a
+ * delete and an insert), but it's the one people expect when
+ * looking at configuration changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "slaxconfig.h"
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xidiff.h>
+
+/*
+ * Hash the namespace URI for a node, if it has one
+ */
+static psu_hash_t
+xi_diff_hash_ns (xi_workspace_t *xwp, psu_hash_t hash, pa_atom_t ns_atom)
+{
+    xi_ns_map_t *ns_map;
+
+    if (ns_atom == PA_NULL_ATOM)
+	return psu_hash_add_string(hash, NULL);
+
+    ns_map = xi_ns_map_addr(xwp, ns_atom);
+    if (ns_map == NULL)
+	return psu_hash_add_string(hash, NULL);
+
+    return psu_hash_add_string(hash, xi_namepool_string(xwp, ns_map->xnm_uri));
+}
+
+/*
+ * Compute (and record) the hash for a node and everything under it.
+ * Depth is bounded by XI_DEPTH_MAX, so recursion is fine.
+ */
+static psu_hash_t
+xi_diff_hash_node (xi_workspace_t *xwp, pa_atom_t node_atom)
+{
+    xi_node_t *nodep = xi_node_addr(xwp, node_atom);
+    xi_node_t *childp;
+    xi_ns_map_t *ns_map;
+    pa_atom_t atom;
+    psu_hash_t hash = PSU_HASH_INIT, *hashp;
+
+    if (nodep == NULL)
+	return 0;
+
+    hash = psu_hash_add_value(hash, nodep->xn_type);
+
+    switch (nodep->xn_type) {
+    case XI_TYPE_ROOT:
+    case XI_TYPE_ELT:
+	hash = psu_hash_add_string(hash,
+			   xi_namepool_string(xwp, nodep->xn_name));
+	hash = xi_diff_hash_ns(xwp, hash, nodep->xn_ns_map);
+
+	for (atom = nodep->xn_contents; atom != PA_NULL_ATOM;
+	     atom = childp->xn_next) {
+	    childp = xi_node_addr(xwp, atom);
+	    if (childp == NULL || childp->xn_depth <= nodep->xn_depth)
+		break;		/* Back at our parent (us) */
+
+	    hash = psu_hash_add_value(hash, xi_diff_hash_node(xwp, atom));
+	}
+	break;
+
+    case XI_TYPE_ATTRIB:
+	hash = psu_hash_add_string(hash,
+			   xi_namepool_string(xwp, nodep->xn_name));
+	hash = xi_diff_hash_ns(xwp, hash, nodep->xn_ns_map);
+	/* FALLTHRU */
+
+    case XI_TYPE_TEXT:
+    case XI_TYPE_UNESC:
+    case XI_TYPE_ATSTR:
+	/* Hash the value, so escaped and unescaped text agree */
+	hash = psu_hash_add_string(hash, xi_node_string(xwp, nodep));
+	break;
+
+    case XI_TYPE_NS:
+	ns_map = xi_ns_map_addr(xwp, nodep->xn_contents);
+	if (ns_map) {
+	    hash = psu_hash_add_string(hash,
+			       xi_namepool_string(xwp, ns_map->xnm_prefix));
+	    hash = psu_hash_add_string(hash,
+			       xi_namepool_string(xwp, ns_map->xnm_uri));
+	}
+	break;
+    }
+
+    if (hash == 0)
+	hash = 1;		/* Zero means "no hash" */
+
+    hashp = pa_fixed_element(xwp->xw_hash, node_atom);
+    if (hashp)
+	*hashp = hash;
+
+    return hash;
+}
+
+void
+xi_tree_hash (xi_tree_t *xtp)
+{
+    xi_diff_hash_node(xtp->xt_workspace, xtp->xt_root);
+    xtp->xt_flags |= XTIF_HASHED;
+}
+
+/*
+ * A child, ready for lining up against the other list
+ */
+typedef struct xi_diff_child_s {
+    pa_atom_t xdc_atom;		/* Node atom */
+    psu_hash_t xdc_hash;	/* Subtree hash */
+} xi_diff_child_t;
+
+/*
+ * Counts of hashes remaining on each side, in an open-addressed
+ * table whose size is a power of two
+ */
+typedef struct xi_diff_count_s {
+    psu_hash_t xdn_hash;	/* Hash (zero means empty) */
+    uint32_t xdn_count[2];	/* Number remaining on each side */
+} xi_diff_count_t;
+
+typedef struct xi_diff_s {
+    xi_tree_t *xd_tree[2];	/* Old and new trees */
+    xi_diff_fn xd_func;		/* Callback */
+    void *xd_opaque;		/* Callback data */
+} xi_diff_t;
+
+#define XI_DIFF_OLD	0	/* Index for the old side */
+#define XI_DIFF_NEW	1	/* Index for the new side */
+
+static xi_diff_count_t *
+xi_diff_count_find (xi_diff_count_t *table, uint32_t mask, psu_hash_t hash)
+{
+    uint32_t slot;
+
+    for (slot = hash & mask; ; slot = (slot + 1) & mask) {
+	if (table[slot].xdn_hash == hash || table[slot].xdn_hash == 0)
+	    return &table[slot];
+    }
+}
+
+/*
+ * Build the list of children for a node, returning the count, or -1
+ */
+static int
+xi_diff_children (xi_workspace_t *xwp, pa_atom_t node_atom,
+		  xi_diff_child_t **listp)
+{
+    xi_node_t *nodep = xi_node_addr(xwp, node_atom);
+    xi_node_t *childp;
+    xi_diff_child_t *list = NULL, *newp;
+    pa_atom_t atom;
+    int count = 0, max = 0;
+
+    *listp = NULL;
+    if (nodep == NULL)
+	return 0;
+
+    for (atom = nodep->xn_contents; atom != PA_NULL_ATOM;
+	 atom = childp->xn_next) {
+	childp = xi_node_addr(xwp, atom);
+	if (childp == NULL || childp->xn_depth <= nodep->xn_depth)
+	    break;
+
+	if (count == max) {
+	    max = max ? max * 2 : 16;
+	    newp = realloc(list, max * sizeof(*list));
+	    if (newp == NULL) {
+		free(list);
+		return -1;
+	    }
+	    list = newp;
+	}
+
+	list[count].xdc_atom = atom;
+	list[count].xdc_hash = xi_node_hash(xwp, atom);
+	count += 1;
+    }
+
+    *listp = list;
+    return count;
+}
+
+/*
+ * Do two nodes have the same type and name (and namespace)?  If so,
+ * a difference between them is a change, not a replacement.
+ */
+static int
+xi_diff_same_label (xi_diff_t *xdp, pa_atom_t old_atom, pa_atom_t new_atom)
+{
+    xi_workspace_t *oxwp = xdp->xd_tree[XI_DIFF_OLD]->xt_workspace;
+    xi_workspace_t *nxwp = xdp->xd_tree[XI_DIFF_NEW]->xt_workspace;
+    xi_node_t *oldp = xi_node_addr(oxwp, old_atom);
+    xi_node_t *newp = xi_node_addr(nxwp, new_atom);
+    const char *oname, *nname;
+
+    if (oldp == NULL || newp == NULL || oldp->xn_type != newp->xn_type)
+	return FALSE;
+
+    switch (oldp->xn_type) {
+    case XI_TYPE_ELT:
+    case XI_TYPE_ATTRIB:
+	if (oxwp == nxwp)
+	    return (oldp->xn_name == newp->xn_name
+		    && xi_diff_hash_ns(oxwp, 0, oldp->xn_ns_map)
+		    == xi_diff_hash_ns(nxwp, 0, newp->xn_ns_map));
+
+	oname = xi_namepool_string(oxwp, oldp->xn_name);
+	nname = xi_namepool_string(nxwp, newp->xn_name);
+	if (oname == NULL || nname == NULL || strcmp(oname, nname) != 0)
+	    return FALSE;
+
+	return (xi_diff_hash_ns(oxwp, 0, oldp->xn_ns_map)
+		== xi_diff_hash_ns(nxwp, 0, newp->xn_ns_map));
+
+    case XI_TYPE_TEXT:
+    case XI_TYPE_UNESC:
+    case XI_TYPE_ATSTR:
+	return TRUE;		/* Text is text */
+    }
+
+    return FALSE;
+}
+
+static int
+xi_diff_emit (xi_diff_t *xdp, xi_diff_op_t op, pa_atom_t old_atom,
+	      pa_atom_t new_atom, xi_depth_t depth)
+{
+    xi_diff_edit_t edit;
+
+    edit.xde_op = op;
+    edit.xde_old = old_atom;
+    edit.xde_new = new_atom;
+    edit.xde_depth = depth;
+
+    return xdp->xd_func(xdp->xd_tree[XI_DIFF_OLD], xdp->xd_tree[XI_DIFF_NEW],
+			&edit, xdp->xd_opaque);
+}
+
+/*
+ * Diff two nodes with the same label but different hashes
+ */
+static int
+xi_diff_node (xi_diff_t *xdp, pa_atom_t old_atom, pa_atom_t new_atom,
+	      xi_depth_t depth)
+{
+    xi_workspace_t *oxwp = xdp->xd_tree[XI_DIFF_OLD]->xt_workspace;
+    xi_workspace_t *nxwp = xdp->xd_tree[XI_DIFF_NEW]->xt_workspace;
+    xi_node_t *oldp = xi_node_addr(oxwp, old_atom);
+    xi_diff_child_t *olist = NULL, *nlist = NULL;
+    xi_diff_count_t *table = NULL, *op, *np;
+    int ocount, ncount, i, j, rc = -1;
+    uint32_t size, mask;
+    psu_hash_t ohash, nhash;
+
+    if (oldp == NULL)
+	return -1;
+
+    if (oldp->xn_type != XI_TYPE_ELT && oldp->xn_type != XI_TYPE_ROOT)
+	return xi_diff_emit(xdp, XI_DIFF_CHANGE, old_atom, new_atom, depth);
+
+    ocount = xi_diff_children(oxwp, old_atom, &olist);
+    ncount = xi_diff_children(nxwp, new_atom, &nlist);
+    if (ocount < 0 || ncount < 0)
+	goto done;
+
+    for (size = 16; size < 2 * (uint32_t) (ocount + ncount); size <<= 1)
+	continue;
+    mask = size - 1;
+
+    table = calloc(size, sizeof(*table));
+    if (table == NULL)
+	goto done;
+
+    for (i = 0; i < ocount; i++) {
+	op = xi_diff_count_find(table, mask, olist[i].xdc_hash);
+	op->xdn_hash = olist[i].xdc_hash;
+	op->xdn_count[XI_DIFF_OLD] += 1;
+    }
+
+    for (j = 0; j < ncount; j++) {
+	np = xi_diff_count_find(table, mask, nlist[j].xdc_hash);
+	np->xdn_hash = nlist[j].xdc_hash;
+	np->xdn_count[XI_DIFF_NEW] += 1;
+    }
+
+    rc = 0;
+    for (i = j = 0; rc == 0 && (i < ocount || j < ncount); ) {
+	if (i == ocount) {
+	    rc = xi_diff_emit(xdp, XI_DIFF_INSERT, old_atom,
+			      nlist[j++].xdc_atom, depth + 1);
+	    continue;
+	}
+
+	if (j == ncount) {
+	    rc = xi_diff_emit(xdp, XI_DIFF_DELETE, olist[i++].xdc_atom,
+			      new_atom, depth + 1);
+	    continue;
+	}
+
+	ohash = olist[i].xdc_hash;
+	nhash = nlist[j].xdc_hash;
+	op = xi_diff_count_find(table, mask, ohash);
+	np = xi_diff_count_find(table, mask, nhash);
+
+	if (ohash == nhash) {
+	    /* Identical subtrees; skip them both */
+	    op->xdn_count[XI_DIFF_OLD] -= 1;
+	    op->xdn_count[XI_DIFF_NEW] -= 1;
+	    i += 1;
+	    j += 1;
+
+	} else if (op->xdn_count[XI_DIFF_NEW] == 0
+		   && np->xdn_count[XI_DIFF_OLD] == 0
+		   && xi_diff_same_label(xdp, olist[i].xdc_atom,
+					 nlist[j].xdc_atom)) {
+	    /* Neither has a twin later on, and they match; look inside */
+	    op->xdn_count[XI_DIFF_OLD] -= 1;
+	    np->xdn_count[XI_DIFF_NEW] -= 1;
+	    rc = xi_diff_node(xdp, olist[i++].xdc_atom,
+			      nlist[j++].xdc_atom, depth + 1);
+
+	} else if (op->xdn_count[XI_DIFF_NEW] == 0) {
+	    /* The old one is gone */
+	    op->xdn_count[XI_DIFF_OLD] -= 1;
+	    rc = xi_diff_emit(xdp, XI_DIFF_DELETE, olist[i++].xdc_atom,
+			      new_atom, depth + 1);
+
+	} else {
+	    /*
+	     * The old one appears later in the new list, so this new
+	     * one is an insertion (or the other half of a move).
+	     */
+	    np->xdn_count[XI_DIFF_NEW] -= 1;
+	    rc = xi_diff_emit(xdp, XI_DIFF_INSERT, old_atom,
+			      nlist[j++].xdc_atom, depth + 1);
+	}
+    }
+
+ done:
+    free(table);
+    free(olist);
+    free(nlist);
+    return rc;
+}
+
+int
+xi_diff (xi_tree_t *old_tree, xi_tree_t *new_tree,
+	 xi_diff_fn func, void *opaque)
+{
+    xi_diff_t xd;
+
+    if (!(old_tree->xt_flags & XTIF_HASHED))
+	xi_tree_hash(old_tree);
+    if (!(new_tree->xt_flags & XTIF_HASHED))
+	xi_tree_hash(new_tree);
+
+    if (xi_node_hash(old_tree->xt_workspace, old_tree->xt_root)
+	== xi_node_hash(new_tree->xt_workspace, new_tree->xt_root))
+	return 0;		/* Nothing to see here */
+
+    bzero(&xd, sizeof(xd));
+    xd.xd_tree[XI_DIFF_OLD] = old_tree;
+    xd.xd_tree[XI_DIFF_NEW] = new_tree;
+    xd.xd_func = func;
+    xd.xd_opaque = opaque;
+
+    return xi_diff_node(&xd, old_tree->xt_root, new_tree->xt_root, 0);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Subtree hashes and structural diffs between two xi trees.  Each
+ * node's hash covers its own type, name, and value, plus the hashes
+ * of its children, so two subtrees with the same hash are (barring
+ * a collision) identical and the diff can skip them without looking
+ * inside.
+ */
+
+#ifndef LIBSLAX_XI_DIFF_H
+#define LIBSLAX_XI_DIFF_H
+
+#include <libpsu/psuhash.h>
+
+typedef unsigned xi_diff_op_t;	/* Edit operation (XI_DIFF_*) */
+
+#define XI_DIFF_DELETE	1	/* Subtree appears only in the old tree */
+#define XI_DIFF_INSERT	2	/* Subtree appears only in the new tree */
+#define XI_DIFF_CHANGE	3	/* Text or attribute value changed */
+
+/*
+ * One step of the edit script.  For XI_DIFF_DELETE, xde_new is the
+ * parent (in the new tree) the subtree was removed from; for
+ * XI_DIFF_INSERT, xde_old is the parent (in the old tree) it was
+ * added to.  Edits arrive in document order.
+ */
+typedef struct xi_diff_edit_s {
+    xi_diff_op_t xde_op;	/* Operation (XI_DIFF_*) */
+    pa_atom_t xde_old;		/* Node in the old tree */
+    pa_atom_t xde_new;		/* Node in the new tree */
+    xi_depth_t xde_depth;	/* Depth of the node */
+} xi_diff_edit_t;
+
+/*
+ * Callback for each edit; return non-zero to stop the diff
+ */
+typedef int (*xi_diff_fn)(xi_tree_t *old_tree, xi_tree_t *new_tree,
+			  xi_diff_edit_t *editp, void *opaque);
+
+/*
+ * (Re)compute the hashes for every node in a tree.  xi_diff() does
+ * this for trees that need it, but a tree that's kept around to be
+ * diffed against later can be hashed once, up front.
+ */
+void
+xi_tree_hash (xi_tree_t *xtp);
+
+/*
+ * Return the (previously computed) hash of a node
+ */
+static inline psu_hash_t
+xi_node_hash (xi_workspace_t *xwp, pa_atom_t node_atom)
+{
+    psu_hash_t *hashp = pa_fixed_element_if_exists(xwp->xw_hash, node_atom);
+
+    return hashp ? *hashp : 0;
+}
+
+/*
+ * Compare two trees, calling "func" for each edit needed to turn the
+ * old one into the new one.  Returns the callback's non-zero value
+ * if it stopped us, -1 for failure, or zero.
+ */
+int
+xi_diff (xi_tree_t *old_tree, xi_tree_t *new_tree,
+	 xi_diff_fn func, void *opaque);
+
+#endif /* LIBSLAX_XI_DIFF_H */
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Parse many files at once, one workspace per worker thread.  See
+ * xidriver.h for the big picture.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "slaxconfig.h"
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#include <pthread.h>
+#define XI_DRIVER_THREADS 1	/* Workers are real threads */
+#endif /* HAVE_PTHREAD_H && HAVE_LIBPTHREAD */
+
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <libpsu/psutime.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+#include <libxi/xidriver.h>
+
+typedef struct xi_driver_worker_s {
+    struct xi_driver_s *xdw_driver; /* Our driver */
+    unsigned xdw_id;		/* Our index in xd_workers */
+    pa_mmap_t *xdw_mmap;	/* Our memory segment */
+    xi_workspace_t *xdw_workspace; /* Our workspace */
+    xi_rulebook_t *xdw_rulebook; /* Our rulebook (or NULL) */
+#ifdef XI_DRIVER_THREADS
+    pthread_t xdw_thread;	/* Our thread */
+    pthread_mutex_t xdw_lock;	/* Protects xdw_next and xdw_end */
+#endif /* XI_DRIVER_THREADS */
+    unsigned xdw_next;		/* Next file in our run */
+    unsigned xdw_end;		/* End of our run */
+    xi_driver_stats_t xdw_stats; /* Our part of the totals */
+} xi_driver_worker_t;
+
+struct xi_driver_s {
+    unsigned xd_flags;		/* Flags (XDF_*) */
+    xi_source_flags_t xd_source_flags; /* Flags for xi_parse_open() */
+    xi_action_type_t xd_default_rule; /* Default rule (or XIA_NONE) */
+    xi_driver_file_fn xd_func;	/* Caller's function */
+    void *xd_opaque;		/* Opaque data for xd_func */
+    const char **xd_files;	/* Files for the current run */
+    xi_driver_result_t *xd_results; /* Results for the current run */
+    xi_driver_stats_t xd_stats;	/* Totals for the last run */
+    unsigned xd_nworkers;	/* Number of workers */
+    xi_driver_worker_t *xd_workers; /* Workers */
+};
+
+#ifdef XI_DRIVER_THREADS
+#define XI_DRIVER_LOCK(_xdwp) pthread_mutex_lock(&(_xdwp)->xdw_lock)
+#define XI_DRIVER_UNLOCK(_xdwp) pthread_mutex_unlock(&(_xdwp)->xdw_lock)
+#else /* XI_DRIVER_THREADS */
+#define XI_DRIVER_LOCK(_xdwp) do { } while (0)
+#define XI_DRIVER_UNLOCK(_xdwp) do { } while (0)
+#endif /* XI_DRIVER_THREADS */
+
+static void
+xi_driver_worker_close (xi_driver_worker_t *xdwp)
+{
+    xi_rulebook_close(xdwp->xdw_rulebook);
+
+    xi_workspace_close(xdwp->xdw_workspace);
+
+    if (xdwp->xdw_mmap)
+	pa_mmap_close(xdwp->xdw_mmap);
+
+#ifdef XI_DRIVER_THREADS
+    pthread_mutex_destroy(&xdwp->xdw_lock);
+#endif /* XI_DRIVER_THREADS */
+}
+
+/*
+ * The workers' memory segments are all made here, in the caller's
+ * thread, since pa_mmap_open() hands out addresses from a global
+ * that has no lock.  Once open, each segment grows on its own.
+ */
+xi_driver_t *
+xi_driver_open (unsigned workers, unsigned flags,
+		xi_source_flags_t source_flags, uint32_t workspace_flags)
+{
+    xi_driver_t *drvp;
+    xi_driver_worker_t *xdwp;
+    unsigned i;
+
+    if (workers == 0) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	workers = (ncpu > 0) ? ncpu : 1;
+    }
+
+#ifndef XI_DRIVER_THREADS
+    workers = 1;		/* No threads means no point */
+#endif /* XI_DRIVER_THREADS */
+
+    if (workers > XI_DRIVER_MAX_THREADS)
+	workers = XI_DRIVER_MAX_THREADS;
+
+    drvp = calloc(1, sizeof(*drvp));
+    if (drvp == NULL)
+	return NULL;
+
+    drvp->xd_flags = flags;
+    drvp->xd_source_flags = source_flags;
+    drvp->xd_default_rule = XIA_NONE;
+
+    drvp->xd_workers = calloc(workers, sizeof(*drvp->xd_workers));
+    if (drvp->xd_workers == NULL)
+	goto fail;
+
+    for (i = 0; i < workers; i++) {
+	xdwp = &drvp->xd_workers[i];
+	xdwp->xdw_driver = drvp;
+	xdwp->xdw_id = i;
+#ifdef XI_DRIVER_THREADS
+	pthread_mutex_init(&xdwp->xdw_lock, NULL);
+#endif /* XI_DRIVER_THREADS */
+	drvp->xd_nworkers += 1;
+
+	xdwp->xdw_mmap = pa_mmap_open(NULL, "xi-driver", 0, 0);
+	if (xdwp->xdw_mmap == NULL)
+	    goto fail;
+
+	xdwp->xdw_workspace = xi_workspace_open_flags(xdwp->xdw_mmap,
+						      "xi-driver",
+						      workspace_flags);
+	if (xdwp->xdw_workspace == NULL)
+	    goto fail;
+    }
+
+    return drvp;
+
+ fail:
+    xi_driver_close(drvp);
+    return NULL;
+}
+
+void
+xi_driver_close (xi_driver_t *drvp)
+{
+    unsigned i;
+
+    if (drvp == NULL)
+	return;
+
+    for (i = 0; i < drvp->xd_nworkers; i++)
+	xi_driver_worker_close(&drvp->xd_workers[i]);
+
+    free(drvp->xd_workers);
+    free(drvp);
+}
+
+void
+xi_driver_set_callback (xi_driver_t *drvp, xi_driver_file_fn func,
+			void *opaque)
+{
+    drvp->xd_func = func;
+    drvp->xd_opaque = opaque;
+}
+
+void
+xi_driver_set_default_rule (xi_driver_t *drvp, xi_action_type_t type)
+{
+    drvp->xd_default_rule = type;
+}
+
+/*
+ * Rulebooks hold name atoms, so each workspace needs its own
+ */
+int
+xi_driver_set_select (xi_driver_t *drvp, const char **paths, unsigned npaths,
+		      xi_action_type_t action)
+{
+    xi_driver_worker_t *xdwp;
+    unsigned i;
+
+    for (i = 0; i < drvp->xd_nworkers; i++) {
+	xdwp = &drvp->xd_workers[i];
+
+	if (xdwp->xdw_rulebook) {
+	    xi_rulebook_close(xdwp->xdw_rulebook);
+	    xdwp->xdw_rulebook = NULL;
+	}
+
+	if (npaths == 0)
+	    continue;
+
+	xdwp->xdw_rulebook = xi_rulebook_compile(xdwp->xdw_workspace,
+						 "xi-driver", paths, npaths,
+						 action);
+	if (xdwp->xdw_rulebook == NULL)
+	    return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Find another worker with files left and take the back half of its
+ * run.  The owner works from the front, so we only meet when there's
+ * a single file left, and the lock settles that.  We never hold two
+ * locks at once.
+ */
+static int
+xi_driver_steal (xi_driver_worker_t *xdwp)
+{
+    xi_driver_t *drvp = xdwp->xdw_driver;
+    xi_driver_worker_t *victimp;
+    unsigned i, left, start = 0, end = 0;
+
+    for (i = 1; i < drvp->xd_nworkers; i++) {
+	victimp = &drvp->xd_workers[(xdwp->xdw_id + i) % drvp->xd_nworkers];
+
+	XI_DRIVER_LOCK(victimp);
+	left = victimp->xdw_end - victimp->xdw_next;
+	if (left > 0) {
+	    end = victimp->xdw_end;
+	    start = end - (left + 1) / 2;
+	    victimp->xdw_end = start;
+	}
+	XI_DRIVER_UNLOCK(victimp);
+
+	if (left > 0) {
+	    XI_DRIVER_LOCK(xdwp);
+	    xdwp->xdw_next = start;
+	    xdwp->xdw_end = end;
+	    XI_DRIVER_UNLOCK(xdwp);
+
+	    xdwp->xdw_stats.xds_steals += 1;
+	    return TRUE;
+	}
+    }
+
+    return FALSE;
+}
+
+/*
+ * Return the index of the next file for this worker to parse, or -1
+ * when there are none left anywhere
+ */
+static int
+xi_driver_next (xi_driver_worker_t *xdwp)
+{
+    int idx;
+
+    for (;;) {
+	XI_DRIVER_LOCK(xdwp);
+	idx = (xdwp->xdw_next < xdwp->xdw_end) ? (int) xdwp->xdw_next++ : -1;
+	XI_DRIVER_UNLOCK(xdwp);
+
+	if (idx >= 0)
+	    return idx;
+
+	if (!xi_driver_steal(xdwp))
+	    return -1;
+    }
+}
+
+static void
+xi_driver_parse (xi_driver_worker_t *xdwp, unsigned idx,
+		 xi_driver_result_t *resp)
+{
+    xi_driver_t *drvp = xdwp->xdw_driver;
+    xi_workspace_t *xwp = xdwp->xdw_workspace;
+    char namebuf[PA_MMAP_HEADER_NAME_LEN];
+    const char *name = "xi-driver";
+    xi_parse_stats_t *statsp;
+    xi_parse_t *parsep;
+    psu_time_nsecs_t start;
+
+    bzero(resp, sizeof(*resp));
+    resp->xdr_filename = drvp->xd_files[idx];
+    resp->xdr_worker = xdwp->xdw_id;
+    resp->xdr_status = -1;
+
+    /* Trees that are kept need names of their own */
+    if (drvp->xd_flags & XDF_KEEP_TREES) {
+	snprintf(namebuf, sizeof(namebuf), "file-%u", idx);
+	name = namebuf;
+    }
+
+    start = psu_time_now_nsecs();
+
+    parsep = xi_parse_open(xdwp->xdw_mmap, xwp, name, resp->xdr_filename,
+			   drvp->xd_source_flags);
+    if (parsep == NULL)
+	goto done;
+
+    if (drvp->xd_default_rule != XIA_NONE)
+	xi_parse_set_default_rule(parsep, drvp->xd_default_rule);
+    if (xdwp->xdw_rulebook)
+	xi_parse_set_rulebook(parsep, xdwp->xdw_rulebook);
+
+    statsp = xi_parse_stats_enable(parsep);
+
+    resp->xdr_status = xi_parse(parsep);
+    resp->xdr_nsecs = psu_time_now_nsecs() - start;
+
+    if (statsp) {
+	resp->xdr_bytes = statsp->xst_source.xss_bytes;
+	resp->xdr_nodes = statsp->xst_workspace.xws_nodes;
+    }
+
+    if (drvp->xd_func && drvp->xd_func(parsep, resp, drvp->xd_opaque))
+	resp->xdr_status = -1;
+
+    xi_parse_destroy(parsep);
+
+ done:
+    if (resp->xdr_nsecs == 0)
+	resp->xdr_nsecs = psu_time_now_nsecs() - start;
+
+    if (!(drvp->xd_flags & XDF_KEEP_TREES))
+	xi_workspace_reset(xwp);
+
+    xdwp->xdw_stats.xds_files += 1;
+    if (resp->xdr_status)
+	xdwp->xdw_stats.xds_failed += 1;
+    xdwp->xdw_stats.xds_bytes += resp->xdr_bytes;
+    xdwp->xdw_stats.xds_nodes += resp->xdr_nodes;
+    xdwp->xdw_stats.xds_parse_nsecs += resp->xdr_nsecs;
+}
+
+static void *
+xi_driver_worker (void *arg)
+{
+    xi_driver_worker_t *xdwp = arg;
+    xi_driver_t *drvp = xdwp->xdw_driver;
+    xi_driver_result_t result, *resp;
+    int idx;
+
+    while ((idx = xi_driver_next(xdwp)) >= 0) {
+	resp = drvp->xd_results ? &drvp->xd_results[idx] : &result;
+	xi_driver_parse(xdwp, idx, resp);
+    }
+
+    return NULL;
+}
+
+int
+xi_driver_run (xi_driver_t *drvp, const char **files, unsigned nfiles,
+	       xi_driver_result_t *results)
+{
+    xi_driver_worker_t *xdwp;
+    psu_time_nsecs_t start;
+    unsigned i, started = 0;
+
+    drvp->xd_files = files;
+    drvp->xd_results = results;
+    bzero(&drvp->xd_stats, sizeof(drvp->xd_stats));
+
+    /* Deal out the files in contiguous runs */
+    for (i = 0; i < drvp->xd_nworkers; i++) {
+	xdwp = &drvp->xd_workers[i];
+	bzero(&xdwp->xdw_stats, sizeof(xdwp->xdw_stats));
+	xdwp->xdw_next = (uint64_t) nfiles * i / drvp->xd_nworkers;
+	xdwp->xdw_end = (uint64_t) nfiles * (i + 1) / drvp->xd_nworkers;
+    }
+
+    start = psu_time_now_nsecs();
+
+#ifdef XI_DRIVER_THREADS
+    /* Worker zero is us */
+    for (i = 1; i < drvp->xd_nworkers; i++) {
+	xdwp = &drvp->xd_workers[i];
+	if (pthread_create(&xdwp->xdw_thread, NULL, xi_driver_worker, xdwp))
+	    break;
+	started += 1;
+    }
+
+    /* If we couldn't start them all, the rest of their runs get stolen */
+    xi_driver_worker(&drvp->xd_workers[0]);
+
+    for (i = 1; i <= started; i++)
+	pthread_join(drvp->xd_workers[i].xdw_thread, NULL);
+#else /* XI_DRIVER_THREADS */
+    xi_driver_worker(&drvp->xd_workers[0]);
+#endif /* XI_DRIVER_THREADS */
+
+    drvp->xd_stats.xds_wall_nsecs = psu_time_now_nsecs() - start;
+    drvp->xd_stats.xds_workers = started + 1;
+
+    for (i = 0; i < drvp->xd_nworkers; i++) {
+	xdwp = &drvp->xd_workers[i];
+	drvp->xd_stats.xds_files += xdwp->xdw_stats.xds_files;
+	drvp->xd_stats.xds_failed += xdwp->xdw_stats.xds_failed;
+	drvp->xd_stats.xds_bytes += xdwp->xdw_stats.xds_bytes;
+	drvp->xd_stats.xds_nodes += xdwp->xdw_stats.xds_nodes;
+	drvp->xd_stats.xds_parse_nsecs += xdwp->xdw_stats.xds_parse_nsecs;
+	drvp->xd_stats.xds_steals += xdwp->xdw_stats.xds_steals;
+    }
+
+    drvp->xd_files = NULL;
+    drvp->xd_results = NULL;
+
+    return drvp->xd_stats.xds_failed;
+}
+
+const xi_driver_stats_t *
+xi_driver_stats (xi_driver_t *drvp)
+{
+    return &drvp->xd_stats;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * A driver for parsing lots of files at once.  Each worker thread has
+ * a workspace of its own (workspaces can't be shared between threads,
+ * since the pools have no locking), and the files are dealt out to
+ * the workers in contiguous runs.  A worker that runs out steals half
+ * of what's left of another worker's run, so a few big files don't
+ * leave the other threads idle.
+ *
+ * After each file is parsed, the caller's function is called (from
+ * the worker thread) with the parser, so the tree can be examined or
+ * copied out; xi_parse_stats() is enabled for every parse.  Then the
+ * workspace is reset for the next file, unless XDF_KEEP_TREES is set.
+ */
+
+#ifndef LIBSLAX_XI_DRIVER_H
+#define LIBSLAX_XI_DRIVER_H
+
+#define XI_DRIVER_MAX_THREADS	256 /* Max number of worker threads */
+
+/*
+ * The result of parsing one file
+ */
+typedef struct xi_driver_result_s {
+    const char *xdr_filename;	/* File we parsed */
+    int xdr_status;		/* Zero for success */
+    unsigned xdr_worker;	/* Worker (thread) that parsed it */
+    uint64_t xdr_bytes;		/* Bytes of input */
+    uint64_t xdr_nsecs;		/* Time spent parsing */
+    uint64_t xdr_nodes;		/* Nodes built */
+} xi_driver_result_t;
+
+/*
+ * Totals for a run
+ */
+typedef struct xi_driver_stats_s {
+    uint64_t xds_files;		/* Files parsed */
+    uint64_t xds_failed;	/* Files that failed */
+    uint64_t xds_bytes;		/* Bytes of input */
+    uint64_t xds_nodes;		/* Nodes built */
+    uint64_t xds_parse_nsecs;	/* Time spent parsing (summed) */
+    uint64_t xds_wall_nsecs;	/* Elapsed time for the run */
+    uint64_t xds_steals;	/* Runs stolen from other workers */
+    unsigned xds_workers;	/* Number of workers */
+} xi_driver_stats_t;
+
+/*
+ * Called, in a worker thread, after each file is parsed.  Calls for
+ * different files can happen at the same time, so the function must
+ * do its own locking.  A non-zero return marks the file as failed.
+ */
+typedef int (*xi_driver_file_fn)(xi_parse_t *parsep,
+				 xi_driver_result_t *resp, void *opaque);
+
+struct xi_driver_s;		/* Opaque (xidriver.c) */
+typedef struct xi_driver_s xi_driver_t;
+
+/* Flags for xi_driver_open(): */
+#define XDF_KEEP_TREES	(1<<0)	/* Don't reset workspaces between files */
+
+/*
+ * Make a driver with the given number of workers (zero means one per
+ * online CPU).  The source flags are given to every xi_parse_open(),
+ * and the workspace flags to every xi_workspace_open_flags().
+ */
+xi_driver_t *
+xi_driver_open (unsigned workers, unsigned flags,
+		xi_source_flags_t source_flags, uint32_t workspace_flags);
+
+void
+xi_driver_close (xi_driver_t *drvp);
+
+void
+xi_driver_set_callback (xi_driver_t *drvp, xi_driver_file_fn func,
+			void *opaque);
+
+void
+xi_driver_set_default_rule (xi_driver_t *drvp, xi_action_type_t type);
+
+/*
+ * Give each worker a rulebook built (in its own workspace) from these
+ * selectors; see xi_rulebook_compile().  The paths are not copied.
+ */
+int
+xi_driver_set_select (xi_driver_t *drvp, const char **paths, unsigned npaths,
+		      xi_action_type_t action);
+
+/*
+ * Parse the files.  If results is non-NULL, it must have room for
+ * nfiles results, which are filled in by index.  Returns the number
+ * of files that failed.  If some threads can't be started, the
+ * others pick up their files.
+ */
+int
+xi_driver_run (xi_driver_t *drvp, const char **files, unsigned nfiles,
+	       xi_driver_result_t *results);
+
+/*
+ * Return the totals for the last xi_driver_run()
+ */
+const xi_driver_stats_t *
+xi_driver_stats (xi_driver_t *drvp);
+
+#endif /* LIBSLAX_XI_DRIVER_H */
@@ -0,0 +1,801 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Output is appended to xe_buf, and the bytes appended since the last
+ * iovec (from xe_mark to xe_len) become an iovec only when we need to
+ * borrow a string or flush.  Borrowed strings point into the
+ * workspace, so they're only used while we're walking a tree
+ * ourselves (XEF_BORROW), and are written out before we return,
+ * since the caller is free to change the tree afterward.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "slaxconfig.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+#include <libxi/xiemit.h>
+
+/* Sets of characters that need escaping */
+#define XI_ESC_TEXT	(1<<0)	/* XML text: & < > */
+#define XI_ESC_ATTR	(1<<1)	/* XML attribute values: & < > " */
+#define XI_ESC_JSON	(1<<2)	/* JSON strings: " \ and controls */
+
+#define XI_JSON_INDENT	4	/* Matches slaxIndent */
+
+xi_emit_t *
+xi_emit_open (int fd, unsigned flags)
+{
+    xi_emit_t *emitp = calloc(1, sizeof(*emitp));
+
+    if (emitp == NULL)
+	return NULL;
+
+    emitp->xe_buf = malloc(XI_EMIT_BUFSIZ);
+    if (emitp->xe_buf == NULL) {
+	free(emitp);
+	return NULL;
+    }
+
+    emitp->xe_fd = fd;
+    emitp->xe_flags = flags & ~XEF_BORROW;
+
+    return emitp;
+}
+
+/*
+ * Turn the buffered bytes since the last iovec into an iovec
+ */
+static void
+xi_emit_segment (xi_emit_t *emitp)
+{
+    struct iovec *iovp;
+
+    if (emitp->xe_len == emitp->xe_mark)
+	return;
+
+    iovp = &emitp->xe_iov[emitp->xe_iovcnt++];
+    iovp->iov_base = emitp->xe_buf + emitp->xe_mark;
+    iovp->iov_len = emitp->xe_len - emitp->xe_mark;
+    emitp->xe_mark = emitp->xe_len;
+}
+
+int
+xi_emit_flush (xi_emit_t *emitp)
+{
+    struct iovec *iovp = emitp->xe_iov;
+    int cnt;
+    ssize_t rc;
+
+    xi_emit_segment(emitp);
+    cnt = emitp->xe_iovcnt;
+
+    /* Once a write fails, we just discard output */
+    while (cnt > 0 && emitp->xe_errno == 0) {
+	rc = writev(emitp->xe_fd, iovp, cnt);
+	if (rc < 0) {
+	    if (errno != EINTR)
+		emitp->xe_errno = errno;
+	    continue;
+	}
+
+	/* Skip what was written, which may end mid-iovec */
+	for ( ; cnt > 0 && (size_t) rc >= iovp->iov_len; iovp++, cnt--)
+	    rc -= iovp->iov_len;
+
+	if (cnt > 0) {
+	    iovp->iov_base = (char *) iovp->iov_base + rc;
+	    iovp->iov_len -= rc;
+	}
+    }
+
+    emitp->xe_len = emitp->xe_mark = 0;
+    emitp->xe_iovcnt = emitp->xe_borrowed = 0;
+
+    return emitp->xe_errno ? -1 : 0;
+}
+
+int
+xi_emit_close (xi_emit_t *emitp)
+{
+    int rc = xi_emit_flush(emitp);
+
+    if (emitp->xe_flags & XEF_CLOSE_FD)
+	close(emitp->xe_fd);
+
+    free(emitp->xe_buf);
+    free(emitp);
+
+    return rc;
+}
+
+/*
+ * Write out borrowed strings before the tree they point into can change
+ */
+static int
+xi_emit_release (xi_emit_t *emitp)
+{
+    emitp->xe_flags &= ~XEF_BORROW;
+
+    if (emitp->xe_borrowed)
+	xi_emit_flush(emitp);
+
+    return emitp->xe_errno ? -1 : 0;
+}
+
+static void
+xi_emit_write (xi_emit_t *emitp, const char *data, size_t len)
+{
+    struct iovec *iovp;
+    size_t space;
+
+    if (len >= XI_EMIT_BORROW && (emitp->xe_flags & XEF_BORROW)) {
+	/* Leave room for this, the segment before it, and the next one */
+	if (emitp->xe_iovcnt + 3 > XI_EMIT_IOV)
+	    xi_emit_flush(emitp);
+
+	xi_emit_segment(emitp);
+	iovp = &emitp->xe_iov[emitp->xe_iovcnt++];
+	iovp->iov_base = (void *) (uintptr_t) data;
+	iovp->iov_len = len;
+	emitp->xe_borrowed += 1;
+	return;
+    }
+
+    while (len > 0) {
+	space = XI_EMIT_BUFSIZ - emitp->xe_len;
+	if (space == 0) {
+	    xi_emit_flush(emitp);
+	    space = XI_EMIT_BUFSIZ;
+	}
+
+	if (space > len)
+	    space = len;
+
+	memcpy(emitp->xe_buf + emitp->xe_len, data, space);
+	emitp->xe_len += space;
+	data += space;
+	len -= space;
+    }
+}
+
+static inline void
+xi_emit_string (xi_emit_t *emitp, const char *str)
+{
+    xi_emit_write(emitp, str, strlen(str));
+}
+
+static inline void
+xi_emit_char (xi_emit_t *emitp, char ch)
+{
+    if (emitp->xe_len == XI_EMIT_BUFSIZ)
+	xi_emit_flush(emitp);
+
+    emitp->xe_buf[emitp->xe_len++] = ch;
+}
+
+static inline xi_boolean_t
+xi_emit_is_special (unsigned char ch, unsigned mode)
+{
+    switch (ch) {
+    case '&':
+    case '<':
+    case '>':
+	return (mode & (XI_ESC_TEXT | XI_ESC_ATTR)) ? TRUE : FALSE;
+    case '"':
+	return (mode & (XI_ESC_ATTR | XI_ESC_JSON)) ? TRUE : FALSE;
+    case '\\':
+	return (mode & XI_ESC_JSON) ? TRUE : FALSE;
+    }
+
+    return (ch < 0x20 && (mode & XI_ESC_JSON)) ? TRUE : FALSE;
+}
+
+/*
+ * Return the number of bytes before the first one that needs escaping.
+ * Most text needs no escaping at all, so with SSE2, we check sixteen
+ * bytes at a time.
+ */
+static size_t
+xi_emit_scan (const char *data, size_t len, unsigned mode)
+{
+    size_t off = 0;
+
+#ifdef __SSE2__
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctl = _mm_set1_epi8(0x1f);
+    __m128i v, hit;
+    int mask;
+
+    for ( ; off + 16 <= len; off += 16) {
+	v = _mm_loadu_si128((const __m128i *) (data + off));
+
+	if (mode & XI_ESC_JSON) {
+	    /* Unsigned "v <= 0x1f" is "max(v, 0x1f) == 0x1f" */
+	    hit = _mm_or_si128(_mm_cmpeq_epi8(v, quot),
+			       _mm_cmpeq_epi8(v, bslash));
+	    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl));
+	} else {
+	    hit = _mm_or_si128(_mm_cmpeq_epi8(v, amp),
+			       _mm_or_si128(_mm_cmpeq_epi8(v, lt),
+					    _mm_cmpeq_epi8(v, gt)));
+	    if (mode & XI_ESC_ATTR)
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, quot));
+	}
+
+	mask = _mm_movemask_epi8(hit);
+	if (mask)
+	    return off + __builtin_ctz(mask);
+    }
+#endif /* __SSE2__ */
+
+    for ( ; off < len; off++)
+	if (xi_emit_is_special(data[off], mode))
+	    break;
+
+    return off;
+}
+
+static void
+xi_emit_entity (xi_emit_t *emitp, unsigned char ch, unsigned mode)
+{
+    char buf[8];
+
+    if (mode & XI_ESC_JSON) {
+	switch (ch) {
+	case '"':
+	    xi_emit_write(emitp, "\\\"", 2);
+	    break;
+	case '\\':
+	    xi_emit_write(emitp, "\\\\", 2);
+	    break;
+	case '\b':
+	    xi_emit_write(emitp, "\\b", 2);
+	    break;
+	case '\f':
+	    xi_emit_write(emitp, "\\f", 2);
+	    break;
+	case '\n':
+	    xi_emit_write(emitp, "\\n", 2);
+	    break;
+	case '\r':
+	    xi_emit_write(emitp, "\\r", 2);
+	    break;
+	case '\t':
+	    xi_emit_write(emitp, "\\t", 2);
+	    break;
+	default:
+	    snprintf(buf, sizeof(buf), "\\u%04x", ch);
+	    xi_emit_write(emitp, buf, 6);
+	}
+	return;
+    }
+
+    switch (ch) {
+    case '&':
+	xi_emit_write(emitp, "&amp;", 5);
+	break;
+    case '<':
+	xi_emit_write(emitp, "&lt;", 4);
+	break;
+    case '>':
+	xi_emit_write(emitp, "&gt;", 4);
+	break;
+    case '"':
+	xi_emit_write(emitp, "&quot;", 6);
+	break;
+    }
+}
+
+static void
+xi_emit_escaped (xi_emit_t *emitp, const char *data, size_t len,
+		 unsigned mode)
+{
+    size_t run;
+
+    while (len > 0) {
+	run = xi_emit_scan(data, len, mode);
+	if (run > 0)
+	    xi_emit_write(emitp, data, run);
+	if (run == len)
+	    break;
+
+	xi_emit_entity(emitp, data[run], mode);
+	data += run + 1;
+	len -= run + 1;
+    }
+}
+
+static void
+xi_emit_qname (xi_emit_t *emitp, xi_workspace_t *xwp, xi_node_t *nodep,
+	       const char *name)
+{
+    xi_ns_map_t *ns_map;
+    const char *pref;
+
+    if (nodep->xn_ns_map != PA_NULL_ATOM) {
+	ns_map = xi_ns_map_addr(xwp, nodep->xn_ns_map);
+	if (ns_map != NULL) {
+	    pref = xi_namepool_string(xwp, ns_map->xnm_prefix);
+	    if (pref) {
+		xi_emit_string(emitp, pref);
+		xi_emit_char(emitp, ':');
+	    }
+	}
+    }
+
+    xi_emit_string(emitp, name);
+}
+
+int
+xi_emit_xml_cb (xi_parse_t *parsep, xi_node_type_t type,
+		xi_node_id_t node_atom UNUSED, xi_node_t *nodep,
+		const char *data, void *opaque)
+{
+    xi_emit_t *emitp = opaque;
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
+    xi_ns_map_t *ns_map;
+    const char *cp;
+
+    switch (type) {
+    case XI_TYPE_ELT:
+	xi_emit_char(emitp, '<');
+	xi_emit_qname(emitp, xwp, nodep, data);
+	break;
+
+    case XI_TYPE_EOL_ATTRIB:
+	xi_emit_char(emitp, '>');
+	break;
+
+    case XI_TYPE_EOL_EMPTY:
+	xi_emit_write(emitp, "/>", 2);
+	break;
+
+    case XI_TYPE_CLOSE:
+	if (data != NULL && emitp->xe_last_type != XI_TYPE_EOL_EMPTY) {
+	    xi_emit_write(emitp, "</", 2);
+	    xi_emit_qname(emitp, xwp, nodep, data);
+	    xi_emit_char(emitp, '>');
+	}
+	break;
+
+    case XI_TYPE_TEXT:
+    case XI_TYPE_UNESC:
+	/* Text that still holds its entities goes out as-is */
+	if (nodep->xn_flags & XNF_ESCAPED)
+	    xi_emit_string(emitp, data);
+	else
+	    xi_emit_escaped(emitp, data, strlen(data), XI_ESC_TEXT);
+	break;
+
+    case XI_TYPE_ATSTR:
+	xi_emit_char(emitp, ' ');
+	xi_emit_string(emitp, data);
+	break;
+
+    case XI_TYPE_ATTRIB:
+	cp = xi_namepool_string(xwp, nodep->xn_name);
+	xi_emit_char(emitp, ' ');
+	xi_emit_string(emitp, cp ?: "");
+	xi_emit_write(emitp, "=\"", 2);
+	if (nodep->xn_flags & XNF_ESCAPED)
+	    xi_emit_string(emitp, data);
+	else
+	    xi_emit_escaped(emitp, data, strlen(data), XI_ESC_ATTR);
+	xi_emit_char(emitp, '"');
+	break;
+
+    case XI_TYPE_NS:
+	ns_map = xi_ns_map_addr(xwp, nodep->xn_contents);
+	if (ns_map) {
+	    xi_emit_string(emitp, " " XI_XMLNS_LEADER);
+	    cp = xi_namepool_string(xwp, ns_map->xnm_prefix);
+	    if (cp) {
+		xi_emit_char(emitp, ':');
+		xi_emit_string(emitp, cp);
+	    }
+	    xi_emit_write(emitp, "=\"", 2);
+	    cp = xi_namepool_string(xwp, ns_map->xnm_uri);
+	    if (cp)
+		xi_emit_escaped(emitp, cp, strlen(cp), XI_ESC_ATTR);
+	    xi_emit_char(emitp, '"');
+	}
+	break;
+
+    case XI_TYPE_EOF:
+	xi_emit_char(emitp, '\n');
+	break;
+    }
+
+    emitp->xe_last_type = type;
+    return 0;
+}
+
+int
+xi_emit_xml (xi_emit_t *emitp, xi_parse_t *parsep, xi_node_id_t node_atom)
+{
+    emitp->xe_flags |= XEF_BORROW;
+    emitp->xe_last_type = XI_TYPE_NONE;
+
+    if (node_atom == PA_NULL_ATOM)
+	xi_parse_emit(parsep, xi_emit_xml_cb, emitp);
+    else
+	xi_parse_emit_node(parsep, node_atom, xi_emit_xml_cb, emitp);
+
+    return xi_emit_release(emitp);
+}
+
+/*
+ * JSON output follows slaxJsonWriteDoc(): the top element is an
+ * object (or an array, with type="array"), and each child element is
+ * a member named by its "name" attribute or its own name.  A child
+ * with element children is an object, type="array" makes an array of
+ * its children, type="member" drops the name, type="number" (or
+ * "true", "false", "null") writes its value bare, and anything else
+ * is a string.  Unlike slaxJsonWriteDoc(), we escape quotes and
+ * backslashes, so the output is always valid JSON.
+ */
+#define XI_JSON_ARRAY	(1<<0)	/* Inside an array (so no names) */
+
+typedef struct xi_emit_json_s {
+    xi_emit_t *xej_emitp;	/* Where to write */
+    xi_workspace_t *xej_workspace; /* Workspace holding the tree */
+    pa_atom_t xej_type_atom;	/* Name atom for "type" */
+    pa_atom_t xej_name_atom;	/* Name atom for "name" */
+} xi_emit_json_t;
+
+/*
+ * Start a line.  Lines that close an object or array are outdented,
+ * which is the only way slaxJsonWriteDoc() outdents.
+ */
+static void
+xi_emit_json_line (xi_emit_json_t *xjp, xi_boolean_t outdent)
+{
+    xi_emit_t *emitp = xjp->xej_emitp;
+    unsigned i;
+
+    if (!(emitp->xe_flags & XEF_PRETTY))
+	return;
+
+    if (outdent && emitp->xe_level > 0)
+	emitp->xe_level -= 1;
+
+    for (i = 0; i < emitp->xe_level * XI_JSON_INDENT; i++)
+	xi_emit_char(emitp, ' ');
+}
+
+/*
+ * End a line, indenting the lines that follow if we opened something
+ */
+static void
+xi_emit_json_newline (xi_emit_json_t *xjp, xi_boolean_t indent)
+{
+    xi_emit_t *emitp = xjp->xej_emitp;
+
+    if (!(emitp->xe_flags & XEF_PRETTY)) {
+	xi_emit_char(emitp, ' ');
+	return;
+    }
+
+    xi_emit_char(emitp, '\n');
+    if (indent)
+	emitp->xe_level += 1;
+}
+
+/*
+ * Find an attribute's value, whether it's been extracted or is still
+ * part of the unparsed attribute string
+ */
+static const char *
+xi_emit_json_attrib (xi_emit_json_t *xjp, xi_node_t *nodep,
+		     pa_atom_t name_atom, const char *name, size_t *lenp)
+{
+    xi_workspace_t *xwp = xjp->xej_workspace;
+    size_t nlen = strlen(name);
+    const char *cp, *np, *vp, *ep;
+    xi_node_t *childp;
+    pa_atom_t atom;
+
+    if (!(nodep->xn_flags & XNF_ATTRIBS_PRESENT))
+	return NULL;
+
+    childp = xi_get_attrib_node(xwp, nodep, name_atom);
+    if (childp) {
+	cp = xi_node_string(xwp, childp);
+	if (cp)
+	    *lenp = strlen(cp);
+	return cp;
+    }
+
+    for (atom = nodep->xn_contents; atom != PA_NULL_ATOM;
+	 atom = childp->xn_next) {
+	childp = xi_node_addr(xwp, atom);
+	if (childp == NULL || childp->xn_depth <= nodep->xn_depth)
+	    break;
+
+	if (childp->xn_type != XI_TYPE_ATSTR)
+	    continue;
+
+	for (cp = xi_node_stored_string(xwp, childp); cp && *cp; cp = ep + 1) {
+	    while (xi_isspace(*cp))
+		cp += 1;
+
+	    for (np = cp; *np && *np != '=' && !xi_isspace(*np); np++)
+		continue;
+
+	    for (vp = np; xi_isspace(*vp) || *vp == '='; vp++)
+		continue;
+
+	    if (*vp != '"' && *vp != '\'')
+		break;
+
+	    ep = strchr(vp + 1, *vp);
+	    if (ep == NULL)
+		break;
+
+	    if ((size_t) (np - cp) == nlen && strncmp(cp, name, nlen) == 0) {
+		*lenp = ep - vp - 1;
+		return vp + 1;
+	    }
+	}
+    }
+
+    return NULL;
+}
+
+static inline xi_boolean_t
+xi_emit_json_is (const char *value, size_t len, const char *match)
+{
+    return (value && strlen(match) == len && memcmp(value, match, len) == 0);
+}
+
+/*
+ * Write an element's text, which is whatever text nodes come before
+ * its first element child, returning the number of bytes written
+ */
+static size_t
+xi_emit_json_value (xi_emit_json_t *xjp, xi_node_t *nodep, unsigned mode)
+{
+    xi_workspace_t *xwp = xjp->xej_workspace;
+    xi_node_t *childp;
+    pa_atom_t atom;
+    const char *cp;
+    size_t len, total = 0;
+
+    for (atom = nodep->xn_contents; atom != PA_NULL_ATOM;
+	 atom = childp->xn_next) {
+	childp = xi_node_addr(xwp, atom);
+	if (childp == NULL || childp->xn_depth <= nodep->xn_depth)
+	    break;
+
+	if (childp->xn_type == XI_TYPE_ELT)
+	    break;
+
+	if (childp->xn_type != XI_TYPE_TEXT && childp->xn_type != XI_TYPE_UNESC)
+	    continue;
+
+	cp = xi_node_string(xwp, childp);
+	if (cp == NULL)
+	    continue;
+
+	len = strlen(cp);
+	if (mode)
+	    xi_emit_escaped(xjp->xej_emitp, cp, len, mode);
+	else
+	    xi_emit_write(xjp->xej_emitp, cp, len);
+	total += len;
+    }
+
+    return total;
+}
+
+static xi_boolean_t
+xi_emit_json_has_elements (xi_emit_json_t *xjp, xi_node_t *nodep)
+{
+    xi_node_t *childp;
+    pa_atom_t atom;
+
+    for (atom = nodep->xn_contents; atom != PA_NULL_ATOM;
+	 atom = childp->xn_next) {
+	childp = xi_node_addr(xjp->xej_workspace, atom);
+	if (childp == NULL || childp->xn_depth <= nodep->xn_depth)
+	    break;
+
+	if (childp->xn_type == XI_TYPE_ELT)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+xi_emit_json_children (xi_emit_json_t *xjp, xi_node_t *nodep, unsigned flags);
+
+static void
+xi_emit_json_node (xi_emit_json_t *xjp, xi_node_t *nodep, unsigned flags,
+		   xi_boolean_t comma)
+{
+    xi_emit_t *emitp = xjp->xej_emitp;
+    const char *type, *name;
+    size_t tlen = 0, nlen = 0;
+
+    type = xi_emit_json_attrib(xjp, nodep, xjp->xej_type_atom, "type", &tlen);
+    name = xi_emit_json_attrib(xjp, nodep, xjp->xej_name_atom, "name", &nlen);
+    if (name == NULL) {
+	name = xi_namepool_string(xjp->xej_workspace, nodep->xn_name);
+	if (name == NULL)
+	    return;
+	nlen = strlen(name);
+    }
+
+    if (xi_emit_json_is(type, tlen, "member"))
+	flags |= XI_JSON_ARRAY;
+
+    xi_emit_json_line(xjp, FALSE);
+
+    if (!(flags & XI_JSON_ARRAY)) {
+	xi_emit_char(emitp, '"');
+	xi_emit_escaped(emitp, name, nlen, XI_ESC_JSON);
+	xi_emit_write(emitp, "\": ", 3);
+    }
+
+    if (xi_emit_json_is(type, tlen, "number")
+	|| xi_emit_json_is(type, tlen, "true")
+	|| xi_emit_json_is(type, tlen, "false")
+	|| xi_emit_json_is(type, tlen, "null")) {
+	if (xi_emit_json_value(xjp, nodep, 0) == 0)
+	    xi_emit_write(emitp, "null", 4);
+	if (comma)
+	    xi_emit_char(emitp, ',');
+	xi_emit_json_newline(xjp, FALSE);
+
+    } else if (xi_emit_json_is(type, tlen, "array")) {
+	xi_emit_char(emitp, '[');
+	xi_emit_json_newline(xjp, TRUE);
+	xi_emit_json_children(xjp, nodep, flags | XI_JSON_ARRAY);
+	xi_emit_json_line(xjp, TRUE);
+	xi_emit_char(emitp, ']');
+	if (comma)
+	    xi_emit_char(emitp, ',');
+	xi_emit_json_newline(xjp, FALSE);
+
+    } else if (xi_emit_json_has_elements(xjp, nodep)) {
+	xi_emit_char(emitp, '{');
+	xi_emit_json_newline(xjp, TRUE);
+	xi_emit_json_children(xjp, nodep, flags & ~XI_JSON_ARRAY);
+	xi_emit_json_line(xjp, TRUE);
+	xi_emit_char(emitp, '}');
+	if (comma)
+	    xi_emit_char(emitp, ',');
+	xi_emit_json_newline(xjp, FALSE);
+
+    } else {
+	xi_emit_char(emitp, '"');
+	xi_emit_json_value(xjp, nodep, XI_ESC_JSON);
+	xi_emit_char(emitp, '"');
+	if (comma)
+	    xi_emit_char(emitp, ',');
+	xi_emit_json_newline(xjp, FALSE);
+    }
+}
+
+/*
+ * Write the element children of a node.  We hold each child until we
+ * find the next one, since that's how we know it needs a comma.
+ */
+static void
+xi_emit_json_children (xi_emit_json_t *xjp, xi_node_t *nodep, unsigned flags)
+{
+    xi_node_t *childp, *prevp = NULL;
+    pa_atom_t atom;
+
+    for (atom = nodep->xn_contents; atom != PA_NULL_ATOM;
+	 atom = childp->xn_next) {
+	childp = xi_node_addr(xjp->xej_workspace, atom);
+	if (childp == NULL || childp->xn_depth <= nodep->xn_depth)
+	    break;
+
+	if (childp->xn_type != XI_TYPE_ELT)
+	    continue;
+
+	if (prevp)
+	    xi_emit_json_node(xjp, prevp, flags, TRUE);
+	prevp = childp;
+    }
+
+    if (prevp)
+	xi_emit_json_node(xjp, prevp, flags, FALSE);
+}
+
+int
+xi_emit_json (xi_emit_t *emitp, xi_parse_t *parsep, xi_node_id_t node_atom)
+{
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
+    xi_emit_json_t xj;
+    xi_node_t *nodep, *rootp;
+    const char *type;
+    size_t tlen = 0;
+    unsigned flags = 0;
+
+    if (node_atom == PA_NULL_ATOM) {
+	/* Find the top element under the root */
+	rootp = xi_node_addr(xwp, parsep->xp_insert->xi_tree->xt_root);
+	if (rootp == NULL)
+	    return -1;
+
+	for (node_atom = rootp->xn_contents; node_atom != PA_NULL_ATOM;
+	     node_atom = nodep->xn_next) {
+	    nodep = xi_node_addr(xwp, node_atom);
+	    if (nodep == NULL || nodep->xn_depth <= rootp->xn_depth)
+		return -1;
+	    if (nodep->xn_type == XI_TYPE_ELT)
+		break;
+	}
+    }
+
+    nodep = xi_node_addr(xwp, node_atom);
+    if (nodep == NULL || nodep->xn_type != XI_TYPE_ELT)
+	return -1;
+
+    bzero(&xj, sizeof(xj));
+    xj.xej_emitp = emitp;
+    xj.xej_workspace = xwp;
+    xj.xej_type_atom = xi_namepool_atom(xwp, "type", FALSE);
+    xj.xej_name_atom = xi_namepool_atom(xwp, "name", FALSE);
+
+    emitp->xe_flags |= XEF_BORROW;
+    emitp->xe_level = 0;
+
+    type = xi_emit_json_attrib(&xj, nodep, xj.xej_type_atom, "type", &tlen);
+    if (xi_emit_json_is(type, tlen, "array"))
+	flags |= XI_JSON_ARRAY;
+
+    xi_emit_char(emitp, (flags & XI_JSON_ARRAY) ? '[' : '{');
+    xi_emit_json_newline(&xj, TRUE);
+
+    xi_emit_json_children(&xj, nodep, flags);
+
+    xi_emit_json_line(&xj, TRUE);
+    xi_emit_char(emitp, (flags & XI_JSON_ARRAY) ? ']' : '}');
+    xi_emit_char(emitp, '\n');
+
+    return xi_emit_release(emitp);
+}
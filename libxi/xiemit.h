@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * An output engine for xi trees.  Output is gathered in a large,
+ * reused buffer and written with writev(), and long strings that
+ * need no escaping are written straight from the workspace instead
+ * of being copied.  Trees can be written as XML or as JSON, using
+ * the same mapping as slaxJsonWriteDoc().
+ */
+
+#ifndef LIBSLAX_XI_EMIT_H
+#define LIBSLAX_XI_EMIT_H
+
+#include <sys/uio.h>
+
+#define XI_EMIT_BUFSIZ	(256 * 1024) /* Size of the output buffer */
+#define XI_EMIT_IOV	64	/* Max iovecs per writev() */
+#define XI_EMIT_BORROW	512	/* Strings this long aren't copied */
+
+typedef struct xi_emit_s {
+    int xe_fd;			/* File being written */
+    unsigned xe_flags;		/* Flags (XEF_*) */
+    char *xe_buf;		/* Output buffer (XI_EMIT_BUFSIZ bytes) */
+    unsigned xe_len;		/* Bytes used in xe_buf */
+    unsigned xe_mark;		/* Start of xe_buf data not yet in xe_iov */
+    unsigned xe_iovcnt;		/* Number of iovecs in use */
+    unsigned xe_borrowed;	/* Number of iovecs that point outside xe_buf */
+    unsigned xe_level;		/* Indent level (for XEF_PRETTY) */
+    int xe_errno;		/* First write error, or zero */
+    xi_node_type_t xe_last_type; /* Last type seen (by xi_emit_xml_cb) */
+    struct iovec xe_iov[XI_EMIT_IOV]; /* Pending output */
+} xi_emit_t;
+
+/* Flags for xe_flags: */
+#define XEF_PRETTY	(1<<0)	/* Newlines and indentation (JSON only) */
+#define XEF_CLOSE_FD	(1<<1)	/* Close fd in xi_emit_close() */
+#define XEF_BORROW	(1<<2)	/* Strings can be borrowed (internal) */
+
+xi_emit_t *
+xi_emit_open (int fd, unsigned flags);
+
+/*
+ * Flush any buffered output and free the emitter.  Returns -1 if any
+ * write failed.
+ */
+int
+xi_emit_close (xi_emit_t *emitp);
+
+int
+xi_emit_flush (xi_emit_t *emitp);
+
+/*
+ * Write a document (if node_atom is PA_NULL_ATOM) or a single subtree
+ * as XML.  Text that still holds its entities is written as-is;
+ * everything else is escaped.
+ */
+int
+xi_emit_xml (xi_emit_t *emitp, xi_parse_t *parsep, xi_node_id_t node_atom);
+
+/*
+ * The xi_parse_emit_fn beneath xi_emit_xml(), which can also be handed
+ * to xi_parse_set_emit() to write XIA_EMIT subtrees as they're parsed.
+ * The opaque argument is the xi_emit_t.
+ */
+int
+xi_emit_xml_cb (xi_parse_t *parsep, xi_node_type_t type,
+		xi_node_id_t node_atom, xi_node_t *nodep,
+		const char *data, void *opaque);
+
+/*
+ * Write a document's top element (if node_atom is PA_NULL_ATOM) or a
+ * given element as JSON, in the style of slaxJsonWriteDoc()
+ */
+int
+xi_emit_json (xi_emit_t *emitp, xi_parse_t *parsep, xi_node_id_t node_atom);
+
+#endif /* LIBSLAX_XI_EMIT_H */
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Turning an xi tree into a libxml2 document is mostly a matter of
+ * walking the nodes and making the matching xmlNodes.  The one trick
+ * is names: the xi namepool has already interned every element and
+ * attribute name, so we keep a cache mapping name atoms to xmlDict
+ * strings, which means each distinct name is hashed into the
+ * dictionary once, no matter how many times it appears.  Since the
+ * names are owned by the document's dictionary, we can hand them to
+ * the "EatName" flavors of the libxml2 constructors and libxml2 won't
+ * copy (or later free) them.
+ *
+ * It would be nice to bulk-allocate the xmlNodes too, but xmlFreeDoc
+ * frees every node individually with xmlFree, so any node that
+ * didn't come from xmlMalloc would blow up when the document is
+ * freed.  Until libxml2 grows a node allocator hook, we're stuck
+ * with one allocation per node.
+ *
+ * Comments, processing instructions, and the DTD never make it into
+ * an xi tree, so the document we build has none of them; slaxproc's
+ * --libxi-input documents this.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "slaxconfig.h"
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+#include <libxi/xilibxml.h>
+
+#define XI_LIBXML_NAMES_MIN	256 /* Initial size of the name cache */
+
+typedef struct xi_libxml_s {
+    xi_workspace_t *xl_workspace; /* Workspace we're reading */
+    xmlDocPtr xl_docp;		/* Document we're building */
+    xmlDictPtr xl_dict;		/* Dictionary for names */
+    const xmlChar **xl_names;	/* Cache: name atom to dict string */
+    pa_atom_t xl_names_max;	/* Number of slots in xl_names */
+} xi_libxml_t;
+
+/*
+ * Turn a name atom into a dictionary string, using (and filling) the
+ * cache.
+ */
+static const xmlChar *
+xi_libxml_name (xi_libxml_t *xlp, pa_atom_t atom)
+{
+    const xmlChar **names;
+    const char *cp;
+    pa_atom_t max;
+
+    if (atom == PA_NULL_ATOM)
+	return NULL;
+
+    if (atom >= xlp->xl_names_max) {
+	max = xlp->xl_names_max ?: XI_LIBXML_NAMES_MIN;
+	while (max <= atom)
+	    max <<= 1;
+
+	names = realloc(xlp->xl_names, max * sizeof(*names));
+	if (names == NULL)
+	    return NULL;
+
+	bzero(names + xlp->xl_names_max,
+	      (max - xlp->xl_names_max) * sizeof(*names));
+	xlp->xl_names = names;
+	xlp->xl_names_max = max;
+    }
+
+    if (xlp->xl_names[atom] == NULL) {
+	cp = xi_namepool_string(xlp->xl_workspace, atom);
+	if (cp == NULL)
+	    return NULL;
+
+	xlp->xl_names[atom] = xmlDictLookup(xlp->xl_dict,
+					    (const xmlChar *) cp, -1);
+    }
+
+    return xlp->xl_names[atom];
+}
+
+/*
+ * The *EatName() functions take names they could free, but they know
+ * better than to free dictionary strings, which is all we give them.
+ * They just don't declare them const.
+ */
+static inline xmlChar *
+xi_libxml_eat_name (const xmlChar *name)
+{
+    union { const xmlChar *cp; xmlChar *p; } u = { name };
+    return u.p;
+}
+
+/*
+ * Find the in-scope libxml2 namespace for one of our ns_map entries
+ */
+static xmlNsPtr
+xi_libxml_ns (xi_libxml_t *xlp, xmlNodePtr nodep, pa_atom_t ns_atom)
+{
+    xi_ns_map_t *ns_map;
+    const xmlChar *prefix;
+
+    if (ns_atom == PA_NULL_ATOM)
+	return NULL;
+
+    ns_map = xi_ns_map_addr(xlp->xl_workspace, ns_atom);
+    if (ns_map == NULL)
+	return NULL;
+
+    prefix = xi_libxml_name(xlp, ns_map->xnm_prefix);
+    return xmlSearchNs(xlp->xl_docp, nodep, prefix);
+}
+
+/*
+ * Make libxml2 nodes for the children of "pnodep", appending them
+ * to "parent".  Depth is bounded by XI_DEPTH_MAX, so recursion is fine.
+ */
+static int
+xi_libxml_children (xi_libxml_t *xlp, xmlNodePtr parent, xi_node_t *pnodep)
+{
+    xi_workspace_t *xwp = xlp->xl_workspace;
+    xi_ns_map_t *ns_map;
+    xi_node_t *nodep;
+    pa_atom_t atom;
+    xmlNodePtr newp;
+    xmlAttrPtr attrp;
+    const xmlChar *name;
+    const char *cp;
+
+    /*
+     * Namespace definitions come first, since the element itself
+     * (and its attributes) may need them.
+     */
+    if (pnodep->xn_type == XI_TYPE_ELT) {
+	for (atom = pnodep->xn_contents; atom != PA_NULL_ATOM;
+	     atom = nodep->xn_next) {
+	    nodep = xi_node_addr(xwp, atom);
+	    if (nodep == NULL || nodep->xn_depth <= pnodep->xn_depth)
+		break;
+
+	    if (nodep->xn_type != XI_TYPE_NS)
+		continue;
+
+	    ns_map = xi_ns_map_addr(xwp, nodep->xn_contents);
+	    if (ns_map == NULL)
+		continue;
+
+	    xmlNewNs(parent,
+		     (const xmlChar *) xi_namepool_string(xwp,
+							 ns_map->xnm_uri),
+		     xi_libxml_name(xlp, ns_map->xnm_prefix));
+	}
+
+	if (pnodep->xn_ns_map != PA_NULL_ATOM)
+	    xmlSetNs(parent, xi_libxml_ns(xlp, parent, pnodep->xn_ns_map));
+    }
+
+    for (atom = pnodep->xn_contents; atom != PA_NULL_ATOM;
+	 atom = nodep->xn_next) {
+	nodep = xi_node_addr(xwp, atom);
+	if (nodep == NULL || nodep->xn_depth <= pnodep->xn_depth)
+	    break;
+
+	switch (nodep->xn_type) {
+	case XI_TYPE_ELT:
+	    name = xi_libxml_name(xlp, nodep->xn_name);
+	    if (name == NULL)
+		return -1;
+
+	    newp = xmlNewDocNodeEatName(xlp->xl_docp, NULL,
+					xi_libxml_eat_name(name), NULL);
+	    if (newp == NULL)
+		return -1;
+
+	    xmlAddChild(parent, newp);
+	    if (xi_libxml_children(xlp, newp, nodep) < 0)
+		return -1;
+	    break;
+
+	case XI_TYPE_TEXT:
+	case XI_TYPE_UNESC:
+	    /*
+	     * Outside the root element, text can only be whitespace,
+	     * which libxml2 doesn't keep (and doesn't expect).
+	     */
+	    if (pnodep->xn_type == XI_TYPE_ROOT)
+		break;
+
+	    cp = xi_node_string(xwp, nodep);
+	    if (cp == NULL)
+		break;
+
+	    newp = xmlNewDocTextLen(xlp->xl_docp, (const xmlChar *) cp,
+				    strlen(cp));
+	    if (newp == NULL)
+		return -1;
+
+	    xmlAddChild(parent, newp);
+	    break;
+
+	case XI_TYPE_ATTRIB:
+	    name = xi_libxml_name(xlp, nodep->xn_name);
+	    if (name == NULL)
+		return -1;
+
+	    attrp = xmlNewNsPropEatName(parent,
+				xi_libxml_ns(xlp, parent, nodep->xn_ns_map),
+				xi_libxml_eat_name(name),
+				(const xmlChar *) xi_node_string(xwp, nodep));
+	    if (attrp == NULL)
+		return -1;
+	    break;
+
+	case XI_TYPE_ATSTR:
+	    /* Unextracted attributes; parse with XIA_SAVE_ATTRIB instead */
+	    psu_log("xi_libxml: ignoring unextracted attributes: [%s]",
+		    xi_node_stored_string(xwp, nodep));
+	    break;
+
+	case XI_TYPE_NS:	/* Handled above */
+	case XI_TYPE_NSPREF:
+	    break;
+
+	default:
+	    psu_log("xi_libxml: unhandled node type %u", nodep->xn_type);
+	}
+    }
+
+    return 0;
+}
+
+xmlDocPtr
+xi_libxml_build (xi_parse_t *parsep, xmlDictPtr dict)
+{
+    xi_libxml_t xl;
+    xi_node_t *rootp;
+
+    bzero(&xl, sizeof(xl));
+    xl.xl_workspace = xi_parse_workspace(parsep);
+
+    rootp = xi_node_addr(xl.xl_workspace, parsep->xp_insert->xi_tree->xt_root);
+    if (rootp == NULL)
+	return NULL;
+
+    xl.xl_docp = xmlNewDoc((const xmlChar *) XML_DEFAULT_VERSION);
+    if (xl.xl_docp == NULL)
+	return NULL;
+
+    if (dict) {
+	xmlDictReference(dict);
+    } else {
+	dict = xmlDictCreate();
+	if (dict == NULL)
+	    goto fail;
+    }
+
+    xl.xl_docp->dict = xl.xl_dict = dict;
+
+    if (xi_libxml_children(&xl, (xmlNodePtr) xl.xl_docp, rootp) < 0)
+	goto fail;
+
+    free(xl.xl_names);
+    return xl.xl_docp;
+
+ fail:
+    free(xl.xl_names);
+    xmlFreeDoc(xl.xl_docp);
+    return NULL;
+}
+
+xmlDocPtr
+xi_libxml_read_file (const char *filename, xmlDictPtr dict)
+{
+    pa_mmap_t *pmp;
+    xi_workspace_t *xwp;
+    xi_parse_t *parsep;
+    xmlDocPtr docp = NULL;
+
+    /* No file name means an anonymous mapping, which is what we want */
+    pmp = pa_mmap_open(NULL, "xi-input", 0, 0);
+    if (pmp == NULL)
+	return NULL;
+
+    xwp = xi_workspace_open(pmp, "input");
+    if (xwp == NULL)
+	goto done;
+
+    parsep = xi_parse_open(pmp, xwp, "input", filename, 0);
+    if (parsep == NULL)
+	goto done;
+
+    /* libxml2 wants attributes as nodes, so we need them extracted */
+    xi_parse_set_default_rule(parsep, XIA_SAVE_ATTRIB);
+
+    if (xi_parse(parsep) == 0)
+	docp = xi_libxml_build(parsep, dict);
+
+    if (docp)
+	docp->URL = xmlStrdup((const xmlChar *) filename);
+
+    xi_parse_destroy(parsep);
+
+ done:
+    xi_workspace_close(xwp);
+    pa_mmap_close(pmp);
+    return docp;
+}
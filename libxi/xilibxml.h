@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * A bridge from xi trees to libxml2 documents, so the rest of libslax
+ * (which speaks libxml2) can use input parsed by libxi.
+ */
+
+#ifndef LIBSLAX_XI_LIBXML_H
+#define LIBSLAX_XI_LIBXML_H
+
+#include <libxml/tree.h>
+#include <libxml/dict.h>
+
+/*
+ * Build a libxml2 document from a parsed xi tree.  Names are
+ * interned in "dict" (or a fresh dictionary if NULL), which becomes
+ * the document's dictionary.  Pass the dictionary from the
+ * stylesheet to share names with it.
+ */
+xmlDocPtr
+xi_libxml_build (xi_parse_t *parsep, xmlDictPtr dict);
+
+/*
+ * Parse a file with libxi and hand back a libxml2 document.  The xi
+ * workspace is scratch space, discarded before we return.  The xi
+ * parser doesn't keep comments, PIs, or the DTD, so the document
+ * won't have them either.
+ */
+xmlDocPtr
+xi_libxml_read_file (const char *filename, xmlDictPtr dict);
+
+#endif /* LIBSLAX_XI_LIBXML_H */
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Set operations for nodesets.  The chunk chains in the mmap are
+ * fine for appending, but useless for anything else, so we pull the
+ * members out into an array of (preorder number, atom) pairs, do our
+ * work there, and write the results into a fresh nodeset.
+ *
+ * There are two ways to do most things, and we pick based on what
+ * the data looks like:
+ *
+ * - Sorting a dense set (one whose preorder numbers cover a range not
+ *   much larger than the set itself) is a bucket pass over that
+ *   range, which dedups as a side effect.  Sparse sets get qsort().
+ *
+ * - When both sides are already sorted, intersection and difference
+ *   are a linear merge.  Otherwise we turn the right side into a bit
+ *   vector keyed by atom and filter the left side through it, which
+ *   avoids sorting the right side at all.
+ *
+ * pa_bitmap would seem to be the natural home for the bit vector,
+ * but it lives in the mmap and tops out at two million bits, and
+ * these are short-lived scratch sets, so we use a plain malloc'd
+ * vector.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "slaxconfig.h"
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xinodeset.h>
+
+#define XI_NODESET_DENSE	4 /* Dense if range < count * this */
+
+typedef struct xi_nodeset_entry_s {
+    uint32_t xne_pre;		/* Preorder number (document order) */
+    pa_atom_t xne_atom;		/* Node atom */
+} xi_nodeset_entry_t;
+
+typedef struct xi_nodeset_bits_s {
+    uint64_t *xnb_bits;		/* Bit per node atom */
+    pa_atom_t xnb_max;		/* Number of bits */
+} xi_nodeset_bits_t;
+
+/*
+ * Copy the members of a nodeset into an entry array, which the
+ * caller has sized using xi_nodeset_count().  Returns the number
+ * of entries written.
+ */
+static uint32_t
+xi_nodeset_load (xi_nodeset_t *nodeset, xi_nodeset_entry_t *entries)
+{
+    xi_workspace_t *xwp = nodeset->xns_workspace;
+    xi_nodeset_chunk_t *chunkp;
+    xi_nodeset_chunk_id_t id;
+    xi_node_order_t *orderp;
+    pa_atom_t atom;
+    uint32_t i, count = 0;
+
+    for (id = nodeset->xns_first; id != PA_NULL_ATOM; id = chunkp->xnsc_next) {
+	chunkp = xi_nodeset_chunk_addr(nodeset, id);
+	if (chunkp == NULL)
+	    break;
+
+	for (i = 0; i < chunkp->xnsc_count; i++) {
+	    atom = chunkp->xnsc_nodes[i];
+	    orderp = pa_fixed_element_if_exists(xwp->xw_order, atom);
+
+	    entries[count].xne_pre = orderp ? orderp->xno_pre : 0;
+	    entries[count].xne_atom = atom;
+	    count += 1;
+	}
+    }
+
+    return count;
+}
+
+/*
+ * Load a nodeset into a freshly allocated array, returning NULL on
+ * failure.  We always allocate at least one entry, so an empty set
+ * isn't mistaken for a failure.
+ */
+static xi_nodeset_entry_t *
+xi_nodeset_load_alloc (xi_nodeset_t *nodeset, uint32_t extra,
+		       uint32_t *countp)
+{
+    uint32_t count = xi_nodeset_count(nodeset);
+    xi_nodeset_entry_t *entries;
+
+    entries = malloc((count + extra + 1) * sizeof(*entries));
+    if (entries == NULL)
+	return NULL;
+
+    *countp = xi_nodeset_load(nodeset, entries);
+    return entries;
+}
+
+/*
+ * Replace the contents of a nodeset with an entry array
+ */
+static void
+xi_nodeset_store (xi_nodeset_t *nodeset, xi_nodeset_entry_t *entries,
+		  uint32_t count)
+{
+    uint32_t i;
+
+    xi_nodeset_empty(nodeset);
+
+    for (i = 0; i < count; i++)
+	xi_nodeset_add(nodeset, entries[i].xne_atom);
+}
+
+/*
+ * Entries are ordered by preorder number, then by atom.  The atom
+ * only matters for nodes with no order information, which all load
+ * with a preorder number of zero (the root's); comparing atoms keeps
+ * them distinct, rather than letting the dedup collapse them into one.
+ */
+static inline int
+xi_nodeset_entry_cmp (const xi_nodeset_entry_t *lp,
+		      const xi_nodeset_entry_t *rp)
+{
+    if (lp->xne_pre != rp->xne_pre)
+	return (lp->xne_pre < rp->xne_pre) ? -1 : 1;
+
+    return (lp->xne_atom < rp->xne_atom) ? -1
+	: (lp->xne_atom > rp->xne_atom) ? 1 : 0;
+}
+
+static int
+xi_nodeset_entry_compare (const void *left, const void *right)
+{
+    return xi_nodeset_entry_cmp(left, right);
+}
+
+/*
+ * Put entries in document order and drop duplicates, returning the
+ * new count
+ */
+static uint32_t
+xi_nodeset_sort_entries (xi_nodeset_entry_t *entries, uint32_t count)
+{
+    uint32_t i, out, min, max;
+    uint64_t range;
+    pa_atom_t *buckets;
+
+    if (count < 2)
+	return count;
+
+    min = max = entries[0].xne_pre;
+    for (i = 1; i < count; i++) {
+	if (entries[i].xne_pre < min)
+	    min = entries[i].xne_pre;
+	else if (entries[i].xne_pre > max)
+	    max = entries[i].xne_pre;
+    }
+
+    range = (uint64_t) max - min + 1;
+    if (range / XI_NODESET_DENSE < count) {
+	/*
+	 * Dense: drop each node into the bucket for its preorder
+	 * number, then read the buckets back in order.  Two different
+	 * nodes landing in one bucket means the preorder numbers
+	 * can't be trusted, so we leave it to qsort.
+	 */
+	buckets = calloc(range, sizeof(*buckets));
+	if (buckets != NULL) {
+	    for (i = 0; i < count; i++) {
+		pa_atom_t *bp = &buckets[entries[i].xne_pre - min];
+
+		if (*bp != PA_NULL_ATOM && *bp != entries[i].xne_atom)
+		    break;
+		*bp = entries[i].xne_atom;
+	    }
+
+	    if (i < count) {
+		free(buckets);
+		goto sort;
+	    }
+
+	    for (i = 0, out = 0; i < range; i++) {
+		if (buckets[i] == PA_NULL_ATOM)
+		    continue;
+
+		entries[out].xne_pre = min + i;
+		entries[out].xne_atom = buckets[i];
+		out += 1;
+	    }
+
+	    free(buckets);
+	    return out;
+	}
+
+	/* If we can't get the buckets, fall back to sorting */
+    }
+
+ sort:
+    qsort(entries, count, sizeof(*entries), xi_nodeset_entry_compare);
+
+    for (i = 1, out = 1; i < count; i++) {
+	if (xi_nodeset_entry_cmp(&entries[i], &entries[out - 1]) != 0)
+	    entries[out++] = entries[i];
+    }
+
+    return out;
+}
+
+/*
+ * Build a bit vector holding the atoms of the given entries
+ */
+static int
+xi_nodeset_bits_build (xi_nodeset_bits_t *xnbp,
+		       xi_nodeset_entry_t *entries, uint32_t count)
+{
+    pa_atom_t max = 0, atom;
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+	if (entries[i].xne_atom > max)
+	    max = entries[i].xne_atom;
+
+    xnbp->xnb_max = max + 1;
+    xnbp->xnb_bits = calloc((xnbp->xnb_max + 63) / 64, sizeof(uint64_t));
+    if (xnbp->xnb_bits == NULL)
+	return -1;
+
+    for (i = 0; i < count; i++) {
+	atom = entries[i].xne_atom;
+	xnbp->xnb_bits[atom / 64] |= 1ULL << (atom % 64);
+    }
+
+    return 0;
+}
+
+static inline int
+xi_nodeset_bits_test (xi_nodeset_bits_t *xnbp, pa_atom_t atom)
+{
+    if (atom >= xnbp->xnb_max)
+	return FALSE;
+
+    return (xnbp->xnb_bits[atom / 64] & (1ULL << (atom % 64))) != 0;
+}
+
+/*
+ * Make a new nodeset holding the given entries, which must already
+ * be in order
+ */
+static xi_nodeset_t *
+xi_nodeset_from_entries (xi_workspace_t *xwp, xi_nodeset_entry_t *entries,
+			 uint32_t count)
+{
+    xi_nodeset_t *nodeset;
+
+    nodeset = xi_nodeset_alloc(xwp, XI_NSTYPE_NORMAL, 0);
+    if (nodeset != NULL)
+	xi_nodeset_store(nodeset, entries, count);
+
+    return nodeset;
+}
+
+/*
+ * Sort a nodeset into document order, dropping duplicates
+ */
+int
+xi_nodeset_sort (xi_nodeset_t *nodeset)
+{
+    xi_nodeset_entry_t *entries;
+    uint32_t count;
+
+    if (nodeset->xns_flags & XI_NSF_SORTED)
+	return 0;
+
+    entries = xi_nodeset_load_alloc(nodeset, 0, &count);
+    if (entries == NULL)
+	return -1;
+
+    count = xi_nodeset_sort_entries(entries, count);
+    xi_nodeset_store(nodeset, entries, count);
+
+    free(entries);
+    return 0;
+}
+
+xi_nodeset_t *
+xi_nodeset_union (xi_nodeset_t *left, xi_nodeset_t *right)
+{
+    xi_nodeset_entry_t *entries, *rentries = NULL, *merged = NULL;
+    xi_nodeset_t *res = NULL;
+    uint32_t lcount, rcount, count, i, j;
+    int cmp;
+
+    entries = xi_nodeset_load_alloc(left, xi_nodeset_count(right), &lcount);
+    if (entries == NULL)
+	return NULL;
+
+    if ((left->xns_flags & XI_NSF_SORTED)
+	&& (right->xns_flags & XI_NSF_SORTED)) {
+	/* Both in order, so a merge does it */
+	rentries = xi_nodeset_load_alloc(right, 0, &rcount);
+	merged = malloc((lcount + rcount + 1) * sizeof(*merged));
+	if (rentries == NULL || merged == NULL)
+	    goto done;
+
+	for (i = j = count = 0; i < lcount || j < rcount; ) {
+	    cmp = (i == lcount) ? 1 : (j == rcount) ? -1
+		: xi_nodeset_entry_cmp(&entries[i], &rentries[j]);
+
+	    if (cmp < 0)
+		merged[count++] = entries[i++];
+	    else if (cmp > 0)
+		merged[count++] = rentries[j++];
+	    else {
+		merged[count++] = entries[i++]; /* Duplicate; keep one */
+		j += 1;
+	    }
+	}
+
+	res = xi_nodeset_from_entries(left->xns_workspace, merged, count);
+
+    } else {
+	count = lcount + xi_nodeset_load(right, entries + lcount);
+	count = xi_nodeset_sort_entries(entries, count);
+	res = xi_nodeset_from_entries(left->xns_workspace, entries, count);
+    }
+
+ done:
+    free(merged);
+    free(rentries);
+    free(entries);
+    return res;
+}
+
+/*
+ * Intersection and difference differ only in which members of
+ * "left" they keep
+ */
+static xi_nodeset_t *
+xi_nodeset_filter (xi_nodeset_t *left, xi_nodeset_t *right, int keep)
+{
+    xi_nodeset_entry_t *entries, *rentries = NULL;
+    xi_nodeset_bits_t bits = { NULL, 0 };
+    xi_nodeset_t *res = NULL;
+    uint32_t lcount, rcount, i, j, out;
+    int found;
+
+    entries = xi_nodeset_load_alloc(left, 0, &lcount);
+    if (entries == NULL)
+	return NULL;
+
+    if (!(left->xns_flags & XI_NSF_SORTED))
+	lcount = xi_nodeset_sort_entries(entries, lcount);
+
+    rentries = xi_nodeset_load_alloc(right, 0, &rcount);
+    if (rentries == NULL)
+	goto done;
+
+    if (right->xns_flags & XI_NSF_SORTED) {
+	/* Both in order, so walk them together */
+	for (i = j = out = 0; i < lcount; i++) {
+	    while (j < rcount
+		   && xi_nodeset_entry_cmp(&rentries[j], &entries[i]) < 0)
+		j += 1;
+
+	    found = (j < rcount
+		     && xi_nodeset_entry_cmp(&rentries[j], &entries[i]) == 0);
+	    if (found == keep)
+		entries[out++] = entries[i];
+	}
+
+    } else {
+	/* Filter the left side through the right side's bits */
+	if (xi_nodeset_bits_build(&bits, rentries, rcount) < 0)
+	    goto done;
+
+	for (i = out = 0; i < lcount; i++) {
+	    found = xi_nodeset_bits_test(&bits, entries[i].xne_atom);
+	    if (found == keep)
+		entries[out++] = entries[i];
+	}
+    }
+
+    res = xi_nodeset_from_entries(left->xns_workspace, entries, out);
+
+ done:
+    free(bits.xnb_bits);
+    free(rentries);
+    free(entries);
+    return res;
+}
+
+xi_nodeset_t *
+xi_nodeset_intersect (xi_nodeset_t *left, xi_nodeset_t *right)
+{
+    return xi_nodeset_filter(left, right, TRUE);
+}
+
+xi_nodeset_t *
+xi_nodeset_difference (xi_nodeset_t *left, xi_nodeset_t *right)
+{
+    return xi_nodeset_filter(left, right, FALSE);
+}
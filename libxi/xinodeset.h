@@ -42,6 +42,9 @@ typedef struct xi_nodeset_info_s {
 #define XI_NSTYPE_VAR	2	/* Normal variable */
 #define XI_NSTYPE_MVAR	3	/* Mutable variable */
 
+/* Flags for xnsi_flags */
+#define XI_NSF_SORTED	(1<<0)	/* In document order, without duplicates */
+
 /*
  * The chunk is a page of nodes within a listed list.
  */
@@ -80,12 +83,13 @@ typedef struct xi_nodeset_s {
 PA_FIXED_FUNCTIONS(xi_nodeset_chunk_id_t, xi_nodeset_chunk_t, xi_nodeset_t,
 		   xns_workspace->xw_nodeset_chunks,
 		   xi_nodeset_chunk_alloc, xi_nodeset_chunk_free,
-		   xi_nodeset_chunk_addr);
+		   xi_nodeset_chunk_addr, pa_fixed_plain, pa_fixed_plain_is_null);
 
 typedef pa_atom_t xi_nodeset_info_id_t;
 PA_FIXED_FUNCTIONS(xi_nodeset_info_id_t, xi_nodeset_info_t, xi_workspace_t,
 		   xw_nodeset_info, xi_nodeset_info_alloc,
-		   xi_nodeset_info_free, xi_nodeset_info_addr);
+		   xi_nodeset_info_free, xi_nodeset_info_addr,
+		   pa_fixed_plain, pa_fixed_plain_is_null);
 
 /*
  * Create a nodeset in the given workspace with the given type and flags.
@@ -116,7 +120,7 @@ xi_nodeset_alloc (xi_workspace_t *xwp, xi_nodeset_type_t type,
     nodeset->xns_infop = infop;
     nodeset->xns_info_atom = info_atom;
     infop->xnsi_type = type;
-    infop->xnsi_flags = flags;
+    infop->xnsi_flags = flags | XI_NSF_SORTED; /* Empty sets are sorted */
 
     /*
      * We need to reverse the calculation for our chunk size, since
@@ -131,7 +135,10 @@ xi_nodeset_alloc (xi_workspace_t *xwp, xi_nodeset_type_t type,
 }
 
 /*
- * Add a node to a nodeset, allocating a new chunk if needed
+ * Add a node to a nodeset, allocating a new chunk if needed.  Adding
+ * nodes in document order keeps the set "sorted"; anything else means
+ * it'll need an xi_nodeset_sort() before the set operations can use
+ * their fast paths.
  */
 static inline void
 xi_nodeset_add (xi_nodeset_t *nodeset, pa_atom_t node_atom)
@@ -157,6 +164,12 @@ xi_nodeset_add (xi_nodeset_t *nodeset, pa_atom_t node_atom)
 	if (chunkp == NULL)
 	    return;		/* Should not occur */
 
+	if ((nodeset->xns_flags & XI_NSF_SORTED) && chunkp->xnsc_count > 0
+	    && xi_node_compare(nodeset->xns_workspace,
+			       chunkp->xnsc_nodes[chunkp->xnsc_count - 1],
+			       node_atom) >= 0)
+	    nodeset->xns_flags &= ~XI_NSF_SORTED;
+
 	if (chunkp->xnsc_count == nodeset->xns_infop->xnsi_chunk_size) {
 	    /* Full house; make a new chunk */
 	    xi_nodeset_chunk_t *newp = xi_nodeset_chunk_alloc(nodeset, &atom);
@@ -175,20 +188,40 @@ xi_nodeset_add (xi_nodeset_t *nodeset, pa_atom_t node_atom)
 }
 
 /*
- * Free a nodeset, releasing any resources it holds
+ * Return the number of members in a nodeset
  */
-static inline void
-xi_nodeset_free (xi_nodeset_t *nodeset)
+static inline uint32_t
+xi_nodeset_count (xi_nodeset_t *nodeset)
 {
+    xi_nodeset_chunk_t *chunkp;
+    xi_nodeset_chunk_id_t id;
+    uint32_t count = 0;
+
     if (nodeset == NULL)
-	return;
+	return 0;
 
-    xi_workspace_t *xwp = nodeset->xns_workspace;
+    for (id = nodeset->xns_first; id != PA_NULL_ATOM; id = chunkp->xnsc_next) {
+	chunkp = xi_nodeset_chunk_addr(nodeset, id);
+	if (chunkp == NULL)
+	    break;
+	count += chunkp->xnsc_count;
+    }
+
+    return count;
+}
+
+/*
+ * Empty a nodeset, freeing its chunks but keeping the nodeset itself
+ */
+static inline void
+xi_nodeset_empty (xi_nodeset_t *nodeset)
+{
     xi_nodeset_chunk_t *chunkp;
     xi_nodeset_chunk_id_t id, last_id;
 
     id = nodeset->xns_first;
-    nodeset->xns_first = PA_NULL_ATOM;
+    nodeset->xns_first = nodeset->xns_last = PA_NULL_ATOM;
+    nodeset->xns_flags |= XI_NSF_SORTED;
 
     /* Free all the chunks inside this nodeset */
     for (chunkp = xi_nodeset_chunk_addr(nodeset, id); chunkp;
@@ -199,6 +232,21 @@ xi_nodeset_free (xi_nodeset_t *nodeset)
 	if (id == PA_NULL_ATOM)
 	    break;
     }
+}
+
+/*
+ * Free a nodeset, releasing any resources it holds
+ */
+static inline void
+xi_nodeset_free (xi_nodeset_t *nodeset)
+{
+    if (nodeset == NULL)
+	return;
+
+    xi_workspace_t *xwp = nodeset->xns_workspace;
+
+    /* Free all the chunks inside this nodeset */
+    xi_nodeset_empty(nodeset);
 
     /* Free the info and user-space pieces */
     xi_nodeset_info_free(xwp, nodeset->xns_info_atom);
@@ -215,17 +263,35 @@ xi_nodeset_dump (xi_nodeset_t *nodeset)
     xi_nodeset_chunk_id_t id = nodeset->xns_first;
     uint32_t j;
 
-    slaxLog("nodeset dump for %u: [%u:%u]",
+    psu_log("nodeset dump for %u: [%u:%u]",
 	    nodeset->xns_info_atom, nodeset->xns_first, nodeset->xns_last);
 
     /* Visit all the chunks inside this nodeset */
     for (chunkp = xi_nodeset_chunk_addr(nodeset, id); chunkp;
 	 chunkp = xi_nodeset_chunk_addr(nodeset, id)) {
-	slaxLog("  nodeset chunk %u: (%d)", id, chunkp->xnsc_count);
+	psu_log("  nodeset chunk %u: (%d)", id, chunkp->xnsc_count);
 	for (j = 0; j < chunkp->xnsc_count; j++)
-	    slaxLog("    member %u", chunkp->xnsc_nodes[j]);
+	    psu_log("    member %u", chunkp->xnsc_nodes[j]);
 	id = chunkp->xnsc_next; /* Fetch before free */
     }
 }
 
+/*
+ * Set operations (in xinodeset.c).  Document order comes from the
+ * preorder numbers in xw_order, so all members should come from the
+ * same tree.  The results are new, sorted nodesets, which the caller
+ * must free.
+ */
+int
+xi_nodeset_sort (xi_nodeset_t *nodeset);
+
+xi_nodeset_t *
+xi_nodeset_union (xi_nodeset_t *left, xi_nodeset_t *right);
+
+xi_nodeset_t *
+xi_nodeset_intersect (xi_nodeset_t *left, xi_nodeset_t *right);
+
+xi_nodeset_t *
+xi_nodeset_difference (xi_nodeset_t *left, xi_nodeset_t *right);
+
 #endif /* LIBSLAX_XI_NODESET_H */
@@ -29,8 +29,9 @@
 #include <limits.h>
 
 #include "slaxconfig.h"
-#include <libslax/slaxdef.h>
-#include <libslax/slax.h>
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <libpsu/psutime.h>
 #include <parrotdb/pacommon.h>
 #include <parrotdb/paconfig.h>
 #include <parrotdb/pammap.h>
@@ -46,11 +47,16 @@
 #include <libxi/xiworkspace.h>
 #include <libxi/xiparse.h>
 
-xi_parse_t *
-xi_parse_open (pa_mmap_t *pmp, xi_workspace_t *workp, const char *name,
-	       const char *input, xi_source_flags_t flags)
+/*
+ * Build the parse handle around a source (which may be NULL when we're
+ * only attaching to a tree that's already been parsed).  If "attach"
+ * is set, we reuse the existing tree header and root node instead of
+ * making a new root.
+ */
+static xi_parse_t *
+xi_parse_create (pa_mmap_t *pmp, xi_workspace_t *workp, const char *name,
+		 xi_source_t *srcp, xi_boolean_t attach)
 {
-    xi_source_t *srcp = NULL;
     xi_parse_t *parsep = NULL;
     xi_insert_t *xip = NULL;
     xi_tree_t *xtp = NULL;
@@ -58,23 +64,25 @@ xi_parse_open (pa_mmap_t *pmp, xi_workspace_t *workp, const char *name,
     pa_atom_t node_atom;
     char namebuf[PA_MMAP_HEADER_NAME_LEN];
 
-    /*
-     * XXX okay, so this is crap, just a bunch of initialization that
-     * needs to be broken out in distinct functions.
-     */
-
-    srcp = xi_source_open(input, flags);
-    if (srcp == NULL)
-	goto fail;
-
     /* The xi_tree_t is the tree we'll be inserting into */
     xtp = calloc(1, sizeof(*xtp));
     if (xtp == NULL)
 	goto fail;
 
-    xtp->xt_infop = pa_mmap_header(pmp, xi_mk_name(namebuf, name, "tree"),
-				   PA_TYPE_TREE, 0, sizeof(*xtp->xt_infop));
-    xtp->xt_max_depth = 0;
+    xi_mk_name(namebuf, name, "tree");
+    if (attach) {
+	/* A zero size means "only if it's already there" */
+	xtp->xt_infop = pa_mmap_header(pmp, namebuf, PA_TYPE_TREE, 0, 0);
+	if (xtp->xt_infop == NULL || xtp->xt_root == PA_NULL_ATOM)
+	    goto fail;
+    } else {
+	xtp->xt_infop = pa_mmap_header(pmp, namebuf, PA_TYPE_TREE, 0,
+				       sizeof(*xtp->xt_infop));
+	if (xtp->xt_infop == NULL)
+	    goto fail;
+	xtp->xt_max_depth = 0;
+	xtp->xt_flags = 0;
+    }
     xtp->xt_workspace = workp;
 
     /* The xi_insert_t is the point in the tree at which we are inserting */
@@ -96,17 +104,28 @@ xi_parse_open (pa_mmap_t *pmp, xi_workspace_t *workp, const char *name,
     parsep->xp_default_rule.xr_flags = XRF_MATCH_ALL;
     parsep->xp_default_rule.xr_action = XIA_SAVE;
 
-    nodep = xi_node_alloc(workp, &node_atom);
-    if (nodep == NULL)
-	goto fail;
-    nodep->xn_type = XI_TYPE_ROOT;
-    nodep->xn_depth = 0;
-    nodep->xn_ns_map = PA_NULL_ATOM;
-    nodep->xn_name = PA_NULL_ATOM;
-    nodep->xn_next = PA_NULL_ATOM;
-    nodep->xn_contents = PA_NULL_ATOM;
+    if (attach) {
+	node_atom = xtp->xt_root;
+	nodep = xi_node_addr(workp, node_atom);
+	if (nodep == NULL)
+	    goto fail;
+    } else {
+	nodep = xi_node_alloc(workp, &node_atom);
+	if (nodep == NULL)
+	    goto fail;
+	XI_WORKSPACE_STAT(workp, xws_nodes, 1);
+	nodep->xn_type = XI_TYPE_ROOT;
+	nodep->xn_depth = 0;
+	nodep->xn_ns_map = PA_NULL_ATOM;
+	nodep->xn_name = PA_NULL_ATOM;
+	nodep->xn_next = PA_NULL_ATOM;
+	nodep->xn_contents = PA_NULL_ATOM;
+
+	xtp->xt_root = node_atom;
+	xtp->xt_next_pre = 0;
+	xi_node_order_set(workp, node_atom, 0, 0);
+    }
 
-    xtp->xt_root = node_atom;
     xip->xi_stack[xip->xi_depth].xs_atom = node_atom;
     xip->xi_stack[xip->xi_depth].xs_node = nodep;
 
@@ -119,15 +138,59 @@ xi_parse_open (pa_mmap_t *pmp, xi_workspace_t *workp, const char *name,
 	free(xtp);
     if (parsep)
 	free(parsep);
-    if (srcp)
-	xi_source_destroy(srcp);
     return NULL;
 }
 
+xi_parse_t *
+xi_parse_open (pa_mmap_t *pmp, xi_workspace_t *workp, const char *name,
+	       const char *input, xi_source_flags_t flags)
+{
+    xi_source_t *srcp;
+    xi_parse_t *parsep;
+
+    srcp = xi_source_open(input, flags);
+    if (srcp == NULL)
+	return NULL;
+
+    parsep = xi_parse_create(pmp, workp, name, srcp, FALSE);
+    if (parsep == NULL)
+	xi_source_destroy(srcp);
+
+    return parsep;
+}
+
+/*
+ * Attach to a tree that was parsed earlier (into a persistent
+ * database), without any input source.  The resulting handle can be
+ * dumped, emitted, and walked, but xi_parse() has nothing to read.
+ */
+xi_parse_t *
+xi_parse_attach (pa_mmap_t *pmp, xi_workspace_t *workp, const char *name)
+{
+    return xi_parse_create(pmp, workp, name, NULL, TRUE);
+}
+
+/*
+ * Release a parser and its source.  The tree stays in the workspace
+ * (and its header in the database), so xi_parse_attach() can find it.
+ */
 void
-xi_parse_destroy (xi_parse_t *parsep UNUSED)
+xi_parse_destroy (xi_parse_t *parsep)
 {
-    return;
+    if (parsep == NULL)
+	return;
+
+    xi_parse_stats_disable(parsep);
+
+    if (parsep->xp_srcp)
+	xi_source_destroy(parsep->xp_srcp);
+
+    if (parsep->xp_insert) {
+	free(parsep->xp_insert->xi_tree);
+	free(parsep->xp_insert);
+    }
+
+    free(parsep);
 }
 
 pa_atom_t
@@ -152,6 +215,22 @@ xi_insert_push (xi_insert_t *xip, pa_atom_t atom, xi_node_t *nodep)
     xip->xi_stack[xip->xi_depth].xs_atom = atom;
     xip->xi_stack[xip->xi_depth].xs_node = nodep;
     xip->xi_stack[xip->xi_depth].xs_statep = statep;
+
+    /* Until we see a namespace declaration, we're in our parent's scope */
+    xip->xi_stack[xip->xi_depth].xs_ns_scope
+	= xip->xi_stack[xip->xi_depth - 1].xs_ns_scope;
+}
+
+/*
+ * Give a new node the next preorder number.  Its end is its own
+ * number until (if it's an element) it closes.
+ */
+static inline void
+xi_insert_order (xi_insert_t *xip, pa_atom_t node_atom)
+{
+    uint32_t pre = ++xip->xi_tree->xt_next_pre;
+
+    xi_node_order_set(xip->xi_tree->xt_workspace, node_atom, pre, pre);
 }
 
 static void
@@ -175,13 +254,16 @@ xi_insert_node (xi_insert_t *xip, const char *msg,
     if (nodep == NULL)
 	return PA_NULL_ATOM;
 
-    /* Initialize our fields */
+    XI_WORKSPACE_STAT(xip->xi_tree->xt_workspace, xws_nodes, 1);
+
+    /* Initialize our fields; recycled nodes still hold their old flags */
     nodep->xn_type = type;
+    nodep->xn_flags = 0;
     nodep->xn_ns_map = PA_NULL_ATOM;
     nodep->xn_name = name_atom;
     nodep->xn_contents = contents;
 
-    slaxLog("%s: [%.*s] %u / %u (depth %u)", msg, len, data,
+    psu_log("%s: [%.*s] %u / %u (depth %u)", msg, len, data,
 	    name_atom, contents, xip->xi_depth + 1);
 
     /*
@@ -212,6 +294,15 @@ xi_insert_node (xi_insert_t *xip, const char *msg,
     if (nodep->xn_depth > xip->xi_maxdepth)
 	xip->xi_maxdepth = nodep->xn_depth;
 
+    xi_insert_order(xip, node_atom);
+
+    /*
+     * Emitted subtrees are recycled as soon as they close, so their
+     * elements stay out of the name index.
+     */
+    if (type == XI_TYPE_ELT && xip->xi_emit_depth == 0)
+	xi_name_index_add(xip->xi_tree->xt_workspace, name_atom, node_atom);
+
     return node_atom;
 }
 
@@ -230,23 +321,28 @@ xi_insert_ns_node (xi_insert_t *xip, const char *msg,
     if (nodep == NULL)
 	return NULL;
 
-    /* Initialize our fields */
+    XI_WORKSPACE_STAT(xip->xi_tree->xt_workspace, xws_nodes, 1);
+
+    /* Initialize our fields; recycled nodes still hold their old flags */
     nodep->xn_type = type;
+    nodep->xn_flags = 0;
     nodep->xn_ns_map = PA_NULL_ATOM;
     nodep->xn_name = name_atom;
     nodep->xn_contents = contents;
 
-    slaxLog("%s: [%.*s] %u / %u (depth %u)", msg, len, data,
+    psu_log("%s: [%.*s] %u / %u (depth %u)", msg, len, data,
 	    name_atom, contents, xip->xi_depth + 1);
 
     nodep->xn_next = (*lastp == PA_NULL_ATOM) ? parent_atom : *lastp;
     *lastp = node_atom;
     lastp = &nodep->xn_next;
 
-    /* Mark the "last" as us */
-    xi_istack_t *xsp = &xip->xi_stack[xip->xi_depth];
-    xsp->xs_last_atom = node_atom;
-    xsp->xs_last_node = nodep;
+    /* If nothing follows us, we're the "last" */
+    if (nodep->xn_next == parent_atom) {
+	xi_istack_t *xsp = &xip->xi_stack[xip->xi_depth];
+	xsp->xs_last_atom = node_atom;
+	xsp->xs_last_node = nodep;
+    }
 
     /* Set our depth */
     nodep->xn_depth = xip->xi_depth + 1;
@@ -255,6 +351,12 @@ xi_insert_ns_node (xi_insert_t *xip, const char *msg,
     if (nodep->xn_depth > xip->xi_maxdepth)
 	xip->xi_maxdepth = nodep->xn_depth;
 
+    /*
+     * Namespace nodes are spliced in ahead of their siblings, so
+     * their numbers are out of order, but still inside the parent.
+     */
+    xi_insert_order(xip, node_atom);
+
     return lastp;
 }
 
@@ -287,7 +389,7 @@ xi_node_parent (xi_workspace_t *xwp, xi_node_t *nodep)
  * we're done.
  */
 static pa_atom_t
-xi_parse_find_ns_atom (xi_parse_t *parsep, xi_node_t *nodep,
+xi_parse_find_ns_walk (xi_parse_t *parsep, xi_node_t *nodep,
 		       pa_atom_t pref_atom)
 {
     xi_workspace_t *xwp = parsep->xp_insert->xi_tree->xt_workspace;
@@ -310,6 +412,48 @@ xi_parse_find_ns_atom (xi_parse_t *parsep, xi_node_t *nodep,
     return PA_NULL_ATOM;
 }
 
+/*
+ * Find the namespace mapping for a prefix.  Nearly every lookup is
+ * for the node on top of the insertion stack, so we can use the
+ * scope cache (see xi_ns_cache_t), and only walk the tree when the
+ * prefix hasn't been used in the current scope yet.
+ */
+static pa_atom_t
+xi_parse_find_ns_atom (xi_parse_t *parsep, xi_node_t *nodep,
+		       pa_atom_t pref_atom)
+{
+    xi_insert_t *xip = parsep->xp_insert;
+    xi_istack_t *xsp = &xip->xi_stack[xip->xi_depth];
+    xi_ns_cache_t *ncp;
+    uint64_t scope;
+    pa_atom_t ns_atom;
+
+    if (xsp->xs_node != nodep)
+	return xi_parse_find_ns_walk(parsep, nodep, pref_atom);
+
+    scope = xsp->xs_ns_scope;
+    ncp = &parsep->xp_ns_cache[(scope * 31 + pref_atom)
+			       & (XI_NS_CACHE_SIZE - 1)];
+    if (ncp->xnc_ns_map != PA_NULL_ATOM && ncp->xnc_scope == scope
+	&& ncp->xnc_prefix == pref_atom) {
+	if (parsep->xp_stats)
+	    parsep->xp_stats->xst_ns_hits += 1;
+	return ncp->xnc_ns_map;
+    }
+
+    if (parsep->xp_stats)
+	parsep->xp_stats->xst_ns_misses += 1;
+
+    ns_atom = xi_parse_find_ns_walk(parsep, nodep, pref_atom);
+    if (ns_atom != PA_NULL_ATOM) {
+	ncp->xnc_scope = scope;
+	ncp->xnc_prefix = pref_atom;
+	ncp->xnc_ns_map = ns_atom;
+    }
+
+    return ns_atom;
+}
+
 /*
  * Find a namespace mapping for the given prefix and return it.  We are
  * forced to search upward thru the hierarchy to find the mapping, which
@@ -349,24 +493,49 @@ xi_parse_is_attrib (xi_node_type_t type)
     return FALSE;
 }
 
+/*
+ * Intern a short value, if the workspace wants that.  Values with
+ * entities are decoded in place later, so they can't be shared.
+ * Returns PA_NULL_ATOM if the value should go to the textpool.
+ */
+static pa_atom_t
+xi_insert_intern (xi_workspace_t *xwp, const char *data, size_t len,
+		  xi_boolean_t escaped)
+{
+    pa_atom_t atom;
+
+    if (!(xwp->xw_flags & XWF_INTERN_TEXT) || len > XI_INTERN_MAX || escaped)
+	return PA_NULL_ATOM;
+
+    atom = xi_valuepool_atom(xwp, data, len);
+    if (atom != PA_NULL_ATOM)
+	XI_WORKSPACE_STAT(xwp, xws_interned, 1);
+
+    return atom;
+}
+
 static void
 xi_insert_attribs (xi_parse_t *parsep, xi_node_t *nodep, const char *data)
 {
     xi_insert_t *xip = parsep->xp_insert;
     pa_arb_t *prp = xip->xi_tree->xt_workspace->xw_textpool;
     size_t len = strlen(data);
-    pa_atom_t data_atom = pa_arb_alloc(prp, len + 1);
+    pa_arb_atom_t data_atom = pa_arb_alloc(prp, len + 1);
     char *cp = pa_arb_atom_addr(prp, data_atom);
 
     if (cp == NULL)
 	return;
 
+    XI_WORKSPACE_STAT(xip->xi_tree->xt_workspace, xws_text, 1);
+    XI_WORKSPACE_STAT(xip->xi_tree->xt_workspace, xws_text_bytes, len + 1);
+
     memcpy(cp, data, len);
     cp[len] = '\0';
 
     pa_atom_t node_atom;
     node_atom = xi_insert_node(xip, "xi_insert_attribs", data, len,
-			       XI_TYPE_ATSTR, PA_NULL_ATOM, data_atom);
+			       XI_TYPE_ATSTR, PA_NULL_ATOM,
+			       pa_arb_atom_of(data_atom));
     if (node_atom == PA_NULL_ATOM) {
 	pa_arb_free_atom(prp, data_atom);
 	return;
@@ -477,6 +646,7 @@ xi_insert_attribs_extract (xi_parse_t *parsep, pa_atom_t node_atom,
     size_t namelen, valuelen;
     pa_atom_t name_atom, value_atom, attrib_atom, stash_atom;
     int hit = FALSE;
+    xi_boolean_t escaped, interned;
     const char *msg;
     pa_atom_t *last_nsp = &nodep->xn_contents; /* XXX For freshly made node */
 
@@ -525,12 +695,15 @@ xi_insert_attribs_extract (xi_parse_t *parsep, pa_atom_t node_atom,
 					 name, name ? strlen(name) : 0,
 					 node_atom, last_nsp,
 					 XI_TYPE_NS, PA_NULL_ATOM, ns_atom);
-	    if (last_nsp == PA_NULL_ATOM) {
+	    if (last_nsp == NULL) {
 		xi_source_failure(parsep->xp_srcp, 0,
 				  "attribute insert (ns) failed");
 		break;
 	    }
 
+	    /* New declarations mean a new scope for prefix lookups */
+	    xip->xi_stack[xip->xi_depth].xs_ns_scope = ++parsep->xp_ns_scope;
+
 	} else if (only_ns) {
 	    continue;		/* Skip other attributes */
 
@@ -553,9 +726,17 @@ xi_insert_attribs_extract (xi_parse_t *parsep, pa_atom_t node_atom,
 	    if (name_atom == PA_NULL_ATOM)
 		break;
 
-	    value_atom = pa_arb_alloc_string(prp, value);
-	    if (value_atom == PA_NULL_ATOM)
-		break;
+	    escaped = (strchr(value, '&') != NULL);
+	    value_atom = xi_insert_intern(xwp, value, valuelen, escaped);
+	    interned = (value_atom != PA_NULL_ATOM);
+	    if (!interned) {
+		value_atom = pa_arb_atom_of(pa_arb_alloc_string(prp, value));
+		if (value_atom == PA_NULL_ATOM)
+		    break;
+
+		XI_WORKSPACE_STAT(xwp, xws_text, 1);
+		XI_WORKSPACE_STAT(xwp, xws_text_bytes, valuelen + 1);
+	    }
 
 	    attrib_atom = xi_insert_node(xip, "xi_insert_attribs_extract",
 				 name, strlen(name),
@@ -563,10 +744,20 @@ xi_insert_attribs_extract (xi_parse_t *parsep, pa_atom_t node_atom,
 	    if (attrib_atom == PA_NULL_ATOM) {
 		xi_source_failure(parsep->xp_srcp, 0,
 				  "attribute insert failed");
-		pa_arb_free_atom(prp, value_atom);
+		if (!interned)
+		    pa_arb_free_atom(prp, pa_arb_atom(value_atom));
 		break;
 	    }
 
+	    /* Like text, values are decoded lazily, if at all */
+	    xi_node_t *attribp = xi_node_addr(xwp, attrib_atom);
+	    if (attribp) {
+		if (escaped)
+		    attribp->xn_flags |= XNF_ESCAPED;
+		if (interned)
+		    attribp->xn_flags |= XNF_INTERNED;
+	    }
+
 	    if (pref_atom != PA_NULL_ATOM) {
 		/*
 		 * We have to stash our prefix atom in a special
@@ -582,7 +773,8 @@ xi_insert_attribs_extract (xi_parse_t *parsep, pa_atom_t node_atom,
 		if (stash_atom == PA_NULL_ATOM) {
 		    xi_source_failure(parsep->xp_srcp, 0,
 				      "attribute (stash) insert failed");
-		    pa_arb_free_atom(prp, value_atom);
+		    if (!interned)
+			pa_arb_free_atom(prp, pa_arb_atom(value_atom));
 		    break;
 		}
 	    }
@@ -598,15 +790,19 @@ xi_insert_attribs_extract (xi_parse_t *parsep, pa_atom_t node_atom,
      * finish that off, finding the real mapping and recording it,
      * discarding the NSPREF node.
      */
+    xi_istack_t *xsp = &xip->xi_stack[xip->xi_depth];
     xi_node_t *childp, *prev = NULL;
-    pa_atom_t ns_atom;
+    pa_atom_t ns_atom, child_atom, prev_atom = PA_NULL_ATOM;
 
-    for (childp = xi_node_addr(xwp, nodep->xn_contents); childp;
-	 childp = xi_node_addr(xwp, childp->xn_next)) {
-	if (nodep->xn_type == XI_TYPE_NS) {
+    for (child_atom = nodep->xn_contents;
+	 child_atom != node_atom
+	     && (childp = xi_node_addr(xwp, child_atom)) != NULL;
+	 child_atom = childp->xn_next) {
+	if (childp->xn_type == XI_TYPE_NS) {
 	    /* Skip namespace defs */
 
-	} else if (!xi_parse_is_attrib(nodep->xn_type)) {
+	} else if (!xi_parse_is_attrib(childp->xn_type)
+		   && childp->xn_type != XI_TYPE_NSPREF) {
 	    break;		/* End of attributes == done */
 
 	} else if (prev == NULL) {
@@ -621,20 +817,29 @@ xi_insert_attribs_extract (xi_parse_t *parsep, pa_atom_t node_atom,
 	    ns_atom = xi_parse_find_ns_atom(parsep, nodep, childp->xn_contents);
 	    if (ns_atom == PA_NULL_ATOM) {
 		const char *prefix = xi_namepool_string(xwp, childp->xn_contents);
+		const char *local = xi_namepool_string(xwp, prev->xn_name);
 		xi_source_failure(parsep->xp_srcp, 0,
 				  "namespace mapping not found for %s:%s",
-				  prefix ?: "", name);
+				  prefix ?: "", local ?: "");
 	    }
 
 	    /* Set the namespace mapping */
 	    prev->xn_ns_map = ns_atom; /* Assign mapping */
 	    prev->xn_next = childp->xn_next; /* Remove node from list */
 
-	    xi_node_free(xwp, prev->xn_next); /* Free node */
+	    /* If the stash was the last child, its predecessor is now */
+	    if (xsp->xs_last_atom == child_atom) {
+		xsp->xs_last_atom = prev_atom;
+		xsp->xs_last_node = prev;
+	    }
+
+	    xi_node_free(xwp, child_atom); /* Free node */
 	    childp = prev;		   /* childp is dead; resume logic */
+	    child_atom = prev_atom;
 	}
 
 	prev = childp;
+	prev_atom = child_atom;
     }
 
     /* Mark the attributes as present and extracted */
@@ -652,6 +857,9 @@ xi_insert_open (xi_parse_t *parsep, pa_atom_t name_atom,
     if (name_atom == PA_NULL_ATOM)
 	return;
 
+    /* Remember our predecessor, in case we need to unlink ourselves */
+    pa_atom_t prev_atom = xip->xi_stack[xip->xi_depth].xs_last_atom;
+
     pa_atom_t node_atom;
     node_atom = xi_insert_node(xip, "xi_insert_open",
 			       name, strlen(name),
@@ -663,6 +871,7 @@ xi_insert_open (xi_parse_t *parsep, pa_atom_t name_atom,
 
     /* Push our node on the stack */
     xi_insert_push(xip, node_atom, nodep);
+    xip->xi_stack[xip->xi_depth].xs_prev_atom = prev_atom;
 
     if (attribs) {
 	enum { SAVE_NONE, SAVE_NS, SAVE_STRING, SAVE_FULL } save = SAVE_NONE;
@@ -706,6 +915,9 @@ xi_insert_open (xi_parse_t *parsep, pa_atom_t name_atom,
     }
 }
 
+static void
+xi_parse_emit_release (xi_parse_t *parsep);
+
 static void
 xi_insert_close (xi_parse_t *parsep, const char *prefix UNUSED, const char *name)
 {
@@ -714,7 +926,7 @@ xi_insert_close (xi_parse_t *parsep, const char *prefix UNUSED, const char *name
 
     name_atom = xi_namepool_atom(xip->xi_tree->xt_workspace, name, FALSE);
     
-    slaxLog("xi_insert_close: [%s] %u (depth %u)", name, name_atom,
+    psu_log("xi_insert_close: [%s] %u (depth %u)", name, name_atom,
 	   xip->xi_depth);
 
     if (name_atom == PA_NULL_ATOM) {
@@ -739,43 +951,82 @@ xi_insert_close (xi_parse_t *parsep, const char *prefix UNUSED, const char *name
 	return;
     }
 
+    /* Our subtree is complete, so we know where it ends */
+    xi_node_order_t *orderp = xi_node_order(xip->xi_tree->xt_workspace,
+					    xsp->xs_atom);
+    if (orderp)
+	orderp->xno_end = xip->xi_tree->xt_next_pre;
+
+    /* A finished XIA_EMIT subtree gets handed off and recycled */
+    if (xsp->xs_action == XIA_EMIT && parsep->xp_emit_func) {
+	xi_parse_emit_release(parsep);
+	if (xip->xi_emit_depth == xip->xi_depth)
+	    xip->xi_emit_depth = 0;
+    }
+
     bzero(xsp, sizeof(*xsp));
     xi_insert_pop(xip);
 }
 
 static void
 xi_insert_text (xi_parse_t *parsep, const char *data, size_t len,
-		xi_node_type_t type)
+		xi_node_type_t type, xi_boolean_t raw)
 {
     xi_insert_t *xip = parsep->xp_insert;
-    pa_arb_t *prp = xip->xi_tree->xt_workspace->xw_textpool;
-    pa_atom_t data_atom = pa_arb_alloc(prp, len + 1);
+    xi_workspace_t *xwp = xip->xi_tree->xt_workspace;
+    xi_boolean_t escaped = (raw && memchr(data, '&', len) != NULL);
+    pa_atom_t node_atom, value_atom;
+
+    value_atom = xi_insert_intern(xwp, data, len, escaped);
+    if (value_atom != PA_NULL_ATOM) {
+	node_atom = xi_insert_node(xip, "xi_insert_text (interned)", data, len,
+				   type, PA_NULL_ATOM, value_atom);
+	if (node_atom != PA_NULL_ATOM)
+	    xip->xi_stack[xip->xi_depth].xs_last_node->xn_flags
+		|= XNF_INTERNED;
+	return;
+    }
+
+    pa_arb_t *prp = xwp->xw_textpool;
+    pa_arb_atom_t data_atom = pa_arb_alloc(prp, len + 1);
     char *cp = pa_arb_atom_addr(prp, data_atom);
 
     if (cp == NULL)
 	return;
 
+    XI_WORKSPACE_STAT(xwp, xws_text, 1);
+    XI_WORKSPACE_STAT(xwp, xws_text_bytes, len + 1);
+
     memcpy(cp, data, len);
     cp[len] = '\0';
 
-    pa_atom_t node_atom;
     node_atom = xi_insert_node(xip, "xi_insert_text", data, len,
-			       type, PA_NULL_ATOM, data_atom);
+			       type, PA_NULL_ATOM, pa_arb_atom_of(data_atom));
     if (node_atom == PA_NULL_ATOM) {
 	pa_arb_free_atom(prp, data_atom);
 	return;
     }
+
+    /* No '&' means nothing to decode, now or later */
+    if (escaped)
+	xip->xi_stack[xip->xi_depth].xs_last_node->xn_flags |= XNF_ESCAPED;
 }
 
-static void
+/*
+ * Perform the action for a rule, returning TRUE if we pushed a
+ * new node onto the insertion stack (which the caller will need to
+ * close for an empty tag).
+ */
+static xi_boolean_t
 xi_parse_handle_rule (xi_parse_t *parsep, pa_atom_t name_atom,
 		      const char *prefix UNUSED, const char *name,
-		      char *attribs, xi_rule_t *xrp)
+		      char *attribs, xi_rule_t *xrp, xi_boolean_t empty)
 {
     xi_insert_t *xip = parsep->xp_insert;
     xi_action_type_t act = xrp->xr_action;
     pa_atom_t use_tag = xrp->xr_use_tag;
     pa_atom_t save_name_atom = name_atom;
+    xi_depth_t depth = xip->xi_depth;
 
     /* Use a different tag is directed */
     if (use_tag)
@@ -789,62 +1040,192 @@ xi_parse_handle_rule (xi_parse_t *parsep, pa_atom_t name_atom,
 	break;
 
     case XIA_EMIT:
-    case XIA_DISCARD:
-	/* XXX */
+	/*
+	 * Build the subtree like any other, but with full attributes,
+	 * since the emit callback will want them.  When it closes,
+	 * xi_insert_close() hands it off and frees it.
+	 */
+	if (parsep->xp_emit_func && parsep->xp_insert->xi_emit_depth == 0)
+	    parsep->xp_insert->xi_emit_depth = parsep->xp_insert->xi_depth + 1;
+
+	xi_insert_open(parsep, name_atom, prefix, name, attribs,
+		       XIA_SAVE_ATTRIB);
 	break;
+
+    case XIA_DISCARD:
+	/*
+	 * Skip the whole subtree; xi_parse() will drop tokens until
+	 * the matching close tag.  An empty tag has no subtree.
+	 */
+	if (!empty)
+	    parsep->xp_discard_depth = 1;
+	return FALSE;
+
+    default:
+	return FALSE;
     }
 
-    if (use_tag) {
-	xi_istack_t *xsp = &xip->xi_stack[xip->xi_depth];
+    if (xip->xi_depth == depth)
+	return FALSE;		/* Insert failed; nothing was pushed */
+
+    xi_istack_t *xsp = &xip->xi_stack[xip->xi_depth];
+    xsp->xs_action = act;
+
+    if (use_tag)
 	xsp->xs_old_name = save_name_atom;
+
+    /* Move to the new state, if the rule gives one */
+    if (xrp->xr_new_state != XI_STATE_EOL && parsep->xp_rulebook)
+	xsp->xs_statep = xi_rulebook_state(parsep->xp_rulebook,
+					   xrp->xr_new_state);
+
+    return TRUE;
+}
+
+/*
+ * Text directly inside the skeleton of a compiled selector (the
+ * elements above the selected subtrees) isn't part of the result.
+ */
+static inline xi_boolean_t
+xi_parse_skip_text (xi_parse_t *parsep)
+{
+    xi_rstate_t *statep = xi_parse_stack_state(parsep);
+
+    return (statep && (statep->xrbs_flags & XRBSF_SKELETON)) ? TRUE : FALSE;
+}
+
+/*
+ * While discarding a subtree, we only care about nesting, so we can
+ * find the close tag that ends it.  Returns TRUE if the token was
+ * eaten.
+ */
+static inline xi_boolean_t
+xi_parse_discard (xi_parse_t *parsep, xi_node_type_t type)
+{
+    if (parsep->xp_discard_depth == 0)
+	return FALSE;
+
+    if (type == XI_TYPE_OPEN)
+	parsep->xp_discard_depth += 1;
+    else if (type == XI_TYPE_CLOSE)
+	parsep->xp_discard_depth -= 1;
+
+    return TRUE;
+}
+
+/*
+ * Count a tag's rule, growing the per-state table as states appear
+ */
+static void
+xi_parse_stats_rule (xi_parse_t *parsep, xi_rstate_t *statep,
+		     xi_rule_t *rulep)
+{
+    xi_parse_stats_t *statsp = parsep->xp_stats;
+    xi_state_id_t sid, max;
+    uint64_t *hits;
+
+    if (rulep == NULL) {
+	statsp->xst_default_hits += 1;
+	rulep = &parsep->xp_default_rule;
+
+    } else if (statep) {
+	sid = statep->xrbs_id;
+	if (sid >= statsp->xst_state_max) {
+	    max = sid + 16;
+	    hits = realloc(statsp->xst_state_hits, max * sizeof(*hits));
+	    if (hits) {
+		bzero(&hits[statsp->xst_state_max],
+		      (max - statsp->xst_state_max) * sizeof(*hits));
+		statsp->xst_state_hits = hits;
+		statsp->xst_state_max = max;
+	    }
+	}
+
+	if (sid < statsp->xst_state_max)
+	    statsp->xst_state_hits[sid] += 1;
     }
+
+    if (rulep->xr_action < XI_PARSE_STATS_ACTIONS)
+	statsp->xst_actions[rulep->xr_action] += 1;
 }
 
-int
-xi_parse (xi_parse_t *parsep)
+static int
+xi_parse_run (xi_parse_t *parsep)
 {
     xi_source_t *srcp = parsep->xp_srcp;
+    xi_parse_stats_t *statsp = parsep->xp_stats;
     char *data, *rest, *localp;
     xi_node_type_t type;
     xi_boolean_t opt_quiet = PSU_BIT_TEST(parsep->xp_flags, XI_PF_DEBUG);
-    xi_boolean_t opt_unescape = 0;
+    xi_boolean_t opt_unescape = PSU_BIT_TEST(parsep->xp_flags, XI_PF_UNESCAPE);
+    size_t len;
     pa_atom_t name_atom;
     xi_rule_t *rulep;
     xi_insert_t *xip = parsep->xp_insert;
+    xi_tree_t *xtp;
+    xi_boolean_t pushed;
+
+    if (srcp == NULL)		/* Attached trees have nothing to parse */
+	return 0;
+
+    /* We're about to change the tree, so any hashes will be stale */
+    xip->xi_tree->xt_flags &= ~XTIF_HASHED;
 
     for (;;) {
 
 	type = xi_source_next_token(srcp, &data, &rest);
 
+	if (statsp && type < XI_PARSE_STATS_TYPES)
+	    statsp->xst_tokens[type] += 1;
+
+	/* Inside a discarded subtree, only EOF and failures matter */
+	if (type > XI_TYPE_FAIL && xi_parse_discard(parsep, type))
+	    continue;
+
 	switch (type) {
 	case XI_TYPE_NONE:	/* Unknown type */
 	    return 1;
 
 	case XI_TYPE_EOF:	/* End of file */
+	    /* The root's subtree is now complete */
+	    xtp = xip->xi_tree;
+	    xi_node_order_set(xtp->xt_workspace, xtp->xt_root,
+			      0, xtp->xt_next_pre);
 	    return 0;
 
 	case XI_TYPE_FAIL:	/* Failure mode */
 	    return -1;
 
 	case XI_TYPE_TEXT:	/* Text content */
-	    type = XI_TYPE_UNESC; /* UNESC (aka CDATA) is unescaped text */
-	    if (!opt_quiet) {
-		int len;
-		if (opt_unescape && data && rest) {
-		    len = xi_source_unescape(srcp, data, rest - data);
-		    type = XI_TYPE_TEXT; /* TEXT is escaped */
-		} else {
-		    len = rest - data;
-		}
-		slaxLog("text [%.*s] (%u)", len, data, type);
-	    }
-	    xi_insert_text(parsep, data, rest - data, type);
+	    /*
+	     * Text is normally stored raw, with XNF_ESCAPED marking
+	     * values that hold entities, so only values that someone
+	     * actually reads get decoded (see xi_node_string).
+	     * XI_PF_UNESCAPE decodes everything up front.
+	     */
+	    if (xi_parse_skip_text(parsep))
+		break;
+
+	    len = rest - data;
+	    if (opt_unescape)
+		len = xi_source_unescape(srcp, data, len);
+	    if (!opt_quiet)
+		psu_log("text [%.*s]", (int) len, data);
+	    xi_insert_text(parsep, data, len, XI_TYPE_UNESC, !opt_unescape);
 	    break;
 
 	case XI_TYPE_OPEN:	/* Open tag */
 	case XI_TYPE_EMPTY:	/* Empty tag */
 	    if (!opt_quiet)
-		slaxLog("open tag [%s] [%s]", data ?: "", rest ?: "");
+		psu_log("open tag [%s] [%s]", data ?: "", rest ?: "");
+
+	    /* The insertion stack can't go any deeper */
+	    if (xip->xi_depth + 1 >= XI_DEPTH_MAX) {
+		xi_source_failure(srcp, 0, "elements nested too deeply "
+				  "(max %u)", XI_DEPTH_MAX - 1);
+		return -1;
+	    }
+
 	    localp = strchr(data, ':');
 	    if (localp)
 		*localp++ = '\0';
@@ -865,6 +1246,9 @@ xi_parse (xi_parse_t *parsep)
 				     statep,
 				     name_atom, data, localp, rest);
 
+	    if (statsp)
+		xi_parse_stats_rule(parsep, statep, rulep);
+
 	    /*
 	     * No rule (or no rulebook) means use the default rule, which
 	     * will likely make us save everything, just in case.
@@ -876,21 +1260,22 @@ xi_parse (xi_parse_t *parsep)
 	     * This is where the real work is done, performing any
 	     * action described in the rule.
 	     */
-	    xi_parse_handle_rule(parsep, name_atom, data, localp,
-				 rest, rulep);
+	    pushed = xi_parse_handle_rule(parsep, name_atom, data, localp,
+					  rest, rulep,
+					  (type == XI_TYPE_EMPTY));
 
 	    /*
 	     * An empty tag is an open and a close, since we've already
 	     * done the parsing, we can't just "fallthru" to the close
 	     * logic, so we call it directly ourselves.
 	     */
-	    if (type == XI_TYPE_EMPTY)
+	    if (type == XI_TYPE_EMPTY && pushed)
 		xi_insert_close(parsep, data, localp);
 	    break;
 
 	case XI_TYPE_CLOSE:	/* Close tag */
 	    if (!opt_quiet)
-		slaxLog("close tag [%s] [%s]", data ?: "", rest ?: "");
+		psu_log("close tag [%s] [%s]", data ?: "", rest ?: "");
 	    localp = strchr(data, ':');
 	    if (localp)
 		*localp++ = '\0';
@@ -904,22 +1289,27 @@ xi_parse (xi_parse_t *parsep)
 
 	case XI_TYPE_PI:	/* Processing instruction */
 	    if (!opt_quiet)
-		slaxLog("pi [%s] [%s]", data ?: "", rest ?: "");
+		psu_log("pi [%s] [%s]", data ?: "", rest ?: "");
 	    break;
 
 	case XI_TYPE_DTD:	/* DTD nonsense */
 	    if (!opt_quiet)
-		slaxLog("dtd [%s] [%s]", data ?: "", rest ?: "");
+		psu_log("dtd [%s] [%s]", data ?: "", rest ?: "");
 	    break;
 
 	case XI_TYPE_COMMENT:	/* Comment */
 	    if (!opt_quiet)
-		slaxLog("comment [%s] [%s]", data ?: "", rest ?: "");
+		psu_log("comment [%s] [%s]", data ?: "", rest ?: "");
 	    break;
 
 	case XI_TYPE_UNESC:	/* unescaped/cdata */
 	    if (!opt_quiet)
-		slaxLog("cdata [%.*s]", (int)(rest - data), data);
+		psu_log("cdata [%.*s]", (int)(rest - data), data);
+	    if (xi_parse_skip_text(parsep))
+		break;
+
+	    /* CDATA and JSON strings are already decoded; never escaped */
+	    xi_insert_text(parsep, data, rest - data, XI_TYPE_UNESC, FALSE);
 	    break;
 	}
     }
@@ -927,6 +1317,25 @@ xi_parse (xi_parse_t *parsep)
     return 0;
 }
 
+int
+xi_parse (xi_parse_t *parsep)
+{
+    xi_parse_stats_t *statsp = parsep->xp_stats;
+    psu_time_nsecs_t start;
+    int rc;
+
+    if (statsp == NULL)
+	return xi_parse_run(parsep);
+
+    start = psu_time_now_nsecs();
+    rc = xi_parse_run(parsep);
+
+    statsp->xst_parse_ns += psu_time_now_nsecs() - start;
+    statsp->xst_calls += 1;
+
+    return rc;
+}
+
 static const char *xi_type_names[] = {
     "NONE",
     "EOF",
@@ -969,7 +1378,7 @@ xi_node_dump (xi_workspace_t *xwp, xi_node_type_t op,
     const char *opname = (op < PSU_NUM_ELTS(xi_type_names) - 1)
 	? xi_type_names[op] : "unknown";
 
-    slaxLog("%s%s%snode %u [%p]: type %u(%s), name %u [%s], "
+    psu_log("%s%s%snode %u [%p]: type %u(%s), name %u [%s], "
 	    "depth %u, flags %#x, "
 	    "ns-map %u [%s]=[%s], next %u, contents %u",
 	    (op > 0) ? "Op: " : "", (op > 0) ? opname : "",
@@ -993,35 +1402,35 @@ xi_parse_dump_cb (xi_parse_t *parsep, xi_node_type_t type,
 
     switch (type) {
     case XI_TYPE_ROOT:
-	slaxLog("(root)");
+	psu_log("(root)");
 	break;
 
     case XI_TYPE_ELT:
-	slaxLog("element: [%s]", data ?: "[error]");
+	psu_log("element: [%s]", data ?: "[error]");
 	if (nodep->xn_ns_map != PA_NULL_ATOM) {
 	    ns_map = xi_ns_map_addr(xwp, nodep->xn_ns_map);
 	    if (ns_map != NULL) {
 		const char *pref = xi_namepool_string(xwp, ns_map->xnm_prefix);
 		const char *uri = xi_namepool_string(xwp, ns_map->xnm_uri);
 
-		slaxLog("element nsmap: [%s]=[%s]", pref ?: "", uri ?: "");
+		psu_log("element nsmap: [%s]=[%s]", pref ?: "", uri ?: "");
 	    } else {
-		slaxLog("element nsmap: null");
+		psu_log("element nsmap: null");
 	    }
 	}
 	break;
 
     case XI_TYPE_TEXT:
-	slaxLog("text: [%s]", data ?: "[error]");
+	psu_log("text: [%s]", data ?: "[error]");
 	break;
 
     case XI_TYPE_UNESC:		/* Unescaped/cdata */
-	slaxLog("cdata: [%s]", data ?: "[error]");
+	psu_log("cdata: [%s]", data ?: "[error]");
 	break;
 
     case XI_TYPE_ATTRIB:
 	cp = xi_parse_namepool_string(parsep, nodep->xn_name);
-	slaxLog("attrib: [%s=\"%s\"]", cp, data);
+	psu_log("attrib: [%s=\"%s\"]", cp, data);
 	break;
 
     case XI_TYPE_NS:
@@ -1030,26 +1439,26 @@ xi_parse_dump_cb (xi_parse_t *parsep, xi_node_type_t type,
 	    const char *pref = xi_namepool_string(xwp, ns_map->xnm_prefix);
 	    const char *uri = xi_namepool_string(xwp, ns_map->xnm_uri);
 
-	    slaxLog("namespace: [%s]=[%s]", pref ?: "", uri ?: "");
+	    psu_log("namespace: [%s]=[%s]", pref ?: "", uri ?: "");
 	} else {
-	    slaxLog("namespace: null");
+	    psu_log("namespace: null");
 	}
 	break;
 
     case XI_TYPE_ATSTR:
-	slaxLog("atrstr: [%s]", data ?: "[error]");
+	psu_log("atrstr: [%s]", data ?: "[error]");
 	break;
 
     case XI_TYPE_EOL_ATTRIB:
-	slaxLog("eol-attrib: %p", nodep);
+	psu_log("eol-attrib: %p", nodep);
 	break;
 
     case XI_TYPE_EOL_EMPTY:
-	slaxLog("eol-empty: %p", nodep);
+	psu_log("eol-empty: %p", nodep);
 	break;
 
     case XI_TYPE_CLOSE:
-	slaxLog("close: [%s]", data ?: "[error]");
+	psu_log("close: [%s]", data ?: "[error]");
 	break;
     }
 
@@ -1062,6 +1471,139 @@ xi_parse_dump (xi_parse_t *parsep)
     xi_parse_emit(parsep, xi_parse_dump_cb, NULL);
 }
 
+xi_parse_stats_t *
+xi_parse_stats_enable (xi_parse_t *parsep)
+{
+    xi_parse_stats_t *statsp = parsep->xp_stats;
+    xi_source_t *srcp = parsep->xp_srcp;
+
+    if (statsp) {
+	free(statsp->xst_state_hits);
+	bzero(statsp, sizeof(*statsp));
+    } else {
+	statsp = calloc(1, sizeof(*statsp));
+	if (statsp == NULL)
+	    return NULL;
+	parsep->xp_stats = statsp;
+    }
+
+    if (srcp) {
+	srcp->xps_stats = &statsp->xst_source;
+
+	/* Whatever's buffered was read before we started counting */
+	statsp->xst_source.xss_bytes = srcp->xps_len;
+	statsp->xst_source.xss_max_size = srcp->xps_size;
+    }
+
+    xi_parse_workspace(parsep)->xw_stats = &statsp->xst_workspace;
+
+    return statsp;
+}
+
+void
+xi_parse_stats_disable (xi_parse_t *parsep)
+{
+    xi_parse_stats_t *statsp = parsep->xp_stats;
+    xi_source_t *srcp = parsep->xp_srcp;
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
+
+    if (statsp == NULL)
+	return;
+
+    /* The workspace may have moved on to another parser's stats */
+    if (srcp && srcp->xps_stats == &statsp->xst_source)
+	srcp->xps_stats = NULL;
+    if (xwp->xw_stats == &statsp->xst_workspace)
+	xwp->xw_stats = NULL;
+
+    free(statsp->xst_state_hits);
+    free(statsp);
+    parsep->xp_stats = NULL;
+}
+
+#define XI_STAT(_x) ((unsigned long long) (_x))
+#define XI_STAT_USECS(_x) ((unsigned long long) ((_x) / NSEC_PER_USEC))
+
+void
+xi_parse_stats_dump (xi_parse_t *parsep, FILE *out)
+{
+    xi_parse_stats_t *statsp = parsep->xp_stats;
+    xi_source_stats_t *ssp;
+    xi_workspace_stats_t *wsp;
+    unsigned i;
+
+    if (statsp == NULL)
+	return;
+
+    ssp = &statsp->xst_source;
+    wsp = &statsp->xst_workspace;
+
+    fprintf(out, "parse: calls %llu, time %llu us\n",
+	    XI_STAT(statsp->xst_calls), XI_STAT_USECS(statsp->xst_parse_ns));
+
+    fprintf(out, "source: bytes %llu, reads %llu (%llu us), "
+	    "copies %llu (%llu bytes), grows %llu, buffer %llu\n",
+	    XI_STAT(ssp->xss_bytes), XI_STAT(ssp->xss_reads),
+	    XI_STAT_USECS(ssp->xss_read_ns), XI_STAT(ssp->xss_copies),
+	    XI_STAT(ssp->xss_copy_bytes), XI_STAT(ssp->xss_grows),
+	    XI_STAT(ssp->xss_max_size));
+
+    fprintf(out, "tokens:");
+    for (i = 0; i < XI_PARSE_STATS_TYPES; i++)
+	if (statsp->xst_tokens[i])
+	    fprintf(out, " %s %llu", xi_type_names[i],
+		    XI_STAT(statsp->xst_tokens[i]));
+    fprintf(out, "\n");
+
+    fprintf(out, "actions:");
+    for (i = 0; i < XI_PARSE_STATS_ACTIONS; i++)
+	if (statsp->xst_actions[i])
+	    fprintf(out, " %s %llu", xi_rule_action_name(i),
+		    XI_STAT(statsp->xst_actions[i]));
+    fprintf(out, "\n");
+
+    fprintf(out, "rules: default %llu", XI_STAT(statsp->xst_default_hits));
+    for (i = 0; i < statsp->xst_state_max; i++)
+	if (statsp->xst_state_hits[i])
+	    fprintf(out, ", state %u %llu", i,
+		    XI_STAT(statsp->xst_state_hits[i]));
+    fprintf(out, "\n");
+
+    fprintf(out, "namespaces: cache hits %llu, misses %llu\n",
+	    XI_STAT(statsp->xst_ns_hits), XI_STAT(statsp->xst_ns_misses));
+
+    fprintf(out, "workspace: nodes %llu, text %llu (%llu bytes), "
+	    "interned %llu, names %llu\n",
+	    XI_STAT(wsp->xws_nodes), XI_STAT(wsp->xws_text),
+	    XI_STAT(wsp->xws_text_bytes), XI_STAT(wsp->xws_interned),
+	    XI_STAT(wsp->xws_names));
+}
+
+/*
+ * Write text content, escaping the characters XML cares about
+ */
+static void
+xi_parse_emit_xml_text (FILE *out, const char *data)
+{
+    const char *cp;
+
+    for (cp = data; *cp; cp++) {
+	switch (*cp) {
+	case '&':
+	    fputs("&amp;", out);
+	    break;
+	case '<':
+	    fputs("&lt;", out);
+	    break;
+	case '>':
+	    fputs("&gt;", out);
+	    break;
+	default:
+	    putc(*cp, out);
+	}
+    }
+}
+
 typedef struct xi_xml_output_s {
     FILE *xx_out;		/* Output file descriptor */
     unsigned xx_indent;		/* Current indent amount */
@@ -1133,9 +1675,16 @@ xi_parse_emit_xml_cb (xi_parse_t *parsep, xi_node_type_t type,
 	}
 	break;
 
-    case XI_TYPE_TEXT:		/* XXX Text needs to be escaped */
+    case XI_TYPE_TEXT:
     case XI_TYPE_UNESC:
-	fprintf(out, "%s", data);
+	/*
+	 * Text that still holds its entities goes out as-is.  Anything
+	 * else is decoded (or never was encoded), so escape it.
+	 */
+	if (nodep->xn_flags & XNF_ESCAPED)
+	    fprintf(out, "%s", data);
+	else
+	    xi_parse_emit_xml_text(out, data);
 	break;
 
     case XI_TYPE_ATSTR:
@@ -1156,7 +1705,7 @@ xi_parse_emit_xml_cb (xi_parse_t *parsep, xi_node_type_t type,
 	    fprintf(out, " xmlns%s%s=\"%s\"",
 		    pref ? ":" : "", pref ?: "", uri ?: "");
 	} else {
-	    slaxLog("namespace: [null]");
+	    psu_log("namespace: [null]");
 	}
 	break;
 
@@ -1181,14 +1730,17 @@ xi_parse_emit_xml (xi_parse_t *parsep, FILE *out)
     xi_parse_emit(parsep, xi_parse_emit_xml_cb, &xml);
 }
 
-void
-xi_parse_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque)
+/*
+ * Walk the tree in document order, starting at "node_atom", making
+ * callbacks as we go.  If "stop_atom" is given, we quit after its
+ * close, which lets us walk a single subtree.
+ */
+static void
+xi_parse_emit_walk (xi_parse_t *parsep, pa_atom_t node_atom,
+		    pa_atom_t stop_atom, xi_parse_emit_fn func, void *opaque)
 {
-    xi_insert_t *xip = parsep->xp_insert;
-    xi_tree_t *xtp = xip->xi_tree;
-    xi_workspace_t *xwp = xtp->xt_workspace;
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
     const char *cp;
-    pa_atom_t node_atom = xtp->xt_root;
     pa_atom_t next_node_atom;
     xi_node_t *nodep;
     xi_depth_t last_depth = 0;
@@ -1197,7 +1749,7 @@ xi_parse_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque)
     while (node_atom != PA_NULL_ATOM) {
 	nodep = xi_node_addr(xwp, node_atom);
 	if (nodep == NULL) {
-	    slaxLog("xi_parse_emit sees a null atom!");
+	    psu_log("xi_parse_emit sees a null atom!");
 	    break;
 	}
 
@@ -1219,6 +1771,8 @@ xi_parse_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque)
 	if (last_depth && last_depth > nodep->xn_depth) {
 	    cp = xi_namepool_string(xwp, nodep->xn_name);
 	    func(parsep, XI_TYPE_CLOSE, node_atom, nodep, cp, opaque);
+	    if (node_atom == stop_atom)
+		break;
 	    node_atom = nodep->xn_next;
 	    last_depth = nodep->xn_depth;
 	    continue;
@@ -1245,6 +1799,8 @@ xi_parse_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque)
 		func(parsep, XI_TYPE_EOL_EMPTY, node_atom, nodep,
 		     NULL, opaque);
 		func(parsep, XI_TYPE_CLOSE, node_atom, nodep, NULL, opaque);
+		if (node_atom == stop_atom)
+		    break;
 	    } else {
 		need_eol_attrib = TRUE;
 		next_node_atom = nodep->xn_contents;
@@ -1252,18 +1808,18 @@ xi_parse_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque)
 
 	} else if (nodep->xn_type == XI_TYPE_TEXT
 		   || nodep->xn_type == XI_TYPE_UNESC) {
-	    cp = xi_textpool_string(xwp, nodep->xn_contents);
+	    cp = xi_node_stored_string(xwp, nodep);
 	    next_node_atom = nodep->xn_next;
 	    func(parsep, nodep->xn_type, node_atom, nodep, cp, opaque);
 
 	} else if (nodep->xn_type == XI_TYPE_ATSTR) {
-	    cp = pa_arb_atom_addr(xwp->xw_textpool, nodep->xn_contents);
+	    cp = xi_node_stored_string(xwp, nodep);
 	    next_node_atom = nodep->xn_next;
 	    func(parsep, nodep->xn_type, node_atom, nodep, cp, opaque);
 	    need_eol_attrib = TRUE;
 
 	} else if (nodep->xn_type == XI_TYPE_ATTRIB) {
-	    cp = pa_arb_atom_addr(xwp->xw_textpool, nodep->xn_contents);
+	    cp = xi_node_stored_string(xwp, nodep);
 	    next_node_atom = nodep->xn_next;
 	    func(parsep, nodep->xn_type, node_atom, nodep, cp, opaque);
 	    need_eol_attrib = TRUE;
@@ -1274,17 +1830,129 @@ xi_parse_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque)
 	    need_eol_attrib = TRUE;
 
 	} else {
-	    slaxLog("unhandled node: %u", nodep->xn_type);
+	    psu_log("unhandled node: %u", nodep->xn_type);
 	    next_node_atom = PA_NULL_ATOM;
 	}
 
 	node_atom = next_node_atom;
 	last_depth = nodep->xn_depth;
     }
+}
+
+void
+xi_parse_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque)
+{
+    xi_parse_emit_walk(parsep, parsep->xp_insert->xi_tree->xt_root,
+		       PA_NULL_ATOM, func, opaque);
 
     func(parsep, XI_TYPE_EOF, PA_NULL_ATOM, NULL, NULL, opaque);
 }
 
+/*
+ * Emit a single subtree, without the ROOT/EOF bracketing
+ */
+void
+xi_parse_emit_node (xi_parse_t *parsep, xi_node_id_t node_atom,
+		    xi_parse_emit_fn func, void *opaque)
+{
+    xi_parse_emit_walk(parsep, node_atom, node_atom, func, opaque);
+}
+
+/*
+ * Free a subtree back to the workspace's pools.  Only elements have
+ * child nodes as their contents; text and attributes have textpool
+ * strings.  Elements may also have an attribute directory, built by
+ * xi_attrib_lookup().  Namespace mappings are shared, so they stay.
+ * Our depth is bounded by XI_DEPTH_MAX, so recursion is fine.
+ */
+static void
+xi_parse_free_subtree (xi_workspace_t *xwp, pa_atom_t node_atom)
+{
+    xi_node_t *nodep = xi_node_addr(xwp, node_atom);
+    xi_node_t *childp;
+    pa_atom_t child_atom, next_atom;
+
+    if (nodep == NULL)
+	return;
+
+    switch (nodep->xn_type) {
+    case XI_TYPE_ELT:
+	xi_attrib_dir_free(xwp, node_atom, nodep);
+
+	for (child_atom = nodep->xn_contents; child_atom != PA_NULL_ATOM;
+	     child_atom = next_atom) {
+	    childp = xi_node_addr(xwp, child_atom);
+	    if (childp == NULL || childp->xn_depth <= nodep->xn_depth)
+		break;		/* Back at our parent (us) */
+
+	    next_atom = childp->xn_next;
+	    xi_parse_free_subtree(xwp, child_atom);
+	}
+	break;
+
+    case XI_TYPE_TEXT:
+    case XI_TYPE_UNESC:
+    case XI_TYPE_ATSTR:
+    case XI_TYPE_ATTRIB:
+	/* Interned values are shared, so they're never freed */
+	if (!(nodep->xn_flags & XNF_INTERNED))
+	    pa_arb_free_atom(xwp->xw_textpool,
+			     pa_arb_atom(nodep->xn_contents));
+	break;
+    }
+
+    xi_node_free(xwp, node_atom);
+}
+
+/*
+ * The XIA_EMIT subtree on top of the insertion stack is complete:
+ * pass it to the emit callback, unlink it from its parent, and give
+ * its nodes and text back to the pools.  The next subtree will reuse
+ * the same atoms, so an endless stream of emitted records keeps the
+ * workspace at a steady size.  (Text outside emitted subtrees, like
+ * whitespace between records, is still kept; use XPSF_IGNORE_WS.)
+ */
+static void
+xi_parse_emit_release (xi_parse_t *parsep)
+{
+    xi_insert_t *xip = parsep->xp_insert;
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
+    xi_istack_t *xsp = &xip->xi_stack[xip->xi_depth];
+    xi_istack_t *parentp = xsp - 1;
+    pa_atom_t node_atom = xsp->xs_atom;
+    pa_atom_t prev_atom = xsp->xs_prev_atom;
+    xi_node_t *prevp;
+
+    xi_parse_emit_node(parsep, node_atom, parsep->xp_emit_func,
+		       parsep->xp_emit_opaque);
+
+    /*
+     * We're the last child of our parent, since nothing can be
+     * appended to it while we're open.  Unlink by making our
+     * predecessor the last child (pointing back to the parent), or
+     * by giving the parent no contents at all.
+     */
+    prevp = (prev_atom == PA_NULL_ATOM) ? NULL : xi_node_addr(xwp, prev_atom);
+    if (prevp) {
+	prevp->xn_next = parentp->xs_atom;
+    } else {
+	parentp->xs_node->xn_contents = PA_NULL_ATOM;
+	prev_atom = PA_NULL_ATOM;
+    }
+
+    parentp->xs_last_atom = prev_atom;
+    parentp->xs_last_node = prevp;
+
+    xi_parse_free_subtree(xwp, node_atom);
+}
+
+void
+xi_parse_set_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque)
+{
+    parsep->xp_emit_func = func;
+    parsep->xp_emit_opaque = opaque;
+}
+
 #if 0
 typedef struct xi_parse_as_source_s {
     xi_node_type_t xps_type;	/* Current type (XI_TYPE_*) */
@@ -1319,7 +1987,7 @@ xi_parse_as_source (xi_parse_t *parsep, xi_workspace_t *xwp,
     while (node_atom != PA_NULL_ATOM) {
 	nodep = xi_node_addr(xwp, node_atom);
 	if (nodep == NULL) {
-	    slaxLog("xi_parse_emit sees a null atom!");
+	    psu_log("xi_parse_emit sees a null atom!");
 	    break;
 	}
 
@@ -1360,18 +2028,18 @@ xi_parse_as_source (xi_parse_t *parsep, xi_workspace_t *xwp,
 
 	} else if (nodep->xn_type == XI_TYPE_TEXT
 		   || nodep->xn_type == XI_TYPE_UNESC) {
-	    cp = xi_textpool_string(xwp, nodep->xn_contents);
+	    cp = xi_node_stored_string(xwp, nodep);
 	    next_node_atom = nodep->xn_next;
 	    func(parsep, nodep->xn_type, node_atom, nodep, cp, opaque);
 
 	} else if (nodep->xn_type == XI_TYPE_ATSTR) {
-	    cp = pa_arb_atom_addr(xwp->xw_textpool, nodep->xn_contents);
+	    cp = xi_node_stored_string(xwp, nodep);
 	    next_node_atom = nodep->xn_next;
 	    func(parsep, nodep->xn_type, node_atom, nodep, cp, opaque);
 	    need_eol_attrib = TRUE;
 
 	} else if (nodep->xn_type == XI_TYPE_ATTRIB) {
-	    cp = pa_arb_atom_addr(xwp->xw_textpool, nodep->xn_contents);
+	    cp = xi_node_stored_string(xwp, nodep);
 	    next_node_atom = nodep->xn_next;
 	    func(parsep, nodep->xn_type, node_atom, nodep, cp, opaque);
 	    need_eol_attrib = TRUE;
@@ -1382,7 +2050,7 @@ xi_parse_as_source (xi_parse_t *parsep, xi_workspace_t *xwp,
 	    need_eol_attrib = TRUE;
 
 	} else {
-	    slaxLog("unhandled node: %u", nodep->xn_type);
+	    psu_log("unhandled node: %u", nodep->xn_type);
 	    next_node_atom = PA_NULL_ATOM;
 	}
 
@@ -12,6 +12,48 @@
 #ifndef LIBSLAX_XI_PARSE_H
 #define LIBSLAX_XI_PARSE_H
 
+typedef int (*xi_parse_emit_fn)(xi_parse_t *, xi_node_type_t,
+				xi_node_id_t node_atom, xi_node_t *,
+				const char *, void *);
+
+#define XI_PARSE_STATS_TYPES	(XI_TYPE_NSPREF + 1) /* Token types */
+#define XI_PARSE_STATS_ACTIONS	(XIA_RETURN + 1) /* Rule actions */
+
+/*
+ * Statistics for a parse, kept only after xi_parse_stats_enable().
+ * The source and workspace counters live here too, and the source
+ * and workspace point at them while they're enabled.
+ */
+typedef struct xi_parse_stats_s {
+    uint64_t xst_calls;		/* Calls to xi_parse() */
+    uint64_t xst_parse_ns;	/* Time spent in xi_parse() (nanoseconds) */
+    uint64_t xst_tokens[XI_PARSE_STATS_TYPES]; /* Tokens seen, by type */
+    uint64_t xst_actions[XI_PARSE_STATS_ACTIONS]; /* Rule actions taken */
+    uint64_t xst_default_hits;	/* Tags handled by the default rule */
+    uint64_t xst_ns_hits;	/* Prefixes found in xp_ns_cache */
+    uint64_t xst_ns_misses;	/* Prefixes we had to go looking for */
+    uint64_t *xst_state_hits;	/* Rule hits, by state id */
+    xi_state_id_t xst_state_max; /* Number of slots in xst_state_hits */
+    xi_source_stats_t xst_source; /* Counters for our source */
+    xi_workspace_stats_t xst_workspace; /* Counters for our workspace */
+} xi_parse_stats_t;
+
+/*
+ * A cache of resolved namespace prefixes.  Each element that declares
+ * namespaces starts a new scope, numbered from a counter that never
+ * goes backwards, and its descendents inherit that scope number (in
+ * xs_ns_scope).  So a prefix always resolves the same way for a given
+ * scope, and entries for closed scopes simply never match again;
+ * there's nothing to flush.
+ */
+#define XI_NS_CACHE_SIZE	64 /* Entries in xp_ns_cache (power of two) */
+
+typedef struct xi_ns_cache_s {
+    uint64_t xnc_scope;		/* Scope the prefix was resolved in */
+    pa_atom_t xnc_prefix;	/* Prefix (namepool atom) */
+    pa_atom_t xnc_ns_map;	/* Resolved mapping (or PA_NULL_ATOM) */
+} xi_ns_cache_t;
+
 /*
  * The state of the parser, meant to be both a handle to parsing
  * functionality as well as a means of restarting parsing.
@@ -22,18 +64,21 @@ typedef struct xi_parse_s {
     xi_rulebook_t *xp_rulebook;	/* Current set of rules */
     xi_rule_t xp_default_rule;	/* Default rule for parsing */
     xi_insert_t *xp_insert;	/* Insertion point */
+    unsigned xp_discard_depth;	/* Depth inside a discarded subtree */
+    xi_parse_emit_fn xp_emit_func; /* Callback for XIA_EMIT subtrees */
+    void *xp_emit_opaque;	/* Opaque data for xp_emit_func */
+    xi_parse_stats_t *xp_stats;	/* Statistics (or NULL) */
+    uint64_t xp_ns_scope;	/* Last namespace scope number handed out */
+    xi_ns_cache_t xp_ns_cache[XI_NS_CACHE_SIZE]; /* Resolved prefixes */
 } xi_parse_t;
 
 /* Flags for xp_flags: */
 #define XI_PF_DEBUG		(1<<0) /* Make some debug output */
+#define XI_PF_UNESCAPE		(1<<1) /* Decode entities eagerly */
 
 #define XI_STATE_EOL		0 /* Indicates end-of-list/invalid state */
 #define XI_STATE_INITIAL	1 /* Initial parser state */
 
-typedef int (*xi_parse_emit_fn)(xi_parse_t *, xi_node_type_t,
-				xi_node_id_t node_atom, xi_node_t *,
-				const char *, void *);
-
 static inline xi_rstate_t *
 xi_parse_stack_state (xi_parse_t *parsep)
 {
@@ -45,6 +90,9 @@ xi_parse_t *
 xi_parse_open (pa_mmap_t *pmap, xi_workspace_t *xwp, const char *name,
 	       const char *filename, xi_source_flags_t flags);
 
+xi_parse_t *
+xi_parse_attach (pa_mmap_t *pmap, xi_workspace_t *xwp, const char *name);
+
 void
 xi_parse_destroy (xi_parse_t *parsep);
 
@@ -54,12 +102,41 @@ xi_parse (xi_parse_t *parsep);
 void
 xi_parse_dump (xi_parse_t *parsep);
 
+/*
+ * Start (or restart) keeping statistics for a parser, its source, and
+ * its workspace.  Returns the (zeroed) statistics, or NULL on failure.
+ */
+xi_parse_stats_t *
+xi_parse_stats_enable (xi_parse_t *parsep);
+
+void
+xi_parse_stats_disable (xi_parse_t *parsep);
+
+static inline xi_parse_stats_t *
+xi_parse_stats (xi_parse_t *parsep)
+{
+    return parsep->xp_stats;
+}
+
+/*
+ * Write a report of the statistics kept so far
+ */
+void
+xi_parse_stats_dump (xi_parse_t *parsep, FILE *out);
+
 void
 xi_parse_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque);
 
+void
+xi_parse_emit_node (xi_parse_t *parsep, xi_node_id_t node_atom,
+		    xi_parse_emit_fn func, void *opaque);
+
 void
 xi_parse_emit_xml (xi_parse_t *parsep, FILE *out);
 
+void
+xi_parse_set_emit (xi_parse_t *parsep, xi_parse_emit_fn func, void *opaque);
+
 void
 xi_parse_set_rulebook (xi_parse_t *parsep, xi_rulebook_t *rulebook);
 
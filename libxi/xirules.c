@@ -29,8 +29,8 @@
 #include <limits.h>
 
 #include "slaxconfig.h"
-#include <libslax/slaxdef.h>
-#include <libslax/slax.h>
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
 #include <parrotdb/pacommon.h>
 #include <parrotdb/paconfig.h>
 #include <parrotdb/pammap.h>
@@ -40,6 +40,7 @@
 #include <parrotdb/papat.h>
 #include <parrotdb/pabitmap.h>
 #include <libxi/xicommon.h>
+#include <libxi/xisource.h>
 #include <libxi/xirules.h>
 #include <libxi/xitree.h>
 #include <libxi/xiworkspace.h>
@@ -55,6 +56,7 @@ xi_rulebook_setup (xi_workspace_t *xwp,
     pa_fixed_t *rules;
     pa_fixed_t *states;
     pa_bitmap_t *bitmaps;
+    pa_fixed_t *table;
 
     infop = pa_mmap_header(pmp, xi_mk_name(namebuf, name, "rulebook.info"),
 			  PA_TYPE_OPAQUE, 0, sizeof(*infop));
@@ -67,7 +69,11 @@ xi_rulebook_setup (xi_workspace_t *xwp,
 
     bitmaps = pa_bitmap_open(pmp, xi_mk_name(namebuf, name, "rulebook.bitmaps"));
 
-    if (infop == NULL || rules == NULL || states == NULL || bitmaps == NULL)
+    table = pa_fixed_open(pmp, xi_mk_name(namebuf, name, "rulebook.table"),
+			  XI_SHIFT, sizeof(xi_rule_id_t), XI_MAX_ATOMS);
+
+    if (infop == NULL || rules == NULL || states == NULL || bitmaps == NULL
+	|| table == NULL)
 	return NULL;
     
     xi_rulebook_t *xrbp = calloc(1, sizeof(*xrbp));
@@ -78,6 +84,7 @@ xi_rulebook_setup (xi_workspace_t *xwp,
 	xrbp->xrb_rules = rules;
 	xrbp->xrb_states = states;
 	xrbp->xrb_bitmaps = bitmaps;
+	xrbp->xrb_table = table;
 	xrbp->xrb_script = script;
     }
 
@@ -104,11 +111,11 @@ xi_rule_action_value (const char *name)
 	    return type;
     }
 
-    slaxLog("unknown action: '%s'", name);
+    psu_log("unknown action: '%s'", name);
     return XIA_NONE;
 }
 
-static const char *
+const char *
 xi_rule_action_name (xi_action_type_t action)
 {
     if (action < PSU_NUM_ELTS(xi_action_names))
@@ -119,17 +126,17 @@ xi_rule_action_name (xi_action_type_t action)
 static void
 xi_rule_bitmap_add (xi_rulebook_t *xrbp, xi_rule_t *xrp, const char *tag)
 {
-    slaxLog("xi_rule_bitmap_add: %p/%p/%s", xrbp, xrp, tag);
+    psu_log("xi_rule_bitmap_add: %p/%p/%s", xrbp, xrp, tag);
 
     /* Find the atom representing the tag */
-    pa_atom_t atom = xi_parse_namepool_atom(xrbp->xrb_script, tag);
+    pa_atom_t atom = xi_namepool_atom(xrbp->xrb_workspace, tag, TRUE);
     if (atom == PA_NULL_ATOM)
 	return;
 
     /* We need to allocate a bitmap for this rule, if we haven't already */
-    if (xrp->xr_bitmap == PA_NULL_ATOM) {
+    if (pa_bitmap_is_null(xrp->xr_bitmap)) {
 	xrp->xr_bitmap = pa_bitmap_alloc(xrbp->xrb_bitmaps);
-	if (xrp->xr_bitmap == PA_NULL_ATOM)
+	if (pa_bitmap_is_null(xrp->xr_bitmap))
 	    return;
     }
 
@@ -187,7 +194,7 @@ xi_rulebook_prep_cb (xi_parse_t *parsep, xi_node_type_t type,
     pa_fixed_page_entry_t *addr;
     for (i = 0; i < 5; i++) {
 	addr = pa_fixed_atom_addr(pfp, atom);
-	slaxLog("rules: check: %u %p", atom, addr);
+	psu_log("rules: check: %u %p", atom, addr);
 	if (addr == NULL)
 	    break;
 	atom = addr[0];
@@ -197,18 +204,18 @@ xi_rulebook_prep_cb (xi_parse_t *parsep, xi_node_type_t type,
     switch (type) {
     case XI_TYPE_OPEN:
 	if (nodep->xn_name == prep->xrp_atom_script) {
-	    slaxLog("prep: open: script: %s", data);
+	    psu_log("prep: open: script: %s", data);
 	} else if (nodep->xn_name == prep->xrp_atom_state) {
-	    slaxLog("prep: open: state: %s", data);
+	    psu_log("prep: open: state: %s", data);
 	    id = GET_ATTRIB(xrp_atom_id);
 	    action = GET_ATTRIB(xrp_atom_action);
-	    slaxLog("prep: open: state: [%s/%s]",
+	    psu_log("prep: open: state: [%s/%s]",
 		    XX(id), XX(action));
 
 	    /* Valid input requires a good state id number */
 	    xi_state_id_t sid = strtol(id, NULL, 0);
 	    if (sid > pa_fixed_max_atoms(xrbp->xrb_states)) {
-		slaxLog("state id > max: %u .vs. %u",
+		psu_log("state id > max: %u .vs. %u",
 			sid, pa_fixed_max_atoms(xrbp->xrb_states));
 		break;
 	    }
@@ -242,12 +249,12 @@ xi_rulebook_prep_cb (xi_parse_t *parsep, xi_node_type_t type,
 		xrbp->xrb_infop->xrsi_max_state = sid;
 
 	} else if (nodep->xn_name == prep->xrp_atom_rule) {
-	    slaxLog("prep: open: rule: %s", data);
+	    psu_log("prep: open: rule: %s", data);
 	    tag = GET_ATTRIB(xrp_atom_tag);
 	    action = GET_ATTRIB(xrp_atom_action);
 	    new_state = GET_ATTRIB(xrp_atom_new_state);
 	    use_tag = GET_ATTRIB(xrp_atom_use_tag);
-	    slaxLog("prep: open: rule: [%s/%s/%s/%s]",
+	    psu_log("prep: open: rule: [%s/%s/%s/%s]",
 		    XX(tag), XX(action), XX(new_state), XX(use_tag));
 
 	    xi_rule_id_t rid;
@@ -271,7 +278,7 @@ xi_rulebook_prep_cb (xi_parse_t *parsep, xi_node_type_t type,
 	    stackp->xrps_nextp = &xrp->xr_next;
 
 	} else {
-	    slaxLog("prep: open: unknown: %s", data);
+	    psu_log("prep: open: unknown: %s", data);
 	}
 	break;
     }
@@ -307,47 +314,483 @@ xi_rulebook_prep (xi_parse_t *input, const char *name)
 
     xi_parse_emit(input, xi_rulebook_prep_cb, &prep);
 
+    xi_rulebook_build_table(xrbp);
+
     return xrbp;
 }
 
 /*
- * Find the appropriate rule to process incoming data
+ * Allocate a fresh state, returning its number.  States are simple
+ * elements in the xrb_states array, so we just take the next one.
  */
-xi_rule_t *
-xi_rulebook_find (xi_parse_t *parsep UNUSED, xi_rulebook_t *xrbp,
-		  xi_rstate_t *statep,
-		  pa_atom_t name_atom UNUSED,
-		  const char *pref UNUSED, const char *name UNUSED,
-		  const char *attribs UNUSED)
+static xi_state_id_t
+xi_rulebook_new_state (xi_rulebook_t *xrbp, xi_action_type_t def_action)
 {
-    if (xrbp == NULL)		/* No rulebook means no rules */
-	return NULL;
+    xi_state_id_t sid = xrbp->xrb_infop->xrsi_max_state + 1;
+    if (sid >= pa_fixed_max_atoms(xrbp->xrb_states))
+	return XI_STATE_EOL;
+
+    xi_rstate_t *statep = xi_rulebook_state(xrbp, sid);
+    if (statep == NULL)
+	return XI_STATE_EOL;
+
+    bzero(statep, sizeof(*statep));
+    statep->xrbs_flags = XRBSF_INUSE;
+
+    xi_rule_id_t rid;
+    xi_rule_t *xrp = xi_rule_alloc(xrbp, &rid);
+    if (xrp == NULL)
+	return XI_STATE_EOL;
+
+    bzero(xrp, sizeof(*xrp));
+    xrp->xr_flags = XRF_MATCH_ALL;
+    xrp->xr_action = def_action;
+    statep->xrbs_default_rule = rid;
+
+    xrbp->xrb_infop->xrsi_max_state = sid;
+    return sid;
+}
+
+/*
+ * Find the rule in a state that handles a given step, or make one.
+ * Each compiled rule matches a single tag (or "*"), so we can look
+ * for a previous rule with a quick bitmap test, which lets selectors
+ * with common leading steps share states.
+ */
+static xi_rule_t *
+xi_rulebook_step_rule (xi_rulebook_t *xrbp, xi_state_id_t sid,
+		       const char *tag, xi_boolean_t *newp)
+{
+    xi_rstate_t *statep = xi_rulebook_state(xrbp, sid);
+    xi_rule_id_t rid, *ridp;
+    xi_rule_t *xrp = NULL;
+    pa_atom_t atom = PA_NULL_ATOM;
+    xi_boolean_t wild = (strcmp(tag, "*") == 0);
 
     if (statep == NULL)
 	return NULL;
 
+    if (!wild) {
+	atom = xi_namepool_atom(xrbp->xrb_workspace, tag, TRUE);
+	if (atom == PA_NULL_ATOM)
+	    return NULL;
+    }
+
+    for (ridp = &statep->xrbs_first_rule; *ridp != PA_NULL_ATOM;
+	 ridp = &xrp->xr_next) {
+	xrp = xi_rulebook_rule(xrbp, *ridp);
+	if (xrp == NULL)
+	    return NULL;
+
+	if (wild ? (xrp->xr_flags & XRF_MATCH_ALL)
+	    : (!(xrp->xr_flags & XRF_MATCH_ALL)
+	       && pa_bitmap_test(xrbp->xrb_bitmaps, xrp->xr_bitmap, atom))) {
+	    *newp = FALSE;
+	    return xrp;
+	}
+    }
+
+    /*
+     * No match, so we append a new rule.  Since rules are tested in
+     * order, a wildcard shadows any specific tag added after it in
+     * the same state.  Selectors are expected to be few and simple,
+     * so callers should list the specific ones first.
+     */
+    xrp = xi_rule_alloc(xrbp, &rid);
+    if (xrp == NULL)
+	return NULL;
+
+    bzero(xrp, sizeof(*xrp));
+    if (wild)
+	xrp->xr_flags = XRF_MATCH_ALL;
+    else
+	xi_rule_bitmap_add(xrbp, xrp, tag);
+
+    *ridp = rid;
+    *newp = TRUE;
+    return xrp;
+}
+
+#define XI_RULEBOOK_TAG_MAX 256 /* Longest tag in a selector step */
+
+/*
+ * Find the end of the step starting at "cp", skipping over any
+ * predicates, which can hold slashes of their own ("/a[b/c]") and
+ * quoted strings that can hold brackets.  Returns NULL if a
+ * predicate isn't closed.
+ */
+static const char *
+xi_rulebook_step_end (const char *cp)
+{
+    int depth = 0;
+    char quote = '\0';
+
+    for ( ; *cp; cp++) {
+	if (quote) {
+	    if (*cp == quote)
+		quote = '\0';
+	} else if (depth > 0 && (*cp == '"' || *cp == '\'')) {
+	    quote = *cp;
+	} else if (*cp == '[') {
+	    depth += 1;
+	} else if (*cp == ']') {
+	    if (depth > 0)
+		depth -= 1;
+	} else if (*cp == '/' && depth == 0) {
+	    break;
+	}
+    }
+
+    return (depth == 0 && quote == '\0') ? cp : NULL;
+}
+
+/*
+ * Compile one selector into the rulebook.  Each step gets a state;
+ * while we're walking down the path, matching elements are saved
+ * (they are the skeleton that holds the result) and everything else,
+ * including text directly inside the skeleton, is discarded.  The last step's rule uses the caller's action and
+ * moves into the "keep" state, where everything is saved.
+ *
+ * Predicates are accepted but ignored: a streaming parser sees the
+ * open tag before it sees the children a predicate like "[name]"
+ * would test, so we can't decide there.  The selector then matches a
+ * superset of what was asked for, but the result is small, so the
+ * caller can afford to filter it.
+ */
+static int
+xi_rulebook_compile_path (xi_rulebook_t *xrbp, const char *path,
+			  xi_action_type_t action, xi_state_id_t keep_sid)
+{
+    char tag[XI_RULEBOOK_TAG_MAX];
+    const char *cp, *ep, *np, *sp;
+    xi_state_id_t sid = XI_STATE_INITIAL;
+    xi_rule_t *xrp;
+    xi_boolean_t is_new;
+    size_t len;
+
+    if (path[0] != '/') {
+	psu_log("rulebook: selector must be a simple absolute path: '%s'",
+		path);
+	return -1;
+    }
+
+    for (cp = path + 1; *cp; cp = ep) {
+	np = xi_rulebook_step_end(cp);
+	if (np == NULL) {
+	    psu_log("rulebook: unterminated predicate in selector: '%s'",
+		    path);
+	    return -1;
+	}
+
+	ep = (*np == '/') ? np + 1 : np;
+
+	sp = memchr(cp, '[', np - cp); /* Trim (and ignore) any predicate */
+	if (sp)
+	    np = sp;
+
+	sp = memchr(cp, ':', np - cp); /* Rules work on local names */
+	if (sp)
+	    cp = sp + 1;
+
+	len = np - cp;
+	if (len == 0) {
+	    psu_log("rulebook: empty step in selector: '%s'", path);
+	    return -1;
+	}
+
+	if (len >= sizeof(tag)) {
+	    psu_log("rulebook: step too long in selector: '%s'", path);
+	    return -1;
+	}
+
+	memcpy(tag, cp, len);
+	tag[len] = '\0';
+
+	xrp = xi_rulebook_step_rule(xrbp, sid, tag, &is_new);
+	if (xrp == NULL)
+	    return -1;
+
+	/* A shorter selector already took this subtree */
+	if (!is_new && xrp->xr_new_state == keep_sid)
+	    return 0;
+
+	if (*ep == '\0') {
+	    /* Last step: take the whole subtree */
+	    xrp->xr_action = action;
+	    xrp->xr_new_state = keep_sid;
+	    return 0;
+	}
+
+	if (is_new) {
+	    xrp->xr_action = XIA_SAVE;
+	    xrp->xr_new_state = xi_rulebook_new_state(xrbp, XIA_DISCARD);
+	    if (xrp->xr_new_state == XI_STATE_EOL)
+		return -1;
+
+	    xi_rulebook_state(xrbp, xrp->xr_new_state)->xrbs_flags
+		|= XRBSF_SKELETON;
+	}
+
+	sid = xrp->xr_new_state;
+    }
+
+    return 0;
+}
+
+/*
+ * Free the rules, bitmaps and states of a partly built rulebook, so
+ * a failed compile doesn't leave them behind in the mmap file.
+ */
+static void
+xi_rulebook_discard (xi_rulebook_t *xrbp)
+{
+    xi_state_id_t sid;
+    xi_rstate_t *statep;
+    xi_rule_id_t rid, next;
+    xi_rule_t *xrp;
+
+    for (sid = XI_STATE_INITIAL; sid <= xrbp->xrb_infop->xrsi_max_state;
+	 sid++) {
+	statep = xi_rulebook_state(xrbp, sid);
+	if (statep == NULL || !(statep->xrbs_flags & XRBSF_INUSE))
+	    continue;
+
+	for (rid = statep->xrbs_first_rule; rid != PA_NULL_ATOM; rid = next) {
+	    xrp = xi_rulebook_rule(xrbp, rid);
+	    if (xrp == NULL)
+		break;
+
+	    next = xrp->xr_next;
+	    pa_bitmap_free(xrbp->xrb_bitmaps, xrp->xr_bitmap);
+	    xi_rule_free(xrbp, rid);
+	}
+
+	xi_rule_free(xrbp, statep->xrbs_default_rule);
+	bzero(statep, sizeof(*statep));
+    }
+
+    bzero(xrbp->xrb_infop, sizeof(*xrbp->xrb_infop));
+}
+
+/*
+ * Build a rulebook from a set of simple absolute selectors, like
+ * "/config/interfaces/interface".  The result is a state machine
+ * that keeps the selected subtrees (and the chain of elements above
+ * them) and discards everything else as it streams by, so pulling
+ * a small slice out of a large document costs a single pass and
+ * memory proportional to the slice.  The "action" is applied to the
+ * selected elements; XIA_SAVE or XIA_EMIT make the most sense.
+ */
+xi_rulebook_t *
+xi_rulebook_compile (xi_workspace_t *xwp, const char *name,
+		     const char **paths, unsigned npaths,
+		     xi_action_type_t action)
+{
+    xi_rulebook_t *xrbp = xi_rulebook_setup(xwp, NULL, name);
+    xi_state_id_t keep_sid;
+    unsigned i;
+
+    if (xrbp == NULL)
+	return NULL;
+
+    /* The initial state discards anything we're not looking for */
+    xrbp->xrb_infop->xrsi_initial_state = XI_STATE_INITIAL;
+    xrbp->xrb_infop->xrsi_max_state = XI_STATE_INITIAL - 1;
+    if (xi_rulebook_new_state(xrbp, XIA_DISCARD) != XI_STATE_INITIAL)
+	goto fail;
+    xi_rulebook_state(xrbp, XI_STATE_INITIAL)->xrbs_flags |= XRBSF_SKELETON;
+
+    /* Once inside a selected subtree, we keep everything */
+    keep_sid = xi_rulebook_new_state(xrbp, XIA_SAVE);
+    if (keep_sid == XI_STATE_EOL)
+	goto fail;
+
+    for (i = 0; i < npaths; i++) {
+	if (xi_rulebook_compile_path(xrbp, paths[i], action, keep_sid))
+	    goto fail;
+    }
+
+    xi_rulebook_build_table(xrbp);
+
+    return xrbp;
+
+ fail:
+    xi_rulebook_discard(xrbp);
+    xi_rulebook_close(xrbp);
+    return NULL;
+}
+
+/*
+ * Release our handle on a rulebook.  The rulebook itself lives in
+ * the mmap file, so this just frees our view of it.
+ */
+void
+xi_rulebook_close (xi_rulebook_t *xrbp)
+{
+    if (xrbp == NULL)
+	return;
+
+    pa_fixed_close(xrbp->xrb_rules);
+    pa_fixed_close(xrbp->xrb_states);
+    pa_bitmap_close(xrbp->xrb_bitmaps);
+    pa_fixed_close(xrbp->xrb_table);
+    free(xrbp);
+}
+
+/*
+ * Walk a state's rule chain the slow way, returning the rule to use
+ * for a given name atom.
+ */
+static xi_rule_id_t
+xi_rulebook_find_slow (xi_rulebook_t *xrbp, xi_rstate_t *statep,
+		       pa_atom_t name_atom)
+{
     xi_rule_id_t rid;
     xi_rule_t *xrp;
+
     for (rid = statep->xrbs_first_rule; rid != PA_NULL_ATOM;
 	 rid = xrp->xr_next) {
 	xrp = xi_rulebook_rule(xrbp, rid);
 	if (xrp == NULL)
-	    continue;
+	    break;
 
 	/* See if our tag is in the bitmap for this rule */
-	if (!pa_bitmap_test(xrbp->xrb_bitmaps, xrp->xr_bitmap, name_atom))
+	if ((xrp->xr_flags & XRF_MATCH_ALL)
+	    || pa_bitmap_test(xrbp->xrb_bitmaps, xrp->xr_bitmap, name_atom))
+	    return rid;
+    }
+
+    /* Nothing matched, so the state's default rule (if any) applies */
+    return statep->xrbs_default_rule;
+}
+
+/*
+ * Flatten the rulebook into a dense (state x name-atom) table of rule
+ * numbers, so xi_rulebook_find() is a single array reference, no
+ * matter how many rules a state has.  Each row is xrsi_table_width
+ * wide, which is one more than the highest name atom mentioned in any
+ * rule; names past that can only hit a wildcard or default rule, which
+ * is the same answer for every such name, so we keep it in slot zero
+ * of the row (PA_NULL_ATOM is never a real name).
+ *
+ * The table is built once, after the rules are loaded.  Changing the
+ * rules afterwards means calling us again.
+ */
+void
+xi_rulebook_build_table (xi_rulebook_t *xrbp)
+{
+    xi_state_id_t sid, max_sid = xrbp->xrb_infop->xrsi_max_state;
+    xi_rstate_t *statep;
+    xi_rule_id_t rid, *row;
+    xi_rule_t *xrp;
+    pa_atom_t atom, width = 0;
+    pa_bitnumber_t num;
+
+    xrbp->xrb_infop->xrsi_table_width = 0; /* Off while we work */
+
+    /* First pass: number the states and find the widest name */
+    for (sid = 1; sid <= max_sid; sid++) {
+	statep = xi_rulebook_state(xrbp, sid);
+	if (statep == NULL)
 	    continue;
 
-	slaxLog("rule match: %u/'%s' rule %u: action %u/%s, flags %#x, "
-		"use-tag %u, new_state %u",
-		name_atom, name ?: "",
-		rid, xrp->xr_action, xi_rule_action_name(xrp->xr_action),
-		xrp->xr_flags, xrp->xr_use_tag, xrp->xr_new_state);
+	statep->xrbs_id = sid;
+
+	for (rid = statep->xrbs_first_rule; rid != PA_NULL_ATOM;
+	     rid = xrp->xr_next) {
+	    xrp = xi_rulebook_rule(xrbp, rid);
+	    if (xrp == NULL)
+		break;
 
-	return xrp;		/* Success! */
+	    for (num = PA_BITMAP_FIND_START;; ) {
+		num = pa_bitmap_find_next(xrbp->xrb_bitmaps, xrp->xr_bitmap,
+					  num);
+		if (num == PA_BITMAP_FIND_DONE)
+		    break;
+		if (num >= width)
+		    width = num + 1;
+	    }
+	}
     }
 
-    return NULL;
+    if (width == 0)
+	width = 1;		/* Just the wildcard/default slot */
+
+    /* Don't blow out the table; the rule chains still work */
+    if ((uint64_t) (max_sid + 1) * width
+	> pa_fixed_max_atoms(xrbp->xrb_table)) {
+	psu_log("rulebook: table too large (%u states x %u names); "
+		"using rule chains", max_sid, width);
+	return;
+    }
+
+    /* Second pass: fill in the rows */
+    for (sid = 1; sid <= max_sid; sid++) {
+	statep = xi_rulebook_state(xrbp, sid);
+	if (statep == NULL)
+	    continue;
+
+	for (atom = 0; atom < width; atom++) {
+	    row = pa_fixed_element(xrbp->xrb_table, sid * width + atom);
+	    if (row == NULL)
+		return;		/* Out of memory; leave the table off */
+
+	    /*
+	     * Slot zero is for names not in any bitmap, which only a
+	     * wildcard or the default rule can match.
+	     */
+	    *row = xi_rulebook_find_slow(xrbp, statep,
+					 atom ? atom : PA_NULL_ATOM);
+	}
+    }
+
+    xrbp->xrb_infop->xrsi_table_width = width;
+}
+
+/*
+ * Find the appropriate rule to process incoming data
+ */
+xi_rule_t *
+xi_rulebook_find (xi_parse_t *parsep UNUSED, xi_rulebook_t *xrbp,
+		  xi_rstate_t *statep, pa_atom_t name_atom,
+		  const char *pref UNUSED, const char *name,
+		  const char *attribs UNUSED)
+{
+    if (xrbp == NULL)		/* No rulebook means no rules */
+	return NULL;
+
+    if (statep == NULL)
+	return NULL;
+
+    xi_rule_id_t rid, *row;
+    pa_atom_t width = xrbp->xrb_infop->xrsi_table_width;
+
+    if (width != 0 && statep->xrbs_id != XI_STATE_EOL) {
+	/* The fast path: one lookup in the transition table */
+	if (name_atom >= width)
+	    name_atom = PA_NULL_ATOM; /* Slot zero: wildcard/default */
+
+	row = pa_fixed_element_if_exists(xrbp->xrb_table,
+					 statep->xrbs_id * width + name_atom);
+	rid = row ? *row : PA_NULL_ATOM;
+    } else {
+	rid = xi_rulebook_find_slow(xrbp, statep, name_atom);
+    }
+
+    if (rid == PA_NULL_ATOM)
+	return NULL;
+
+    xi_rule_t *xrp = xi_rulebook_rule(xrbp, rid);
+    if (xrp == NULL)
+	return NULL;
+
+    psu_log("rule match: %u/'%s' rule %u: action %u/%s, flags %#x, "
+	    "use-tag %u, new_state %u",
+	    name_atom, name ?: "",
+	    rid, xrp->xr_action, xi_rule_action_name(xrp->xr_action),
+	    xrp->xr_flags, xrp->xr_use_tag, xrp->xr_new_state);
+
+    return xrp;			/* Success! */
 }
 
 /*
@@ -372,7 +815,7 @@ xi_rule_bitmap_string (xi_rulebook_t *xrbp, xi_rule_t *xrp,
 	    break;
 
 	/* Turn the bit into a string */
-	str = xi_parse_namepool_string(xrbp->xrb_script, num);
+	str = xi_namepool_string(xrbp->xrb_workspace, num);
 
 	/* Make some pretty pretty output */
 	rc = snprintf(cp, ep - cp, "%s%d%s%s%s",
@@ -400,10 +843,10 @@ xi_rulebook_dump_rule (xi_rulebook_t *xrbp, xi_rule_id_t rid, const char *tag)
     const char *rname = xi_rule_action_name(rulep->xr_action);
     char buf[1024];
 
-    slaxLog("    %srule %u:", tag, rid);
-    slaxLog("        bitmap: %s",
+    psu_log("    %srule %u:", tag, rid);
+    psu_log("        bitmap: %s",
 	    xi_rule_bitmap_string(xrbp, rulep, buf, sizeof(buf)));
-    slaxLog("        flags %#x, action %u/%s, use-tag %u, "
+    psu_log("        flags %#x, action %u/%s, use-tag %u, "
 	    "new_state %u, next %u",
 	    rulep->xr_flags, rulep->xr_action, rname,
 	    rulep->xr_use_tag, rulep->xr_new_state, rulep->xr_next);
@@ -421,14 +864,15 @@ xi_rulebook_dump (xi_rulebook_t *xrbp)
     xi_rule_id_t rid;
     xi_rstate_t *statep;
 
-    slaxLog("dumping rulebook");
+    psu_log("dumping rulebook (table width %u)",
+	    xrbp->xrb_infop->xrsi_table_width);
 
     for (sid = 1; sid <= max_sid; sid++) {
 	statep = xi_rulebook_state(xrbp, sid);
 	if (statep == NULL)
 	    continue;
 
-	slaxLog("state %u: flags %#x, default rule %u",
+	psu_log("state %u: flags %#x, default rule %u",
 		sid, statep->xrbs_flags, statep->xrbs_default_rule);
 
 	/* Dump the full set of rules */
@@ -61,14 +61,17 @@ typedef struct xi_rstate_s {
     xi_rule_id_t xrbs_first_rule; /* Number of first rule (in xb_rules) */
     xi_rule_id_t xrbs_default_rule; /* Number of default rule (in xb_rules) */
     uint16_t xrbs_flags;	/* Flags for this state */
+    xi_state_id_t xrbs_id;	/* Our own number (set by table build) */
 } xi_rstate_t;
 
 /* Flags for xrbs_flags */
 #define XRBSF_INUSE	(1<<0)	/* State is used/defined */
+#define XRBSF_SKELETON	(1<<1)	/* Selector path; text is dropped */
 
 typedef struct xi_rulebook_info_s {
     xi_state_id_t xrsi_initial_state; /* First state in the rule book */
     xi_state_id_t xrsi_max_state;     /* Maximum allocated (seen) state */
+    pa_atom_t xrsi_table_width;	      /* Row width of xrb_table (or zero) */
 } xi_rulebook_info_t;
 
 /*
@@ -81,6 +84,7 @@ typedef struct xi_rulebook_s {
     pa_fixed_t *xrb_rules;	  /* List of rules (xi_rule_t) */
     pa_fixed_t *xrb_states;	  /* List of states (xi_rule_state_t) */
     pa_bitmap_t *xrb_bitmaps;	  /* Pool of bitmaps */
+    pa_fixed_t *xrb_table;	  /* Transition table (xi_rule_id_t) */
 } xi_rulebook_t;
 
 static inline xi_rstate_t *
@@ -92,7 +96,7 @@ xi_rulebook_state (xi_rulebook_t *xrbp, xi_state_id_t sid)
 static inline xi_rule_t *
 xi_rulebook_rule (xi_rulebook_t *xrbp, xi_rule_id_t rid)
 {
-    return pa_fixed_atom_addr(xrbp->xrb_rules, rid);
+    return pa_fixed_atom_addr(xrbp->xrb_rules, pa_fixed_atom(rid));
 }
 
 xi_rulebook_t *
@@ -112,10 +116,22 @@ xi_rulebook_find (xi_parse_t *parsep, xi_rulebook_t *xrbp, xi_rstate_t *statep,
 xi_rulebook_t *
 xi_rulebook_prep (xi_parse_t *input, const char *name);
 
+void
+xi_rulebook_build_table (xi_rulebook_t *xrbp);
+
+xi_rulebook_t *
+xi_rulebook_compile (xi_workspace_t *xwp, const char *name,
+		     const char **paths, unsigned npaths,
+		     xi_action_type_t action);
+
 void
 xi_rulebook_dump (xi_rulebook_t *xrbp);
 
+const char *
+xi_rule_action_name (xi_action_type_t action);
+
 PA_FIXED_FUNCTIONS(xi_rule_id_t, xi_rule_t, xi_rulebook_t, xrb_rules,
-		   xi_rule_alloc, xi_rule_free, xi_rule_addr);
+		   xi_rule_alloc, xi_rule_free, xi_rule_addr,
+		   pa_fixed_plain, pa_fixed_plain_is_null);
 
 #endif /* LIBSLAX_XI_RULES_H */
@@ -36,8 +36,36 @@
 #include <assert.h>
 #include <ctype.h>
 #include <limits.h>
+#include <errno.h>
+
+#include "slaxconfig.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#include <pthread.h>
+#define XI_READ_AHEAD 1		/* Support XPSF_READ_AHEAD */
+#endif /* HAVE_PTHREAD_H && HAVE_LIBPTHREAD */
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#define XI_GZIP 1		/* Support gzip'd input */
+#endif /* HAVE_ZLIB_H && HAVE_LIBZ */
+
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+#include <lzma.h>
+#define XI_XZ 1			/* Support xz'd input */
+#endif /* HAVE_LZMA_H && HAVE_LIBLZMA */
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#include <zstd.h>
+#define XI_ZSTD 1		/* Support zstd'd input */
+#endif /* HAVE_ZSTD_H && HAVE_LIBZSTD */
 
 #include <libpsu/psucommon.h>
+#include <libpsu/psutime.h>
 #include <parrotdb/pacommon.h>
 #include <libxi/xicommon.h>
 #include <libxi/xisource.h>
@@ -49,9 +77,26 @@
 #define XI_BUFSIZ_MIN	4096	/* Minimum space for reading data */
 #define XI_BUFSIZ_FAIL	512	/* Absolute minimum space for reading data */
 
+#define XI_RA_BUFSIZ	(256 * 1024) /* Size of each read-ahead buffer */
+#define XI_RA_COUNT	4	/* Number of read-ahead buffers */
+
+#define XI_DC_BUFSIZ	(64 * 1024) /* Size of the compressed input buffer */
+#define XI_DC_MAGIC_MAX	6	/* Longest magic number we look for */
+
 /* This array is used by xi_isspace to find writespace bytes */
 char xi_space_test[256]	= { [0x20] = 1, [0x09] = 1, [0x0d] = 1, [0x0a] = 1 };
 
+static struct xi_json_s *xi_json_create (void);
+static void xi_json_destroy (struct xi_json_s *jp);
+static void xi_read_ahead_start (xi_source_t *srcp);
+static void xi_read_ahead_stop (xi_source_t *srcp);
+static int xi_validate (xi_source_t *srcp, const char *data, unsigned len);
+static int xi_decomp_start (xi_source_t *srcp, char *peek,
+			    unsigned *peek_lenp);
+static void xi_decomp_stop (xi_source_t *srcp);
+static ssize_t xi_source_raw_read (int fd, struct xi_decomp_s *dcp,
+				   char *buf, size_t size);
+
 void
 xi_source_failure (xi_source_t *srcp, int errnum, const char *fmt, ...)
 {
@@ -101,20 +146,78 @@ xi_source_create (int fd, xi_source_flags_t flags)
 	    struct stat st;
 
 	    if (fstat(fd, &st) >= 0 && st.st_size > 0) {
-		void *addr = mmap(NULL, st.st_size, PROT_READ, 0, fd, 0);
-		if (addr) {
+		/* Private and writable, since tokens are split in place */
+		void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED) {
 		    srcp->xps_flags |= XPSF_MMAP_INPUT | XPSF_NO_READ;
 		    srcp->xps_bufp = srcp->xps_curp = addr;
-		    srcp->xps_size = st.st_size;
+		    srcp->xps_size = srcp->xps_len = st.st_size;
 		}
 	    }
 	}
 
-	/* If needed, allocate an initial buffer */
+	/*
+	 * Look for a compression magic number.  Bytes we read that
+	 * turn out not to be one are saved in "peek" until we have a
+	 * buffer to put them in.
+	 */
+	char peek[XI_DC_MAGIC_MAX];
+	unsigned peek_len = 0;
+
+	if ((flags & XPSF_DECOMPRESS)
+	    && xi_decomp_start(srcp, peek, &peek_len) < 0) {
+	    xi_source_destroy(srcp);
+	    return NULL;
+	}
+
+	/*
+	 * Read-ahead is a hint; without it, we read() as normal.
+	 * Decompressing is the costly part of compressed input, so we
+	 * always try to move that to the helper thread.
+	 */
+	srcp->xps_flags &= ~XPSF_READ_AHEAD;
+	if (((flags & XPSF_READ_AHEAD) || srcp->xps_decomp)
+	    && !(srcp->xps_flags & XPSF_NO_READ))
+	    xi_read_ahead_start(srcp);
+
+	/*
+	 * If needed, allocate an initial buffer.  With read-ahead, we
+	 * want to take a whole ring buffer at a time.
+	 */
 	if (srcp->xps_bufp == NULL) {
-	    srcp->xps_bufp = srcp->xps_curp = calloc(1, XI_BUFSIZ);
+	    unsigned size = (srcp->xps_flags & XPSF_READ_AHEAD)
+		? XI_RA_BUFSIZ : XI_BUFSIZ;
+	    srcp->xps_bufp = srcp->xps_curp = calloc(1, size);
 	    if (srcp->xps_bufp != NULL)
-		srcp->xps_size = XI_BUFSIZ;
+		srcp->xps_size = size;
+	}
+
+	if (peek_len > 0) {
+	    if (srcp->xps_bufp == NULL) {
+		xi_source_destroy(srcp);
+		return NULL;
+	    }
+
+	    memcpy(srcp->xps_bufp, peek, peek_len);
+	    srcp->xps_len = peek_len;
+	}
+
+	/* Data that didn't come thru xi_source_read() needs validating */
+	if (flags & XPSF_VALIDATE) {
+	    unsigned len = (srcp->xps_flags & XPSF_MMAP_INPUT)
+		? srcp->xps_size : srcp->xps_len;
+
+	    if (len > 0 && xi_validate(srcp, srcp->xps_bufp, len) >= 0)
+		srcp->xps_flags |= XPSF_INVALID;
+	}
+
+	if (flags & XPSF_JSON) {
+	    srcp->xps_json = xi_json_create();
+	    if (srcp->xps_json == NULL) {
+		xi_source_destroy(srcp);
+		return NULL;
+	    }
 	}
     }
 
@@ -122,7 +225,8 @@ xi_source_create (int fd, xi_source_flags_t flags)
 }
 
 /*
- * Open an xi_source_t for the given file.
+ * Open an xi_source_t for the given file.  Files are always checked
+ * for compression, so archived input can be parsed as-is.
  */
 xi_source_t *
 xi_source_open (const char *filename, xi_source_flags_t flags)
@@ -132,7 +236,7 @@ xi_source_open (const char *filename, xi_source_flags_t flags)
 	return NULL;
 
     xi_source_t *srcp;
-    srcp = xi_source_create(fd, flags | XPSF_CLOSE_FD);
+    srcp = xi_source_create(fd, flags | XPSF_CLOSE_FD | XPSF_DECOMPRESS);
     if (srcp)
 	srcp->xps_filename = strdup(filename);
 
@@ -150,12 +254,25 @@ xi_source_destroy (xi_source_t *srcp)
     if (srcp->xps_filename != NULL)
 	free(srcp->xps_filename);
 
-    if (srcp->xps_curp != NULL)
-	free(srcp->xps_curp);
+    /* Stop the read-ahead thread before we close its fd */
+    if (srcp->xps_read_ahead)
+	xi_read_ahead_stop(srcp);
+
+    if (srcp->xps_decomp)
+	xi_decomp_stop(srcp);
+
+    /* Free the buffer itself, not wherever curp has wandered to */
+    if (srcp->xps_flags & XPSF_MMAP_INPUT)
+	munmap(srcp->xps_bufp, srcp->xps_size);
+    else if (srcp->xps_bufp != NULL)
+	free(srcp->xps_bufp);
 
     if (srcp->xps_flags & XPSF_CLOSE_FD)
 	close(srcp->xps_fd);
 
+    if (srcp->xps_json)
+	xi_json_destroy(srcp->xps_json);
+
     free(srcp);
 }
 
@@ -169,69 +286,63 @@ xi_source_unescape (xi_source_t *srcp, char *start, unsigned len)
 {
     /* First byte is the unescaped form; the rest is the entity form */
     static const char *entities[] = {
-	"&amp;", "<lt;", ">gt;", "'&apos;", "\"quot;", NULL
+	"&amp;", "<lt;", ">gt;", "'apos;", "\"quot;", NULL
     };
 
-    size_t rc = len, elen = 0;
-    char *cur = start, *ins = NULL, *from = cur;
+    char *end = start + len, *cur = start, *ins = start, *amp, *xp;
     const char **ep;
+    size_t elen = 0, plen;
 
-    while (len > 0) {
-	cur = psu_memchr(cur, '&', len);
-	if (cur == NULL)
+    /*
+     * "ins" trails "cur", so we're copying down within the same
+     * buffer; the pieces can overlap, so it's memmove, not memcpy.
+     */
+    while (cur < end) {
+	amp = psu_memchr(cur, '&', end - cur);
+	if (amp == NULL)
 	    break;
 
-	len -= cur - from;
+	plen = amp - cur;	/* Length of uncopied data */
+	if (ins != cur)
+	    memmove(ins, cur, plen);
+	ins += plen;
+	cur = amp + 1;		/* Skip '&' */
+
 	for (ep = entities; *ep; ep++) {
 	    elen = strlen(*ep + 1);
-	    if (memcmp(*ep + 1, cur + 1, elen) == 0)
+	    if ((size_t) (end - cur) >= elen
+		    && memcmp(*ep + 1, cur, elen) == 0)
 		break;
 	}
 
-	if (*ep == NULL) {
-	    /* We didn't find the entity; bummer */
-	    xi_source_failure(srcp, 0, "could not decode entity");
-
-	    char *xp = psu_memchr(cur + 1, ';', len);
-	    if (xp != NULL) {
-		/*
-		 * Okay, the entity is trash, but at least we found a
-		 * semi-colon.  Move along, discarding the broken entity.
-		 */
-		ins = cur;
-		cur = from = xp;
-	    } else {
-		len -= 1;	/* Skip single character ('&') */
-		cur += 1;
-	    }
+	if (*ep != NULL) {
+	    *ins++ = **ep;	/* Insert unencoded form */
+	    cur += elen;	/* Skip over the rest of the entity */
 	    continue;
-
 	}
 
-	if (ins == NULL) {
-	    *cur++ = **ep;	/* Replace '&' with unencoded form */
-	    ins = cur;		/* Point where we'll copy data (next time) */
+	/* We didn't find the entity; bummer */
+	xi_source_failure(srcp, 0, "could not decode entity");
 
+	xp = psu_memchr(cur, ';', end - cur);
+	if (xp != NULL) {
+	    /*
+	     * Okay, the entity is trash, but at least we found a
+	     * semi-colon.  Move along, discarding the broken entity.
+	     */
+	    cur = xp + 1;
 	} else {
-	    size_t plen = cur - from; /* Length of uncopied data */
-	    memcpy(ins, from, plen);
-	    ins += plen;
-	    *ins++ = **ep;	/* Insert unencoded form */
-	    cur += 1;		/* Skip '&' */
+	    *ins++ = '&';	/* Keep the '&' as plain data */
 	}
-
-	/* Pointer maintenance */
-	cur += elen;		/* Skip over the rest of  */
-	from = cur;		/* Point where we'll copy from */
-	len -= elen + 1;
-	rc -= elen;
     }
 
     /* If there's anything left over, copy it */
-    if (ins != NULL && len > 0)
-	memcpy(ins, from, len);
+    plen = end - cur;
+    if (ins != cur)
+	memmove(ins, cur, plen);
+    ins += plen;
 
-    return rc;
+    return ins - start;
 }
 
 static void
@@ -254,538 +365,2158 @@ xi_source_move_curp (xi_source_t *srcp, char *newp)
 }
 
 /*
- * Read some input data from the source.  If min is non-zero, it's the
- * minimum number of bytes we'd like to see.
+ * Compressed input support.  With XPSF_DECOMPRESS, we read the first
+ * few bytes of input looking for a gzip, xz, or zstd magic number.
+ * If we find one, reads go thru a streaming decompressor, which
+ * writes straight into our buffer, so there's no temporary file and
+ * no second copy.  Like read-ahead, this lives entirely beneath
+ * xi_source_read(), and the tokenizer never knows.  Formats we
+ * recognize but weren't built with are reported as failures, rather
+ * than handed to the tokenizer as garbage.
  */
-static int
-xi_source_read (xi_source_t *srcp, int min)
+#define XI_DC_NONE	0	/* Not compressed */
+#define XI_DC_GZIP	1	/* gzip (RFC 1952) */
+#define XI_DC_XZ	2	/* xz */
+#define XI_DC_ZSTD	3	/* zstd (RFC 8878) */
+
+typedef struct xi_dc_magic_s {
+    int xdm_type;		/* Type of compression (XI_DC_*) */
+    const char *xdm_name;	/* Name, for error messages */
+    unsigned xdm_len;		/* Length of magic number */
+    const char *xdm_magic;	/* Magic number */
+} xi_dc_magic_t;
+
+static const xi_dc_magic_t xi_dc_magic[] = {
+    { XI_DC_GZIP, "gzip", 2, "\x1f\x8b" },
+    { XI_DC_XZ, "xz", 6, "\xfd" "7zXZ\0" },
+    { XI_DC_ZSTD, "zstd", 4, "\x28\xb5\x2f\xfd" },
+    { XI_DC_NONE, NULL, 0, NULL }
+};
+
+typedef struct xi_decomp_s {
+    const xi_dc_magic_t *xdc_magic; /* Format we're decompressing */
+    int xdc_fd;			/* File being read */
+    char *xdc_inbuf;		/* Compressed data (XI_DC_BUFSIZ bytes) */
+    unsigned xdc_in_len;	/* Number of bytes in xdc_inbuf */
+    unsigned xdc_in_pos;	/* Number of bytes consumed */
+    uint8_t xdc_in_eof;		/* Compressed input is exhausted */
+    uint8_t xdc_boundary;	/* Between streams, so EOF is okay */
+    uint8_t xdc_done;		/* Decompressed output is exhausted */
+    union {
+#ifdef XI_GZIP
+	z_stream xdcu_gzip;	/* zlib state */
+#endif /* XI_GZIP */
+#ifdef XI_XZ
+	lzma_stream xdcu_xz;	/* liblzma state */
+#endif /* XI_XZ */
+#ifdef XI_ZSTD
+	ZSTD_DStream *xdcu_zstd; /* libzstd state */
+#endif /* XI_ZSTD */
+	int xdcu_none;		/* Keep the union non-empty */
+    } xdc_u;
+} xi_decomp_t;
+
+#define xdc_gzip xdc_u.xdcu_gzip
+#define xdc_xz xdc_u.xdcu_xz
+#define xdc_zstd xdc_u.xdcu_zstd
+
+/*
+ * Match the bytes we've seen against our magic numbers.  We return
+ * the match, if any, and set *morep if reading more bytes could
+ * still turn up a match.
+ */
+static const xi_dc_magic_t *
+xi_decomp_match (const char *data, unsigned len, xi_boolean_t *morep)
 {
-    if (srcp->xps_flags & (XPSF_NO_READ | XPSF_EOF_SEEN))
-	return -1;
+    const xi_dc_magic_t *dmp;
+    unsigned cmp;
 
-    unsigned seen = srcp->xps_curp - srcp->xps_bufp;
-    unsigned left = srcp->xps_len - seen;
+    *morep = FALSE;
 
-    if (left == 0) {
-	/* If we've consumed all data, reset it to initial state */
-	srcp->xps_curp = srcp->xps_bufp; /* Reset curp */
-	srcp->xps_len = 0;
+    for (dmp = xi_dc_magic; dmp->xdm_type != XI_DC_NONE; dmp++) {
+	cmp = (len < dmp->xdm_len) ? len : dmp->xdm_len;
+	if (memcmp(data, dmp->xdm_magic, cmp) != 0)
+	    continue;
 
-    } else if (left > 0 && seen > XI_BUFSIZ_COPY_WHEN) {
-	/*
-	 * If we've got data left to copy and we're close to the end,
-	 * copy it.
-	 */
-	memcpy(srcp->xps_bufp, srcp->xps_curp, left);
-	srcp->xps_len = left;
-	srcp->xps_curp = srcp->xps_bufp;
+	if (cmp == dmp->xdm_len)
+	    return dmp;
+
+	*morep = TRUE;
     }
 
-    seen = srcp->xps_curp - srcp->xps_bufp; /* Refresh 'seen' */
+    return NULL;
+}
 
-    /* If there's not enough room, expand the buffer */
-    xi_offset_t space = srcp->xps_size - srcp->xps_len;
-    if (space < XI_BUFSIZ_MIN) {
-	unsigned size = srcp->xps_size << 1; /* Double the buffer size */
-	char *cp = realloc(srcp->xps_bufp, size);
-	if (cp != NULL) {
-	    /* Record new buffer pointer values */
-	    srcp->xps_size = size;
-	    srcp->xps_curp = cp + seen;
-	    srcp->xps_bufp = cp;
+/*
+ * Build the decompressor for the format we found, handing it the
+ * magic bytes we've already read
+ */
+static int
+xi_decomp_init (xi_source_t *srcp, const xi_dc_magic_t *dmp,
+		const char *data, unsigned len)
+{
+    xi_decomp_t *dcp;
+    int ok = FALSE;
 
-	} else if (srcp->xps_size - seen < XI_BUFSIZ_FAIL)
-	    return -1;		/* Not enough room to bother reading */
+    dcp = calloc(1, sizeof(*dcp));
+    if (dcp == NULL)
+	return -1;
+
+    dcp->xdc_inbuf = malloc(XI_DC_BUFSIZ);
+    if (dcp->xdc_inbuf == NULL) {
+	free(dcp);
+	return -1;
     }
 
-    /*
-     * Read as much data as we can, remembering that we may have existing
-     * data already in the buffer.  The first 'xps_len' bytes are precious.
-     */
-    int rc = read(srcp->xps_fd, srcp->xps_bufp + srcp->xps_len,
-		  srcp->xps_size - srcp->xps_len);
-    if (rc <= 0) {
-	srcp->xps_flags |= XPSF_EOF_SEEN;
+    switch (dmp->xdm_type) {
+#ifdef XI_GZIP
+    case XI_DC_GZIP:
+	/* 16 + MAX_WBITS means "gzip wrapper only" */
+	ok = (inflateInit2(&dcp->xdc_gzip, 16 + MAX_WBITS) == Z_OK);
+	break;
+#endif /* XI_GZIP */
+
+#ifdef XI_XZ
+    case XI_DC_XZ: {
+	lzma_stream init = LZMA_STREAM_INIT;
+
+	dcp->xdc_xz = init;
+	ok = (lzma_stream_decoder(&dcp->xdc_xz, UINT64_MAX,
+				  LZMA_CONCATENATED) == LZMA_OK);
+	break;
+    }
+#endif /* XI_XZ */
+
+#ifdef XI_ZSTD
+    case XI_DC_ZSTD:
+	dcp->xdc_zstd = ZSTD_createDStream();
+	ok = (dcp->xdc_zstd != NULL
+	      && !ZSTD_isError(ZSTD_initDStream(dcp->xdc_zstd)));
+	if (!ok && dcp->xdc_zstd)
+	    ZSTD_freeDStream(dcp->xdc_zstd);
+	break;
+#endif /* XI_ZSTD */
+    }
+
+    if (!ok) {
+	xi_source_failure(srcp, 0, "%s input is not supported",
+			  dmp->xdm_name);
+	free(dcp->xdc_inbuf);
+	free(dcp);
 	return -1;
     }
 
-    srcp->xps_len += rc;
+    dcp->xdc_magic = dmp;
+    dcp->xdc_fd = srcp->xps_fd;
+    memcpy(dcp->xdc_inbuf, data, len);
+    dcp->xdc_in_len = len;
 
-    return (rc >= min);
+    srcp->xps_decomp = dcp;
+    return 0;
 }
 
-static inline xi_offset_t
-xi_source_offset (xi_source_t *srcp)
+/*
+ * Look for compressed input.  If it's there, we set up xps_decomp;
+ * if not, the bytes we read are returned in "peek" (and *peek_lenp)
+ * for the caller to put back.  An mmap'd file is checked in place,
+ * and dropped back to read() if it's compressed.
+ */
+static int
+xi_decomp_start (xi_source_t *srcp, char *peek, unsigned *peek_lenp)
 {
-    return srcp->xps_curp - srcp->xps_bufp;
-}
+    const xi_dc_magic_t *dmp;
+    xi_boolean_t more;
+    unsigned len = 0;
+    ssize_t rc;
+
+    if (srcp->xps_flags & XPSF_MMAP_INPUT) {
+	dmp = xi_decomp_match(srcp->xps_bufp,
+			      (srcp->xps_size < XI_DC_MAGIC_MAX)
+			      ? srcp->xps_size : XI_DC_MAGIC_MAX, &more);
+	if (dmp == NULL)
+	    return 0;
+
+	munmap(srcp->xps_bufp, srcp->xps_size);
+	srcp->xps_flags &= ~(XPSF_MMAP_INPUT | XPSF_NO_READ);
+	srcp->xps_bufp = srcp->xps_curp = NULL;
+	srcp->xps_size = 0;
+    }
 
-static inline xi_offset_t
-xi_source_left (xi_source_t *srcp)
-{
-    xi_offset_t seen = srcp->xps_curp - srcp->xps_bufp;
-    return srcp->xps_len - seen;
-}
+    if (srcp->xps_flags & XPSF_NO_READ)
+	return 0;
 
-static inline xi_offset_t
-xi_source_avail (xi_source_t *srcp, xi_offset_t min)
-{
-    xi_offset_t left = xi_source_left(srcp);
+    /*
+     * A pipe may hand us the magic number in pieces, but we don't
+     * want to wait for more once the bytes can't be a match.
+     */
+    do {
+	do {
+	    rc = read(srcp->xps_fd, peek + len, XI_DC_MAGIC_MAX - len);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0) {
+	    xi_source_failure(srcp, errno, "read failed");
+	    return -1;
+	}
 
-    if (left >= min)
-	return left;
+	len += rc;
+	dmp = xi_decomp_match(peek, len, &more);
+    } while (rc > 0 && dmp == NULL && more);
 
-    return xi_source_read(srcp, min);
+    if (dmp)
+	return xi_decomp_init(srcp, dmp, peek, len);
+
+    *peek_lenp = len;
+    return 0;
 }
 
-static xi_offset_t
-xi_source_find (xi_source_t *srcp, int ch, xi_offset_t offset)
+static void
+xi_decomp_stop (xi_source_t *srcp)
 {
-    char *cur;
-
-    for (;;) {
-	if (offset >= srcp->xps_len) {
-	    if (xi_source_read(srcp, 0) < 0)
-		return -1;
-	    offset = xi_source_offset(srcp); /* Recalculate our offset */
-	}
+    xi_decomp_t *dcp = srcp->xps_decomp;
+
+    switch (dcp->xdc_magic->xdm_type) {
+#ifdef XI_GZIP
+    case XI_DC_GZIP:
+	inflateEnd(&dcp->xdc_gzip);
+	break;
+#endif /* XI_GZIP */
+
+#ifdef XI_XZ
+    case XI_DC_XZ:
+	lzma_end(&dcp->xdc_xz);
+	break;
+#endif /* XI_XZ */
+
+#ifdef XI_ZSTD
+    case XI_DC_ZSTD:
+	ZSTD_freeDStream(dcp->xdc_zstd);
+	break;
+#endif /* XI_ZSTD */
+    }
 
-	cur = psu_memchr(srcp->xps_bufp + offset, ch, srcp->xps_len - offset);
-	if (cur != NULL) {
-	    /* We've found it; return the offset */
-	    return cur - srcp->xps_bufp;
-	}
+    free(dcp->xdc_inbuf);
+    free(dcp);
 
-	offset = srcp->xps_len;
-    }
+    srcp->xps_decomp = NULL;
 }
 
 /*
- * Deal with comments.
- *
- * XXX We don't enforce the XML prohibition on the use of "--" within
- * comments.  It makes no sense and is really just a CLR (crummy
- * little rule).  But we should check this if XPSF_VALIDATE is set.
+ * Run the decompressor over whatever input we have, returning the
+ * number of bytes produced, or -1 for corrupt input.  Each format
+ * allows concatenated streams, so we note when we're between them,
+ * which is the only place EOF is allowed.
  */
-static xi_node_type_t
-xi_source_token_comment (xi_source_t *srcp, char **datap,
-			char **restp UNUSED)
+static ssize_t
+xi_decomp_step (xi_decomp_t *dcp, char *buf UNUSED, size_t size UNUSED)
 {
-    const int SKIP_LEN = 4;	/* strlen("<!--") */
-    char *dp, *cp;
-    xi_offset_t off;
+    const char *name = dcp->xdc_magic->xdm_name;
+    unsigned avail UNUSED = dcp->xdc_in_len - dcp->xdc_in_pos;
+    size_t out = 0;
 
-    if (xi_source_avail(srcp, SKIP_LEN) <= 0) {
-	/* Failure; premature EOF */
-	xi_source_failure(srcp, 0, "premature end-of-file: comment");
-	return XI_TYPE_FAIL;
-    }
+    switch (dcp->xdc_magic->xdm_type) {
+#ifdef XI_GZIP
+    case XI_DC_GZIP: {
+	z_stream *zp = &dcp->xdc_gzip;
+	int rc;
 
-    off = xi_source_offset(srcp) + SKIP_LEN; /* Skip "<!--" */
+	zp->next_in = (Bytef *) dcp->xdc_inbuf + dcp->xdc_in_pos;
+	zp->avail_in = avail;
+	zp->next_out = (Bytef *) buf;
+	zp->avail_out = size;
 
-    for (;;) {
-	off = xi_source_find(srcp, '>', off);
-	if (off < 0) {
-	    xi_source_failure(srcp, 0, "missing termination of comment");
-	    return XI_TYPE_FAIL;
-	}
+	rc = inflate(zp, Z_NO_FLUSH);
+	dcp->xdc_in_pos += avail - zp->avail_in;
+	out = size - zp->avail_out;
 
-	cp = &srcp->xps_bufp[off];
-	if (cp[-1] == '-' && cp[-2] == '-')
-	    break;
+	if (rc == Z_STREAM_END) {
+	    dcp->xdc_boundary = TRUE;
+	    inflateReset(zp);
 
-	off += 1;
+	} else if (rc == Z_OK || rc == Z_BUF_ERROR) {
+	    if (zp->avail_in != avail)
+		dcp->xdc_boundary = FALSE;
+
+	} else if (rc == Z_DATA_ERROR && dcp->xdc_boundary) {
+	    /* Trailing garbage after a member; gzip(1) ignores it too */
+	    dcp->xdc_done = TRUE;
+
+	} else {
+	    xi_source_failure(NULL, 0, "%s: %s", name,
+			      zp->msg ?: "corrupt input");
+	    return -1;
+	}
+	break;
     }
+#endif /* XI_GZIP */
 
-    dp = srcp->xps_curp + SKIP_LEN;
-    cp[-2] = '\0';		/* 2 for "--" */
-    xi_source_move_curp(srcp, cp + 1);
+#ifdef XI_XZ
+    case XI_DC_XZ: {
+	lzma_stream *lp = &dcp->xdc_xz;
+	lzma_ret rc;
 
-    if (srcp->xps_flags & XPSF_IGNORE_COMMENTS)
-	return XI_TYPE_SKIP;
+	lp->next_in = (const uint8_t *) dcp->xdc_inbuf + dcp->xdc_in_pos;
+	lp->avail_in = avail;
+	lp->next_out = (uint8_t *) buf;
+	lp->avail_out = size;
 
-    if (srcp->xps_flags & XPSF_TRIM_WS) {
-	cp -= 2;			/* 2 for "--" */
-	dp = xi_skipws(dp, cp - dp, 1); /* Trim leading ws */
-	if (dp != NULL) {
-	    cp -= 1;
-	    cp = xi_skipws(cp, cp - dp, -1); /* Trim trailing ws */
-	    if (cp != NULL)
-		*++cp = '\0';
+	rc = lzma_code(lp, dcp->xdc_in_eof ? LZMA_FINISH : LZMA_RUN);
+	dcp->xdc_in_pos += avail - lp->avail_in;
+	out = size - lp->avail_out;
+
+	if (rc == LZMA_STREAM_END) {
+	    dcp->xdc_boundary = dcp->xdc_done = TRUE;
+
+	} else if (rc != LZMA_OK && rc != LZMA_BUF_ERROR) {
+	    xi_source_failure(NULL, 0, "%s: corrupt input (%d)", name, rc);
+	    return -1;
 	}
+	break;
     }
+#endif /* XI_XZ */
+
+#ifdef XI_ZSTD
+    case XI_DC_ZSTD: {
+	ZSTD_inBuffer in = { dcp->xdc_inbuf + dcp->xdc_in_pos, avail, 0 };
+	ZSTD_outBuffer outb = { buf, size, 0 };
+	size_t rc;
+
+	rc = ZSTD_decompressStream(dcp->xdc_zstd, &outb, &in);
+	if (ZSTD_isError(rc)) {
+	    xi_source_failure(NULL, 0, "%s: %s", name, ZSTD_getErrorName(rc));
+	    return -1;
+	}
 
-    *datap = dp;
+	dcp->xdc_in_pos += in.pos;
+	out = outb.pos;
 
-    return XI_TYPE_COMMENT;
+	/* Zero means the frame is complete and flushed */
+	if (in.pos > 0 || out > 0)
+	    dcp->xdc_boundary = (rc == 0);
+	break;
+    }
+#endif /* XI_ZSTD */
+
+    default:
+	xi_source_failure(NULL, 0, "%s input is not supported", name);
+	return -1;
+    }
+
+    return out;
 }
 
 /*
- * Look for the terminating bit of a "<!DOCTYPE name [ ]>".  Returns a
- * pointer to the tailing '>' character.  Note that the spec allows
- * whitespace between the "]" and the ">", which makes no sense.
+ * Read decompressed data, with read() semantics.  This runs in the
+ * read-ahead thread when there is one.
  */
-static char *
-xi_source_find_brklt1 (xi_source_t *srcp, xi_offset_t off)
+static ssize_t
+xi_decomp_read (xi_decomp_t *dcp, char *buf, size_t size)
 {
-    char *cp, *wp;
+    unsigned pos;
+    ssize_t rc;
 
     for (;;) {
-	off = xi_source_find(srcp, '>', off);
-	if (off < 0)
-	    return NULL;
+	if (dcp->xdc_done)
+	    return 0;
+
+	/* Pending output comes first, even without new input */
+	pos = dcp->xdc_in_pos;
+	rc = xi_decomp_step(dcp, buf, size);
+	if (rc != 0)
+	    return rc;
+
+	if (dcp->xdc_in_pos < dcp->xdc_in_len) {
+	    if (dcp->xdc_in_pos == pos && !dcp->xdc_done) {
+		xi_source_failure(NULL, 0, "%s: decompressor is stuck",
+				  dcp->xdc_magic->xdm_name);
+		errno = EIO;
+		return -1;
+	    }
+	    continue;
+	}
 
-	cp = &srcp->xps_bufp[off];
-	wp = cp - 1;
-	wp = xi_skipws(wp, wp - srcp->xps_bufp, -1); /* Trim trailing ws */
-	if (wp != NULL)
-	    cp = wp + 1;
+	if (dcp->xdc_in_eof) {
+	    if (dcp->xdc_boundary)
+		return 0;
 
+	    xi_source_failure(NULL, 0, "%s: truncated input",
+			      dcp->xdc_magic->xdm_name);
+	    errno = EIO;
+	    return -1;
+	}
 
-	if (cp[-1] == ']')
-	    return cp;
+	do {
+	    rc = read(dcp->xdc_fd, dcp->xdc_inbuf, XI_DC_BUFSIZ);
+	} while (rc < 0 && errno == EINTR);
 
-	off += 1;
+	if (rc < 0)
+	    return -1;
+
+	dcp->xdc_in_pos = 0;
+	dcp->xdc_in_len = rc;
+	if (rc == 0)
+	    dcp->xdc_in_eof = TRUE;
     }
 }
 
 /*
- * Look for the terminating bit of a "<![CDATA[ ]]>".  Returns a pointer
- * to the tailing '>' character.  Note that the spec does not allow
- * any whitespace between the "]]>" characters, nor between the opening
- * characters.
+ * Read raw input, decompressing it if needed
  */
-static char *
-xi_source_find_brklt2 (xi_source_t *srcp, xi_offset_t off)
+static ssize_t
+xi_source_raw_read (int fd, struct xi_decomp_s *dcp, char *buf, size_t size)
 {
-    char *cp;
+    return dcp ? xi_decomp_read(dcp, buf, size) : read(fd, buf, size);
+}
 
-    for (;;) {
-	off = xi_source_find(srcp, '>', off);
-	if (off < 0)
-	    return NULL;
+/*
+ * Read-ahead support.  Normally, we read() when the tokenizer runs
+ * low on data, so the parser stalls waiting for the I/O.  With
+ * XPSF_READ_AHEAD, a helper thread reads into a ring of large
+ * buffers, staying up to XI_RA_COUNT buffers ahead of us, and
+ * xi_source_read() copies from the ring instead of calling read().
+ * The tokenizer still returns pointers into a single contiguous
+ * buffer, so nothing past xi_source_read() knows the difference.
+ * The win is for pipes and cold files, where the reads overlap
+ * with our parsing.
+ */
+#ifdef XI_READ_AHEAD
+
+typedef struct xi_ra_buf_s {
+    char *xrb_data;		/* Buffer (XI_RA_BUFSIZ bytes) */
+    unsigned xrb_len;		/* Number of bytes read into the buffer */
+    unsigned xrb_used;		/* Number of bytes we've consumed */
+} xi_ra_buf_t;
+
+typedef struct xi_read_ahead_s {
+    pthread_t xra_thread;	/* Our helper thread */
+    pthread_mutex_t xra_lock;	/* Protects the fields below */
+    pthread_cond_t xra_filled;	/* Signaled when a buffer is filled */
+    pthread_cond_t xra_drained;	/* Signaled when a buffer is drained */
+    int xra_fd;			/* File being read */
+    struct xi_decomp_s *xra_decomp; /* Decompressor (or NULL) */
+    unsigned xra_head;		/* Next buffer the thread will fill */
+    unsigned xra_tail;		/* Next buffer we will drain */
+    unsigned xra_count;		/* Number of filled buffers */
+    int xra_errno;		/* Error from read(), or zero */
+    uint8_t xra_eof;		/* Thread hit EOF (or an error) */
+    uint8_t xra_stop;		/* Thread should stop */
+    xi_ra_buf_t xra_buf[XI_RA_COUNT]; /* Ring of buffers */
+} xi_read_ahead_t;
 
-	cp = &srcp->xps_bufp[off];
-	if (cp[-1] == ']' && cp[-2] == ']')
-	    return cp;
+static void
+xi_read_ahead_unlock (void *arg)
+{
+    xi_read_ahead_t *rap = arg;
 
-	off += 1;
-    }
+    pthread_mutex_unlock(&rap->xra_lock);
 }
 
 /*
- * DTDs are evil.  We don't support them.  But we need to parse them
- * enough to ignore them, which is not as easy as one would hope.  The
- * twisty little rules are oddly different for each little featurette.
- * You are likely to be eaten by a grue.
+ * The helper thread: fill the next empty buffer, hand it over, and
+ * repeat until EOF or we're told to stop.  read() is a cancellation
+ * point, which lets xi_read_ahead_stop() get us out of a read on a
+ * quiet pipe.
  */
-static xi_node_type_t
-xi_source_token_dtd (xi_source_t *srcp, char **datap, char **restp)
+static void *
+xi_read_ahead_thread (void *arg)
 {
-    xi_offset_t off = xi_source_find(srcp, '>', xi_source_offset(srcp));
-    if (off < 0) {
-	xi_source_failure(srcp, 0, "missing termination of dtd tag");
-	return XI_TYPE_FAIL;
-    }
+    xi_read_ahead_t *rap = arg;
+    xi_ra_buf_t *bufp;
+    ssize_t rc;
 
-    char *dp = srcp->xps_curp + 2; /* 2 for "<!" */
-    char *cp = &srcp->xps_bufp[off];
+    for (;;) {
+	pthread_mutex_lock(&rap->xra_lock);
+	pthread_cleanup_push(xi_read_ahead_unlock, rap);
 
-    /*
-     * Find the attributes, but don't bother parsing them.  Trim whitespace.
+	while (rap->xra_count == XI_RA_COUNT && !rap->xra_stop)
+	    pthread_cond_wait(&rap->xra_drained, &rap->xra_lock);
+
+	bufp = rap->xra_stop ? NULL : &rap->xra_buf[rap->xra_head];
+
+	pthread_cleanup_pop(1);
+
+	if (bufp == NULL)
+	    break;
+
+	/* The buffer is ours until we bump xra_count */
+	do {
+	    rc = xi_source_raw_read(rap->xra_fd, rap->xra_decomp,
+				    bufp->xrb_data, XI_RA_BUFSIZ);
+	} while (rc < 0 && errno == EINTR);
+
+	pthread_mutex_lock(&rap->xra_lock);
+	if (rc <= 0) {
+	    rap->xra_eof = TRUE;
+	    rap->xra_errno = (rc < 0) ? errno : 0;
+	} else {
+	    bufp->xrb_len = rc;
+	    bufp->xrb_used = 0;
+	    rap->xra_head = (rap->xra_head + 1) % XI_RA_COUNT;
+	    rap->xra_count += 1;
+	}
+	pthread_cond_signal(&rap->xra_filled);
+	pthread_mutex_unlock(&rap->xra_lock);
+
+	if (rc <= 0)
+	    break;
+    }
+
+    return NULL;
+}
+
+static void
+xi_read_ahead_free (xi_read_ahead_t *rap)
+{
+    int i;
+
+    for (i = 0; i < XI_RA_COUNT; i++)
+	if (rap->xra_buf[i].xrb_data)
+	    free(rap->xra_buf[i].xrb_data);
+
+    free(rap);
+}
+
+/*
+ * Start the read-ahead thread.  If anything fails, we simply don't
+ * set XPSF_READ_AHEAD, and reads happen inline.
+ */
+static void
+xi_read_ahead_start (xi_source_t *srcp)
+{
+    xi_read_ahead_t *rap;
+    int i;
+
+    rap = calloc(1, sizeof(*rap));
+    if (rap == NULL)
+	return;
+
+    for (i = 0; i < XI_RA_COUNT; i++) {
+	rap->xra_buf[i].xrb_data = malloc(XI_RA_BUFSIZ);
+	if (rap->xra_buf[i].xrb_data == NULL) {
+	    xi_read_ahead_free(rap);
+	    return;
+	}
+    }
+
+    rap->xra_fd = srcp->xps_fd;
+    rap->xra_decomp = srcp->xps_decomp;
+    pthread_mutex_init(&rap->xra_lock, NULL);
+    pthread_cond_init(&rap->xra_filled, NULL);
+    pthread_cond_init(&rap->xra_drained, NULL);
+
+    if (pthread_create(&rap->xra_thread, NULL,
+		       xi_read_ahead_thread, rap) != 0) {
+	pthread_cond_destroy(&rap->xra_drained);
+	pthread_cond_destroy(&rap->xra_filled);
+	pthread_mutex_destroy(&rap->xra_lock);
+	xi_read_ahead_free(rap);
+	return;
+    }
+
+    srcp->xps_read_ahead = rap;
+    srcp->xps_flags |= XPSF_READ_AHEAD;
+}
+
+static void
+xi_read_ahead_stop (xi_source_t *srcp)
+{
+    xi_read_ahead_t *rap = srcp->xps_read_ahead;
+
+    pthread_mutex_lock(&rap->xra_lock);
+    rap->xra_stop = TRUE;
+    if (!rap->xra_eof)
+	pthread_cancel(rap->xra_thread); /* In case it's stuck in read() */
+    pthread_cond_signal(&rap->xra_drained);
+    pthread_mutex_unlock(&rap->xra_lock);
+
+    pthread_join(rap->xra_thread, NULL);
+
+    pthread_cond_destroy(&rap->xra_drained);
+    pthread_cond_destroy(&rap->xra_filled);
+    pthread_mutex_destroy(&rap->xra_lock);
+    xi_read_ahead_free(rap);
+
+    srcp->xps_read_ahead = NULL;
+    srcp->xps_flags &= ~XPSF_READ_AHEAD;
+}
+
+/*
+ * Copy data from the ring into the caller's buffer, with read()
+ * semantics.  We wait for the first filled buffer, but after that
+ * take only what's already there.
+ */
+static ssize_t
+xi_read_ahead_read (xi_source_t *srcp, char *buf, size_t size)
+{
+    xi_read_ahead_t *rap = srcp->xps_read_ahead;
+    xi_ra_buf_t *bufp;
+    size_t len, done = 0;
+
+    pthread_mutex_lock(&rap->xra_lock);
+
+    while (rap->xra_count == 0 && !rap->xra_eof)
+	pthread_cond_wait(&rap->xra_filled, &rap->xra_lock);
+
+    while (done < size && rap->xra_count > 0) {
+	/* Filled buffers belong to us, so we can copy without the lock */
+	bufp = &rap->xra_buf[rap->xra_tail];
+	pthread_mutex_unlock(&rap->xra_lock);
+
+	len = bufp->xrb_len - bufp->xrb_used;
+	if (len > size - done)
+	    len = size - done;
+
+	memcpy(buf + done, bufp->xrb_data + bufp->xrb_used, len);
+	bufp->xrb_used += len;
+	done += len;
+
+	pthread_mutex_lock(&rap->xra_lock);
+	if (bufp->xrb_used == bufp->xrb_len) {
+	    rap->xra_tail = (rap->xra_tail + 1) % XI_RA_COUNT;
+	    rap->xra_count -= 1;
+	    pthread_cond_signal(&rap->xra_drained);
+	}
+    }
+
+    if (done == 0 && rap->xra_errno) {
+	errno = rap->xra_errno;
+	pthread_mutex_unlock(&rap->xra_lock);
+	return -1;
+    }
+
+    pthread_mutex_unlock(&rap->xra_lock);
+    return done;
+}
+
+#else /* XI_READ_AHEAD */
+
+/*
+ * Without threads, XPSF_READ_AHEAD is quietly ignored
+ */
+static void
+xi_read_ahead_start (xi_source_t *srcp UNUSED)
+{
+}
+
+static void
+xi_read_ahead_stop (xi_source_t *srcp UNUSED)
+{
+}
+
+static ssize_t
+xi_read_ahead_read (xi_source_t *srcp UNUSED, char *buf UNUSED,
+		    size_t size UNUSED)
+{
+    return -1;
+}
+
+#endif /* XI_READ_AHEAD */
+
+/*
+ * Input validation (XPSF_VALIDATE).  Every byte we read must be part
+ * of a well-formed UTF-8 sequence, and the character it encodes must
+ * be allowed by the XML "Char" production:
+ *
+ *   #x9 | #xA | #xD | [#x20-#xD7FF] | [#xE000-#xFFFD] | [#x10000-#x10FFFF]
+ *
+ * so overlong forms, surrogates, and most control characters are
+ * rejected.  We check data as it's read, before the tokenizer sees
+ * it, carrying any partial character over to the next read.  Most
+ * input is ASCII, so (where we have SSE2) we test sixteen bytes at
+ * a time for anything that's non-ASCII or a control character, and
+ * only drop into the byte-at-a-time decoder for blocks that have one.
+ *
+ * xi_validate_bytes() is that decoder.  It returns -1 if the bytes
+ * are good, or the offset of the first bad one.
+ */
+static int
+xi_validate_bytes (xi_source_t *srcp, const unsigned char *start,
+		   const unsigned char *end)
+{
+    const unsigned char *cp;
+    uint32_t code = srcp->xps_utf8_code;
+    unsigned need = srcp->xps_utf8_need;
+    unsigned len = srcp->xps_utf8_len;
+    unsigned ch;
+
+    for (cp = start; cp < end; cp++) {
+	ch = *cp;
+
+	if (need == 0) {
+	    if (ch < 0x80) {
+		if (ch < 0x20 && ch != '\t' && ch != '\n' && ch != '\r')
+		    goto fail;
+		continue;
+	    }
+
+	    if (ch < 0xc2)	/* Continuation byte or overlong lead */
+		goto fail;
+	    else if (ch < 0xe0) {
+		need = 1;
+		code = ch & 0x1f;
+	    } else if (ch < 0xf0) {
+		need = 2;
+		code = ch & 0x0f;
+	    } else if (ch < 0xf5) {
+		need = 3;
+		code = ch & 0x07;
+	    } else
+		goto fail;
+
+	    len = need + 1;
+	    continue;
+	}
+
+	if ((ch & 0xc0) != 0x80)
+	    goto fail;
+
+	code = (code << 6) | (ch & 0x3f);
+	if (--need > 0)
+	    continue;
+
+	if ((len == 3 && code < 0x800)
+	    || (len == 4 && (code < 0x10000 || code > 0x10ffff))
+	    || (code >= 0xd800 && code <= 0xdfff)
+	    || code == 0xfffe || code == 0xffff)
+	    goto fail;
+    }
+
+    srcp->xps_utf8_code = code;
+    srcp->xps_utf8_need = need;
+    srcp->xps_utf8_len = len;
+    return -1;
+
+ fail:
+    xi_source_failure(srcp, 0, "invalid character (byte 0x%02x) at offset %u",
+		      *cp, srcp->xps_offset
+		      + (unsigned) ((const char *) cp - srcp->xps_curp));
+    return (const char *) cp - (const char *) start;
+}
+
+/*
+ * Validate newly read data, returning -1 if it's all good, or the
+ * number of good bytes that precede the bad one.
+ */
+static int
+xi_validate (xi_source_t *srcp, const char *data, unsigned len)
+{
+    const unsigned char *cp = (const unsigned char *) data;
+    const unsigned char *ep = cp + len;
+    int rc;
+
+#ifdef __SSE2__
+    const __m128i low = _mm_set1_epi8(0x20);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const unsigned char *bp;
+    __m128i v, bad;
+
+    while (ep - cp >= 16) {
+	/* Finish any partial character before looking at whole blocks */
+	if (srcp->xps_utf8_need == 0) {
+	    v = _mm_loadu_si128((const __m128i *) cp);
+
+	    /*
+	     * Signed compare, so bytes with the high bit set count as
+	     * "less than 0x20" too, catching non-ASCII for free
+	     */
+	    bad = _mm_cmplt_epi8(v, low);
+	    bad = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(v, tab),
+				   _mm_or_si128(_mm_cmpeq_epi8(v, nl),
+						_mm_cmpeq_epi8(v, cr))), bad);
+	    if (_mm_movemask_epi8(bad) == 0) {
+		cp += 16;
+		continue;
+	    }
+	}
+
+	bp = cp;
+	cp += 16;
+	rc = xi_validate_bytes(srcp, bp, cp);
+	if (rc >= 0)
+	    return (bp - (const unsigned char *) data) + rc;
+    }
+#endif /* __SSE2__ */
+
+    rc = xi_validate_bytes(srcp, cp, ep);
+    if (rc >= 0)
+	return (cp - (const unsigned char *) data) + rc;
+
+    return -1;
+}
+
+/*
+ * Mark the end of input, failing validation if it splits a character
+ */
+static void
+xi_source_eof (xi_source_t *srcp)
+{
+    srcp->xps_flags |= XPSF_EOF_SEEN;
+
+    if ((srcp->xps_flags & XPSF_VALIDATE) && srcp->xps_utf8_need) {
+	xi_source_failure(srcp, 0, "truncated character at end of input");
+	srcp->xps_flags |= XPSF_INVALID;
+    }
+}
+
+/*
+ * Read some input data from the source.  If min is non-zero, it's the
+ * minimum number of bytes we'd like to see.
+ */
+static int
+xi_source_read (xi_source_t *srcp, int min)
+{
+    xi_source_stats_t *statsp = srcp->xps_stats;
+    psu_time_nsecs_t start = 0;
+
+    if (srcp->xps_flags & XPSF_EOF_SEEN)
+	return -1;
+
+    /*
+     * A mapped file was validated whole when we opened it, so
+     * running off its end is our EOF, and the only check left is for
+     * a character cut short by the end of the file.
+     */
+    if (srcp->xps_flags & XPSF_NO_READ) {
+	xi_source_eof(srcp);
+	return -1;
+    }
+
+    unsigned seen = srcp->xps_curp - srcp->xps_bufp;
+    unsigned left = srcp->xps_len - seen;
+
+    if (left == 0) {
+	/* If we've consumed all data, reset it to initial state */
+	srcp->xps_curp = srcp->xps_bufp; /* Reset curp */
+	srcp->xps_len = 0;
+
+    } else if (left > 0 && seen > XI_BUFSIZ_COPY_WHEN) {
+	/*
+	 * If we've got data left to copy and we're close to the end,
+	 * copy it.
+	 */
+	memcpy(srcp->xps_bufp, srcp->xps_curp, left);
+	srcp->xps_len = left;
+	srcp->xps_curp = srcp->xps_bufp;
+
+	if (statsp) {
+	    statsp->xss_copies += 1;
+	    statsp->xss_copy_bytes += left;
+	}
+    }
+
+    seen = srcp->xps_curp - srcp->xps_bufp; /* Refresh 'seen' */
+
+    /* If there's not enough room, expand the buffer */
+    xi_offset_t space = srcp->xps_size - srcp->xps_len;
+    if (space < XI_BUFSIZ_MIN) {
+	unsigned size = srcp->xps_size << 1; /* Double the buffer size */
+	char *cp = realloc(srcp->xps_bufp, size);
+	if (cp != NULL) {
+	    /* Record new buffer pointer values */
+	    srcp->xps_size = size;
+	    srcp->xps_curp = cp + seen;
+	    srcp->xps_bufp = cp;
+
+	    if (statsp) {
+		statsp->xss_grows += 1;
+		if (statsp->xss_max_size < size)
+		    statsp->xss_max_size = size;
+	    }
+
+	} else if (srcp->xps_size - seen < XI_BUFSIZ_FAIL)
+	    return -1;		/* Not enough room to bother reading */
+    }
+
+    /*
+     * Read as much data as we can, remembering that we may have existing
+     * data already in the buffer.  The first 'xps_len' bytes are precious.
+     */
+    char *readp = srcp->xps_bufp + srcp->xps_len;
+    size_t readlen = srcp->xps_size - srcp->xps_len;
+
+    if (statsp)
+	start = psu_time_now_nsecs();
+
+    int rc = (srcp->xps_flags & XPSF_READ_AHEAD)
+	? xi_read_ahead_read(srcp, readp, readlen)
+	: xi_source_raw_read(srcp->xps_fd, srcp->xps_decomp, readp, readlen);
+
+    if (statsp) {
+	statsp->xss_read_ns += psu_time_now_nsecs() - start;
+	statsp->xss_reads += 1;
+	if (rc > 0)
+	    statsp->xss_bytes += rc;
+    }
+    if (rc <= 0) {
+	xi_source_eof(srcp);
+	return -1;
+    }
+
+    /*
+     * Bad data is kept from the tokenizer; we hand over what comes
+     * before it and fail the next token.
+     */
+    if (srcp->xps_flags & XPSF_VALIDATE) {
+	int good = xi_validate(srcp, readp, rc);
+	if (good >= 0) {
+	    srcp->xps_flags |= XPSF_EOF_SEEN | XPSF_INVALID;
+	    if (good == 0)
+		return -1;
+	    rc = good;
+	}
+    }
+
+    srcp->xps_len += rc;
+
+    return (rc >= min);
+}
+
+static inline xi_offset_t
+xi_source_offset (xi_source_t *srcp)
+{
+    return srcp->xps_curp - srcp->xps_bufp;
+}
+
+static inline xi_offset_t
+xi_source_left (xi_source_t *srcp)
+{
+    xi_offset_t seen = srcp->xps_curp - srcp->xps_bufp;
+    return srcp->xps_len - seen;
+}
+
+static inline xi_offset_t
+xi_source_avail (xi_source_t *srcp, xi_offset_t min)
+{
+    xi_offset_t left = xi_source_left(srcp);
+
+    if (left >= min)
+	return left;
+
+    return xi_source_read(srcp, min);
+}
+
+static xi_offset_t
+xi_source_find (xi_source_t *srcp, int ch, xi_offset_t offset)
+{
+    char *cur;
+
+    for (;;) {
+	if (offset >= srcp->xps_len) {
+	    if (xi_source_read(srcp, 0) < 0)
+		return -1;
+	    offset = xi_source_offset(srcp); /* Recalculate our offset */
+	}
+
+	cur = psu_memchr(srcp->xps_bufp + offset, ch, srcp->xps_len - offset);
+	if (cur != NULL) {
+	    /* We've found it; return the offset */
+	    return cur - srcp->xps_bufp;
+	}
+
+	offset = srcp->xps_len;
+    }
+}
+
+/*
+ * Deal with comments.
+ *
+ * We only enforce the XML prohibition on the use of "--" within
+ * comments if XPSF_VALIDATE is set.  It makes no sense and is really
+ * just a CLR (crummy little rule).
+ */
+static xi_node_type_t
+xi_source_token_comment (xi_source_t *srcp, char **datap,
+			char **restp UNUSED)
+{
+    const int SKIP_LEN = 4;	/* strlen("<!--") */
+    char *dp, *cp;
+    xi_offset_t off;
+
+    if (xi_source_avail(srcp, SKIP_LEN) <= 0) {
+	/* Failure; premature EOF */
+	xi_source_failure(srcp, 0, "premature end-of-file: comment");
+	return XI_TYPE_FAIL;
+    }
+
+    off = xi_source_offset(srcp) + SKIP_LEN; /* Skip "<!--" */
+
+    for (;;) {
+	off = xi_source_find(srcp, '>', off);
+	if (off < 0) {
+	    xi_source_failure(srcp, 0, "missing termination of comment");
+	    return XI_TYPE_FAIL;
+	}
+
+	cp = &srcp->xps_bufp[off];
+	if (cp[-1] == '-' && cp[-2] == '-')
+	    break;
+
+	off += 1;
+    }
+
+    dp = srcp->xps_curp + SKIP_LEN;
+
+    if (srcp->xps_flags & XPSF_VALIDATE) {
+	/* The body can't contain "--" or end with "-" */
+	char *xp = dp, *ep = cp - 2;
+
+	while ((xp = memchr(xp, '-', ep - xp)) != NULL) {
+	    if (xp + 1 == ep || xp[1] == '-') {
+		xi_source_failure(srcp, 0, "'--' is not allowed in comments");
+		return XI_TYPE_FAIL;
+	    }
+	    xp += 2;
+	}
+    }
+
+    cp[-2] = '\0';		/* 2 for "--" */
+    xi_source_move_curp(srcp, cp + 1);
+
+    if (srcp->xps_flags & XPSF_IGNORE_COMMENTS)
+	return XI_TYPE_SKIP;
+
+    if (srcp->xps_flags & XPSF_TRIM_WS) {
+	cp -= 2;			/* 2 for "--" */
+	dp = xi_skipws(dp, cp - dp, 1); /* Trim leading ws */
+	if (dp != NULL) {
+	    cp -= 1;
+	    cp = xi_skipws(cp, cp - dp, -1); /* Trim trailing ws */
+	    if (cp != NULL)
+		*++cp = '\0';
+	}
+    }
+
+    *datap = dp;
+
+    return XI_TYPE_COMMENT;
+}
+
+/*
+ * Look for the terminating bit of a "<!DOCTYPE name [ ]>".  Returns a
+ * pointer to the tailing '>' character.  Note that the spec allows
+ * whitespace between the "]" and the ">", which makes no sense.
+ */
+static char *
+xi_source_find_brklt1 (xi_source_t *srcp, xi_offset_t off)
+{
+    char *cp, *wp;
+
+    for (;;) {
+	off = xi_source_find(srcp, '>', off);
+	if (off < 0)
+	    return NULL;
+
+	cp = &srcp->xps_bufp[off];
+	wp = cp - 1;
+	wp = xi_skipws(wp, wp - srcp->xps_bufp, -1); /* Trim trailing ws */
+	if (wp != NULL)
+	    cp = wp + 1;
+
+
+	if (cp[-1] == ']')
+	    return cp;
+
+	off += 1;
+    }
+}
+
+/*
+ * Look for the terminating bit of a "<![CDATA[ ]]>".  Returns a pointer
+ * to the tailing '>' character.  Note that the spec does not allow
+ * any whitespace between the "]]>" characters, nor between the opening
+ * characters.
+ */
+static char *
+xi_source_find_brklt2 (xi_source_t *srcp, xi_offset_t off)
+{
+    char *cp;
+
+    for (;;) {
+	off = xi_source_find(srcp, '>', off);
+	if (off < 0)
+	    return NULL;
+
+	cp = &srcp->xps_bufp[off];
+	if (cp[-1] == ']' && cp[-2] == ']')
+	    return cp;
+
+	off += 1;
+    }
+}
+
+/*
+ * DTDs are evil.  We don't support them.  But we need to parse them
+ * enough to ignore them, which is not as easy as one would hope.  The
+ * twisty little rules are oddly different for each little featurette.
+ * You are likely to be eaten by a grue.
+ */
+static xi_node_type_t
+xi_source_token_dtd (xi_source_t *srcp, char **datap, char **restp)
+{
+    xi_offset_t off = xi_source_find(srcp, '>', xi_source_offset(srcp));
+    if (off < 0) {
+	xi_source_failure(srcp, 0, "missing termination of dtd tag");
+	return XI_TYPE_FAIL;
+    }
+
+    char *dp = srcp->xps_curp + 2; /* 2 for "<!" */
+    char *cp = &srcp->xps_bufp[off];
+
+    /*
+     * Find the attributes, but don't bother parsing them.  Trim whitespace.
+     */
+    char *rp = psu_memchr(dp, ' ', cp + 1 - dp);
+    if (rp != NULL) {
+	*rp++ = '\0';
+	rp = xi_skipws(rp, cp + 1 - rp, 1);
+	if (rp != NULL && *rp == '\0')
+	    rp = NULL;
+	else if (strcmp(dp, "DOCTYPE") == 0) {
+	    /*
+	     * <!DOCTYPE> is it's own little bit of hell.  We need to handle
+	     * the case where an internal DTD appears as a chunk of XML
+	     * with the <!DOCTYPE> tag.  Nested tags.  How wonderful.
+	     */
+	    char *xp = psu_memchr(rp, ' ', cp + 1 - rp);
+	    if (xp != NULL) {
+		xp = xi_skipws(xp, strlen(xp), 1);
+		if (xp) {
+		    char *zp = psu_memchr(xp, ' ', cp + 1 - xp);
+		    if (xp[0] == '[' || (zp != NULL && zp[1] == '[')) {
+			/*
+			 * Bad news!  The input has an internal DTD, which
+			 * means finding the ">" wasn't enough.  We need to
+			 * find the terminating "]>".  For details:
+			 * https://www.w3.org/TR/xml/#NT-intSubset
+			 */
+			cp = xi_source_find_brklt1(srcp, xp - srcp->xps_bufp);
+		    }
+		}
+	    }
+	}
+    }
+
+    *cp++ = '\0';		/* Whack the '>' */
+    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+
+    if (srcp->xps_flags & XPSF_IGNORE_DTD)
+	return XI_TYPE_SKIP;
+
+    *datap = dp;
+    *restp = rp;
+
+    return XI_TYPE_DTD;
+}
+
+/*
+ * Handle the case where we see "<![".  Don't panic.  We're mostly
+ * ignoring these bits of fluff, but we do handle CDATA, because
+ * it's fairly trivial.
+ */
+static xi_node_type_t
+xi_source_token_bracket (xi_source_t *srcp, char **datap UNUSED,
+			char **restp UNUSED)
+{
+    if (xi_source_avail(srcp, 4) <= 0) {
+	/* Failure; premature EOF */
+	xi_source_failure(srcp, 0, "premature end-of-file: bracket");
+	return XI_TYPE_FAIL;
+    }
+
+    char *dp = srcp->xps_curp;
+    int cdata = (strncmp(dp, "<![CDATA[", 9) == 0);
+    dp += 9;
+
+    xi_offset_t off = xi_source_offset(srcp) + 3; /* Skip "<![" */
+    char *cp = xi_source_find_brklt2(srcp, off);
+    if (cp == NULL) {
+	xi_source_failure(srcp, 0, "premature end-of-file: bracket");
+	return XI_TYPE_FAIL;
+    }
+
+    cp[-2] = '\0';
+    xi_source_move_curp(srcp, cp + 1);
+
+    if (cdata) {
+	*datap = dp;
+	*restp = cp - 2;
+	return XI_TYPE_CDATA;
+    }
+
+    return XI_TYPE_SKIP;
+}
+
+/*
+ * XML magical happenings!!  Unfortunately, the XML spec create an
+ * annoyingly complex set of features.  The most common is the comment
+ * (<!-- comment -->) but there are also <!DOCTYPE>, <!ELEMENT>,
+ * <!ATTLIST>, <![IGNORE[]]>, <![INCLUDE[]]>, and everyone's favorite,
+ * <!ENTITY>.  Don't get me started....
+ *
+ * Fortunately, most of these can be (read: will be) ignored (for now).
+ * And since they are chiefly targeted as human writers and IMHO
+ * humans should never need to write XML content, we're really
+ * not losing anything.
+ */
+static xi_node_type_t
+xi_source_token_magic (xi_source_t *srcp, char **datap,
+		      char **restp)
+{
+    if (xi_source_avail(srcp, 4) <= 0) {
+	/* Failure; premature EOF */
+	xi_source_failure(srcp, 0, "premature end-of-file: xml");
+	return XI_TYPE_FAIL;
+
+    } else if (srcp->xps_curp[2] == '-' && srcp->xps_curp[3] == '-') {
+	/* Comment tag */
+	return xi_source_token_comment(srcp, datap, restp);
+
+    } else if (srcp->xps_curp[2] == '[') {
+	/* 'bracket' == '<![xxx]]>'.  We ignore the conents */
+	return xi_source_token_bracket(srcp, datap, restp);
+
+    } else if (isalpha((int) srcp->xps_curp[2])) {
+	/* <!XXX> tag */
+	return xi_source_token_dtd(srcp, datap, restp);
+
+    } else {
+	xi_source_failure(srcp, 0, "unhandled xml magic");
+	return XI_TYPE_FAIL;
+    }
+}
+
+static xi_node_type_t
+xi_source_token_pi (xi_source_t *srcp, char **datap,
+		   char **restp)
+{
+    if (xi_source_avail(srcp, 4) <= 0) {
+	/* Failure; premature EOF */
+	xi_source_failure(srcp, 0, "premature end-of-file: " XI_PI);
+	return XI_TYPE_FAIL;
+    }
+
+    xi_offset_t off = xi_source_find(srcp, '>', xi_source_offset(srcp));
+    if (off < 0) {
+	xi_source_failure(srcp, 0, "missing termination of " XI_PI);
+	return XI_TYPE_FAIL;
+    }
+
+    char *dp = srcp->xps_curp + 2;
+    char *cp = &srcp->xps_bufp[off];
+    char *ep = cp;
+
+    if (ep < dp + 2 || ep[-1] != '?') {
+	xi_source_failure(srcp, 0, "invalid termination of " XI_PI);
+	return XI_TYPE_FAIL;
+    }
+
+    *--ep = '\0';		/* Whach the '?' */
+    *cp++ = '\0';		/* Whack the '>' */
+    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+
+    /* Should not be any sort of whitespace before the target, but .. */
+    dp = xi_skipws(dp, ep - dp, 1);
+    if (dp == NULL) {
+	xi_source_failure(srcp, 0, "invalid target of " XI_PI);
+	return XI_TYPE_FAIL;
+    }
+
+    /*
+     * Find the attributes, but don't bother parsing them.  Trim whitespace.
+     */
+    char *rp = psu_memchr(dp, ' ', ep - dp);
+    if (rp != NULL) {
+	*rp++ = '\0';
+	rp = xi_skipws(rp, ep - rp, 1);
+	if (rp != NULL && *rp == '\0')
+	    rp = NULL;
+    }
+
+    *datap = dp;
+    *restp = rp;
+
+    return XI_TYPE_PI;
+}
+
+static xi_node_type_t
+xi_source_token_open (xi_source_t *srcp, char **datap, char **restp)
+{
+    xi_node_type_t token = XI_TYPE_OPEN;
+
+    xi_offset_t off = xi_source_find(srcp, '>', xi_source_offset(srcp));
+    if (off < 0) {
+	xi_source_failure(srcp, 0, "missing termination of open tag");
+	return XI_TYPE_FAIL;
+    }
+
+    char *dp = srcp->xps_curp + 1;
+    char *cp = &srcp->xps_bufp[off];
+
+    if (dp < cp && cp[-1] == '/') { /* Spec says no space between "/>" */
+	token = XI_TYPE_EMPTY;
+	cp[-1] = '\0';		/* Back up over '/' */
+    }
+
+    *cp++ = '\0';		/* Whack the '>' */
+    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+
+    /*
+     * Find the attributes, but don't bother parsing them.  Trim whitespace.
+     */
+    char *rp = psu_memchr(dp, ' ', cp - dp);
+    if (rp != NULL) {
+	*rp++ = '\0';
+	rp = xi_skipws(rp, cp - rp, 1);
+	if (rp != NULL && *rp == '\0')
+	    rp = NULL;
+    }
+
+    *datap = dp;
+    *restp = rp;
+
+    return token;
+}
+
+static xi_node_type_t
+xi_source_token_close (xi_source_t *srcp, char **datap)
+{
+    xi_offset_t off = xi_source_find(srcp, '>', xi_source_offset(srcp));
+    if (off < 0) {
+	xi_source_failure(srcp, 0, "missing termination of close tag");
+	return XI_TYPE_FAIL;
+    }
+
+    char *dp = srcp->xps_curp + 2; /* Skip "</" */
+    char *cp = &srcp->xps_bufp[off];
+    *cp++ = '\0';		/* Whack the '>' */
+    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+
+    *datap = dp;
+
+    return XI_TYPE_CLOSE;
+}
+
+static xi_node_type_t
+xi_source_token_text (xi_source_t *srcp, char **datap, char **restp)
+{
+    xi_offset_t off = xi_source_find(srcp, '<', xi_source_offset(srcp));
+    if (off < 0) {
+	xi_offset_t left = xi_source_left(srcp);
+	if (left == 0) {
+	    xi_source_failure(srcp, 0, "missing termination of text");
+	    return XI_TYPE_FAIL;
+	}
+
+	off = srcp->xps_len;
+    }
+
+    /*
+     * We can't NUL-terminate our strings, so we use 'restp' to return
+     * the end-of-string marker.
      */
-    char *rp = psu_memchr(dp, ' ', cp + 1 - dp);
-    if (rp != NULL) {
-	*rp++ = '\0';
-	rp = xi_skipws(rp, cp + 1 - rp, 1);
-	if (rp != NULL && *rp == '\0')
-	    rp = NULL;
-	else if (strcmp(dp, "DOCTYPE") == 0) {
-	    /*
-	     * <!DOCTYPE> is it's own little bit of hell.  We need to handle
-	     * the case where an internal DTD appears as a chunk of XML
-	     * with the <!DOCTYPE> tag.  Nested tags.  How wonderful.
-	     */
-	    char *xp = psu_memchr(rp, ' ', cp + 1 - rp);
-	    if (xp != NULL) {
-		xp = xi_skipws(xp, strlen(xp), 1);
-		if (xp) {
-		    char *zp = psu_memchr(xp, ' ', cp + 1 - xp);
-		    if (xp[0] == '[' || (zp != NULL && zp[1] == '[')) {
-			/*
-			 * Bad news!  The input has an internal DTD, which
-			 * means finding the ">" wasn't enough.  We need to
-			 * find the terminating "]>".  For details:
-			 * https://www.w3.org/TR/xml/#NT-intSubset
-			 */
-			cp = xi_source_find_brklt1(srcp, xp - srcp->xps_bufp);
-		    }
+    char *dp = srcp->xps_curp;
+    char *cp = &srcp->xps_bufp[off];
+    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+
+    if (srcp->xps_flags & XPSF_TRIM_WS) {
+	dp = xi_skipws(dp, cp - dp, 1); /* Trim leading ws */
+	if (dp == NULL)			/* Nothing but ws */
+	    cp = NULL;
+	else {
+	    char *wp = cp - 1;
+	    wp = xi_skipws(wp, wp - dp, -1); /* Trim trailing ws */
+	    if (wp != NULL)
+		cp = wp + 1;
+	}
+    }
+
+    *datap = dp;
+    *restp = cp;		/* Restp is the end of text */
+
+    return XI_TYPE_TEXT;
+}
+
+static void
+xi_source_ignorews (xi_source_t *srcp)
+{
+    xi_offset_t off = xi_source_offset(srcp); /* Starting point */
+    char *cp;
+
+    for (cp = &srcp->xps_bufp[off]; xi_isspace(*cp); cp++, off++) {
+	if (off >= srcp->xps_len) {
+	    if (xi_source_read(srcp, 0) < 0)
+		return;
+	    cp = &srcp->xps_bufp[off]; /* Refresh */
+	}
+    }
+
+    if (*cp != '<')
+	return;
+
+    xi_source_move_curp(srcp, cp);	/* Skip over whitespace */
+}
+
+
+/*
+ * JSON input.  Rather than build a separate tree model, we turn JSON
+ * into the same XML tokens that slaxJsonDataToXml() would have turned
+ * into libxml2 nodes, so the rest of libxi (rules, insertion,
+ * emitting) doesn't know or care.  The mapping matches libslax:
+ *
+ *   - the document element is <json>
+ *   - object members become elements named after the member; names
+ *     that aren't valid XML names become <element name="...">
+ *   - array items become <member> elements, and the array's element
+ *     gets type="array"
+ *   - numbers, true, false, and null get type="number", etc., while
+ *     strings and objects inside arrays get type="member"
+ *
+ * Since one JSON construct becomes several tokens (an open tag, some
+ * text, and a close tag), we run a small state machine, handing back
+ * one token per call.  Strings are decoded in place and returned as
+ * XI_TYPE_UNESC, since they're already unescaped.  Names live in our
+ * own buffer, since we need them again for the close tag.
+ */
+
+#define XI_JSON_DEPTH_MAX	254 /* Max nesting (matches XI_DEPTH_MAX) */
+#define XI_JSON_BUFSIZ		1024 /* Initial size for our buffers */
+
+#define XI_JSON_ELT_JSON	"json"
+#define XI_JSON_ELT_ELEMENT	"element"
+#define XI_JSON_ELT_MEMBER	"member"
+
+#define XI_JSON_ATT_NAME	"name"
+#define XI_JSON_ATT_TYPE	"type"
+
+#define XI_JSON_VAL_ARRAY	"array"
+#define XI_JSON_VAL_FALSE	"false"
+#define XI_JSON_VAL_MEMBER	"member"
+#define XI_JSON_VAL_NULL	"null"
+#define XI_JSON_VAL_NUMBER	"number"
+#define XI_JSON_VAL_TRUE	"true"
+
+/* Values for xj_state */
+#define XJS_START	0	/* Before the top-level value */
+#define XJS_VALUE	1	/* Value for the innermost element is next */
+#define XJS_ITEM	2	/* Next member/item or end of container */
+#define XJS_AFTER	3	/* After an item: ',' or end of container */
+#define XJS_CLOSE	4	/* Close the innermost element */
+#define XJS_DONE	5	/* All done */
+
+/* Values for xje_container */
+#define XJC_NONE	0	/* Value is a simple value */
+#define XJC_OBJECT	1	/* Value is an object ('{') */
+#define XJC_ARRAY	2	/* Value is an array ('[') */
+
+typedef struct xi_json_elt_s {
+    unsigned xje_name;		/* Offset of our name in xj_names */
+    uint8_t xje_container;	/* Type of our value (XJC_*) */
+} xi_json_elt_t;
+
+typedef struct xi_json_s {
+    unsigned xj_state;		/* Current state (XJS_*) */
+    unsigned xj_depth;		/* Number of open elements */
+    xi_json_elt_t xj_stack[XI_JSON_DEPTH_MAX]; /* Open elements */
+    char *xj_names;		/* Names of open elements */
+    unsigned xj_names_len;	/* Bytes used in xj_names */
+    unsigned xj_names_size;	/* Size of xj_names */
+    char *xj_attrs;		/* Attributes for open tags */
+    unsigned xj_attrs_size;	/* Size of xj_attrs */
+} xi_json_t;
+
+static xi_json_t *
+xi_json_create (void)
+{
+    xi_json_t *jp = calloc(1, sizeof(*jp));
+
+    if (jp == NULL)
+	return NULL;
+
+    jp->xj_names = malloc(XI_JSON_BUFSIZ);
+    jp->xj_attrs = malloc(XI_JSON_BUFSIZ);
+    if (jp->xj_names == NULL || jp->xj_attrs == NULL) {
+	free(jp->xj_names);
+	free(jp->xj_attrs);
+	free(jp);
+	return NULL;
+    }
+
+    jp->xj_names_size = jp->xj_attrs_size = XI_JSON_BUFSIZ;
+    return jp;
+}
+
+static void
+xi_json_destroy (xi_json_t *jp)
+{
+    free(jp->xj_names);
+    free(jp->xj_attrs);
+    free(jp);
+}
+
+/*
+ * Is this a name we can use as an XML element name?  We're stricter
+ * than XML, since a ':' would be taken as a prefix.
+ */
+static int
+xi_json_valid_name (const char *name, size_t len)
+{
+    const unsigned char *cp = (const unsigned char *) name;
+    const unsigned char *ep = cp + len;
+
+    if (len == 0 || !(isalpha(*cp) || *cp == '_' || *cp >= 0x80))
+	return FALSE;
+
+    for (cp++; cp < ep; cp++) {
+	if (!(isalnum(*cp) || *cp == '_' || *cp == '-' || *cp == '.'
+	      || *cp >= 0x80))
+	    return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Record the name for a new element, returning its offset in
+ * xj_names, or -1 on failure.  Names are NUL-terminated.
+ */
+static int
+xi_json_push_name (xi_json_t *jp, const char *name, size_t len)
+{
+    unsigned off = jp->xj_names_len;
+    unsigned need = off + len + 1;
+
+    if (need > jp->xj_names_size) {
+	unsigned size = jp->xj_names_size;
+	while (size < need)
+	    size <<= 1;
+
+	char *cp = realloc(jp->xj_names, size);
+	if (cp == NULL)
+	    return -1;
+
+	jp->xj_names = cp;
+	jp->xj_names_size = size;
+    }
+
+    memmove(jp->xj_names + off, name, len);
+    jp->xj_names[off + len] = '\0';
+    jp->xj_names_len = need;
+
+    return off;
+}
+
+/*
+ * Build the attribute string for an open tag.  "name" is the
+ * original member name, when it wasn't valid as an element name.
+ * Returns NULL if there are no attributes.
+ */
+static char *
+xi_json_attrs (xi_json_t *jp, const char *name, const char *type)
+{
+    static const char type_attr[] = " " XI_JSON_ATT_TYPE "=\"";
+    static const char name_attr[] = XI_JSON_ATT_NAME "=\"";
+    size_t need, len = name ? strlen(name) : 0;
+    char *cp;
+
+    if (name == NULL && type == NULL)
+	return NULL;
+
+    /* Worst case: every byte of the name needs "&quot;" */
+    need = sizeof(name_attr) + len * 6 + sizeof(type_attr) + 16 + 1;
+    if (need > jp->xj_attrs_size) {
+	cp = realloc(jp->xj_attrs, need);
+	if (cp == NULL)
+	    return NULL;
+
+	jp->xj_attrs = cp;
+	jp->xj_attrs_size = need;
+    }
+
+    cp = jp->xj_attrs;
+
+    if (name) {
+	memcpy(cp, name_attr, sizeof(name_attr) - 1);
+	cp += sizeof(name_attr) - 1;
+
+	for ( ; *name; name++) {
+	    switch (*name) {
+	    case '&':
+		memcpy(cp, "&amp;", 5);
+		cp += 5;
+		break;
+	    case '<':
+		memcpy(cp, "&lt;", 4);
+		cp += 4;
+		break;
+	    case '>':
+		memcpy(cp, "&gt;", 4);
+		cp += 4;
+		break;
+	    case '"':
+		memcpy(cp, "&quot;", 6);
+		cp += 6;
+		break;
+	    default:
+		*cp++ = *name;
+	    }
+	}
+
+	*cp++ = '"';
+    }
+
+    if (type) {
+	if (cp == jp->xj_attrs) {
+	    memcpy(cp, type_attr + 1, sizeof(type_attr) - 2);
+	    cp += sizeof(type_attr) - 2;
+	} else {
+	    memcpy(cp, type_attr, sizeof(type_attr) - 1);
+	    cp += sizeof(type_attr) - 1;
+	}
+
+	len = strlen(type);
+	memcpy(cp, type, len);
+	cp += len;
+	*cp++ = '"';
+    }
+
+    *cp = '\0';
+    return jp->xj_attrs;
+}
+
+/*
+ * The "type" attribute for a value, based on its first character.
+ * Strings and objects get no type, unless they are array members.
+ */
+static const char *
+xi_json_value_type (int ch, int member)
+{
+    switch (ch) {
+    case '[':
+	return XI_JSON_VAL_ARRAY;
+
+    case '{':
+    case '"':
+	return member ? XI_JSON_VAL_MEMBER : NULL;
+
+    case 't':
+	return XI_JSON_VAL_TRUE;
+
+    case 'f':
+	return XI_JSON_VAL_FALSE;
+
+    case 'n':
+	return XI_JSON_VAL_NULL;
+
+    default:
+	return XI_JSON_VAL_NUMBER;
+    }
+}
+
+/*
+ * Skip whitespace, returning the next character (which is left in
+ * the buffer) or -1 at EOF.
+ */
+static int
+xi_json_peek (xi_source_t *srcp)
+{
+    char *cp, *ep;
+
+    for (;;) {
+	cp = srcp->xps_curp;
+	ep = srcp->xps_bufp + srcp->xps_len;
+
+	while (cp < ep && xi_isspace(*cp))
+	    cp += 1;
+
+	xi_source_move_curp(srcp, cp);
+
+	if (cp < ep)
+	    return *(unsigned char *) cp;
+
+	if (xi_source_read(srcp, 0) < 0)
+	    return -1;
+    }
+}
+
+/*
+ * Find the length of a bare token (number, literal, or unquoted
+ * name) at the current point, reading more data as needed.
+ */
+static xi_offset_t
+xi_json_scan (xi_source_t *srcp)
+{
+    xi_offset_t rel = 0;
+    int ch;
+
+    for (;;) {
+	while (rel < xi_source_left(srcp)) {
+	    ch = srcp->xps_curp[rel];
+	    if (xi_isspace(ch) || strchr(",:[]{}\"", ch) != NULL)
+		return rel;
+	    rel += 1;
+	}
+
+	if (xi_source_read(srcp, 0) < 0)
+	    return rel;		/* EOF ends the token */
+    }
+}
+
+static int
+xi_json_hex4 (const char *cp, unsigned long *valp)
+{
+    unsigned long val = 0;
+    int i;
+
+    for (i = 0; i < 4; i++, cp++) {
+	val <<= 4;
+	if (*cp >= '0' && *cp <= '9')
+	    val |= *cp - '0';
+	else if (*cp >= 'a' && *cp <= 'f')
+	    val |= *cp - 'a' + 10;
+	else if (*cp >= 'A' && *cp <= 'F')
+	    val |= *cp - 'A' + 10;
+	else
+	    return -1;
+    }
+
+    *valp = val;
+    return 0;
+}
+
+static char *
+xi_json_utf8 (char *cp, unsigned long ch)
+{
+    if (ch < 0x80) {
+	*cp++ = ch;
+    } else if (ch < 0x800) {
+	*cp++ = 0xc0 | (ch >> 6);
+	*cp++ = 0x80 | (ch & 0x3f);
+    } else if (ch < 0x10000) {
+	*cp++ = 0xe0 | (ch >> 12);
+	*cp++ = 0x80 | ((ch >> 6) & 0x3f);
+	*cp++ = 0x80 | (ch & 0x3f);
+    } else {
+	*cp++ = 0xf0 | (ch >> 18);
+	*cp++ = 0x80 | ((ch >> 12) & 0x3f);
+	*cp++ = 0x80 | ((ch >> 6) & 0x3f);
+	*cp++ = 0x80 | (ch & 0x3f);
+    }
+
+    return cp;
+}
+
+/*
+ * Decode JSON backslash escapes in place, returning the new length.
+ * The encoded forms are always at least as long as the UTF-8 they
+ * turn into, so we never run into ourselves.
+ */
+static size_t
+xi_json_unescape (xi_source_t *srcp, char *start, size_t len)
+{
+    char *from, *to, *end = start + len;
+    unsigned long ch, low;
+
+    to = psu_memchr(start, '\\', len);
+    if (to == NULL)
+	return len;
+
+    for (from = to; from < end; ) {
+	if (*from != '\\') {
+	    *to++ = *from++;
+	    continue;
+	}
+
+	if (from + 1 >= end)
+	    break;
+
+	from += 2;
+	switch (from[-1]) {
+	case '"':
+	case '\\':
+	case '/':
+	    *to++ = from[-1];
+	    break;
+
+	case 'b':
+	    *to++ = '\b';
+	    break;
+
+	case 'f':
+	    *to++ = '\f';
+	    break;
+
+	case 'n':
+	    *to++ = '\n';
+	    break;
+
+	case 'r':
+	    *to++ = '\r';
+	    break;
+
+	case 't':
+	    *to++ = '\t';
+	    break;
+
+	case 'u':
+	    if (end - from < 4 || xi_json_hex4(from, &ch) < 0) {
+		xi_source_failure(srcp, 0, "invalid \\u escape in string");
+		break;
+	    }
+	    from += 4;
+
+	    /* Surrogates come in pairs; lonely ones become U+FFFD */
+	    if (ch >= 0xd800 && ch < 0xdc00) {
+		if (end - from >= 6 && from[0] == '\\' && from[1] == 'u'
+		    && xi_json_hex4(from + 2, &low) == 0
+		    && low >= 0xdc00 && low < 0xe000) {
+		    ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+		    from += 6;
+		} else {
+		    ch = 0xfffd;
 		}
+	    } else if (ch >= 0xdc00 && ch < 0xe000) {
+		ch = 0xfffd;
 	    }
+
+	    to = xi_json_utf8(to, ch);
+	    break;
+
+	default:
+	    xi_source_failure(srcp, 0, "invalid escape '\\%c' in string",
+			      from[-1]);
+	    *to++ = from[-1];
 	}
     }
 
-    *cp++ = '\0';		/* Whack the '>' */
-    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+    return to - start;
+}
+
+/*
+ * Find the string at the current point (which is a '"'), decode it,
+ * and move past it.  The decoded string is left in our buffer,
+ * good until the next read.
+ */
+static int
+xi_json_string (xi_source_t *srcp, char **datap, char **restp)
+{
+    xi_offset_t off, rel = 1;
+    char *dp, *cp;
+
+    for (;;) {
+	off = xi_source_find(srcp, '"', xi_source_offset(srcp) + rel);
+	if (off < 0) {
+	    xi_source_failure(srcp, 0, "missing termination of string");
+	    return -1;
+	}
+
+	/* An odd number of backslashes means the quote is escaped */
+	dp = srcp->xps_curp + 1;
+	cp = &srcp->xps_bufp[off];
+	if (cp < dp) {		/* Found our opening quote (after a read) */
+	    rel = 1;
+	    continue;
+	}
+
+	for (rel = 0; cp - rel > dp && cp[-rel - 1] == '\\'; rel++)
+	    continue;
+
+	if ((rel & 1) == 0)
+	    break;
 
-    if (srcp->xps_flags & XPSF_IGNORE_DTD)
-	return XI_TYPE_SKIP;
+	rel = cp - srcp->xps_curp + 1;
+    }
 
-    *datap = dp;
-    *restp = rp;
+    /* Move first, so line numbers are counted on the raw data */
+    xi_source_move_curp(srcp, cp + 1);
 
-    return XI_TYPE_DTD;
+    *datap = dp;
+    *restp = dp + xi_json_unescape(srcp, dp, cp - dp);
+    return 0;
 }
 
 /*
- * Handle the case where we see "<![".  Don't panic.  We're mostly
- * ignoring these bits of fluff, but we do handle CDATA, because
- * it's fairly trivial.
+ * Is this bare token a valid JSON value?  That's one of the three
+ * literals, or a number:
+ *     -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][-+]?[0-9]+)?
  */
-static xi_node_type_t
-xi_source_token_bracket (xi_source_t *srcp, char **datap UNUSED,
-			char **restp UNUSED)
+static int
+xi_json_valid_bare (const char *cp, size_t len)
 {
-    if (xi_source_avail(srcp, 4) <= 0) {
-	/* Failure; premature EOF */
-	xi_source_failure(srcp, 0, "premature end-of-file: bracket");
-	return XI_TYPE_FAIL;
-    }
+    const char *ep = cp + len;
 
-    char *dp = srcp->xps_curp;
-    int cdata = (strncmp(dp, "<![CDATA[", 9) == 0);
-    dp += 9;
+    if ((len == 4 && memcmp(cp, "true", 4) == 0)
+	    || (len == 5 && memcmp(cp, "false", 5) == 0)
+	    || (len == 4 && memcmp(cp, "null", 4) == 0))
+	return TRUE;
 
-    xi_offset_t off = xi_source_offset(srcp) + 3; /* Skip "<![" */
-    char *cp = xi_source_find_brklt2(srcp, off);
-    if (cp == NULL) {
-	xi_source_failure(srcp, 0, "premature end-of-file: bracket");
-	return XI_TYPE_FAIL;
-    }
+    if (cp < ep && *cp == '-')
+	cp += 1;
 
-    cp[-2] = '\0';
-    xi_source_move_curp(srcp, cp + 1);
+    /* No leading zeros, so "0" stands alone */
+    if (cp < ep && *cp == '0')
+	cp += 1;
+    else if (cp < ep && isdigit((unsigned char) *cp))
+	while (cp < ep && isdigit((unsigned char) *cp))
+	    cp += 1;
+    else
+	return FALSE;
+
+    if (cp < ep && *cp == '.') {
+	cp += 1;
+	if (cp == ep || !isdigit((unsigned char) *cp))
+	    return FALSE;
+	while (cp < ep && isdigit((unsigned char) *cp))
+	    cp += 1;
+    }
 
-    if (cdata) {
-	*datap = dp;
-	*restp = cp - 2;
-	return XI_TYPE_CDATA;
+    if (cp < ep && (*cp == 'e' || *cp == 'E')) {
+	cp += 1;
+	if (cp < ep && (*cp == '-' || *cp == '+'))
+	    cp += 1;
+	if (cp == ep || !isdigit((unsigned char) *cp))
+	    return FALSE;
+	while (cp < ep && isdigit((unsigned char) *cp))
+	    cp += 1;
     }
 
-    return XI_TYPE_SKIP;
+    return (cp == ep);
 }
 
 /*
- * XML magical happenings!!  Unfortunately, the XML spec create an
- * annoyingly complex set of features.  The most common is the comment
- * (<!-- comment -->) but there are also <!DOCTYPE>, <!ELEMENT>,
- * <!ATTLIST>, <![IGNORE[]]>, <![INCLUDE[]]>, and everyone's favorite,
- * <!ENTITY>.  Don't get me started....
- *
- * Fortunately, most of these can be (read: will be) ignored (for now).
- * And since they are chiefly targeted as human writers and IMHO
- * humans should never need to write XML content, we're really
- * not losing anything.
+ * Open a new element, returning the open tag token.  The caller has
+ * already pushed the name (at "off") onto xj_names.
  */
 static xi_node_type_t
-xi_source_token_magic (xi_source_t *srcp, char **datap,
-		      char **restp)
+xi_json_open (xi_source_t *srcp, int off, size_t len, int member,
+	      char **datap, char **restp)
 {
-    if (xi_source_avail(srcp, 4) <= 0) {
-	/* Failure; premature EOF */
-	xi_source_failure(srcp, 0, "premature end-of-file: xml");
-	return XI_TYPE_FAIL;
-
-    } else if (srcp->xps_curp[2] == '-' && srcp->xps_curp[3] == '-') {
-	/* Comment tag */
-	return xi_source_token_comment(srcp, datap, restp);
+    xi_json_t *jp = srcp->xps_json;
+    int elt = -1, ch;
 
-    } else if (srcp->xps_curp[2] == '[') {
-	/* 'bracket' == '<![xxx]]>'.  We ignore the conents */
-	return xi_source_token_bracket(srcp, datap, restp);
-
-    } else if (isalpha((int) srcp->xps_curp[2])) {
-	/* <!XXX> tag */
-	return xi_source_token_dtd(srcp, datap, restp);
-
-    } else {
-	xi_source_failure(srcp, 0, "unhandled xml magic");
+    if (off < 0)
 	return XI_TYPE_FAIL;
-    }
-}
 
-static xi_node_type_t
-xi_source_token_pi (xi_source_t *srcp, char **datap,
-		   char **restp)
-{
-    if (xi_source_avail(srcp, 4) <= 0) {
-	/* Failure; premature EOF */
-	xi_source_failure(srcp, 0, "premature end-of-file: " XI_PI);
+    if (jp->xj_depth >= XI_JSON_DEPTH_MAX) {
+	xi_source_failure(srcp, 0, "json data is too deeply nested");
 	return XI_TYPE_FAIL;
     }
 
-    xi_offset_t off = xi_source_find(srcp, '>', xi_source_offset(srcp));
-    if (off < 0) {
-	xi_source_failure(srcp, 0, "missing termination of " XI_PI);
-	return XI_TYPE_FAIL;
+    /* Invalid names are kept as an attribute of an <element> */
+    if (!xi_json_valid_name(jp->xj_names + off, len)) {
+	elt = xi_json_push_name(jp, XI_JSON_ELT_ELEMENT,
+				sizeof(XI_JSON_ELT_ELEMENT) - 1);
+	if (elt < 0)
+	    return XI_TYPE_FAIL;
     }
 
-    char *dp = srcp->xps_curp + 2;
-    char *cp = &srcp->xps_bufp[off];
-    char *ep = cp;
-
-    if (ep < dp + 2 || ep[-1] != '?') {
-	xi_source_failure(srcp, 0, "invalid termination of " XI_PI);
+    /* The type attribute depends on the value, so we peek at it */
+    ch = xi_json_peek(srcp);
+    if (ch < 0) {
+	xi_source_failure(srcp, 0, "premature end-of-file: json value");
 	return XI_TYPE_FAIL;
     }
 
-    *--ep = '\0';		/* Whach the '?' */
-    *cp++ = '\0';		/* Whack the '>' */
-    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+    /*
+     * A bare value has to be checked now, before we hand out an
+     * open tag that claims it's a number.
+     */
+    if (ch != '{' && ch != '[' && ch != '"') {
+	xi_offset_t vlen = xi_json_scan(srcp);
 
-    /* Should not be any sort of whitespace before the target, but .. */
-    dp = xi_skipws(dp, ep - dp, 1);
-    if (dp == NULL) {
-	xi_source_failure(srcp, 0, "invalid target of " XI_PI);
-	return XI_TYPE_FAIL;
+	if (vlen == 0) {
+	    xi_source_failure(srcp, 0, "unexpected character '%c'", ch);
+	    return XI_TYPE_FAIL;
+	}
+
+	if (!xi_json_valid_bare(srcp->xps_curp, vlen)) {
+	    xi_source_failure(srcp, 0, "invalid json value '%.*s'",
+			      (int) vlen, srcp->xps_curp);
+	    return XI_TYPE_FAIL;
+	}
     }
 
-    /*
-     * Find the attributes, but don't bother parsing them.  Trim whitespace.
-     */
-    char *rp = psu_memchr(dp, ' ', ep - dp);
-    if (rp != NULL) {
-	*rp++ = '\0';
-	rp = xi_skipws(rp, ep - rp, 1);
-	if (rp != NULL && *rp == '\0')
-	    rp = NULL;
+    *restp = xi_json_attrs(jp, (elt >= 0) ? jp->xj_names + off : NULL,
+			   xi_json_value_type(ch, member));
+
+    /* Now that the attributes are built, we can drop the original name */
+    if (elt >= 0) {
+	memmove(jp->xj_names + off, jp->xj_names + elt,
+		sizeof(XI_JSON_ELT_ELEMENT));
+	jp->xj_names_len = off + sizeof(XI_JSON_ELT_ELEMENT);
     }
 
-    *datap = dp;
-    *restp = rp;
+    jp->xj_stack[jp->xj_depth].xje_name = off;
+    jp->xj_stack[jp->xj_depth].xje_container = XJC_NONE;
+    jp->xj_depth += 1;
+    jp->xj_state = XJS_VALUE;
 
-    return XI_TYPE_PI;
+    *datap = jp->xj_names + off;
+    return XI_TYPE_OPEN;
 }
 
+/*
+ * Return the next token from JSON input
+ */
 static xi_node_type_t
-xi_source_token_open (xi_source_t *srcp, char **datap, char **restp)
+xi_json_next_token (xi_source_t *srcp, char **datap, char **restp)
 {
-    xi_node_type_t token = XI_TYPE_OPEN;
+    xi_json_t *jp = srcp->xps_json;
+    xi_json_elt_t *jep;
+    xi_offset_t len;
+    char *name;
+    int ch, off;
 
-    xi_offset_t off = xi_source_find(srcp, '>', xi_source_offset(srcp));
-    if (off < 0) {
-	xi_source_failure(srcp, 0, "missing termination of open tag");
-	return XI_TYPE_FAIL;
-    }
+    for (;;) {
+	jep = jp->xj_depth ? &jp->xj_stack[jp->xj_depth - 1] : NULL;
 
-    char *dp = srcp->xps_curp + 1;
-    char *cp = &srcp->xps_bufp[off];
+	switch (jp->xj_state) {
+	case XJS_START:
+	    if (xi_json_peek(srcp) < 0)
+		return XI_TYPE_EOF;
 
-    if (dp < cp && cp[-1] == '/') { /* Spec says no space between "/>" */
-	token = XI_TYPE_EMPTY;
-	cp[-1] = '\0';		/* Back up over '/' */
-    }
+	    len = sizeof(XI_JSON_ELT_JSON) - 1;
+	    return xi_json_open(srcp,
+				xi_json_push_name(jp, XI_JSON_ELT_JSON, len),
+				len, FALSE, datap, restp);
 
-    *cp++ = '\0';		/* Whack the '>' */
-    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+	case XJS_VALUE:
+	    ch = xi_json_peek(srcp);
+	    if (ch < 0)
+		goto premature;
 
-    /*
-     * Find the attributes, but don't bother parsing them.  Trim whitespace.
-     */
-    char *rp = psu_memchr(dp, ' ', cp - dp);
-    if (rp != NULL) {
-	*rp++ = '\0';
-	rp = xi_skipws(rp, cp - rp, 1);
-	if (rp != NULL && *rp == '\0')
-	    rp = NULL;
-    }
+	    if (ch == '{' || ch == '[') {
+		jep->xje_container = (ch == '{') ? XJC_OBJECT : XJC_ARRAY;
+		xi_source_move_curp(srcp, srcp->xps_curp + 1);
+		jp->xj_state = XJS_ITEM;
+		continue;
+	    }
 
-    *datap = dp;
-    *restp = rp;
+	    jp->xj_state = XJS_CLOSE;
 
-    return token;
-}
+	    if (ch == '"') {
+		if (xi_json_string(srcp, datap, restp) < 0)
+		    goto fail;
 
-static xi_node_type_t
-xi_source_token_close (xi_source_t *srcp, char **datap)
-{
-    xi_offset_t off = xi_source_find(srcp, '>', xi_source_offset(srcp));
-    if (off < 0) {
-	xi_source_failure(srcp, 0, "missing termination of close tag");
-	return XI_TYPE_FAIL;
-    }
+		if (*datap == *restp) { /* Empty string means empty element */
+		    *datap = *restp = NULL;
+		    continue;
+		}
 
-    char *dp = srcp->xps_curp + 2; /* Skip "</" */
-    char *cp = &srcp->xps_bufp[off];
-    *cp++ = '\0';		/* Whack the '>' */
-    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+		return XI_TYPE_UNESC;
+	    }
 
-    *datap = dp;
+	    len = xi_json_scan(srcp);
+	    if (len == 0) {
+		xi_source_failure(srcp, 0, "unexpected character '%c'", ch);
+		goto fail;
+	    }
 
-    return XI_TYPE_CLOSE;
-}
+	    *datap = srcp->xps_curp;
+	    *restp = srcp->xps_curp + len;
+	    xi_source_move_curp(srcp, *restp);
 
-static xi_node_type_t
-xi_source_token_text (xi_source_t *srcp, char **datap, char **restp)
-{
-    xi_offset_t off = xi_source_find(srcp, '<', xi_source_offset(srcp));
-    if (off < 0) {
-	xi_offset_t left = xi_source_left(srcp);
-	if (left == 0) {
-	    xi_source_failure(srcp, 0, "missing termination of text");
-	    return XI_TYPE_FAIL;
-	}
+	    return XI_TYPE_UNESC;
 
-	off = srcp->xps_len;
-    }
+	case XJS_ITEM:
+	    ch = xi_json_peek(srcp);
+	    if (ch < 0)
+		goto premature;
 
-    /*
-     * We can't NUL-terminate our strings, so we use 'restp' to return
-     * the end-of-string marker.
-     */
-    char *dp = srcp->xps_curp;
-    char *cp = &srcp->xps_bufp[off];
-    xi_source_move_curp(srcp, cp); /* Save as next starting point */
+	    /* We allow a trailing comma, like libslax does */
+	    if (ch == ((jep->xje_container == XJC_OBJECT) ? '}' : ']')) {
+		xi_source_move_curp(srcp, srcp->xps_curp + 1);
+		jp->xj_state = XJS_CLOSE;
+		continue;
+	    }
 
-    if (srcp->xps_flags & XPSF_TRIM_WS) {
-	dp = xi_skipws(dp, cp - dp, 1); /* Trim leading ws */
-	if (dp == NULL)			/* Nothing but ws */
-	    cp = NULL;
-	else {
-	    char *wp = cp - 1;
-	    wp = xi_skipws(wp, wp - dp, -1); /* Trim trailing ws */
-	    if (wp != NULL)
-		cp = wp + 1;
-	}
-    }
+	    if (jep->xje_container == XJC_ARRAY) {
+		len = sizeof(XI_JSON_ELT_MEMBER) - 1;
+		return xi_json_open(srcp,
+				xi_json_push_name(jp, XI_JSON_ELT_MEMBER, len),
+				len, TRUE, datap, restp);
+	    }
 
-    *datap = dp;
-    *restp = cp;		/* Restp is the end of text */
+	    /* Object member names are quoted, but we allow bare ones */
+	    if (ch == '"') {
+		if (xi_json_string(srcp, &name, restp) < 0)
+		    goto fail;
+		len = *restp - name;
 
-    return XI_TYPE_TEXT;
-}
+	    } else {
+		len = xi_json_scan(srcp);
+		if (len == 0) {
+		    xi_source_failure(srcp, 0,
+				      "unexpected character '%c'", ch);
+		    goto fail;
+		}
+		name = srcp->xps_curp;
+		xi_source_move_curp(srcp, name + len);
+	    }
 
-static void
-xi_source_ignorews (xi_source_t *srcp)
-{
-    xi_offset_t off = xi_source_offset(srcp); /* Starting point */
-    char *cp;
+	    /* Copy the name before we go reading more data */
+	    off = xi_json_push_name(jp, name, len);
+	    if (off < 0)
+		goto fail;
 
-    for (cp = &srcp->xps_bufp[off]; xi_isspace(*cp); cp++, off++) {
-	if (off >= srcp->xps_len) {
-	    if (xi_source_read(srcp, 0) < 0)
-		return;
-	    cp = &srcp->xps_bufp[off]; /* Refresh */
+	    if (xi_json_peek(srcp) != ':') {
+		xi_source_failure(srcp, 0, "missing ':' after member name");
+		goto fail;
+	    }
+	    xi_source_move_curp(srcp, srcp->xps_curp + 1);
+
+	    return xi_json_open(srcp, off, len, FALSE, datap, restp);
+
+	case XJS_AFTER:
+	    ch = xi_json_peek(srcp);
+	    if (ch < 0)
+		goto premature;
+
+	    if (ch == ',') {
+		xi_source_move_curp(srcp, srcp->xps_curp + 1);
+		jp->xj_state = XJS_ITEM;
+		continue;
+	    }
+
+	    if (ch == ((jep->xje_container == XJC_OBJECT) ? '}' : ']')) {
+		xi_source_move_curp(srcp, srcp->xps_curp + 1);
+		jp->xj_state = XJS_CLOSE;
+		continue;
+	    }
+
+	    xi_source_failure(srcp, 0, "unexpected character '%c'", ch);
+	    goto fail;
+
+	case XJS_CLOSE:
+	    /*
+	     * The name stays in xj_names until the next push, which
+	     * won't happen before the caller is done with it.
+	     */
+	    jp->xj_depth -= 1;
+	    jp->xj_names_len = jep->xje_name;
+	    jp->xj_state = jp->xj_depth ? XJS_AFTER : XJS_DONE;
+
+	    *datap = jp->xj_names + jep->xje_name;
+	    return XI_TYPE_CLOSE;
+
+	case XJS_DONE:
+	    if (xi_json_peek(srcp) >= 0) {
+		xi_source_failure(srcp, 0, "extra data after json value");
+		goto fail;
+	    }
+	    return XI_TYPE_EOF;
 	}
     }
 
-    if (*cp != '<')
-	return;
+ premature:
+    xi_source_failure(srcp, 0, "premature end-of-file: json");
 
-    xi_source_move_curp(srcp, cp);	/* Skip over whitespace */
+ fail:
+    jp->xj_state = XJS_DONE;
+    return XI_TYPE_FAIL;
 }
 
-
 /*
  * Parse the next token.  This is really the main entry point of the
  * parsing functions, functioning as a "pull" parser.
@@ -795,6 +2526,21 @@ xi_source_next_token (xi_source_t *srcp, char **datap, char **restp)
 {
     xi_node_type_t token;
 
+    /* Once validation fails, the source is done */
+    if (srcp->xps_flags & XPSF_INVALID) {
+	*datap = *restp = NULL;
+	return XI_TYPE_FAIL;
+    }
+
+    if (srcp->xps_json) {
+	*datap = *restp = NULL;	/* Clear pointers */
+	token = xi_json_next_token(srcp, datap, restp);
+	if (token == XI_TYPE_EOF && (srcp->xps_flags & XPSF_INVALID))
+	    token = XI_TYPE_FAIL;
+	srcp->xps_last = token;
+	return token;
+    }
+
     for (;;) {
 	*datap = *restp = NULL;	/* Clear pointers */
 
@@ -806,8 +2552,10 @@ xi_source_next_token (xi_source_t *srcp, char **datap, char **restp)
 
 	/* If we don't have data, go get some data */
 	if (xi_source_left(srcp) == 0) {
-	    if (xi_source_read(srcp, 0) < 0)
-		return XI_TYPE_EOF;
+	    if (xi_source_read(srcp, 0) < 0) {
+		token = XI_TYPE_EOF;
+		break;
+	    }
 	}
 
 	if (srcp->xps_curp[0] != '<') {
@@ -849,6 +2597,10 @@ xi_source_next_token (xi_source_t *srcp, char **datap, char **restp)
 	    break;
     }
 
+    /* Running out of input because of bad input isn't EOF */
+    if (token == XI_TYPE_EOF && (srcp->xps_flags & XPSF_INVALID))
+	token = XI_TYPE_FAIL;
+
     srcp->xps_last = token;
     return token;
 }
@@ -23,6 +23,25 @@
  * XI_TYPE_ATVALUE under a node of type XI_TYPE_ATTRIB.
  */
 
+struct xi_json_s;		/* JSON tokenizer state (private) */
+struct xi_read_ahead_s;		/* Read-ahead thread state (private) */
+struct xi_decomp_s;		/* Decompression state (private) */
+
+/*
+ * Counters for a source, kept only when xps_stats is set (see
+ * xi_parse_stats_enable), so an uninstrumented source pays a single
+ * test per buffer refill.
+ */
+typedef struct xi_source_stats_s {
+    uint64_t xss_bytes;		/* Bytes read (after decompression) */
+    uint64_t xss_reads;		/* Buffer refills */
+    uint64_t xss_read_ns;	/* Time spent in refills (nanoseconds) */
+    uint64_t xss_copies;	/* Times leftover data was moved down */
+    uint64_t xss_copy_bytes;	/* Bytes moved down */
+    uint64_t xss_grows;		/* Times the buffer was doubled */
+    uint64_t xss_max_size;	/* Largest buffer size */
+} xi_source_stats_t;
+
 /*
  * Parser source object
  *
@@ -39,6 +58,13 @@ struct xi_source_s {
     unsigned xps_len;		/* Number of bytes in the input buffer */
     unsigned xps_size;		/* Size of the input buffer (max) */
     xi_node_type_t xps_last;	/* Type of last token returned */
+    struct xi_json_s *xps_json;	/* State for XPSF_JSON */
+    struct xi_read_ahead_s *xps_read_ahead; /* State for XPSF_READ_AHEAD */
+    struct xi_decomp_s *xps_decomp; /* State for compressed input */
+    uint32_t xps_utf8_code;	/* Partial UTF-8 character (XPSF_VALIDATE) */
+    uint8_t xps_utf8_need;	/* Bytes needed to finish xps_utf8_code */
+    uint8_t xps_utf8_len;	/* Length of the UTF-8 character */
+    xi_source_stats_t *xps_stats; /* Counters (or NULL) */
 }; /* xi_source_t */
 
 /* Flags for ps_flags: */
@@ -49,10 +75,14 @@ struct xi_source_s {
 #define XPSF_READ_ALL	(1<<4)	/* File is read completely into memory */
 #define XPSF_CLOSE_FD	(1<<5)	/* Close fd when cleaning up */
 #define XPSF_TRIM_WS	(1<<6)	/* Trim whitespace from data */
-#define XPSF_VALIDATE	(1<<7)	/* Validate input */
+#define XPSF_VALIDATE	(1<<7)	/* Validate input (UTF-8, chars, comments) */
 #define XPSF_LINE_NO	(1<<8)	/* Track line numbers for input */
 #define XPSF_IGNORE_COMMENTS (1<<9) /* Discard comments */
 #define XPSF_IGNORE_DTD (1<<10) /* Discard DTDs */
+#define XPSF_JSON	(1<<11)	/* Input is JSON, not XML */
+#define XPSF_READ_AHEAD	(1<<12)	/* Read input in a helper thread */
+#define XPSF_DECOMPRESS	(1<<13)	/* Detect and decompress gzip/xz/zstd */
+#define XPSF_INVALID	(1<<14)	/* Input failed validation */
 
 xi_source_t *
 xi_source_create (int fd, xi_source_flags_t flags);
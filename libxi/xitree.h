@@ -18,6 +18,15 @@
 #define XI_SHIFT	12	/* Bit shift for packed array paging */
 #define XI_ISTR_SHIFT	2	/* Bit shift for immutable string storage */
 
+/*
+ * Geometry for XWF_LARGE workspaces.  Bigger pages keep the page
+ * tables about the size of the normal ones while covering 32 times as
+ * many nodes, and bigger text atoms let the textpool reach 256GB.
+ */
+#define XI_LARGE_MAX_ATOMS	(1U<<31) /* Max nodes in a large document */
+#define XI_LARGE_SHIFT		16	/* Bit shift for large paging */
+#define XI_LARGE_TEXT_SHIFT	6	/* Textpool atom shift (64 bytes) */
+
 /*
  * A node in an XML hierarchy, made as small as possible.  We use the
  * trick where the last sibling points to the parent, allowing us to
@@ -45,6 +54,10 @@ typedef struct xi_node_s {
 /* Flags for xn_flags */
 #define XNF_ATTRIBS_PRESENT	(1<<0) /* Attributes available */
 #define XNF_ATTRIBS_EXTRACTED	(1<<1) /* Attributes aleady extracted */
+#define XNF_ESCAPED		(1<<2) /* Contents hold entities (decode lazily) */
+#define XNF_INTERNED		(1<<3) /* Contents are a value pool atom */
+#define XNF_ATTRIBS_INDEXED	(1<<4) /* Attribute directory built (xw_attrib_dir) */
+#define XNF_DETACHED		(1<<5) /* Not in the tree (xi_attrib_dir_extract) */
 
 /*
  * Each tree (document or RTF) is represented as a tree.  The
@@ -54,8 +67,13 @@ typedef struct xi_node_s {
 typedef struct xi_tree_info_s {
     xi_node_id_t xti_root;	/* Number of the root node */
     xi_depth_t xti_max_depth;	/* Max depth of the tree */
+    uint32_t xti_next_pre;	/* Last preorder number handed out */
+    uint32_t xti_flags;		/* Flags (XTIF_*) */
 } xi_tree_info_t;
 
+/* Flags for xti_flags */
+#define XTIF_HASHED	(1<<0)	/* Subtree hashes (xw_hash) are current */
+
 /*
  * The in-memory representation of a tree
  */
@@ -66,6 +84,22 @@ typedef struct xi_tree_s {
 
 #define xt_root xt_infop->xti_root
 #define xt_max_depth xt_infop->xti_max_depth
+#define xt_next_pre xt_infop->xti_next_pre
+#define xt_flags xt_infop->xti_flags
+
+/*
+ * Document order, kept beside the nodes (in xw_order) so xi_node_t
+ * stays small.  Each node gets its preorder number, and each element
+ * gets the preorder number of the last node in its subtree, so the
+ * subtree is exactly the nodes numbered (pre, end].  Until an
+ * element closes, its end is its own preorder number (as it is for
+ * any node without children), so an open element has no descendants
+ * as far as xw_order is concerned.
+ */
+typedef struct xi_node_order_s {
+    uint32_t xno_pre;		/* Preorder number (root is zero) */
+    uint32_t xno_end;		/* Preorder number of last descendant */
+} xi_node_order_t;
 
 /*
  * The insertion stack
@@ -78,6 +112,8 @@ typedef struct xi_istack_s {
     xi_action_type_t xs_action;	/* Action being taken (XIA_*) */
     xi_rstate_t *xs_statep;	/* Current parser state */
     pa_atom_t xs_old_name;	/* Old (original) name atom; for use-tag="x" */
+    xi_node_id_t xs_prev_atom;	/* Parent's last child before us */
+    uint64_t xs_ns_scope;	/* Namespace scope (see xi_ns_cache_t) */
 } xi_istack_t;
 
 /*
@@ -89,6 +125,7 @@ typedef struct xi_insert_s {
     xi_depth_t xi_depth;	/* Current depth in hierarchy */
     xi_depth_t xi_maxdepth;	/* Maximum depth seen */
     unsigned xi_relation;	/* How to handle the next insertion */
+    xi_depth_t xi_emit_depth;	/* Depth of open XIA_EMIT subtree (or 0) */
     xi_istack_t xi_stack[XI_DEPTH_MAX]; /* Insertion points */
 } xi_insert_t;
 
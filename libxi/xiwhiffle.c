@@ -7,186 +7,999 @@
  * LICENSE.
  *
  * Phil Shafer <phil@>, September 2016
+ *
+ * The whiffle pipeline (see xiwhiffle.h).  The driver fills a batch
+ * from the source, tracking depth and interning tag names, then hands
+ * the batch to each stage in turn.  Filters compact the batch in
+ * place; serializers write it out.  Nothing outlives the batch except
+ * the small per-depth state the stages keep, so a document of any
+ * size streams thru in the same memory.
  */
 
-typedef xi_node_type_t (*xi_whiffle_source_next_token_func_t)
-	(void *opaque_state, char **datap, char **restp);
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
 
-typedef xi_node_type_t (*xi_whiffle_dest_next_token_func_t)
-	(void *opaque_state, xi_node_type_t type);
+#include "slaxconfig.h"
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+#include <libxi/xiwhiffle.h>
 
-typedef struct xi_whiffle_s {
-    void *xwf_source_state;
-    xi_whiffle_source_next_token_func_t xwf_source_func;
-    void *xwf_dest_state;
-    xi_whiffle_dest_next_token_func_t xwf_dest_func;
-} xi_whiffle_t;
+#define XI_WHIFFLE_BUFSIZ	(64 * 1024) /* Batch data before we pass it on */
+#define XI_WHIFFLE_BUFSIZ_MIN	4096 /* Initial size of the batch buffer */
 
-static inline void
-xi_whiffle_set_source (xi_whiffle_t *xwfp,
-		       xi_whiffle_source_next_token_func_t func, void *data)
+unsigned
+xi_whiffle_batch_add (xi_whiffle_batch_t *batchp, const char *data,
+		      size_t len)
 {
-    xwfp->xwf_source_func = func;
-    xwfp->xwf_source_state = data;
+    unsigned off = batchp->xwb_len, size;
+    char *cp;
+
+    if (off + len + 1 > batchp->xwb_size) {
+	size = batchp->xwb_size ?: XI_WHIFFLE_BUFSIZ_MIN;
+	while (size < off + len + 1)
+	    size <<= 1;
+
+	cp = realloc(batchp->xwb_buf, size);
+	if (cp == NULL)
+	    return XI_WHIFFLE_NONE;
+
+	batchp->xwb_buf = cp;
+	batchp->xwb_size = size;
+    }
+
+    if (len > 0)
+	memcpy(batchp->xwb_buf + off, data, len);
+    batchp->xwb_buf[off + len] = '\0';
+    batchp->xwb_len = off + len + 1;
+
+    return off;
 }
 
-static inline void
-xi_whiffle_set_dest (xi_whiffle_t *xwfp,
-		     xi_whiffle_dest_next_token_func_t func, void *data)
+xi_whiffle_t *
+xi_whiffle_open (xi_workspace_t *xwp, xi_source_t *srcp)
 {
-    xwfp->xwf_dest_func = func;
-    xwfp->xwf_dest_state = data;
+    xi_whiffle_t *xwfp = calloc(1, sizeof(*xwfp));
+
+    if (xwfp) {
+	xwfp->xwf_workspace = xwp;
+	xwfp->xwf_source = srcp;
+    }
+
+    return xwfp;
 }
 
-static void
-xi_whiffle_process_token (xi_whiffle_t *xwfp, xi_node_type_t type)
+void
+xi_whiffle_close (xi_whiffle_t *xwfp)
 {
-    ;
+    xi_whiffle_stage_t *stagep, *nextp;
+
+    for (stagep = xwfp->xwf_stages; stagep; stagep = nextp) {
+	nextp = stagep->xws_next;
+	if (stagep->xws_cleanup)
+	    stagep->xws_cleanup(xwfp, stagep);
+	free(stagep);
+    }
+
+    if (xwfp->xwf_batch.xwb_buf)
+	free(xwfp->xwf_batch.xwb_buf);
+
+    free(xwfp);
 }
 
-static inline xi_node_type_t
-xi_whiffle_next_token (xi_whiffle_t *xwfp)
+int
+xi_whiffle_add_stage (xi_whiffle_t *xwfp, xi_whiffle_stage_fn func,
+		      xi_whiffle_cleanup_fn cleanup, void *opaque)
 {
-    return xwfp->xwf_source_func(xwfp->xwf_source_state, xwfp);
+    xi_whiffle_stage_t *stagep = calloc(1, sizeof(*stagep));
+
+    if (stagep == NULL)
+	return -1;
+
+    stagep->xws_func = func;
+    stagep->xws_cleanup = cleanup;
+    stagep->xws_opaque = opaque;
+
+    if (xwfp->xwf_last_stage)
+	xwfp->xwf_last_stage->xws_next = stagep;
+    else
+	xwfp->xwf_stages = stagep;
+    xwfp->xwf_last_stage = stagep;
+
+    return 0;
 }
 
+/*
+ * A generic cleanup for stages whose opaque data is a simple malloc
+ */
 static void
-xi_whiffle_process (xi_whiffle_t *xwfp)
+xi_whiffle_cleanup_free (xi_whiffle_t *xwfp UNUSED, xi_whiffle_stage_t *stagep)
 {
+    free(stagep->xws_opaque);
+}
+
+static inline xi_boolean_t
+xi_whiffle_is_tag (xi_node_type_t type)
+{
+    return (type == XI_TYPE_OPEN || type == XI_TYPE_EMPTY
+	    || type == XI_TYPE_CLOSE);
+}
+
+/*
+ * Fill the batch from the source.  We stop when the batch is full,
+ * when we've buffered enough data, or at EOF, which gets a token of
+ * its own so the stages know to finish up.
+ */
+static int
+xi_whiffle_fill (xi_whiffle_t *xwfp)
+{
+    xi_source_t *srcp = xwfp->xwf_source;
+    xi_whiffle_batch_t *batchp = &xwfp->xwf_batch;
+    xi_whiffle_token_t *tokp;
     xi_node_type_t type;
+    char *data, *rest, *localp;
+    size_t len;
+
+    batchp->xwb_count = 0;
+    batchp->xwb_len = 0;
+
+    while (batchp->xwb_count < XI_WHIFFLE_BATCH
+	   && batchp->xwb_len < XI_WHIFFLE_BUFSIZ) {
+	type = xi_source_next_token(srcp, &data, &rest);
+	if (type == XI_TYPE_FAIL || type == XI_TYPE_NONE)
+	    return -1;
+
+	tokp = &batchp->xwb_tokens[batchp->xwb_count];
+	tokp->xwt_type = type;
+	tokp->xwt_name = PA_NULL_ATOM;
+	tokp->xwt_data = XI_WHIFFLE_NONE;
+	tokp->xwt_data_len = 0;
+	tokp->xwt_rest = XI_WHIFFLE_NONE;
+
+	switch (type) {
+	case XI_TYPE_EOF:
+	    tokp->xwt_depth = 0;
+	    batchp->xwb_count += 1;
+	    xwfp->xwf_eof = TRUE;
+	    return 0;
 
-    for (type = xi_whiffle_next_token(xwfp); type != XI_TYPE_EOF;
-	 type = xi_whiffle_next_token(xwfp)) {
-	xi_whiffle_process_token(xwfp, type);
+	case XI_TYPE_OPEN:
+	case XI_TYPE_EMPTY:
+	    if (xwfp->xwf_depth >= XI_DEPTH_MAX) {
+		xi_source_failure(srcp, 0, "document is too deep");
+		return -1;
+	    }
+
+	    tokp->xwt_depth = xwfp->xwf_depth + 1;
+	    if (type == XI_TYPE_OPEN)
+		xwfp->xwf_depth += 1;
+	    break;
+
+	case XI_TYPE_CLOSE:
+	    if (xwfp->xwf_depth == 0) {
+		xi_source_failure(srcp, 0, "close tag without open tag");
+		return -1;
+	    }
+
+	    tokp->xwt_depth = xwfp->xwf_depth--;
+	    break;
+
+	default:
+	    tokp->xwt_depth = xwfp->xwf_depth;
+	}
+
+	/* Text is a range; everything else is a pair of strings */
+	if (type == XI_TYPE_TEXT || type == XI_TYPE_UNESC) {
+	    len = rest - data;
+	    rest = NULL;
+	} else
+	    len = data ? strlen(data) : 0;
+
+	tokp->xwt_data = xi_whiffle_batch_add(batchp, data, len);
+	if (tokp->xwt_data == XI_WHIFFLE_NONE)
+	    return -1;
+	tokp->xwt_data_len = len;
+
+	if (rest) {
+	    tokp->xwt_rest = xi_whiffle_batch_add(batchp, rest, strlen(rest));
+	    if (tokp->xwt_rest == XI_WHIFFLE_NONE)
+		return -1;
+	}
+
+	/* Rules (like the namepool) work on local names */
+	if (xi_whiffle_is_tag(type) && data) {
+	    localp = strchr(data, ':');
+	    tokp->xwt_name = xi_namepool_atom(xwfp->xwf_workspace,
+					      localp ? localp + 1 : data, TRUE);
+	}
+
+	batchp->xwb_count += 1;
     }
+
+    return 0;
 }
 
-static inline xi_boolean_t
-xi_whiffle_ignore_child (xi_node_t *nodep)
+int
+xi_whiffle_run (xi_whiffle_t *xwfp)
 {
-    switch (nodep->xn_type) {
-    case XI_TYPE_ROOT:
-    case XI_TYPE_ELT:
-	return FALSE;
+    xi_whiffle_batch_t *batchp = &xwfp->xwf_batch;
+    xi_whiffle_stage_t *stagep;
+    int rc, stop;
+
+    while (!xwfp->xwf_eof) {
+	if (xi_whiffle_fill(xwfp) < 0)
+	    return -1;
+
+	stop = 0;
+	for (stagep = xwfp->xwf_stages; stagep && batchp->xwb_count > 0;
+	     stagep = stagep->xws_next) {
+	    rc = stagep->xws_func(xwfp, stagep, batchp);
+	    if (rc < 0)
+		return -1;
+	    if (rc > 0)
+		stop = rc;
+	}
+
+	if (stop)
+	    return stop;
     }
 
-    return TRUE;
+    return 0;
 }
 
-typedef struct xi_whiffle_parse_as_source_s {
-    pa_atom_t xwps_first_atom;	/* First atom returned */
-    pa_atom_t xwps_last_atom;	/* Last atom returned */
-    xi_depth_t xwps_last_depth;	/* Depth of last node */
-    uint8_t xwps_direction;	/* Direction to proceed */
-    xi_node_t *xwps_last_nodep;	/* Last results */
-} xi_whiffle_parse_as_source_t;
+/*
+ * Give a tag token a new name.  The new name has no prefix.
+ */
+static int
+xi_whiffle_rename_token (xi_whiffle_t *xwfp, xi_whiffle_batch_t *batchp,
+			 xi_whiffle_token_t *tokp, pa_atom_t name_atom)
+{
+    const char *name = xi_namepool_string(xwfp->xwf_workspace, name_atom);
+    size_t len;
+    unsigned off;
+
+    if (name == NULL)
+	return -1;
 
-/* Values for xwps_direction */
-#define XI_DIR_INIT	0	/* Fresh source */
-#define XI_DIR_SELF	1	/* Return self */
-#define XI_DIR_CHILD	2	/* Return child atom */
-#define XI_DIR_NEXT	3	/* Return next atom */
-#define XI_DIR_EOF	4	/* Return EOF */
+    len = strlen(name);
+    off = xi_whiffle_batch_add(batchp, name, len);
+    if (off == XI_WHIFFLE_NONE)
+	return -1;
 
-static xi_node_type_t
-xi_whiffle_parse_as_source (void *opaque, xi_whiffle_t *xwfp,
-			    xi_workspace_t *xwp)
+    tokp->xwt_name = name_atom;
+    tokp->xwt_data = off;
+    tokp->xwt_data_len = len;
+
+    return 0;
+}
+
+/*
+ * The rules stage.  We keep the rule state for each depth, just as
+ * xi_parse() keeps it on its insertion stack, plus any replacement
+ * tag, so the close tag can follow the open tag's lead.
+ */
+typedef struct xi_whiffle_rules_s {
+    xi_rulebook_t *xwr_rulebook; /* Rules to follow */
+    xi_boolean_t xwr_owned;	/* We built the rulebook, so we free it */
+    unsigned xwr_discard_depth;	/* Depth inside a discarded subtree */
+    xi_rstate_t *xwr_state[XI_DEPTH_MAX + 1]; /* State for children */
+    pa_atom_t xwr_use_tag[XI_DEPTH_MAX + 1]; /* Replacement tags */
+} xi_whiffle_rules_t;
+
+static int
+xi_whiffle_rules (xi_whiffle_t *xwfp, xi_whiffle_stage_t *stagep,
+		  xi_whiffle_batch_t *batchp)
 {
-    xi_whiffle_parse_as_source_t *xwpsp = opaque;
+    xi_whiffle_rules_t *xwrp = stagep->xws_opaque;
+    xi_rulebook_t *xrbp = xwrp->xwr_rulebook;
+    xi_whiffle_token_t *tokp;
+    xi_rstate_t *statep;
+    xi_rule_t *xrp;
+    xi_action_type_t act;
+    xi_depth_t depth;
+    unsigned i, j;
+
+    for (i = j = 0; i < batchp->xwb_count; i++) {
+	tokp = &batchp->xwb_tokens[i];
+	depth = tokp->xwt_depth;
+
+	/* Inside a discarded subtree, we only care about nesting */
+	if (xwrp->xwr_discard_depth && tokp->xwt_type != XI_TYPE_EOF) {
+	    if (tokp->xwt_type == XI_TYPE_OPEN)
+		xwrp->xwr_discard_depth += 1;
+	    else if (tokp->xwt_type == XI_TYPE_CLOSE)
+		xwrp->xwr_discard_depth -= 1;
+	    continue;
+	}
+
+	switch (tokp->xwt_type) {
+	case XI_TYPE_OPEN:
+	case XI_TYPE_EMPTY:
+	    statep = xwrp->xwr_state[depth - 1];
+	    xrp = xi_rulebook_find(NULL, xrbp, statep, tokp->xwt_name, NULL,
+				   xi_whiffle_data(batchp, tokp),
+				   xi_whiffle_rest(batchp, tokp));
+	    act = xrp ? xrp->xr_action : XIA_SAVE;
 
-    /* If we're at EOF, then we're done (and boring) */
-    if (xwpsp->xwps_direction = XI_TYPE_EOF) 
-	return XI_TYPE_EOF;
+	    if (act == XIA_DISCARD) {
+		if (tokp->xwt_type == XI_TYPE_OPEN)
+		    xwrp->xwr_discard_depth = 1;
+		continue;
+	    }
 
-    xi_node_type_t type = XI_TYPE_EOF;
-    uint8_t new_dir = XI_DIR_CHILD;
-    pa_atom_t atom = xwpsp->xwps_last_atom, new_atom = PA_NULL_ATOM;
-    xi_depth_t new_depth = xwpsp->xwps_last_depth;
-    xi_node_t *nodep = xwpsp->xwps_last_nodep;
-    xi_node_t *new_nodep = NULL;
+	    if (act == XIA_RETURN) {
+		/* Cut the batch off here, leaving an EOF to end it */
+		tokp = &batchp->xwb_tokens[j];
+		bzero(tokp, sizeof(*tokp));
+		tokp->xwt_type = XI_TYPE_EOF;
+		tokp->xwt_data = tokp->xwt_rest = XI_WHIFFLE_NONE;
+		batchp->xwb_count = j + 1;
+		return 1;
+	    }
 
-    if (nodep == NULL) {
-	/* Should not occur, but if it does ... */
-	new_dir = XI_DIR_EOF;
-	return XI_DIR_EOF;
+	    /* Children use the rule's new state, or inherit ours */
+	    xwrp->xwr_state[depth] = statep;
+	    if (xrp && xrp->xr_new_state != XI_STATE_EOL)
+		xwrp->xwr_state[depth] = xi_rulebook_state(xrbp,
+							   xrp->xr_new_state);
+
+	    xwrp->xwr_use_tag[depth] = xrp ? xrp->xr_use_tag : PA_NULL_ATOM;
+	    if (xwrp->xwr_use_tag[depth] != PA_NULL_ATOM
+		&& xi_whiffle_rename_token(xwfp, batchp, tokp,
+					   xwrp->xwr_use_tag[depth]) < 0)
+		return -1;
+	    break;
+
+	case XI_TYPE_CLOSE:
+	    if (xwrp->xwr_use_tag[depth] != PA_NULL_ATOM
+		&& xi_whiffle_rename_token(xwfp, batchp, tokp,
+					   xwrp->xwr_use_tag[depth]) < 0)
+		return -1;
+	    break;
+	}
+
+	if (j != i)
+	    batchp->xwb_tokens[j] = *tokp;
+	j += 1;
     }
 
-    /* The direction tells us our state and where we are heading next */
-    switch (xwpsp->xwps_direction) {
-    case XI_DIR_INIT:
-    case XI_DIR_SELF:
-	new_atom = xwpsp->xwps_first_atom;
-	break;
+    batchp->xwb_count = j;
+    return 0;
+}
+
+static void
+xi_whiffle_rules_cleanup (xi_whiffle_t *xwfp UNUSED, xi_whiffle_stage_t *stagep)
+{
+    xi_whiffle_rules_t *xwrp = stagep->xws_opaque;
+
+    if (xwrp->xwr_owned)
+	xi_rulebook_close(xwrp->xwr_rulebook);
+    free(xwrp);
+}
+
+static int
+xi_whiffle_add_rules_internal (xi_whiffle_t *xwfp, xi_rulebook_t *xrbp,
+			       xi_boolean_t owned)
+{
+    xi_whiffle_rules_t *xwrp = calloc(1, sizeof(*xwrp));
+
+    if (xwrp == NULL)
+	return -1;
+
+    xwrp->xwr_rulebook = xrbp;
+    xwrp->xwr_owned = owned;
+    xwrp->xwr_state[0] = xi_rulebook_state(xrbp, XI_STATE_INITIAL);
+
+    if (xi_whiffle_add_stage(xwfp, xi_whiffle_rules,
+			     xi_whiffle_rules_cleanup, xwrp) < 0) {
+	free(xwrp);
+	return -1;
+    }
+
+    return 0;
+}
+
+int
+xi_whiffle_add_rules (xi_whiffle_t *xwfp, xi_rulebook_t *xrbp)
+{
+    return xi_whiffle_add_rules_internal(xwfp, xrbp, FALSE);
+}
+
+int
+xi_whiffle_add_project (xi_whiffle_t *xwfp, const char **paths,
+			unsigned npaths)
+{
+    xi_rulebook_t *xrbp;
+
+    xrbp = xi_rulebook_compile(xwfp->xwf_workspace, "whiffle-project",
+			       paths, npaths, XIA_SAVE);
+    if (xrbp == NULL)
+	return -1;
+
+    if (xi_whiffle_add_rules_internal(xwfp, xrbp, TRUE) < 0) {
+	xi_rulebook_close(xrbp);
+	return -1;
+    }
+
+    return 0;
+}
+
+typedef struct xi_whiffle_rename_s {
+    pa_atom_t xwn_from;		/* Name to look for */
+    pa_atom_t xwn_to;		/* Name to replace it with */
+} xi_whiffle_rename_t;
+
+static int
+xi_whiffle_rename (xi_whiffle_t *xwfp, xi_whiffle_stage_t *stagep,
+		   xi_whiffle_batch_t *batchp)
+{
+    xi_whiffle_rename_t *xwnp = stagep->xws_opaque;
+    xi_whiffle_token_t *tokp;
+    unsigned i;
+
+    for (i = 0; i < batchp->xwb_count; i++) {
+	tokp = &batchp->xwb_tokens[i];
+	if (xi_whiffle_is_tag(tokp->xwt_type)
+	    && tokp->xwt_name == xwnp->xwn_from
+	    && xi_whiffle_rename_token(xwfp, batchp, tokp,
+				       xwnp->xwn_to) < 0)
+	    return -1;
+    }
+
+    return 0;
+}
+
+int
+xi_whiffle_add_rename (xi_whiffle_t *xwfp, const char *from, const char *to)
+{
+    xi_whiffle_rename_t *xwnp = calloc(1, sizeof(*xwnp));
+
+    if (xwnp == NULL)
+	return -1;
+
+    xwnp->xwn_from = xi_namepool_atom(xwfp->xwf_workspace, from, TRUE);
+    xwnp->xwn_to = xi_namepool_atom(xwfp->xwf_workspace, to, TRUE);
+    if (xwnp->xwn_from == PA_NULL_ATOM || xwnp->xwn_to == PA_NULL_ATOM
+	|| xi_whiffle_add_stage(xwfp, xi_whiffle_rename,
+				xi_whiffle_cleanup_free, xwnp) < 0) {
+	free(xwnp);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write text content, escaping the characters XML cares about
+ */
+static void
+xi_whiffle_xml_text (FILE *out, const char *data, size_t len)
+{
+    const char *cp, *ep = data + len;
+
+    for (cp = data; cp < ep; cp++) {
+	switch (*cp) {
+	case '&':
+	    fputs("&amp;", out);
+	    break;
+	case '<':
+	    fputs("&lt;", out);
+	    break;
+	case '>':
+	    fputs("&gt;", out);
+	    break;
+	default:
+	    putc(*cp, out);
+	}
+    }
+}
+
+/*
+ * The XML serializer writes tokens back out as they came in, so text
+ * that arrived escaped stays that way and only decoded text (CDATA
+ * and JSON strings) needs escaping.  DTDs are dropped.
+ *
+ * We keep the names of the open elements, so that if the pipeline
+ * stops early (XIA_RETURN), we can close them and still write a
+ * well-formed document.
+ */
+typedef struct xi_whiffle_xml_s {
+    FILE *xwx_out;		/* Where to write */
+    xi_depth_t xwx_depth;	/* Depth of the innermost open element */
+    char *xwx_names;		/* Names of open elements, NUL-separated */
+    unsigned xwx_names_len;	/* Bytes used in xwx_names */
+    unsigned xwx_names_size;	/* Size of xwx_names */
+    unsigned xwx_name_off[XI_DEPTH_MAX + 1]; /* Offsets, by depth */
+} xi_whiffle_xml_t;
+
+static int
+xi_whiffle_xml_push (xi_whiffle_xml_t *xwxp, xi_depth_t depth,
+		     const char *name)
+{
+    size_t len = strlen(name) + 1;
+    unsigned size;
+    char *cp;
+
+    if (depth > XI_DEPTH_MAX)
+	return -1;
+
+    if (xwxp->xwx_names_len + len > xwxp->xwx_names_size) {
+	size = xwxp->xwx_names_size ?: XI_WHIFFLE_BUFSIZ_MIN;
+	while (size < xwxp->xwx_names_len + len)
+	    size <<= 1;
+
+	cp = realloc(xwxp->xwx_names, size);
+	if (cp == NULL)
+	    return -1;
+
+	xwxp->xwx_names = cp;
+	xwxp->xwx_names_size = size;
+    }
 
-    case XI_DIR_CHILD:
-	if (nodep->xn_contents != PA_NULL_ATOM) {
-	    new_atom = nodep->xn_contents;
-	    new_dir = XI_DIR_CHILD;
-	    type = XI_TYPE_OPEN;
+    xwxp->xwx_name_off[depth] = xwxp->xwx_names_len;
+    memcpy(xwxp->xwx_names + xwxp->xwx_names_len, name, len);
+    xwxp->xwx_names_len += len;
+    xwxp->xwx_depth = depth;
+
+    return 0;
+}
+
+static void
+xi_whiffle_xml_pop (xi_whiffle_xml_t *xwxp, xi_depth_t depth)
+{
+    if (depth == 0 || depth > xwxp->xwx_depth)
+	return;
+
+    xwxp->xwx_names_len = xwxp->xwx_name_off[depth];
+    xwxp->xwx_depth = depth - 1;
+}
+
+static int
+xi_whiffle_xml (xi_whiffle_t *xwfp UNUSED, xi_whiffle_stage_t *stagep,
+		xi_whiffle_batch_t *batchp)
+{
+    xi_whiffle_xml_t *xwxp = stagep->xws_opaque;
+    FILE *out = xwxp->xwx_out;
+    xi_whiffle_token_t *tokp;
+    const char *data, *rest;
+    unsigned i;
+
+    for (i = 0; i < batchp->xwb_count; i++) {
+	tokp = &batchp->xwb_tokens[i];
+	data = xi_whiffle_data(batchp, tokp);
+	rest = xi_whiffle_rest(batchp, tokp);
+
+	switch (tokp->xwt_type) {
+	case XI_TYPE_OPEN:
+	case XI_TYPE_EMPTY:
+	    putc('<', out);
+	    fputs(data, out);
+	    if (rest && *rest) {
+		putc(' ', out);
+		fputs(rest, out);
+	    }
+	    fputs((tokp->xwt_type == XI_TYPE_EMPTY) ? "/>" : ">", out);
+
+	    if (tokp->xwt_type == XI_TYPE_OPEN
+		&& xi_whiffle_xml_push(xwxp, tokp->xwt_depth, data) < 0)
+		return -1;
+	    break;
+
+	case XI_TYPE_CLOSE:
+	    fprintf(out, "</%s>", data);
+	    xi_whiffle_xml_pop(xwxp, tokp->xwt_depth);
+	    break;
+
+	case XI_TYPE_TEXT:
+	    fwrite(data, 1, tokp->xwt_data_len, out);
+	    break;
+
+	case XI_TYPE_UNESC:
+	    xi_whiffle_xml_text(out, data, tokp->xwt_data_len);
+	    break;
+
+	case XI_TYPE_COMMENT:
+	    fprintf(out, "<!--%s-->", data);
+	    break;
+
+	case XI_TYPE_PI:
+	    fprintf(out, "<?%s%s%s?>", data, rest ? " " : "", rest ?: "");
+	    break;
+
+	case XI_TYPE_EOF:
+	    /* Close anything a stopped pipeline left open */
+	    while (xwxp->xwx_depth > 0) {
+		fprintf(out, "</%s>", xwxp->xwx_names
+			+ xwxp->xwx_name_off[xwxp->xwx_depth]);
+		xi_whiffle_xml_pop(xwxp, xwxp->xwx_depth);
+	    }
+
+	    putc('\n', out);
+	    fflush(out);
 	    break;
 	}
-	/* fallthru */
+    }
+
+    return ferror(out) ? -1 : 0;
+}
+
+static void
+xi_whiffle_xml_cleanup (xi_whiffle_t *xwfp UNUSED, xi_whiffle_stage_t *stagep)
+{
+    xi_whiffle_xml_t *xwxp = stagep->xws_opaque;
+
+    free(xwxp->xwx_names);
+    free(xwxp);
+}
+
+int
+xi_whiffle_add_xml (xi_whiffle_t *xwfp, FILE *out)
+{
+    xi_whiffle_xml_t *xwxp = calloc(1, sizeof(*xwxp));
 
-    case XI_DIR_NEXT:
-	if (nodep->xn_next == PA_NULL_ATOM
-	    || nodep->xn_next == xwpsp->xwps_last_atom) {
-	    new_atom = PA_NULL_ATOM;
+    if (xwxp == NULL)
+	return -1;
+
+    xwxp->xwx_out = out;
+
+    if (xi_whiffle_add_stage(xwfp, xi_whiffle_xml, xi_whiffle_xml_cleanup,
+			     xwxp) < 0) {
+	free(xwxp);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * The JSON serializer follows the same mapping as the JSON tokenizer
+ * in xisource.c (and libslax), in reverse: type="array" makes an
+ * array of <member> items, type="number" (etc.) makes a bare value,
+ * <element name="..."> carries names that aren't valid XML names,
+ * and a top-level <json> is just a wrapper.  Other documents get
+ * wrapped in an object, keyed by the top element's name.
+ *
+ * Until we see a child element, we don't know whether an element is
+ * an object or a simple value, so we hold its text until either a
+ * child appears (making it an object, and the text just whitespace)
+ * or it closes.  We never look at more than one element's text at a
+ * time, so there's a single text buffer.  Repeated siblings come out
+ * as repeated keys, since a stream can't go back and make an array.
+ */
+#define XWJ_PENDING	0	/* Could still be a value or an object */
+#define XWJ_OBJECT	1	/* Has child elements */
+#define XWJ_ARRAY	2	/* Has type="array" */
+
+typedef struct xi_whiffle_json_elt_s {
+    uint8_t xje_kind;		/* What we are (XWJ_*) */
+    uint8_t xje_raw;		/* Value is a number, boolean, or null */
+    unsigned xje_count;		/* Number of members/items written */
+} xi_whiffle_json_elt_t;
+
+typedef struct xi_whiffle_json_s {
+    FILE *xwj_out;		/* Where to write */
+    xi_boolean_t xwj_wrapped;	/* Top element is wrapped in an object */
+    xi_depth_t xwj_depth;	/* Depth of the innermost open element */
+    char *xwj_text;		/* Text of the innermost pending element */
+    unsigned xwj_text_len;	/* Bytes used in xwj_text */
+    unsigned xwj_text_size;	/* Size of xwj_text */
+    xi_whiffle_json_elt_t xwj_stack[XI_DEPTH_MAX + 1]; /* By depth */
+} xi_whiffle_json_t;
+
+/*
+ * Find the value of an attribute in an unparsed attribute string
+ */
+static const char *
+xi_whiffle_attrib (const char *attribs, const char *name, size_t *lenp)
+{
+    size_t nlen = strlen(name);
+    const char *cp = attribs, *np, *vp, *ep;
+
+    while (cp && *cp) {
+	while (xi_isspace(*cp))
+	    cp += 1;
+
+	for (np = cp; *np && *np != '=' && !xi_isspace(*np); np++)
+	    continue;
+
+	for (vp = np; xi_isspace(*vp) || *vp == '='; vp++)
+	    continue;
+
+	if (*vp != '"' && *vp != '\'')
 	    break;
+
+	ep = strchr(vp + 1, *vp);
+	if (ep == NULL)
+	    break;
+
+	if ((size_t) (np - cp) == nlen && strncmp(cp, name, nlen) == 0) {
+	    *lenp = ep - vp - 1;
+	    return vp + 1;
 	}
 
-	new_atom = nodep->xn_next;
-	break;
+	cp = ep + 1;
     }
 
-    new_nodep = xi_node_addr(xwp, new_atom);
-    if (new_nodep == NULL)
-	new_depth = 0;
-    else {
-	if (new_dir == XI_DIR_CHILD && xi_whiffle_ignore_child(new_nodep))
-	    new_dir = XI_DIR_NEXT;
-
-	new_depth = new_nodep->xn_depth;
-	if (new_depth < xwpsp->xwps_last_depth) {
-	    /*
-	     * We're done with our parent's children; send a close event and
-	     * move to the next item;
-	     */
-	    new_dir = XI_DIR_NEXT;
-	    type = XI_TYPE_CLOSE;
+    return NULL;
+}
+
+static void
+xi_whiffle_json_string (FILE *out, const char *data, size_t len)
+{
+    const char *cp, *ep = data + len;
+
+    putc('"', out);
+
+    for (cp = data; cp < ep; cp++) {
+	switch (*cp) {
+	case '"':
+	    fputs("\\\"", out);
+	    break;
+	case '\\':
+	    fputs("\\\\", out);
+	    break;
+	case '\n':
+	    fputs("\\n", out);
+	    break;
+	case '\r':
+	    fputs("\\r", out);
+	    break;
+	case '\t':
+	    fputs("\\t", out);
+	    break;
+	default:
+	    if ((unsigned char) *cp < 0x20)
+		fprintf(out, "\\u%04x", (unsigned char) *cp);
+	    else
+		putc(*cp, out);
+	}
+    }
+
+    putc('"', out);
+}
+
+static int
+xi_whiffle_json_text (xi_whiffle_json_t *xwjp, const char *data, size_t len,
+		      xi_boolean_t escaped)
+{
+    unsigned size;
+    char *cp;
+
+    if (xwjp->xwj_text_len + len + 1 > xwjp->xwj_text_size) {
+	size = xwjp->xwj_text_size ?: XI_WHIFFLE_BUFSIZ_MIN;
+	while (size < xwjp->xwj_text_len + len + 1)
+	    size <<= 1;
+
+	cp = realloc(xwjp->xwj_text, size);
+	if (cp == NULL)
+	    return -1;
+
+	xwjp->xwj_text = cp;
+	xwjp->xwj_text_size = size;
+    }
+
+    /* Decode our own copy; later stages may still want the original */
+    cp = xwjp->xwj_text + xwjp->xwj_text_len;
+    memcpy(cp, data, len);
+    if (escaped)
+	len = xi_source_unescape(NULL, cp, len);
+    xwjp->xwj_text_len += len;
+
+    return 0;
+}
+
+static void
+xi_whiffle_json_open (xi_whiffle_json_t *xwjp, xi_whiffle_batch_t *batchp,
+		      xi_whiffle_token_t *tokp)
+{
+    FILE *out = xwjp->xwj_out;
+    xi_depth_t depth = tokp->xwt_depth;
+    xi_whiffle_json_elt_t *parentp = &xwjp->xwj_stack[depth - 1];
+    xi_whiffle_json_elt_t *eltp = &xwjp->xwj_stack[depth];
+    const char *name = xi_whiffle_data(batchp, tokp);
+    const char *rest = xi_whiffle_rest(batchp, tokp);
+    const char *cp, *type;
+    size_t len, tlen;
+    xi_boolean_t keyed;
+
+    cp = strchr(name, ':');	/* JSON has no prefixes */
+    if (cp)
+	name = cp + 1;
+
+    if (depth == 1) {
+	/* The first top element tells us if we're wrapping */
+	if (parentp->xje_count == 0) {
+	    xwjp->xwj_wrapped = (strcmp(name, "json") != 0);
+	    if (xwjp->xwj_wrapped)
+		putc('{', out);
+	}
+	keyed = xwjp->xwj_wrapped;
+
+    } else {
+	/* A child means our parent is an object, not a simple value */
+	if (parentp->xje_kind == XWJ_PENDING) {
+	    parentp->xje_kind = XWJ_OBJECT;
+	    putc('{', out);
+	}
+	keyed = (parentp->xje_kind == XWJ_OBJECT);
+    }
+
+    if (parentp->xje_count++ > 0)
+	putc(',', out);
+
+    if (keyed) {
+	len = strlen(name);
+	if (strcmp(name, "element") == 0) {
+	    cp = xi_whiffle_attrib(rest, "name", &tlen);
+	    if (cp) {
+		name = cp;
+		len = tlen;
+	    }
+	}
+
+	xi_whiffle_json_string(out, name, len);
+	putc(':', out);
+    }
+
+    bzero(eltp, sizeof(*eltp));
+    xwjp->xwj_text_len = 0;
+
+    type = xi_whiffle_attrib(rest, "type", &tlen);
+    if (type == NULL)
+	return;
+
+    if (tlen == 5 && strncmp(type, "array", tlen) == 0) {
+	eltp->xje_kind = XWJ_ARRAY;
+	putc('[', out);
+    } else if ((tlen == 6 && strncmp(type, "number", tlen) == 0)
+	       || (tlen == 4 && strncmp(type, "true", tlen) == 0)
+	       || (tlen == 5 && strncmp(type, "false", tlen) == 0)
+	       || (tlen == 4 && strncmp(type, "null", tlen) == 0)) {
+	eltp->xje_raw = TRUE;
+    }
+}
+
+static void
+xi_whiffle_json_close (xi_whiffle_json_t *xwjp, xi_depth_t depth)
+{
+    FILE *out = xwjp->xwj_out;
+    xi_whiffle_json_elt_t *eltp = &xwjp->xwj_stack[depth];
+    char *cp, *ep;
+
+    switch (eltp->xje_kind) {
+    case XWJ_PENDING:
+	cp = xwjp->xwj_text;
+	ep = cp + xwjp->xwj_text_len;
+
+	if (eltp->xje_raw) {
+	    /* Bare values are written as-is, sans whitespace */
+	    while (cp < ep && xi_isspace(*cp))
+		cp += 1;
+	    while (ep > cp && xi_isspace(ep[-1]))
+		ep -= 1;
+
+	    if (cp == ep)
+		fputs("null", out);
+	    else
+		fwrite(cp, 1, ep - cp, out);
 	} else {
-	    type = new_nodep->xn_type;
+	    xi_whiffle_json_string(out, cp ?: "", ep - cp);
 	}
+	break;
+
+    case XWJ_OBJECT:
+	putc('}', out);
+	break;
+
+    case XWJ_ARRAY:
+	putc(']', out);
+	break;
     }
 
-    slaxLog("parse-as-source: last: %d/%d/%p(%d) -> new: %d/%d/%p(%d) -> %d",
-	    xwpsp->xwps_direction, atom, nodep, xwpsp->xwps_last_depth,
-	    new_dir, new_atom, new_nodep, new_depth,
-	    type);
+    xwjp->xwj_text_len = 0;
+}
+
+static int
+xi_whiffle_json (xi_whiffle_t *xwfp UNUSED, xi_whiffle_stage_t *stagep,
+		 xi_whiffle_batch_t *batchp)
+{
+    xi_whiffle_json_t *xwjp = stagep->xws_opaque;
+    xi_whiffle_token_t *tokp;
+    xi_whiffle_json_elt_t *eltp;
+    unsigned i;
+
+    for (i = 0; i < batchp->xwb_count; i++) {
+	tokp = &batchp->xwb_tokens[i];
+
+	switch (tokp->xwt_type) {
+	case XI_TYPE_OPEN:
+	    xi_whiffle_json_open(xwjp, batchp, tokp);
+	    xwjp->xwj_depth = tokp->xwt_depth;
+	    break;
+
+	case XI_TYPE_EMPTY:
+	    xi_whiffle_json_open(xwjp, batchp, tokp);
+	    xi_whiffle_json_close(xwjp, tokp->xwt_depth);
+	    break;
+
+	case XI_TYPE_CLOSE:
+	    xi_whiffle_json_close(xwjp, tokp->xwt_depth);
+	    xwjp->xwj_depth = tokp->xwt_depth - 1;
+	    break;
+
+	case XI_TYPE_TEXT:
+	case XI_TYPE_UNESC:
+	    /* Only a (so far) simple value wants its text */
+	    if (tokp->xwt_depth == 0)
+		break;
+
+	    eltp = &xwjp->xwj_stack[tokp->xwt_depth];
+	    if (eltp->xje_kind == XWJ_PENDING
+		&& xi_whiffle_json_text(xwjp, xi_whiffle_data(batchp, tokp),
+					tokp->xwt_data_len,
+					(tokp->xwt_type == XI_TYPE_TEXT)) < 0)
+		return -1;
+	    break;
 
-    /* Record results */
-    xwpsp->xwps_direction = new_dir;
-    xwpsp->xwps_last_atom = new_atom;
-    xwpsp->xwps_last_nodep = new_nodep;
-    xwpsp->xwps_last_depth = new_depth;
-    return type;
+	case XI_TYPE_EOF:
+	    /* Close anything a stopped pipeline left open */
+	    for (; xwjp->xwj_depth > 0; xwjp->xwj_depth--)
+		xi_whiffle_json_close(xwjp, xwjp->xwj_depth);
+
+	    if (xwjp->xwj_wrapped)
+		putc('}', xwjp->xwj_out);
+	    putc('\n', xwjp->xwj_out);
+	    fflush(xwjp->xwj_out);
+	    break;
+	}
+    }
+
+    return ferror(xwjp->xwj_out) ? -1 : 0;
 }
 
-typedef struct xi_whiffle_parse_as_dest_s {
-} xi_whiffle_parse_as_dest_t;
+static void
+xi_whiffle_json_cleanup (xi_whiffle_t *xwfp UNUSED, xi_whiffle_stage_t *stagep)
+{
+    xi_whiffle_json_t *xwjp = stagep->xws_opaque;
 
-void
-xi_whiffle_test (xi_parse_t *parsep)
+    if (xwjp->xwj_text)
+	free(xwjp->xwj_text);
+    free(xwjp);
+}
+
+int
+xi_whiffle_add_json (xi_whiffle_t *xwfp, FILE *out)
 {
-    xi_whiffle_t xwf;
-    xi_whiffle_parse_as_source_t source;
-    xi_whiffle_parse_as_dest_t dest;
+    xi_whiffle_json_t *xwjp = calloc(1, sizeof(*xwjp));
 
-    bzero(&xwf, sizeof(xwf));
-    bzero(&source, sizeof(source));
-    bzero(&dest, sizeof(dest));
+    if (xwjp == NULL)
+	return -1;
 
-    xi_whiffle_set_source(&xwf, xi_whiffle_parse_as_source, &source);
-    xi_whiffle_set_dest(&xwf, xi_whiffle_parse_as_dest, &dest);
+    xwjp->xwj_out = out;
+
+    if (xi_whiffle_add_stage(xwfp, xi_whiffle_json,
+			     xi_whiffle_json_cleanup, xwjp) < 0) {
+	free(xwjp);
+	return -1;
+    }
 
-    xi_whiffle_process(&xwf);
+    return 0;
 }
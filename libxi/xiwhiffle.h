@@ -7,12 +7,161 @@
  * LICENSE.
  *
  * Phil Shafer <phil@>, September 2016
+ *
+ * A "whiffle" is a streaming token pipeline: tokens come from an
+ * xi_source_t, pass thru a chain of stages (rule filters, renames,
+ * projections), and go out the far end via a serializer, without
+ * ever building a tree.  Tokens move in batches, so each stage is a
+ * tight loop over an array rather than a function call per token,
+ * and the batch (and its data buffer) is reused, so memory use is
+ * constant no matter how large the document is.
  */
 
 #ifndef LIBSLAX_XI_WHIFFLE_H
 #define LIBSLAX_XI_WHIFFLE_H
 
+#define XI_WHIFFLE_BATCH	256 /* Max tokens per batch */
+#define XI_WHIFFLE_NONE		((unsigned) -1) /* Offset for "no data" */
+
+/*
+ * A token in a batch.  Token data is copied into the batch's buffer,
+ * since the source's buffer moves as it reads, and we record offsets
+ * rather than pointers, since stages can add data (which can move the
+ * batch buffer).  Data is always NUL-terminated.
+ *
+ * For tags, xwt_data is the (qualified) name, xwt_rest is the
+ * attribute string, and xwt_name is the atom (in the workspace's
+ * namepool) of the local name.  For text, xwt_data is the text.
+ * xwt_depth is the depth of the element for tags, and of the
+ * enclosing element for everything else.
+ */
+typedef struct xi_whiffle_token_s {
+    xi_node_type_t xwt_type;	/* Type of token (XI_TYPE_*) */
+    xi_depth_t xwt_depth;	/* Depth (see above) */
+    pa_atom_t xwt_name;		/* Local name atom (tags only) */
+    unsigned xwt_data;		/* Offset of data in xwb_buf */
+    unsigned xwt_data_len;	/* Length of data */
+    unsigned xwt_rest;		/* Offset of rest (or XI_WHIFFLE_NONE) */
+} xi_whiffle_token_t;
+
+typedef struct xi_whiffle_batch_s {
+    unsigned xwb_count;		/* Number of tokens in the batch */
+    xi_whiffle_token_t xwb_tokens[XI_WHIFFLE_BATCH]; /* Tokens */
+    char *xwb_buf;		/* Token data */
+    unsigned xwb_len;		/* Bytes used in xwb_buf */
+    unsigned xwb_size;		/* Bytes allocated for xwb_buf */
+} xi_whiffle_batch_t;
+
+static inline char *
+xi_whiffle_data (xi_whiffle_batch_t *batchp, xi_whiffle_token_t *tokp)
+{
+    return batchp->xwb_buf + tokp->xwt_data;
+}
+
+static inline char *
+xi_whiffle_rest (xi_whiffle_batch_t *batchp, xi_whiffle_token_t *tokp)
+{
+    if (tokp->xwt_rest == XI_WHIFFLE_NONE)
+	return NULL;
+
+    return batchp->xwb_buf + tokp->xwt_rest;
+}
+
+/*
+ * Add a string to the batch's buffer, returning its offset, or
+ * XI_WHIFFLE_NONE on failure
+ */
+unsigned
+xi_whiffle_batch_add (xi_whiffle_batch_t *batchp, const char *data,
+		      size_t len);
+
+struct xi_whiffle_s;
+struct xi_whiffle_stage_s;
+
+/*
+ * A stage works on a batch in place: it can drop tokens (by
+ * compacting the array), change them, or just look at them.  It
+ * returns zero to keep going, non-zero to stop the pipeline after
+ * this batch, or -1 for failure.  A stage that stops the pipeline
+ * should end its batch with an XI_TYPE_EOF token, so the stages
+ * after it can finish up.
+ */
+typedef int (*xi_whiffle_stage_fn)(struct xi_whiffle_s *xwfp,
+				   struct xi_whiffle_stage_s *stagep,
+				   xi_whiffle_batch_t *batchp);
+
+/* Release a stage's private data */
+typedef void (*xi_whiffle_cleanup_fn)(struct xi_whiffle_s *xwfp,
+				      struct xi_whiffle_stage_s *stagep);
+
+typedef struct xi_whiffle_stage_s {
+    struct xi_whiffle_stage_s *xws_next; /* Next stage in the pipeline */
+    xi_whiffle_stage_fn xws_func;	 /* Process a batch */
+    xi_whiffle_cleanup_fn xws_cleanup;	 /* Release xws_opaque */
+    void *xws_opaque;			 /* Private data for the stage */
+} xi_whiffle_stage_t;
+
+typedef struct xi_whiffle_s {
+    xi_workspace_t *xwf_workspace; /* Workspace (for name atoms) */
+    xi_source_t *xwf_source;	/* Source of tokens */
+    xi_whiffle_stage_t *xwf_stages; /* First stage */
+    xi_whiffle_stage_t *xwf_last_stage; /* Last stage */
+    xi_depth_t xwf_depth;	/* Current depth in the source */
+    xi_boolean_t xwf_eof;	/* Source is exhausted */
+    xi_whiffle_batch_t xwf_batch; /* The batch we move thru the stages */
+} xi_whiffle_t;
+
+xi_whiffle_t *
+xi_whiffle_open (xi_workspace_t *xwp, xi_source_t *srcp);
+
+/*
+ * Free the whiffle and its stages; the source belongs to the caller
+ */
 void
-xi_whiffle_test (xi_parse_t *parsep);
+xi_whiffle_close (xi_whiffle_t *xwfp);
+
+int
+xi_whiffle_add_stage (xi_whiffle_t *xwfp, xi_whiffle_stage_fn func,
+		      xi_whiffle_cleanup_fn cleanup, void *opaque);
+
+/*
+ * Filter tokens thru a rulebook, the same way xi_parse() does:
+ * discarded subtrees are dropped, xr_use_tag renames elements, and
+ * XIA_RETURN stops the pipeline.  The rulebook belongs to the caller.
+ */
+int
+xi_whiffle_add_rules (xi_whiffle_t *xwfp, xi_rulebook_t *xrbp);
+
+/*
+ * Keep only the subtrees selected by a set of simple absolute paths
+ * (see xi_rulebook_compile), along with the elements above them.
+ */
+int
+xi_whiffle_add_project (xi_whiffle_t *xwfp, const char **paths,
+			unsigned npaths);
+
+/*
+ * Rename elements with the local name "from" to "to"
+ */
+int
+xi_whiffle_add_rename (xi_whiffle_t *xwfp, const char *from, const char *to);
+
+/*
+ * Serializers.  These write whatever reaches them, so they belong at
+ * the end of the pipeline.
+ */
+int
+xi_whiffle_add_xml (xi_whiffle_t *xwfp, FILE *out);
+
+int
+xi_whiffle_add_json (xi_whiffle_t *xwfp, FILE *out);
+
+/*
+ * Run the pipeline until the source is exhausted.  Returns zero at
+ * EOF, -1 on failure, or the non-zero value of a stage that stopped
+ * the pipeline.
+ */
+int
+xi_whiffle_run (xi_whiffle_t *xwfp);
 
 #endif /* LIBSLAX_XI_WHIFFLE_H */
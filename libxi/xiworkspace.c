@@ -29,8 +29,8 @@
 #include <limits.h>
 
 #include "slaxconfig.h"
-#include <libslax/slaxdef.h>
-#include <libslax/slax.h>
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
 #include <parrotdb/pacommon.h>
 #include <parrotdb/paconfig.h>
 #include <parrotdb/pammap.h>
@@ -47,11 +47,27 @@
 #include <libxi/xinodeset.h>
 #include <libxi/xiparse.h>
 
+/* Initial size of the name index: the short strings, plus as many names */
+#define XI_NAME_INDEX_MIN	(PA_SHORT_STRINGS_MAX * 2)
+#define XI_ATTRIB_NAME_MAX	256 /* Longest attribute name we'll extract */
+
+static void
+xi_istr_pool_open (pa_mmap_t *pmap, const char *basename, uint32_t max_atoms,
+		   pa_istr_t **namesp, pa_pat_t **names_indexp);
+
 xi_workspace_t *
 xi_workspace_open (pa_mmap_t *pmp, const char *name)
+{
+    return xi_workspace_open_flags(pmp, name, 0);
+}
+
+xi_workspace_t *
+xi_workspace_open_flags (pa_mmap_t *pmp, const char *name, uint32_t flags)
 {
     pa_istr_t *names = NULL;
     pa_pat_t *names_index = NULL;
+    pa_istr_t *values = NULL;
+    pa_pat_t *values_index = NULL;
     pa_fixed_t *ns_map = NULL;
     pa_pat_t *ns_map_index = NULL;
     pa_istr_t *pip = NULL;
@@ -62,6 +78,21 @@ xi_workspace_open (pa_mmap_t *pmp, const char *name)
     xi_workspace_t *workp = NULL;
     char namebuf[PA_MMAP_HEADER_NAME_LEN];
     pa_fixed_t *nodeset_chunks = NULL, *nodeset_info = NULL;
+    pa_fixed_t *order = NULL, *hash = NULL, *attrib_dir = NULL;
+    pa_shift_t shift = XI_SHIFT;
+    pa_shift_t text_shift = PA_ARB_ATOM_SHIFT;
+    uint32_t max_atoms = XI_MAX_ATOMS;
+
+    /*
+     * Large workspaces only change the pools that grow with the
+     * document.  Names and namespaces grow with the vocabulary, and
+     * xn_name and xn_ns_map couldn't hold bigger atoms anyway.
+     */
+    if (flags & XWF_LARGE) {
+	shift = XI_LARGE_SHIFT;
+	text_shift = XI_LARGE_TEXT_SHIFT;
+	max_atoms = XI_LARGE_MAX_ATOMS;
+    }
 
     /* Holds the names of our elements, attributes, etc */
     xi_mk_name(namebuf, name, "names");
@@ -69,23 +100,54 @@ xi_workspace_open (pa_mmap_t *pmp, const char *name)
     if (names == NULL)
 	goto fail;
 
+    /* Interned text values live in a pool of their own */
+    xi_mk_name(namebuf, name, "values");
+    xi_istr_pool_open(pmp, namebuf, XI_INTERN_MAX_ATOMS,
+		      &values, &values_index);
+    if (values == NULL)
+	goto fail;
+
     xi_mk_name(namebuf, name, "namespaces");
     xi_ns_open(pmp, namebuf, &ns_map, &ns_map_index);
     if (ns_map == NULL)
 	goto fail;
 
-    nodes = pa_fixed_open(pmp, xi_mk_name(namebuf, name, "nodes"), XI_SHIFT,
-			 sizeof(*nodep), XI_MAX_ATOMS);
+    nodes = pa_fixed_open(pmp, xi_mk_name(namebuf, name, "nodes"), shift,
+			 sizeof(*nodep), max_atoms);
     if (nodes == NULL)
 	goto fail;
 
-    pap = pa_arb_open(pmp, xi_mk_name(namebuf, name, "data"));
+    /* Document order runs parallel to the nodes, indexed by node atom */
+    order = pa_fixed_open(pmp, xi_mk_name(namebuf, name, "order"), shift,
+			  sizeof(xi_node_order_t), max_atoms);
+    if (order == NULL)
+	goto fail;
+
+    pa_fixed_set_flags(order, PFF_INIT_ZERO);
+
+    /* Subtree hashes (see xidiff.c) also run parallel to the nodes */
+    hash = pa_fixed_open(pmp, xi_mk_name(namebuf, name, "hash"), shift,
+			 sizeof(uint64_t), max_atoms);
+    if (hash == NULL)
+	goto fail;
+
+    /*
+     * Attribute directory atoms run parallel too; a slot only means
+     * something when its node has XNF_ATTRIBS_INDEXED set
+     */
+    attrib_dir = pa_fixed_open(pmp, xi_mk_name(namebuf, name, "attrib-dir"),
+			       shift, sizeof(pa_atom_t), max_atoms);
+    if (attrib_dir == NULL)
+	goto fail;
+
+    pap = pa_arb_open_shift(pmp, xi_mk_name(namebuf, name, "data"),
+			    text_shift);
     if (pap == NULL)
 	goto fail;
 
     nodeset_chunks = pa_fixed_open(pmp,
-			xi_mk_name(namebuf, name, "nodeset-chunks"), XI_SHIFT,
-			XI_NODESET_CHUNK_SIZE, XI_MAX_ATOMS);
+			xi_mk_name(namebuf, name, "nodeset-chunks"), shift,
+			XI_NODESET_CHUNK_SIZE, max_atoms);
     if (nodeset_chunks == NULL)
 	goto fail;
 
@@ -93,8 +155,8 @@ xi_workspace_open (pa_mmap_t *pmp, const char *name)
     pa_fixed_set_flags(nodeset_chunks, PFF_INIT_ZERO);
 
     nodeset_info = pa_fixed_open(pmp,
-			xi_mk_name(namebuf, name, "nodeset-info"), XI_SHIFT,
-			sizeof(xi_nodeset_info_t), XI_MAX_ATOMS);
+			xi_mk_name(namebuf, name, "nodeset-info"), shift,
+			sizeof(xi_nodeset_info_t), max_atoms);
     if (nodeset_info == NULL)
 	goto fail;
 
@@ -112,8 +174,14 @@ xi_workspace_open (pa_mmap_t *pmp, const char *name)
     workp->xw_ns_map = ns_map;
     workp->xw_ns_map_index = ns_map_index;
     workp->xw_textpool = pap;
+    workp->xw_values = values;
+    workp->xw_values_index = values_index;
     workp->xw_nodeset_chunks = nodeset_chunks;
     workp->xw_nodeset_info = nodeset_info;
+    workp->xw_order = order;
+    workp->xw_hash = hash;
+    workp->xw_attrib_dir = attrib_dir;
+    workp->xw_flags = flags & (XWF_LARGE | XWF_INTERN_TEXT);
 
     return workp;
 
@@ -122,6 +190,12 @@ xi_workspace_open (pa_mmap_t *pmp, const char *name)
 	pa_fixed_close(nodeset_chunks);
     if (nodeset_info != NULL)
 	pa_fixed_close(nodeset_info);
+    if (order != NULL)
+	pa_fixed_close(order);
+    if (hash != NULL)
+	pa_fixed_close(hash);
+    if (attrib_dir != NULL)
+	pa_fixed_close(attrib_dir);
     if (pap != NULL)
 	pa_arb_close(pap);
     if (pip != NULL)
@@ -134,6 +208,10 @@ xi_workspace_open (pa_mmap_t *pmp, const char *name)
 	pa_istr_close(names);
     if (names_index != NULL)
 	pa_pat_close(names_index);
+    if (values != NULL)
+	pa_istr_close(values);
+    if (values_index != NULL)
+	pa_pat_close(values_index);
     if (ns_map != NULL)
 	pa_fixed_close(ns_map);
     if (ns_map_index != NULL)
@@ -142,17 +220,92 @@ xi_workspace_open (pa_mmap_t *pmp, const char *name)
     return NULL;
 }
 
+/*
+ * Empty a workspace so it can be used for the next document, at a
+ * fraction of the cost of a new one.  Nodes, text, and nodesets are
+ * all released at once, but the pages that hold them are kept, so the
+ * next document reuses them without going back to the mmap.  Every
+ * tree and nodeset in the workspace is dead after this.
+ *
+ * Names and namespace mappings are kept: they're interned, so they
+ * stop growing once the vocabulary is known, and compiled rules hold
+ * name atoms, which need to stay valid between documents.  Interned
+ * values are kept for the same reason: the next document will likely
+ * use the same ones.  The value pool is capped (XI_INTERN_MAX_ATOMS),
+ * so keeping it can't make it grow without end.
+ */
 void
-xi_namepool_open (pa_mmap_t *pmap, const char *basename,
-		  pa_istr_t **namesp, pa_pat_t **names_indexp)
+xi_workspace_reset (xi_workspace_t *xwp)
+{
+    pa_atom_t atom;
+
+    /*
+     * Nodesets in the name index are about to lose their chunks, so
+     * release them properly; their info blocks live in a pool, too.
+     */
+    for (atom = 0; atom < xwp->xw_name_index_max; atom++) {
+	xi_nodeset_free(xwp->xw_name_index[atom]);
+	xwp->xw_name_index[atom] = NULL;
+    }
+
+    pa_fixed_reset(xwp->xw_nodes);
+    pa_fixed_reset(xwp->xw_nodeset_chunks);
+    pa_fixed_reset(xwp->xw_nodeset_info);
+    pa_arb_reset(xwp->xw_textpool);
+
+    /*
+     * xw_order and xw_hash are indexed by node atom and are rewritten
+     * as nodes are built and hashed, so they can stay as they are.
+     * The same goes for xw_attrib_dir, whose slots are ignored until
+     * a new node sets XNF_ATTRIBS_INDEXED; the directories themselves
+     * were in the textpool.
+     */
+}
+
+/*
+ * Close a workspace, releasing the handles it holds and the workspace
+ * itself.  The contents stay in the mmap; it's the caller's, so it's
+ * left open.
+ */
+void
+xi_workspace_close (xi_workspace_t *xwp)
+{
+    if (xwp == NULL)
+	return;
+
+    xi_name_index_disable(xwp);
+
+    pa_fixed_close(xwp->xw_nodeset_chunks);
+    pa_fixed_close(xwp->xw_nodeset_info);
+    pa_fixed_close(xwp->xw_order);
+    pa_fixed_close(xwp->xw_hash);
+    pa_fixed_close(xwp->xw_attrib_dir);
+    pa_arb_close(xwp->xw_textpool);
+    pa_fixed_close(xwp->xw_nodes);
+    pa_istr_close(xwp->xw_names);
+    pa_pat_close(xwp->xw_names_index);
+    pa_istr_close(xwp->xw_values);
+    pa_pat_close(xwp->xw_values_index);
+    pa_fixed_close(xwp->xw_ns_map);
+    pa_pat_close(xwp->xw_ns_map_index);
+
+    free(xwp);
+}
+
+/*
+ * Open an interned string pool and its index, with room for the
+ * given number of storage atoms
+ */
+static void
+xi_istr_pool_open (pa_mmap_t *pmap, const char *basename, uint32_t max_atoms,
+		   pa_istr_t **namesp, pa_pat_t **names_indexp)
 {
     char namebuf[PA_MMAP_HEADER_NAME_LEN];
     pa_istr_t *pip = NULL;
     pa_pat_t *ppp = NULL;
 
-    /* The name pool holds the names of our elements, attributes, etc */
     pip = pa_istr_open(pmap, xi_mk_name(namebuf, basename, "data"),
-		       XI_SHIFT, XI_ISTR_SHIFT, XI_MAX_ATOMS);
+		       XI_SHIFT, XI_ISTR_SHIFT, max_atoms);
     if (pip == NULL)
 	return;
 
@@ -168,10 +321,19 @@ xi_namepool_open (pa_mmap_t *pmap, const char *basename,
     *names_indexp = ppp;
 }
 
+void
+xi_namepool_open (pa_mmap_t *pmap, const char *basename,
+		  pa_istr_t **namesp, pa_pat_t **names_indexp)
+{
+    /* The name pool holds the names of our elements, attributes, etc */
+    xi_istr_pool_open(pmap, basename, XI_MAX_ATOMS, namesp, names_indexp);
+}
+
 static const uint8_t *
-xi_ns_key_func (pa_pat_t *pp, pa_pat_node_t *node)
+xi_ns_key_func (pa_pat_t *pp, pa_pat_data_atom_t datom)
 {
-    return pa_fixed_atom_addr(pp->pp_data, node->ppn_data);
+    return pa_fixed_atom_addr(pp->pp_data,
+			      pa_fixed_atom(pa_pat_data_atom_of(datom)));
 }
 
 void
@@ -206,7 +368,7 @@ xi_ns_open (pa_mmap_t *pmap, const char *basename,
  * It's some ugly "atom smashing" that keeps us type safe.  Think of it
  * as lead shielding.
  */
-xi_name_atom_t
+pa_atom_t
 xi_namepool_atom (xi_workspace_t *xwp, const char *data, xi_boolean_t createp)
 {
     uint16_t len = strlen(data) + 1;
@@ -217,25 +379,90 @@ xi_namepool_atom (xi_workspace_t *xwp, const char *data, xi_boolean_t createp)
 	/* Allocate the name from our pool and add it to the tree */
 	pa_istr_atom_t iatom = pa_istr_string(xwp->xw_names, data);
 	datom = pa_pat_data_atom(pa_istr_atom_of(iatom));
-	if (pa_istr_is_null(atom))
+	if (pa_istr_is_null(iatom))
 	    pa_warning(0, "namepool create key failed for key '%s'", data);
 	else if (!pa_pat_add(ppp, datom, len))
 	    pa_warning(0, "duplicate key: %s", data);
+	else
+	    XI_WORKSPACE_STAT(xwp, xws_names, 1);
     }
 
-    xi_name_atom_t atom = xi_name_atom_t(pa_pat_data_atom_of(datom));
-    return atom;
+    return pa_pat_data_atom_of(datom);
 }
 
+void
+xi_text_intern_enable (xi_workspace_t *xwp)
+{
+    xwp->xw_flags |= XWF_INTERN_TEXT;
+}
+
+/*
+ * Stop interning new values; nodes that are already interned stay so
+ */
+void
+xi_text_intern_disable (xi_workspace_t *xwp)
+{
+    xwp->xw_flags &= ~XWF_INTERN_TEXT;
+}
+
+/*
+ * Return the value pool atom for a string, adding it if needed.
+ * Returns PA_NULL_ATOM if the string is too long to intern, or is
+ * new and the pool is full (or we fail), in which case the caller
+ * should use the textpool.
+ */
 pa_atom_t
-xi_get_attrib (xi_workspace_t *xwp, xi_node_t *nodep, pa_atom_t name_atom)
+xi_valuepool_atom (xi_workspace_t *xwp, const char *data, size_t len)
+{
+    char buf[XI_INTERN_MAX + 1];
+    pa_pat_t *ppp = xwp->xw_values_index;
+    pa_istr_atom_t iatom;
+    pa_pat_data_atom_t datom;
+
+    if (len > XI_INTERN_MAX)
+	return PA_NULL_ATOM;
+
+    /* Our data isn't NUL-terminated, but our keys need to be */
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+
+    /* One byte strings are built into the istr code; no need to store */
+    if (len <= 1)
+	return pa_istr_atom_of(pa_istr_nstring(xwp->xw_values, buf, len));
+
+    datom = pa_pat_get_atom(ppp, len + 1, buf);
+    if (!pa_pat_data_is_null(datom))
+	return pa_pat_data_atom_of(datom);
+
+    if (xwp->xw_flags & XWF_VALUES_FULL)
+	return PA_NULL_ATOM;
+
+    iatom = pa_istr_nstring(xwp->xw_values, buf, len);
+    if (pa_istr_is_null(iatom)) {
+	/* Out of room (see XI_INTERN_MAX_ATOMS); say so just once */
+	pa_warning(0, "valuepool is full; new values will not be interned");
+	xwp->xw_flags |= XWF_VALUES_FULL;
+	return PA_NULL_ATOM;
+    }
+
+    datom = pa_pat_data_atom(pa_istr_atom_of(iatom));
+    if (!pa_pat_add(ppp, datom, len + 1)) {
+	pa_warning(0, "duplicate value key: %s", buf);
+	return PA_NULL_ATOM;
+    }
+
+    return pa_istr_atom_of(iatom);
+}
+
+xi_node_t *
+xi_get_attrib_node (xi_workspace_t *xwp, xi_node_t *nodep,
+		    pa_atom_t name_atom)
 {
     pa_atom_t node_atom;
-    int attrib_seen = FALSE;
     xi_depth_t depth = nodep->xn_depth;
 
     if (!(nodep->xn_flags & XNF_ATTRIBS_PRESENT))
-	return PA_NULL_ATOM;
+	return NULL;
 
 #if 0 /* XXX */
     if (!(nodep->xn_flags & XNF_ATTRIBS_EXTRACTED))
@@ -254,13 +481,313 @@ xi_get_attrib (xi_workspace_t *xwp, xi_node_t *nodep, pa_atom_t name_atom)
 	if (nodep->xn_type != XI_TYPE_ATTRIB)
 	    continue;
 
-	attrib_seen = TRUE;
-
 	if (nodep->xn_name == name_atom)
-	    return nodep->xn_contents;
+	    return nodep;
     }
 
-    return PA_NULL_ATOM;
+    return NULL;
+}
+
+static inline uint32_t
+xi_attrib_dir_hash (pa_atom_t name_atom, uint32_t mask)
+{
+    return (name_atom * 2654435761U) & mask; /* Knuth's multiplier */
+}
+
+/*
+ * Find the entry for a name, or the empty entry where it would go
+ */
+static xi_attrib_dir_entry_t *
+xi_attrib_dir_slot (xi_attrib_dir_t *dirp, pa_atom_t name_atom)
+{
+    uint32_t slot = xi_attrib_dir_hash(name_atom, dirp->xad_mask);
+    xi_attrib_dir_entry_t *entp;
+
+    for (;; slot = (slot + 1) & dirp->xad_mask) {
+	entp = &dirp->xad_entry[slot];
+	if (entp->xade_name == name_atom || entp->xade_name == PA_NULL_ATOM)
+	    return entp;
+    }
+}
+
+/*
+ * Add an attribute to a directory.  As with xi_get_attrib_node(), the
+ * first attribute with a given name wins.
+ */
+static void
+xi_attrib_dir_add (xi_attrib_dir_t *dirp, pa_atom_t name_atom,
+		   pa_atom_t attrib_atom)
+{
+    xi_attrib_dir_entry_t *entp = xi_attrib_dir_slot(dirp, name_atom);
+
+    if (entp->xade_name == name_atom)
+	return;
+
+    entp->xade_name = name_atom;
+    entp->xade_node = attrib_atom;
+}
+
+/*
+ * Turn an unparsed attribute string into attribute nodes and add them
+ * to the directory.  The nodes aren't linked into the tree (the string
+ * is still the tree's copy of the attributes), so they're marked
+ * XNF_DETACHED and the directory is all that holds them; their xn_next
+ * points at the element, as a last child's would.  Names that aren't
+ * in the name pool can't be asked for, so they're skipped, as are
+ * repeated names and namespace definitions, which XIA_SAVE_ATSTR never
+ * leaves in the string.
+ */
+static void
+xi_attrib_dir_extract (xi_workspace_t *xwp, xi_attrib_dir_t *dirp,
+		       pa_atom_t node_atom, xi_node_t *nodep, const char *cp)
+{
+    char namebuf[XI_ATTRIB_NAME_MAX];
+    const char *np, *lp, *vp, *ep;
+    pa_atom_t name_atom, value_atom, attrib_atom;
+    xi_node_t *attribp;
+    size_t len;
+    char *dp;
+
+    for ( ; cp && *cp; cp = ep + 1) {
+	while (xi_isspace(*cp))
+	    cp += 1;
+
+	for (np = cp; *np && *np != '=' && !xi_isspace(*np); np++)
+	    continue;
+
+	for (vp = np; xi_isspace(*vp) || *vp == '='; vp++)
+	    continue;
+
+	if (*vp != '"' && *vp != '\'')
+	    break;
+
+	ep = strchr(vp + 1, *vp);
+	if (ep == NULL)
+	    break;
+
+	/* Attributes are named by their local name */
+	lp = memchr(cp, ':', np - cp);
+	lp = lp ? lp + 1 : cp;
+	len = np - lp;
+	if (len == 0 || len >= sizeof(namebuf))
+	    continue;
+
+	memcpy(namebuf, lp, len);
+	namebuf[len] = '\0';
+
+	name_atom = xi_namepool_atom(xwp, namebuf, FALSE);
+	if (name_atom == PA_NULL_ATOM)
+	    continue;
+
+	/* The first one wins, so a repeat would never be found */
+	if (xi_attrib_dir_slot(dirp, name_atom)->xade_name != PA_NULL_ATOM)
+	    continue;
+
+	vp += 1;		/* Skip the quote */
+	len = ep - vp;
+
+	value_atom = pa_arb_atom_of(pa_arb_alloc(xwp->xw_textpool, len + 1));
+	dp = pa_arb_atom_addr(xwp->xw_textpool, pa_arb_atom(value_atom));
+	if (dp == NULL)
+	    break;
+
+	XI_WORKSPACE_STAT(xwp, xws_text, 1);
+	XI_WORKSPACE_STAT(xwp, xws_text_bytes, len + 1);
+
+	memcpy(dp, vp, len);
+	dp[len] = '\0';
+
+	attribp = xi_node_alloc(xwp, &attrib_atom);
+	if (attribp == NULL) {
+	    pa_arb_free_atom(xwp->xw_textpool, pa_arb_atom(value_atom));
+	    break;
+	}
+
+	XI_WORKSPACE_STAT(xwp, xws_nodes, 1);
+
+	attribp->xn_type = XI_TYPE_ATTRIB;
+	attribp->xn_depth = nodep->xn_depth + 1;
+	attribp->xn_flags = XNF_DETACHED
+	    | (memchr(vp, '&', len) ? XNF_ESCAPED : 0);
+	attribp->xn_ns_map = PA_NULL_ATOM;
+	attribp->xn_name = name_atom;
+	attribp->xn_next = node_atom;
+	attribp->xn_contents = value_atom;
+
+	xi_attrib_dir_add(dirp, name_atom, attrib_atom);
+    }
+}
+
+/*
+ * Build the attribute directory for an element, returning its
+ * textpool atom.  The table is at least twice the number of
+ * attributes, so there's always an empty slot to end a probe.
+ */
+static pa_atom_t
+xi_attrib_dir_build (xi_workspace_t *xwp, pa_atom_t node_atom,
+		     xi_node_t *nodep)
+{
+    xi_depth_t depth = nodep->xn_depth;
+    unsigned count = 0, size = 1;
+    xi_attrib_dir_t *dirp;
+    xi_node_t *childp;
+    pa_atom_t atom, dir_atom;
+    const char *cp;
+
+    /* Count the attributes; '=' signs are a fine upper bound for ATSTRs */
+    for (atom = nodep->xn_contents; atom != PA_NULL_ATOM;
+	 atom = childp->xn_next) {
+	childp = xi_node_addr(xwp, atom);
+	if (childp == NULL || childp->xn_depth <= depth)
+	    break;
+
+	if (childp->xn_type == XI_TYPE_ATTRIB) {
+	    count += 1;
+	} else if (childp->xn_type == XI_TYPE_ATSTR) {
+	    for (cp = xi_node_stored_string(xwp, childp);
+		 cp && (cp = strchr(cp, '=')) != NULL; cp++)
+		count += 1;
+	}
+    }
+
+    while (size < count * 2)
+	size <<= 1;
+
+    size_t len = sizeof(*dirp) + size * sizeof(dirp->xad_entry[0]);
+    dir_atom = pa_arb_atom_of(pa_arb_alloc(xwp->xw_textpool, len));
+    dirp = pa_arb_atom_addr(xwp->xw_textpool, pa_arb_atom(dir_atom));
+    if (dirp == NULL)
+	return PA_NULL_ATOM;
+
+    XI_WORKSPACE_STAT(xwp, xws_text, 1);
+    XI_WORKSPACE_STAT(xwp, xws_text_bytes, len);
+
+    bzero(dirp, len);
+    dirp->xad_mask = size - 1;
+
+    for (atom = nodep->xn_contents; atom != PA_NULL_ATOM;
+	 atom = childp->xn_next) {
+	childp = xi_node_addr(xwp, atom);
+	if (childp == NULL || childp->xn_depth <= depth)
+	    break;
+
+	if (childp->xn_type == XI_TYPE_ATTRIB)
+	    xi_attrib_dir_add(dirp, childp->xn_name, atom);
+	else if (childp->xn_type == XI_TYPE_ATSTR)
+	    xi_attrib_dir_extract(xwp, dirp, node_atom, nodep,
+				  xi_node_stored_string(xwp, childp));
+    }
+
+    return dir_atom;
+}
+
+xi_node_t *
+xi_attrib_lookup (xi_workspace_t *xwp, pa_atom_t node_atom,
+		  xi_node_t *nodep, pa_atom_t name_atom)
+{
+    xi_attrib_dir_t *dirp;
+    xi_attrib_dir_entry_t *entp;
+    pa_atom_t *slotp;
+
+    if (nodep == NULL) {
+	nodep = xi_node_addr(xwp, node_atom);
+	if (nodep == NULL)
+	    return NULL;
+    }
+
+    if (!(nodep->xn_flags & XNF_ATTRIBS_PRESENT) || name_atom == PA_NULL_ATOM)
+	return NULL;
+
+    slotp = pa_fixed_element(xwp->xw_attrib_dir, node_atom);
+    if (slotp == NULL)		/* No memory; fall back to a plain scan */
+	return xi_get_attrib_node(xwp, nodep, name_atom);
+
+    if (!(nodep->xn_flags & XNF_ATTRIBS_INDEXED)) {
+	*slotp = xi_attrib_dir_build(xwp, node_atom, nodep);
+	if (*slotp == PA_NULL_ATOM)
+	    return xi_get_attrib_node(xwp, nodep, name_atom);
+
+	nodep->xn_flags |= XNF_ATTRIBS_INDEXED;
+    }
+
+    dirp = pa_arb_atom_addr(xwp->xw_textpool, pa_arb_atom(*slotp));
+    if (dirp == NULL)		/* Should not occur */
+	return NULL;
+
+    entp = xi_attrib_dir_slot(dirp, name_atom);
+    if (entp->xade_name == PA_NULL_ATOM)
+	return NULL;
+
+    return xi_node_addr(xwp, entp->xade_node);
+}
+
+void
+xi_attrib_dir_free (xi_workspace_t *xwp, pa_atom_t node_atom,
+		    xi_node_t *nodep)
+{
+    xi_attrib_dir_t *dirp;
+    xi_attrib_dir_entry_t *entp;
+    xi_node_t *attribp;
+    pa_atom_t *slotp;
+    uint32_t slot;
+
+    if (nodep == NULL || !(nodep->xn_flags & XNF_ATTRIBS_INDEXED))
+	return;
+
+    nodep->xn_flags &= ~XNF_ATTRIBS_INDEXED;
+
+    slotp = pa_fixed_element(xwp->xw_attrib_dir, node_atom);
+    if (slotp == NULL || *slotp == PA_NULL_ATOM)
+	return;
+
+    dirp = pa_arb_atom_addr(xwp->xw_textpool, pa_arb_atom(*slotp));
+    if (dirp != NULL) {
+	/* Attribute nodes in the tree are the tree's to free */
+	for (slot = 0; slot <= dirp->xad_mask; slot++) {
+	    entp = &dirp->xad_entry[slot];
+	    if (entp->xade_name == PA_NULL_ATOM)
+		continue;
+
+	    attribp = xi_node_addr(xwp, entp->xade_node);
+	    if (attribp == NULL || !(attribp->xn_flags & XNF_DETACHED))
+		continue;
+
+	    pa_arb_free_atom(xwp->xw_textpool,
+			     pa_arb_atom(attribp->xn_contents));
+	    xi_node_free(xwp, entp->xade_node);
+	}
+    }
+
+    pa_arb_free_atom(xwp->xw_textpool, pa_arb_atom(*slotp));
+    *slotp = PA_NULL_ATOM;
+}
+
+pa_atom_t
+xi_get_attrib (xi_workspace_t *xwp, pa_atom_t node_atom, pa_atom_t name_atom)
+{
+    xi_node_t *nodep = xi_attrib_lookup(xwp, node_atom, NULL, name_atom);
+
+    return nodep ? nodep->xn_contents : PA_NULL_ATOM;
+}
+
+/*
+ * Decode the entities in a node's value, in place.  The decoded form
+ * is never longer than the raw one, so the textpool atom can hold it.
+ * Once done, we clear XNF_ESCAPED so we never do it again.
+ */
+const char *
+xi_node_string_decode (xi_workspace_t *xwp, xi_node_t *nodep)
+{
+    char *cp = pa_arb_atom_addr(xwp->xw_textpool,
+				pa_arb_atom(nodep->xn_contents));
+    if (cp == NULL)
+	return NULL;
+
+    size_t len = xi_source_unescape(NULL, cp, strlen(cp));
+    cp[len] = '\0';
+
+    nodep->xn_flags &= ~XNF_ESCAPED;
+    return cp;
 }
 
 /*
@@ -300,7 +827,8 @@ xi_ns_find (xi_workspace_t *xwp, const char *prefix, const char *uri,
 
     pa_pat_t *ppp = xwp->xw_ns_map_index;
     xi_ns_map_t ns = { prefix_atom, uri_atom };
-    pa_atom_t atom = pa_pat_get_atom(ppp, sizeof(ns), &ns);
+    pa_pat_data_atom_t datom = pa_pat_get_atom(ppp, sizeof(ns), &ns);
+    pa_atom_t atom = pa_pat_data_atom_of(datom);
     if (atom == PA_NULL_ATOM && createp) {
 	xi_ns_map_t *nsp = xi_ns_map_alloc(xwp, &atom);
 	if (nsp == NULL) {
@@ -312,7 +840,7 @@ xi_ns_find (xi_workspace_t *xwp, const char *prefix, const char *uri,
 	*nsp = ns;		/* Initialize newly allocated ns_map entry */
 
 	/* Add it to the patricia tree */
-	if (!pa_pat_add(ppp, atom, sizeof(ns))) {
+	if (!pa_pat_add(ppp, pa_pat_data_atom(atom), sizeof(ns))) {
 	    xi_ns_map_free(xwp, atom);
 
 	    pa_warning(0, "duplicate key failure for namespace '%s%s%s'",
@@ -324,3 +852,71 @@ xi_ns_find (xi_workspace_t *xwp, const char *prefix, const char *uri,
     return atom;
 
 }
+
+void
+xi_name_index_enable (xi_workspace_t *xwp)
+{
+    xwp->xw_flags |= XWF_NAME_INDEX;
+}
+
+/*
+ * Turn off the index and release the nodesets it holds
+ */
+void
+xi_name_index_disable (xi_workspace_t *xwp)
+{
+    pa_atom_t atom;
+
+    for (atom = 0; atom < xwp->xw_name_index_max; atom++)
+	xi_nodeset_free(xwp->xw_name_index[atom]);
+
+    free(xwp->xw_name_index);
+    xwp->xw_name_index = NULL;
+    xwp->xw_name_index_max = 0;
+    xwp->xw_flags &= ~XWF_NAME_INDEX;
+}
+
+/*
+ * Record an element in the name index, a flat array indexed by name
+ * atom.  Name atoms aren't offsets into the namepool's data; they're
+ * slots in its index table, numbered from PA_SHORT_STRINGS_MAX up in
+ * the order the names were first seen, with one-character names
+ * taking the "short string" atoms below that.  So the array is sized
+ * by the highest atom, which is PA_SHORT_STRINGS_MAX plus the number
+ * of distinct names, and it only grows as the vocabulary does.
+ */
+void
+xi_name_index_add (xi_workspace_t *xwp, pa_atom_t name_atom,
+		   pa_atom_t node_atom)
+{
+    xi_nodeset_t **index, *nodeset;
+    pa_atom_t max;
+
+    if (!(xwp->xw_flags & XWF_NAME_INDEX) || name_atom == PA_NULL_ATOM)
+	return;
+
+    if (name_atom >= xwp->xw_name_index_max) {
+	max = xwp->xw_name_index_max ?: XI_NAME_INDEX_MIN;
+	while (max <= name_atom)
+	    max <<= 1;
+
+	index = realloc(xwp->xw_name_index, max * sizeof(*index));
+	if (index == NULL)
+	    return;
+
+	bzero(index + xwp->xw_name_index_max,
+	      (max - xwp->xw_name_index_max) * sizeof(*index));
+	xwp->xw_name_index = index;
+	xwp->xw_name_index_max = max;
+    }
+
+    nodeset = xwp->xw_name_index[name_atom];
+    if (nodeset == NULL) {
+	nodeset = xi_nodeset_alloc(xwp, XI_NSTYPE_NORMAL, 0);
+	if (nodeset == NULL)
+	    return;
+	xwp->xw_name_index[name_atom] = nodeset;
+    }
+
+    xi_nodeset_add(nodeset, node_atom);
+}
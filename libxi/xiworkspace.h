@@ -33,6 +33,43 @@ typedef struct xi_ns_map_s {
     pa_atom_t xnm_uri;		/* Atom of URL string (in namepool) */
 } xi_ns_map_t;
 
+struct xi_nodeset_s;		/* Forward declaration (xinodeset.h) */
+
+/*
+ * Allocation counters for a workspace, kept only when xw_stats is set
+ * (see xi_parse_stats_enable)
+ */
+typedef struct xi_workspace_stats_s {
+    uint64_t xws_nodes;		/* Nodes allocated */
+    uint64_t xws_text;		/* Textpool allocations */
+    uint64_t xws_text_bytes;	/* Bytes requested from the textpool */
+    uint64_t xws_interned;	/* Values taken from the value pool */
+    uint64_t xws_names;		/* Names added to the name pool */
+} xi_workspace_stats_t;
+
+/*
+ * An attribute directory is a small open-addressed hash table, kept
+ * in the textpool, that maps an element's attribute name atoms to
+ * the attribute nodes holding their values.  It's built the first
+ * time xi_attrib_lookup() is asked about an element, and xw_attrib_dir
+ * (which runs parallel to the nodes) records where it lives.
+ */
+typedef struct xi_attrib_dir_entry_s {
+    pa_atom_t xade_name;	/* Name atom (or PA_NULL_ATOM if empty) */
+    pa_atom_t xade_node;	/* Attribute node */
+} xi_attrib_dir_entry_t;
+
+typedef struct xi_attrib_dir_s {
+    uint32_t xad_mask;		/* Number of entries, less one */
+    xi_attrib_dir_entry_t xad_entry[]; /* Hash table */
+} xi_attrib_dir_t;
+
+#define XI_WORKSPACE_STAT(_xwp, _field, _val) \
+    do { \
+	if ((_xwp)->xw_stats) \
+	    (_xwp)->xw_stats->_field += (_val); \
+    } while (0)
+
 typedef struct xi_workspace_s {
     pa_mmap_t *xw_mmap;	/* Base memory information */
     pa_fixed_t *xw_nodes;	/* Pool of nodes (xi_node_t) */
@@ -41,13 +78,58 @@ typedef struct xi_workspace_s {
     pa_fixed_t *xw_ns_map; /* Map from prefixes to URLs (xi_ns_map_t) */
     pa_pat_t *xw_ns_map_index;	/* Index of xw_ns_map entries */
     pa_arb_t *xw_textpool;	/* Text data values */
+    pa_istr_t *xw_values;	/* Interned (short) text values */
+    pa_pat_t *xw_values_index;	/* Patricia tree for interned values */
     pa_fixed_t *xw_nodeset_chunks; /* Pool of chunks for nodesets node lists */
     pa_fixed_t *xw_nodeset_info; /* Pool of chunks for nodeset "info" data */
+    pa_fixed_t *xw_order;	/* Document order, by node atom (xi_node_order_t) */
+    pa_fixed_t *xw_hash;	/* Subtree hashes, by node atom (psu_hash_t) */
+    pa_fixed_t *xw_attrib_dir;	/* Attribute directories, by node atom */
+    uint32_t xw_flags;		/* Flags (XWF_*) */
+    struct xi_nodeset_s **xw_name_index; /* Name atom -> nodeset of elements */
+    pa_atom_t xw_name_index_max; /* Number of slots in xw_name_index */
+    xi_workspace_stats_t *xw_stats; /* Allocation counters (or NULL) */
 } xi_workspace_t;
 
+/* Flags for xw_flags */
+#define XWF_NAME_INDEX	(1<<0)	/* Maintain the element-name index */
+#define XWF_INTERN_TEXT	(1<<1)	/* Intern short text and attribute values */
+#define XWF_LARGE	(1<<2)	/* Sized for huge documents (see xitree.h) */
+#define XWF_VALUES_FULL	(1<<3)	/* Value pool is full; stop adding to it */
+
+/*
+ * Values up to this length are interned when XWF_INTERN_TEXT is set;
+ * longer ones are rarely repeated and go to the textpool as usual.
+ */
+#define XI_INTERN_MAX	32
+
+/*
+ * The value pool is never emptied, not even by xi_workspace_reset(),
+ * so a stream of distinct values would grow it without end.  It's
+ * capped at this many storage atoms (XI_ISTR_SHIFT sized, so 4MB);
+ * once it's full, values already in the pool are still shared, but
+ * new ones go to the textpool.
+ */
+#define XI_INTERN_MAX_ATOMS (1<<20)
+
 xi_workspace_t *
 xi_workspace_open (pa_mmap_t *pmp, const char *name);
 
+/*
+ * Open a workspace with the given flags (XWF_LARGE and
+ * XWF_INTERN_TEXT).  XWF_LARGE only means something here: the pools
+ * are laid out when they are created, and an existing workspace keeps
+ * the layout it was created with.
+ */
+xi_workspace_t *
+xi_workspace_open_flags (pa_mmap_t *pmp, const char *name, uint32_t flags);
+
+void
+xi_workspace_reset (xi_workspace_t *xwp);
+
+void
+xi_workspace_close (xi_workspace_t *xwp);
+
 void
 xi_namepool_open (pa_mmap_t *pmap, const char *basename,
 		  pa_istr_t **namesp, pa_pat_t **names_indexp);
@@ -60,8 +142,9 @@ pa_atom_t
 xi_ns_find (xi_workspace_t *xwp, const char *prefix, const char *uri,
 	    xi_boolean_t createp);
 
-PA_FIXED_FUNCTIONS(xi_node_atom_t, xi_node_t, xi_workspace_t, xw_nodes,
-		   xi_node_alloc, xi_node_free, xi_node_addr);
+PA_FIXED_FUNCTIONS(xi_node_id_t, xi_node_t, xi_workspace_t, xw_nodes,
+		   xi_node_alloc, xi_node_free, xi_node_addr,
+		   pa_fixed_plain, pa_fixed_plain_is_null);
 
 pa_atom_t
 xi_namepool_atom (xi_workspace_t *xwp, const char *data, xi_boolean_t createp);
@@ -69,32 +152,248 @@ xi_namepool_atom (xi_workspace_t *xwp, const char *data, xi_boolean_t createp);
 static inline const char *
 xi_namepool_string (xi_workspace_t *xwp, pa_atom_t name_atom)
 {
-    return pa_istr_atom_string(xwp->xw_names, name_atom);
+    return pa_istr_atom_string(xwp->xw_names, pa_istr_atom(name_atom));
+}
+
+/*
+ * The value pool works like the name pool, but holds text values.
+ * Operational data repeats the same handful of values ("up", "true",
+ * interface names) endlessly, so with XWF_INTERN_TEXT set, short
+ * values are stored once and the nodes holding them are marked
+ * XNF_INTERNED, with xn_contents being the value pool atom.  Interned
+ * values are shared, so they must never be modified or freed.
+ */
+void
+xi_text_intern_enable (xi_workspace_t *xwp);
+
+void
+xi_text_intern_disable (xi_workspace_t *xwp);
+
+pa_atom_t
+xi_valuepool_atom (xi_workspace_t *xwp, const char *data, size_t len);
+
+static inline const char *
+xi_valuepool_string (xi_workspace_t *xwp, pa_atom_t value_atom)
+{
+    return pa_istr_atom_string(xwp->xw_values, pa_istr_atom(value_atom));
 }
 
+xi_node_t *
+xi_get_attrib_node (xi_workspace_t *xwp, xi_node_t *nodep,
+		    pa_atom_t name_atom);
+
+/*
+ * Find an attribute of an element, using (and building, if needed)
+ * the element's attribute directory.  Attributes that are still part
+ * of an unparsed attribute string (XIA_SAVE_ATSTR) are extracted into
+ * attribute nodes of their own when the directory is built, so both
+ * cases cost a hash probe after the first lookup.  nodep can be NULL.
+ * This is the one to use when the same elements are asked about
+ * repeatedly; xi_get_attrib_node() is cheaper for a one-time look.
+ */
+xi_node_t *
+xi_attrib_lookup (xi_workspace_t *xwp, pa_atom_t node_atom,
+		  xi_node_t *nodep, pa_atom_t name_atom);
+
+/*
+ * Free an element's attribute directory, along with the attribute
+ * nodes that were extracted from its attribute string to fill it.
+ * Does nothing unless XNF_ATTRIBS_INDEXED is set.
+ */
+void
+xi_attrib_dir_free (xi_workspace_t *xwp, pa_atom_t node_atom,
+		    xi_node_t *nodep);
+
+/*
+ * Return the value atom of an element's attribute, which is a value
+ * pool atom for XNF_INTERNED attributes and a textpool atom otherwise
+ */
 pa_atom_t
-xi_get_attrib (xi_workspace_t *xwp, xi_node_t *nodep, pa_atom_t name_atom);
+xi_get_attrib (xi_workspace_t *xwp, pa_atom_t node_atom, pa_atom_t name_atom);
 
+/*
+ * Return a textpool string as stored, which for XNF_ESCAPED nodes
+ * means with entities intact; use xi_node_string() for the value.
+ */
 static inline const char *
 xi_textpool_string (xi_workspace_t *xwp, pa_atom_t atom)
 {
-    return pa_arb_atom_addr(xwp->xw_textpool, atom);
+    return pa_arb_atom_addr(xwp->xw_textpool, pa_arb_atom(atom));
+}
+
+/*
+ * Return a node's value as stored, from whichever pool holds it
+ */
+static inline const char *
+xi_node_stored_string (xi_workspace_t *xwp, xi_node_t *nodep)
+{
+    if (nodep->xn_flags & XNF_INTERNED)
+	return xi_valuepool_string(xwp, nodep->xn_contents);
+
+    return xi_textpool_string(xwp, nodep->xn_contents);
+}
+
+const char *
+xi_node_string_decode (xi_workspace_t *xwp, xi_node_t *nodep);
+
+/*
+ * Return the (decoded) value of a text or attribute node.  Values
+ * are stored raw and decoded the first time someone asks, so values
+ * that are never read (or are discarded) never pay for it.
+ */
+static inline const char *
+xi_node_string (xi_workspace_t *xwp, xi_node_t *nodep)
+{
+    if (nodep == NULL)
+	return NULL;
+
+    if (nodep->xn_flags & XNF_ESCAPED)
+	return xi_node_string_decode(xwp, nodep);
+
+    return xi_node_stored_string(xwp, nodep);
+}
+
+/*
+ * Do two nodes (of the same workspace) have the same value?  When
+ * both are interned, this is an atom comparison.
+ */
+static inline xi_boolean_t
+xi_node_value_equal (xi_workspace_t *xwp, xi_node_t *leftp, xi_node_t *rightp)
+{
+    const char *lcp, *rcp;
+
+    if ((leftp->xn_flags & rightp->xn_flags) & XNF_INTERNED)
+	return (leftp->xn_contents == rightp->xn_contents);
+
+    lcp = xi_node_string(xwp, leftp);
+    rcp = xi_node_string(xwp, rightp);
+    if (lcp == NULL || rcp == NULL)
+	return (lcp == rcp);
+
+    return (strcmp(lcp, rcp) == 0);
 }
 
 static inline const char *
 xi_get_attrib_string (xi_workspace_t *xwp, xi_node_t *nodep,
 		      pa_atom_t name_atom)
 {
-    pa_atom_t atom = xi_get_attrib(xwp, nodep, name_atom);
-    return (atom == PA_NULL_ATOM) ? NULL : xi_textpool_string(xwp, atom);
+    return xi_node_string(xwp, xi_get_attrib_node(xwp, nodep, name_atom));
+}
+
+static inline const char *
+xi_attrib_lookup_string (xi_workspace_t *xwp, pa_atom_t node_atom,
+			 xi_node_t *nodep, pa_atom_t name_atom)
+{
+    return xi_node_string(xwp,
+			  xi_attrib_lookup(xwp, node_atom, nodep, name_atom));
+}
+
+/*
+ * The element-name index maps each name atom to a nodeset holding
+ * every element with that name, in the order they were inserted,
+ * which for a parse is document order.  It's off by default, since
+ * it costs a nodeset slot per element; turn it on before parsing.
+ */
+void
+xi_name_index_enable (xi_workspace_t *xwp);
+
+void
+xi_name_index_disable (xi_workspace_t *xwp);
+
+void
+xi_name_index_add (xi_workspace_t *xwp, pa_atom_t name_atom,
+		   pa_atom_t node_atom);
+
+/*
+ * Return the nodeset of elements with the given name, or NULL if
+ * there are none (or the index isn't enabled).  The nodeset belongs
+ * to the index; don't free it.
+ */
+static inline struct xi_nodeset_s *
+xi_name_index_lookup (xi_workspace_t *xwp, pa_atom_t name_atom)
+{
+    if (name_atom == PA_NULL_ATOM || name_atom >= xwp->xw_name_index_max)
+	return NULL;
+
+    return xwp->xw_name_index[name_atom];
 }
 
-PA_ATOM_TYPE(xi_ns_map_id_t, xi_ns_map_id_s, xnm_atom, xi_ns_map_id_is_null,
-	     xi_ns_map_id, xi_ns_map_null_atom);
+/*
+ * Return the order information for a node.  xw_order is a plain
+ * paged array indexed by node atom, running parallel to xw_nodes.
+ */
+static inline xi_node_order_t *
+xi_node_order (xi_workspace_t *xwp, pa_atom_t node_atom)
+{
+    return pa_fixed_element(xwp->xw_order, node_atom);
+}
+
+static inline void
+xi_node_order_set (xi_workspace_t *xwp, pa_atom_t node_atom,
+		   uint32_t pre, uint32_t end)
+{
+    xi_node_order_t *orderp = xi_node_order(xwp, node_atom);
+
+    if (orderp) {
+	orderp->xno_pre = pre;
+	orderp->xno_end = end;
+    }
+}
+
+/*
+ * Is "anc" a proper ancestor of "desc"?
+ */
+static inline xi_boolean_t
+xi_node_is_ancestor (xi_workspace_t *xwp, pa_atom_t anc, pa_atom_t desc)
+{
+    xi_node_order_t *ap = pa_fixed_element_if_exists(xwp->xw_order, anc);
+    xi_node_order_t *dp = pa_fixed_element_if_exists(xwp->xw_order, desc);
+
+    if (ap == NULL || dp == NULL)
+	return FALSE;
+
+    return (ap->xno_pre < dp->xno_pre && dp->xno_pre <= ap->xno_end);
+}
+
+/*
+ * Compare two nodes (of the same tree) in document order, returning
+ * less than, equal to, or greater than zero, in the style of qsort().
+ * Nodes with no order information all look like the root, so ties
+ * are broken by atom, which keeps distinct nodes from comparing equal.
+ */
+static inline int
+xi_node_compare (xi_workspace_t *xwp, pa_atom_t left, pa_atom_t right)
+{
+    xi_node_order_t *lp = pa_fixed_element_if_exists(xwp->xw_order, left);
+    xi_node_order_t *rp = pa_fixed_element_if_exists(xwp->xw_order, right);
+    uint32_t lpre = lp ? lp->xno_pre : 0, rpre = rp ? rp->xno_pre : 0;
+
+    if (lpre != rpre)
+	return (lpre < rpre) ? -1 : 1;
+
+    return (left < right) ? -1 : (left > right) ? 1 : 0;
+}
+
+/*
+ * Return the preorder number just past a node's subtree, which lets
+ * a scan over a document-ordered nodeset skip the whole subtree
+ */
+static inline uint32_t
+xi_node_subtree_end (xi_workspace_t *xwp, pa_atom_t node_atom)
+{
+    xi_node_order_t *orderp
+	= pa_fixed_element_if_exists(xwp->xw_order, node_atom);
+
+    if (orderp == NULL)
+	return 0;
+
+    return ((orderp->xno_end > orderp->xno_pre)
+	    ? orderp->xno_end : orderp->xno_pre) + 1;
+}
 
-PA_FIXED_FUNCTIONS(xi_ns_map_id_t, xi_ns_map_t, xi_workspace_t, xw_ns_map,
+PA_FIXED_FUNCTIONS(xi_ns_id_t, xi_ns_map_t, xi_workspace_t, xw_ns_map,
 		   xi_ns_map_alloc, xi_ns_map_free, xi_ns_map_addr,
-		   xi_ns_map_id_is_null, xi_ns_map_id);
+		   pa_fixed_plain, pa_fixed_plain_is_null);
 
 #endif /* LIBSLAX_XI_WORKSPACE_H */
 
@@ -20,6 +20,7 @@
 #include <assert.h>
 
 #include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
 #include <parrotdb/pammap.h>
 #include <parrotdb/palog2.h>
 #include <parrotdb/paarb.h>
@@ -27,18 +28,18 @@
 #include <libpsu/psulog.h>
 
 static inline unsigned
-pa_arb_slot (size_t size)
+pa_arb_slot (pa_arb_t *prp, size_t size)
 {
-    if (size < (1 << PA_ARB_ATOM_SHIFT))
+    if (size < (1U << prp->pr_atom_shift))
 	return 0;
 
-    return pa_log2(size - 1) - PA_ARB_ATOM_SHIFT;
+    return pa_log2(size - 1) - prp->pr_atom_shift;
 }
 
 static inline uint32_t
-pa_arb_chunks_per_page (pa_arb_t *prp UNUSED, unsigned slot)
+pa_arb_chunks_per_page (pa_arb_t *prp, unsigned slot)
 {
-    uint32_t val = 1 << PA_ARB_OFFSET_SHIFT;
+    uint32_t val = 1 << prp->pr_offset_shift;
     val >>= slot;
     return val ?: 1;
 }
@@ -48,22 +49,22 @@ pa_arb_chunks_per_page (pa_arb_t *prp UNUSED, unsigned slot)
  * the first slot is an atom (PA_ARB_ATOM_SIZE).
  */
 static inline size_t
-pa_arb_slot_to_size (pa_arb_t *prp UNUSED, unsigned slot)
+pa_arb_slot_to_size (pa_arb_t *prp, unsigned slot)
 {
-    size_t val = 1 << (slot + PA_ARB_ATOM_SHIFT);
+    size_t val = (size_t) 1 << (slot + prp->pr_atom_shift);
 
     return (val < PA_MMAP_ATOM_SIZE) ? PA_MMAP_ATOM_SIZE : val;
 }
 
 static inline pa_arb_atom_t
-pa_arb_build_atom (pa_arb_t *prp UNUSED, pa_mmap_atom_t matom,
+pa_arb_build_atom (pa_arb_t *prp, pa_mmap_atom_t matom,
 		      pa_arb_slot_t slot, pa_arb_chunk_t chunk)
 {
     if (pa_mmap_is_null(matom))
 	return pa_arb_null_atom();
 
     /* High bits are the mmap atom */
-    pa_atom_t raw = pa_mmap_atom_of(matom) << PA_ARB_OFFSET_SHIFT;
+    pa_atom_t raw = pa_mmap_atom_of(matom) << prp->pr_offset_shift;
 
     /* Low bits are the arb atom */
     uint32_t off = (1 << slot) * chunk;
@@ -72,14 +73,55 @@ pa_arb_build_atom (pa_arb_t *prp UNUSED, pa_mmap_atom_t matom,
     return pa_arb_atom(raw);
 }
 
+/*
+ * Record a page, so we can find it at reset time
+ */
 static void
-pa_arb_make_page (pa_arb_t *prp, unsigned slot)
+pa_arb_page_record (pa_arb_t *prp, pa_mmap_atom_t matom, unsigned slot)
 {
-    size_t real_size = pa_arb_slot_to_size(prp, slot);
-    pa_mmap_atom_t matom = pa_mmap_alloc(prp->pr_mmap, real_size);
-    if (pa_mmap_is_null(matom))
-	return;
+    pa_arb_page_t *pages;
+    uint32_t max;
+
+    if (prp->pr_pages_count == prp->pr_pages_max) {
+	max = prp->pr_pages_max ? prp->pr_pages_max * 2 : 64;
+	pages = psu_realloc(prp->pr_pages, max * sizeof(*pages));
+	if (pages == NULL)
+	    return;		/* Page won't be reused; not fatal */
 
+	prp->pr_pages = pages;
+	prp->pr_pages_max = max;
+    }
+
+    prp->pr_pages[prp->pr_pages_count].prp_matom = matom;
+    prp->pr_pages[prp->pr_pages_count].prp_slot = slot;
+    prp->pr_pages_count += 1;
+}
+
+/*
+ * Forget a large allocation that's being freed
+ */
+static void
+pa_arb_page_forget (pa_arb_t *prp, pa_mmap_atom_t matom)
+{
+    uint32_t i;
+
+    /* Large allocations are rare, and usually freed young */
+    for (i = prp->pr_pages_count; i > 0; i--) {
+	if (pa_mmap_atom_of(prp->pr_pages[i - 1].prp_matom)
+	    == pa_mmap_atom_of(matom)) {
+	    prp->pr_pages[i - 1] = prp->pr_pages[--prp->pr_pages_count];
+	    return;
+	}
+    }
+}
+
+/*
+ * Carve a page into chunks for the given slot, putting them on the
+ * front of that slot's free list
+ */
+static void
+pa_arb_carve_page (pa_arb_t *prp, pa_mmap_atom_t matom, unsigned slot)
+{
     pa_arb_header_t *prhp;
     unsigned chunks_per_page = pa_arb_chunks_per_page(prp, slot);
     unsigned i, imax = chunks_per_page;
@@ -97,7 +139,7 @@ pa_arb_make_page (pa_arb_t *prp, unsigned slot)
 	prhp->prh_chunk = i;
 
 	if (i == imax - 1)
-	    atom = pa_arb_null_atom(); /* End of the block */
+	    atom = prp->pr_infop->pri_free[slot]; /* End of the block */
 	else atom = pa_arb_build_atom(prp, matom, slot, i + 1);
 
 	prhp->prh_next_free[0] = atom;
@@ -106,6 +148,18 @@ pa_arb_make_page (pa_arb_t *prp, unsigned slot)
     prp->pr_infop->pri_free[slot] = saved_atom;
 }
 
+static void
+pa_arb_make_page (pa_arb_t *prp, unsigned slot)
+{
+    size_t real_size = pa_arb_slot_to_size(prp, slot);
+    pa_mmap_atom_t matom = pa_mmap_alloc(prp->pr_mmap, real_size);
+    if (pa_mmap_is_null(matom))
+	return;
+
+    pa_arb_page_record(prp, matom, slot);
+    pa_arb_carve_page(prp, matom, slot);
+}
+
 /*
  * Allocate memory from a paged array malloc pool.  We find the best slot
  * in the page table, based on side rounded up to power-of-two.  Then
@@ -117,7 +171,7 @@ pa_arb_alloc (pa_arb_t *prp, size_t size)
 {
     pa_arb_header_t *prhp;
     size_t full_size = size + sizeof(pa_arb_header_t);
-    unsigned slot = pa_arb_slot(full_size);
+    unsigned slot = pa_arb_slot(prp, full_size);
 
     pa_arb_atom_t atom = pa_arb_null_atom();
 
@@ -153,7 +207,7 @@ pa_arb_alloc (pa_arb_t *prp, size_t size)
 	 * Since our atom numbers are just shifted matoms, we just
 	 * need to zero fill the low bits.
 	 */
-	atom = pa_arb_atom(pa_mmap_atom_of(matom) << PA_ARB_OFFSET_SHIFT);
+	atom = pa_arb_atom(pa_mmap_atom_of(matom) << prp->pr_offset_shift);
 
 	prhp = pa_arb_header(prp, atom);
 	prhp->prh_magic = PRH_MAGIC_LARGE_INUSE;
@@ -165,6 +219,8 @@ pa_arb_alloc (pa_arb_t *prp, size_t size)
 	 */
 	prhp->prh_size = full_size >> PA_MMAP_ATOM_SHIFT;
 
+	pa_arb_page_record(prp, matom, PA_ARB_SLOT_LARGE);
+
     } else {
 	pa_warning(0, "pa_arb: allocation size limit exceeded: %lu", size);
     }
@@ -198,8 +254,10 @@ pa_arb_free_atom_addr (pa_arb_t *prp, pa_arb_atom_t atom, void *addr)
 
     case PRH_MAGIC_LARGE_INUSE:
 	full_size = prhp->prh_size << PA_MMAP_ATOM_SHIFT;
+	pa_arb_page_forget(prp,
+		   pa_mmap_atom(pa_arb_atom_of(atom) >> prp->pr_offset_shift));
 	pa_mmap_free(prp->pr_mmap,
-		     pa_mmap_atom(pa_arb_atom_of(atom) >> PA_ARB_OFFSET_SHIFT),
+		     pa_mmap_atom(pa_arb_atom_of(atom) >> prp->pr_offset_shift),
 		     full_size);
 	break;
 
@@ -230,7 +288,14 @@ pa_arb_free_atom (pa_arb_t *prp, pa_arb_atom_t atom)
 void
 pa_arb_init (pa_mmap_t *pmp, pa_arb_t *prp)
 {
+    pa_shift_t shift = PA_ARB_ATOM_SHIFT;
+
+    if (prp->pr_infop && prp->pr_infop->pri_atom_shift)
+	shift = prp->pr_infop->pri_atom_shift;
+
     prp->pr_mmap = pmp;
+    prp->pr_atom_shift = shift;
+    prp->pr_offset_shift = PA_MMAP_ATOM_SHIFT - shift;
 }
 
 pa_arb_t *
@@ -247,7 +312,7 @@ pa_arb_setup (pa_mmap_t *pmp, pa_arb_info_t *prip)
 }    
 
 pa_arb_t *
-pa_arb_open (pa_mmap_t *pmp, const char *name)
+pa_arb_open_shift (pa_mmap_t *pmp, const char *name, pa_shift_t atom_shift)
 {
     pa_arb_info_t *prip = NULL;
 
@@ -257,18 +322,75 @@ pa_arb_open (pa_mmap_t *pmp, const char *name)
 	    pa_warning(0, "pa_arb header not found: %s", name);
 	    return NULL;
 	}
+
+	/* A new pool takes the caller's atom size; an old one keeps its */
+	if (prip->pri_atom_shift == 0) {
+	    atom_shift = pa_config_value32(name, "atom-shift", atom_shift);
+	    if (atom_shift < PA_ARB_ATOM_SHIFT)
+		atom_shift = PA_ARB_ATOM_SHIFT;
+	    else if (atom_shift > PA_ARB_ATOM_SHIFT_MAX)
+		atom_shift = PA_ARB_ATOM_SHIFT_MAX;
+
+	    prip->pri_atom_shift = atom_shift;
+	}
     }
 
     return pa_arb_setup(pmp, prip);
 }
 
+pa_arb_t *
+pa_arb_open (pa_mmap_t *pmp, const char *name)
+{
+    return pa_arb_open_shift(pmp, name, PA_ARB_ATOM_SHIFT);
+}
+
 
 void
 pa_arb_close (pa_arb_t *prp)
 {
+    psu_free(prp->pr_pages);
     psu_free(prp);
 }
 
+/*
+ * Throw away every allocation.  Large allocations go back to the
+ * mmap, while small pages are carved up again and put back on the
+ * free lists, so the next round of allocations reuses them without
+ * going back to the mmap.  Pages allocated before this pa_arb_t was
+ * opened aren't known to us, and stay as they are.
+ */
+void
+pa_arb_reset (pa_arb_t *prp)
+{
+    pa_arb_header_t *prhp;
+    pa_arb_page_t *pagep;
+    pa_arb_atom_t atom;
+    uint32_t i, count = 0;
+    unsigned slot;
+
+    for (slot = 0; slot <= PA_ARB_MAX_POW2; slot++)
+	prp->pr_infop->pri_free[slot] = pa_arb_null_atom();
+
+    for (i = 0; i < prp->pr_pages_count; i++) {
+	pagep = &prp->pr_pages[i];
+
+	if (pagep->prp_slot == PA_ARB_SLOT_LARGE) {
+	    atom = pa_arb_atom(pa_mmap_atom_of(pagep->prp_matom)
+			       << prp->pr_offset_shift);
+	    prhp = pa_arb_header(prp, atom);
+	    if (prhp && prhp->prh_magic == PRH_MAGIC_LARGE_INUSE)
+		pa_mmap_free(prp->pr_mmap, pagep->prp_matom,
+			     prhp->prh_size << PA_MMAP_ATOM_SHIFT);
+	    continue;
+	}
+
+	pa_arb_carve_page(prp, pagep->prp_matom, pagep->prp_slot);
+	prp->pr_pages[count++] = *pagep; /* Keep small pages */
+    }
+
+    prp->pr_pages_count = count;
+}
+
 void
 pa_arb_dump (pa_arb_t *prp)
 {
@@ -35,6 +35,9 @@
  * We use the low bits of the atom value to identify the chunk's
  * offset, and the minimal chunk size is 16 bytes (PA_ARB_ATOM_SIZE).
  * That gives us a max database size of 64GB when pa_arb is in use.
+ * Callers that need more can use pa_arb_open_shift() to pick a larger
+ * atom (up to PA_ARB_ATOM_SHIFT_MAX), trading small-allocation
+ * overhead for reach: each bit of shift doubles both.
  *
  * Be aware that you will likely forget most numbers are in atoms,
  * not bytes, e.g. slot 9 is not 1<<9 (256), it's 1<<9<<4 (8192).
@@ -72,6 +75,7 @@ typedef struct pa_arb_header_s {
 
 /** Constants for "small" allocations */
 #define PA_ARB_ATOM_SHIFT	4 /* 1<<4 == 16, size of atom */
+#define PA_ARB_ATOM_SHIFT_MAX	8 /* 1<<8 == 256, largest atom (1TB) */
 #define PA_ARB_ATOM_SIZE	(1 << PA_ARB_ATOM_SIZE)
 #define PA_ARB_PAGE_SHIFT	12 /* 1<<12 == 4k atoms per page */
 #define PA_ARB_PAGE_SIZE	(1 << PA_ARB_PAGE_SHIFT)
@@ -108,12 +112,30 @@ typedef struct pa_page_info_s {
  */
 typedef struct pa_arb_info_s {
     pa_arb_atom_t pri_free[PA_ARB_MAX_POW2 + 1]; /* The free list */
+    pa_shift_t pri_atom_shift;	/* Atom size (shift), or zero if unset */
 } pa_arb_info_t;
 
+/*
+ * A page (or large allocation) we've gotten from the mmap, recorded
+ * so pa_arb_reset() can find it again.  This is transient, so only
+ * pages allocated since pa_arb_open() are recorded.
+ */
+typedef struct pa_arb_page_s {
+    pa_mmap_atom_t prp_matom;	/* Memory atom of the page */
+    pa_arb_slot_t prp_slot;	/* Slot, or PA_ARB_SLOT_LARGE */
+} pa_arb_page_t;
+
+#define PA_ARB_SLOT_LARGE	0xff /* prp_slot for large allocations */
+
 typedef struct pa_arb_s {
     pa_mmap_t *pr_mmap;		/* Underlaying memory file */
     pa_arb_info_t pr_info;	/* Our info structure, if needed */
     pa_arb_info_t *pr_infop;	/* A pointer to our info structure */
+    pa_arb_page_t *pr_pages;	/* Pages we've allocated */
+    uint32_t pr_pages_count;	/* Number of entries in pr_pages */
+    uint32_t pr_pages_max;	/* Number of slots in pr_pages */
+    pa_shift_t pr_atom_shift;	/* Atom size (shift) */
+    pa_shift_t pr_offset_shift;	/* Bits of atom used as offset in a matom */
 } pa_arb_t;
 
 static inline void *
@@ -130,15 +152,15 @@ static inline pa_arb_header_t *
 pa_arb_header (pa_arb_t *prp, pa_arb_atom_t atom)
 {
     /* Lower bits are the arb atom */
-    uint32_t off = pa_arb_atom_of(atom) & ((1 << PA_ARB_OFFSET_SHIFT) - 1);
+    uint32_t off = pa_arb_atom_of(atom) & ((1 << prp->pr_offset_shift) - 1);
 
     /* Upper bits are the mmap atom */
     pa_mmap_atom_t matom;
-    matom = pa_mmap_atom(pa_arb_atom_of(atom) >> PA_ARB_OFFSET_SHIFT);
+    matom = pa_mmap_atom(pa_arb_atom_of(atom) >> prp->pr_offset_shift);
 
     psu_byte_t *addr = pa_arb_matom_addr(prp, matom);
     if (addr)
-	addr += off << PA_ARB_ATOM_SHIFT;
+	addr += off << prp->pr_atom_shift;
 
     void *vaddr = addr;
     return vaddr;
@@ -189,10 +211,23 @@ pa_arb_setup (pa_mmap_t *pmp, pa_arb_info_t *prip);
 pa_arb_t *
 pa_arb_open (pa_mmap_t *pmp, const char *name);
 
+/*
+ * Open with a given atom size (as a shift).  The size is recorded
+ * when the pool is created, and an existing pool keeps its own.
+ */
+pa_arb_t *
+pa_arb_open_shift (pa_mmap_t *pmp, const char *name, pa_shift_t atom_shift);
+
 void
 pa_arb_close (pa_arb_t *prp);
 
 void
 pa_arb_dump (pa_arb_t *prp);
 
+/*
+ * Free everything, all at once, keeping the pages for reuse
+ */
+void
+pa_arb_reset (pa_arb_t *prp);
+
 #endif /* PARROTDB_PAARB_H */
@@ -121,6 +121,26 @@ pa_bitmap_chunk_addr (pa_bitmap_t *pfp, pa_bitmap_atom_t atom)
     return pa_fixed_atom_addr(pfp->pb_data, pa_bitmap_to_fixed(atom));
 }
 
+/*
+ * Free a bitmap, along with any chunks of bits it has allocated
+ */
+static inline void
+pa_bitmap_free (pa_bitmap_t *pfp, pa_bitmap_id_t bitmap_id)
+{
+    if (pa_bitmap_is_null(bitmap_id))
+	return;
+
+    pa_fixed_atom_t *chunkp = pa_bitmap_chunk_addr(pfp, bitmap_id);
+    if (chunkp == NULL)
+	return;			/* Internal error */
+
+    uint32_t i;
+    for (i = 0; i < PA_BITMAP_CHUNK_SIZE; i++)
+	pa_fixed_free_atom(pfp->pb_data, chunkp[i]);
+
+    pa_fixed_free_atom(pfp->pb_data, pa_bitmap_to_fixed(bitmap_id));
+}
+
 static inline uint8_t
 pa_bitmap_test (pa_bitmap_t *pfp, pa_bitmap_id_t bitmap_id, pa_bitnumber_t num)
 {
@@ -118,6 +118,18 @@ pa_fixed_init (pa_mmap_t *pmp, pa_fixed_t *pfp, const char *name,
     /* Round max_atoms up to the next page size */
     max_atoms = pa_roundup_shift32(max_atoms, shift);
 
+    /* If we're reopening an existing table, just find the base */
+    if (pfp->pf_base == NULL && !pa_mmap_is_null(pfp->pf_infop->pfi_base)) {
+	pfp->pf_base = pa_mmap_addr(pmp, pfp->pf_infop->pfi_base);
+
+	/* The page table was sized for the table's own geometry */
+	if (pfp->pf_infop->pfi_max_atoms) {
+	    shift = pfp->pf_infop->pfi_shift;
+	    atom_size = pfp->pf_infop->pfi_atom_size;
+	    max_atoms = pfp->pf_infop->pfi_max_atoms;
+	}
+    }
+
     /* No base is NULL, allocate it, zero it and init the free list */
     if (pfp->pf_base == NULL) {
 	size_t size = (max_atoms >> shift) * sizeof(uint8_t *);
@@ -180,3 +192,42 @@ pa_fixed_close (pa_fixed_t *pfp)
 {
     psu_free(pfp);
 }
+
+/*
+ * Put every atom back on the free list, keeping the pages we've
+ * already got.  Since pages are allocated in order, we thread the
+ * free list through them in order, with the last atom of the last
+ * page pointing to the first atom of the next page, which
+ * pa_fixed_alloc_atom() will set up when (and if) it's needed.
+ * This is only for alloc/free-style arrays; pa_fixed_element()
+ * users don't have free lists.
+ */
+void
+pa_fixed_reset (pa_fixed_t *pfp)
+{
+    pa_atom_t count = 1 << pfp->pf_shift;
+    pa_page_t page, max_page = pfp->pf_max_atoms >> pfp->pf_shift;
+    size_t size = pfp->pf_atom_size;
+    uint8_t *addr;
+    pa_atom_t i, first;
+
+    if (pfp->pf_base == NULL)
+	return;
+
+    for (page = 0; page < max_page; page++) {
+	addr = pa_fixed_page_get(pfp, page);
+	if (addr == NULL)
+	    break;
+
+	/* Index by bytes; atoms needn't be a multiple of the link size */
+	first = page << pfp->pf_shift;
+	for (i = 0; i < count - 1; i++)
+	    ((pa_fixed_atom_t *) (addr + i * size))->pfa_atom = first + i + 1;
+
+	((pa_fixed_atom_t *) (addr + (count - 1) * size))->pfa_atom
+	    = (page + 1 < max_page) ? first + count : PA_NULL_ATOM;
+    }
+
+    /* Atom zero is the null atom, so we start at one */
+    pfp->pf_free = pa_fixed_atom(1);
+}
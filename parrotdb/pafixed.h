@@ -47,6 +47,30 @@ PA_ATOM_TYPE(pa_fixed_atom_t, pa_fixed_atom_s, pfa_atom,
 	     pa_fixed_is_null, pa_fixed_atom, pa_fixed_atom_of,
 	     pa_fixed_null_atom);
 
+/*
+ * Some callers keep plain pa_atom_t's, since wrappers can't be used
+ * in bitfields or compared with "==".  These let PA_FIXED_FUNCTIONS
+ * build functions for them ("pa_fixed_plain" as the build function
+ * and "pa_fixed_plain_is_null" as the null test).
+ */
+static inline pa_atom_t
+pa_fixed_plain (pa_fixed_atom_t atom)
+{
+    return pa_fixed_atom_of(atom);
+}
+
+static inline pa_fixed_atom_t
+pa_fixed_plain_of (pa_atom_t atom)
+{
+    return pa_fixed_atom(atom);
+}
+
+static inline psu_boolean_t
+pa_fixed_plain_is_null (pa_atom_t atom)
+{
+    return (atom == PA_NULL_ATOM);
+}
+
 typedef uint8_t pa_fixed_flags_t;
 
 typedef struct pa_fixed_info_s {
@@ -269,6 +293,9 @@ pa_fixed_open (pa_mmap_t *pmp, const char *name, pa_shift_t shift,
 void
 pa_fixed_close (pa_fixed_t *pfp);
 
+void
+pa_fixed_reset (pa_fixed_t *pfp);
+
 static inline void
 pa_fixed_set_flags (pa_fixed_t *pfp, pa_fixed_flags_t flags)
 {
@@ -109,6 +109,18 @@ pa_istr_init (pa_mmap_t *pmp, pa_istr_t *pip, const char *name,
     /* Round max_atoms up to the next page size */
     max_atoms = pa_roundup_shift32(max_atoms, shift);
 
+    /* If we're reopening an existing table, just find the base */
+    if (pip->pi_base == NULL && !pa_mmap_is_null(pip->pi_datap->pid_base)) {
+	pip->pi_base = pa_mmap_addr(pmp, pip->pi_datap->pid_base);
+
+	/* The page table was sized for the table's own geometry */
+	if (pip->pi_max_atoms) {
+	    shift = pip->pi_shift;
+	    atom_shift = pip->pi_atom_shift;
+	    max_atoms = pip->pi_max_atoms;
+	}
+    }
+
     /* No base is NULL, allocate it, zero it and init the free list */
     if (pip->pi_base == NULL) {
 	size_t size = (max_atoms >> shift) * sizeof(uint8_t *);
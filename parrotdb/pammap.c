@@ -224,6 +224,7 @@ pa_mmap_alloc (pa_mmap_t *pmp, size_t size)
     }
 
     pmp->pm_len = new_len;	/* Record our new length */
+    pmp->pm_infop->pmi_len = new_len;
     /* We'll use the first chunk for this allocation */
     fa = pa_mmap_atom(old_len >> PA_MMAP_ATOM_SHIFT);
 
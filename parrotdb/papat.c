@@ -247,10 +247,10 @@ pa_pat_root_init (pa_pat_t *root, pa_pat_info_t *ppip, pa_mmap_t *pmp,
 }
 
 const uint8_t *
-pa_pat_istr_key_func (pa_pat_t *pp, pa_pat_node_t *node)
+pa_pat_istr_key_func (pa_pat_t *pp, pa_pat_data_atom_t datom)
 {
     /* Need to "convert" the data atom to an istr data */
-    pa_istr_atom_t atom = pa_istr_atom(pa_pat_data_atom_of(node->ppn_data));
+    pa_istr_atom_t atom = pa_istr_atom(pa_pat_data_atom_of(datom));
     return (const uint8_t *) pa_istr_atom_string(pp->pp_data, atom);
 }
 
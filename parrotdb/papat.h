@@ -158,7 +158,7 @@ pa_pat_root_init (pa_pat_t *root, pa_pat_info_t *ppip, pa_mmap_t *pmp,
 		  pa_pat_key_func_t key_func, uint16_t klen);
 
 const psu_byte_t *
-pa_pat_istr_key_func (pa_pat_t *pp, pa_pat_node_t *node);
+pa_pat_istr_key_func (pa_pat_t *pp, pa_pat_data_atom_t datom);
 
 /*
  * Add a node to the patricia tree.
@@ -25,6 +25,10 @@
 #include <libslax/jsonlexer.h>
 #include <libslax/jsonwriter.h>
 
+#include <parrotdb/pacommon.h>
+#include <libxi/xicommon.h>
+#include <libxi/xilibxml.h>
+
 #include <err.h>
 #include <time.h>
 #include <sys/time.h>
@@ -56,6 +60,7 @@ static int opt_slax_output;	/* Make output in SLAX format */
 static int opt_json_tagging;	/* Tag JSON output */
 static int opt_json_flags;	/* Flags for JSON conversion */
 static int opt_keep_text;	/* Don't add a rule to discard text values */
+static int opt_libxi_input;	/* Parse input using libxi */
 
 static const char *
 get_filename (const char *filename, char ***pargv, int outp)
@@ -461,6 +466,8 @@ do_run (const char *name, const char *output, const char *input, char **argv)
 	indoc = buildEmptyFile();
     else if (opt_html)
 	indoc = htmlReadFile(input, encoding, options);
+    else if (opt_libxi_input)
+	indoc = xi_libxml_read_file(input, script->dict);
     else
 	indoc = xmlReadFile(input, encoding, options);
     if (indoc == NULL)
@@ -723,6 +730,7 @@ print_help (void)
 "\t--json-tagging: tag json-style input with the 'json' attribute\n"
 "\t--keep-text: mini-templates should not discard text\n"
 "\t--lib <dir> OR -L <dir>: search directory for extension libraries\n"
+"\t--libxi-input: parse input using libxi (drops comments and PIs)\n"
 "\t--log <file>: use given log file\n"
 "\t--mini-template <code> OR -m <code>: wrap template code in a script\n"
 "\t--name <file> OR -n <file>: read the script from the given file\n"
@@ -885,6 +893,9 @@ main (int argc UNUSED, char **argv)
 	} else if (streq(cp, "--lib") || streq(cp, "-L")) {
 	    slaxDynAdd(check_arg("library path", &argv));
 
+	} else if (streq(cp, "--libxi-input")) {
+	    opt_libxi_input = TRUE;
+
 	} else if (streq(cp, "--log") || streq(cp, "-l")) {
 	    opt_log_file = check_arg("log file name", &argv);
 
@@ -31,6 +31,7 @@ int
 main (int argc, char **argv)
 {
     const char *opt_filename = NULL;
+    const char *opt_fixture = NULL;
     int opt_quiet = FALSE;
     int opt_log = FALSE;
     int opt_unescape = FALSE;
@@ -42,6 +43,9 @@ main (int argc, char **argv)
 	    || strcmp(argv[argc], "input") == 0) {
 	    if (argv[argc + 1])
 		opt_filename = argv[++argc];
+	} else if (strcmp(argv[argc], "fixture") == 0) {
+	    if (argv[argc + 1])
+		opt_fixture = argv[++argc];
 	} else if (strcmp(argv[argc], "quiet") == 0) {
 	    opt_quiet = TRUE;
 	} else if (strcmp(argv[argc], "unescape") == 0) {
@@ -58,12 +62,37 @@ main (int argc, char **argv)
 	    flags |= XPSF_IGNORE_COMMENTS;
 	} else if (strcmp(argv[argc], "ignore-dtd") == 0) {
 	    flags |= XPSF_IGNORE_DTD;
+	} else if (strcmp(argv[argc], "json") == 0) {
+	    flags |= XPSF_JSON;
+	} else if (strcmp(argv[argc], "read-ahead") == 0) {
+	    flags |= XPSF_READ_AHEAD;
+	} else if (strcmp(argv[argc], "decompress") == 0) {
+	    flags |= XPSF_DECOMPRESS;
+	} else if (strcmp(argv[argc], "validate") == 0) {
+	    flags |= XPSF_VALIDATE;
+	} else if (strcmp(argv[argc], "mmap") == 0) {
+	    flags |= XPSF_MMAP_INPUT;
 	}
     }
 
     if (opt_log)
 	psu_log_enable(TRUE);
 
+    /*
+     * A fixture lives next to the input file, which holds the test
+     * arguments (and, for a compressed fixture, its content).  This
+     * is how we feed in input that can't carry the arguments itself.
+     */
+    char path[PATH_MAX];
+    if (opt_fixture != NULL && opt_filename != NULL) {
+	const char *cp = strrchr(opt_filename, '/');
+	int len = cp ? cp - opt_filename + 1 : 0;
+
+	snprintf(path, sizeof(path), "%.*s%s", len, opt_filename,
+		 opt_fixture);
+	opt_filename = path;
+    }
+
     if (opt_filename != NULL) {
 	fd = open(opt_filename, O_RDONLY);
 	if (fd < 0)
@@ -0,0 +1,9 @@
+<script>
+  <state id="1" action="save">
+    <rule tag="secret" action="discard"/>
+    <rule tag="section" action="save" new-state="2"/>
+  </state>
+  <state id="2" action="discard">
+    <rule tag="title" action="save"/>
+  </state>
+</script>
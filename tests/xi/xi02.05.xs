@@ -0,0 +1,17 @@
+<script>
+  <state id="1">
+    <rule tag="list" action="save" new-state="2"/>
+  </state>
+  <state id="2" action="discard">
+    <rule tag="item" action="save" new-state="3"/>
+    <rule tag="item" action="discard"/>
+    <rule tag="meta" action="save"/>
+  </state>
+  <state id="3" action="save">
+    <rule tag="skip" action="discard"/>
+    <rule tag="item" action="save" new-state="5"/>
+  </state>
+  <state id="5">
+    <rule tag="name" action="save"/>
+  </state>
+</script>
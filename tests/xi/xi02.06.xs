@@ -0,0 +1,8 @@
+<script>
+  <state id="1">
+    <rule tag="feed" action="save" new-state="2"/>
+  </state>
+  <state id="2" action="save">
+    <rule tag="entry" action="emit"/>
+  </state>
+</script>
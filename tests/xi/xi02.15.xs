@@ -0,0 +1,10 @@
+<script>
+  <state id="1">
+    <rule tag="top" action="save" new-state="2"/>
+  </state>
+  <state id="2" action="save">
+    <rule tag="secret" action="discard"/>
+    <rule tag="desc" action="save" use-tag="description"/>
+    <rule tag="end" action="return"/>
+  </state>
+</script>
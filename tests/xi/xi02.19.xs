@@ -0,0 +1,11 @@
+<script>
+  <state id="1">
+    <rule tag="feed" action="save" new-state="2"/>
+  </state>
+  <state id="2" action="save">
+    <rule tag="entry" action="emit" new-state="3"/>
+  </state>
+  <state id="3" action="save">
+    <rule tag="link" action="save-simple"/>
+  </state>
+</script>
@@ -19,33 +19,54 @@
 #include <string.h>
 #include <err.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <assert.h>
 #include <ctype.h>
 #include <limits.h>
+#include <time.h>
 
-#include "slaxconfig.h"
-#include <libslax/slax.h>
-#include <libslax/pa_common.h>
-#include <libslax/pa_config.h>
-#include <libslax/pa_mmap.h>
-#include <libslax/pa_fixed.h>
-#include <libslax/pa_arb.h>
-#include <libslax/pa_istr.h>
-#include <libslax/pa_pat.h>
-#include <libslax/pa_bitmap.h>
-#include <libslax/xi_common.h>
-#include <libslax/xi_source.h>
-#include <libslax/xi_rules.h>
-#include <libslax/xi_tree.h>
-#include <libslax/xi_workspace.h>
-#include <libslax/xi_parse.h>
-#include <libslax/xi_nodeset.h>
+#include <libpsu/psucommon.h>
+#include <libpsu/psulog.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+#include <libxi/xinodeset.h>
+#include <libxi/xiemit.h>
+#include <libxi/xicache.h>
+#include <libxi/xilibxml.h>
+#include <libxi/xibinary.h>
+#include <libxi/xidiff.h>
+#include <libxi/xiwhiffle.h>
+#include <libxi/xidriver.h>
+
+#define TEST_MAX_SELECT 8	/* Max number of "select" paths */
+#define TEST_MAX_DRIVE 8	/* Max number of "drive" files */
 
 typedef struct test_data_s {
     xi_workspace_t *td_workp;
     xi_nodeset_t *td_nsp;
 } test_data_t;
 
+typedef struct test_record_s {
+    unsigned tr_depth;		/* Depth within the current record */
+    unsigned tr_count;		/* Records seen */
+    pa_atom_t tr_max_atom;	/* Highest node atom seen */
+    int tr_empty;		/* Last element was closed by EOL_EMPTY */
+    const char *tr_lookup;	/* Attribute to look up (or NULL) */
+    pa_atom_t tr_max_text;	/* Highest textpool atom used by lookups */
+} test_record_t;
+
 static int
 test_node_set (xi_parse_t *parsep UNUSED, xi_node_type_t type,
 	       pa_atom_t node_atom, xi_node_t *nodep UNUSED,
@@ -61,17 +82,926 @@ test_node_set (xi_parse_t *parsep UNUSED, xi_node_type_t type,
     return 0;
 }
 
+/*
+ * Look up an attribute of an element in an emitted record, printing
+ * it as "@name=value" and noting the highest node and textpool atoms
+ * the attribute directory uses
+ */
+static void
+test_emit_lookup (xi_workspace_t *xwp, test_record_t *trp,
+		  pa_atom_t node_atom, xi_node_t *nodep)
+{
+    pa_atom_t name_atom = xi_namepool_atom(xwp, trp->tr_lookup, FALSE);
+    xi_node_t *attribp = xi_attrib_lookup(xwp, node_atom, nodep, name_atom);
+    xi_attrib_dir_t *dirp;
+    pa_atom_t *slotp;
+    uint32_t slot;
+
+    if (attribp == NULL)
+	return;
+
+    printf(" @%s=%s", trp->tr_lookup, xi_node_string(xwp, attribp));
+
+    if (attribp->xn_contents > trp->tr_max_text)
+	trp->tr_max_text = attribp->xn_contents;
+
+    slotp = pa_fixed_element(xwp->xw_attrib_dir, node_atom);
+    if (slotp == NULL || *slotp == PA_NULL_ATOM)
+	return;
+
+    if (*slotp > trp->tr_max_text)
+	trp->tr_max_text = *slotp;
+
+    /* Extracted attribute nodes are only found through the directory */
+    dirp = pa_arb_atom_addr(xwp->xw_textpool, pa_arb_atom(*slotp));
+    for (slot = 0; slot <= dirp->xad_mask; slot++)
+	if (dirp->xad_entry[slot].xade_node > trp->tr_max_atom)
+	    trp->tr_max_atom = dirp->xad_entry[slot].xade_node;
+}
+
+/*
+ * Print each XIA_EMIT record on a line of its own, noting the highest
+ * node atom we see.  Since emitted records are recycled, that atom
+ * should stay put, however many records there are.
+ */
+static int
+test_emit_record (xi_parse_t *parsep, xi_node_type_t type,
+		  pa_atom_t node_atom, xi_node_t *nodep,
+		  const char *data, void *opaque)
+{
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
+    test_record_t *trp = opaque;
+
+    if (node_atom > trp->tr_max_atom)
+	trp->tr_max_atom = node_atom;
+
+    switch (type) {
+    case XI_TYPE_OPEN:
+	printf("<%s", data);
+	trp->tr_depth += 1;
+	if (trp->tr_lookup)
+	    test_emit_lookup(xwp, trp, node_atom, nodep);
+	break;
+
+    case XI_TYPE_ATTRIB:
+	printf(" %s=\"%s\"", xi_namepool_string(xwp, nodep->xn_name),
+	       data);
+	break;
+
+    case XI_TYPE_EOL_ATTRIB:
+	printf(">");
+	break;
+
+    case XI_TYPE_ATSTR:
+	printf(" %s", data);
+	break;
+
+    case XI_TYPE_EOL_EMPTY:
+	printf("/>");
+	trp->tr_empty = TRUE;
+	break;
+
+    case XI_TYPE_TEXT:
+    case XI_TYPE_UNESC:
+	printf("%s", data);
+	break;
+
+    case XI_TYPE_CLOSE:
+	/* An element with only attributes gets EOL_EMPTY and a close */
+	if (data && !trp->tr_empty)
+	    printf("</%s>", data);
+	trp->tr_empty = FALSE;
+	trp->tr_depth -= 1;
+	if (trp->tr_depth == 0) {
+	    printf("\n");
+	    trp->tr_count += 1;
+	}
+	break;
+    }
+
+    return 0;
+}
+
+typedef struct test_order_s {
+    unsigned to_depth;		/* Number of open elements */
+    pa_atom_t to_last;		/* Last node printed */
+    pa_atom_t to_open[XI_DEPTH_MAX + 1]; /* Stack of open elements */
+} test_order_t;
+
+/*
+ * Print the preorder number and subtree extent of each node, checking
+ * that it follows the last node in document order and that its
+ * parent is seen as its ancestor
+ */
+static int
+test_order (xi_parse_t *parsep, xi_node_type_t type,
+	    pa_atom_t node_atom, xi_node_t *nodep UNUSED,
+	    const char *data, void *opaque)
+{
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
+    test_order_t *top = opaque;
+    xi_node_order_t *orderp;
+    const char *what;
+
+    switch (type) {
+    case XI_TYPE_OPEN:
+	what = data;
+	break;
+
+    case XI_TYPE_TEXT:
+    case XI_TYPE_UNESC:
+	what = "(text)";
+	break;
+
+    case XI_TYPE_ATTRIB:
+	what = "(attrib)";
+	break;
+
+    case XI_TYPE_CLOSE:
+	if (top->to_depth > 0)
+	    top->to_depth -= 1;
+	return 0;
+
+    default:
+	return 0;
+    }
+
+    orderp = xi_node_order(xwp, node_atom);
+    printf("%*s%s: pre %u, end %u", top->to_depth * 2, "", what,
+	   orderp ? orderp->xno_pre : 0, orderp ? orderp->xno_end : 0);
+
+    if (top->to_last != PA_NULL_ATOM
+	&& xi_node_compare(xwp, top->to_last, node_atom) >= 0)
+	printf(" (out of order)");
+
+    if (top->to_depth > 0
+	&& !xi_node_is_ancestor(xwp, top->to_open[top->to_depth - 1],
+				node_atom))
+	printf(" (not under its parent)");
+
+    printf("\n");
+    top->to_last = node_atom;
+
+    if (type == XI_TYPE_OPEN && top->to_depth < XI_DEPTH_MAX)
+	top->to_open[top->to_depth++] = node_atom;
+
+    return 0;
+}
+
+typedef struct test_intern_s {
+    unsigned ti_values;		/* Text and attribute values seen */
+    unsigned ti_interned;	/* Those that were interned */
+} test_intern_t;
+
+/*
+ * Count the values that made it into the value pool
+ */
+static int
+test_intern (xi_parse_t *parsep UNUSED, xi_node_type_t type,
+	     pa_atom_t node_atom UNUSED, xi_node_t *nodep,
+	     const char *data UNUSED, void *opaque)
+{
+    test_intern_t *tip = opaque;
+
+    switch (type) {
+    case XI_TYPE_TEXT:
+    case XI_TYPE_UNESC:
+    case XI_TYPE_ATTRIB:
+	tip->ti_values += 1;
+	if (nodep->xn_flags & XNF_INTERNED)
+	    tip->ti_interned += 1;
+	break;
+    }
+
+    return 0;
+}
+
+/*
+ * Print text and attribute values, decoding any entities they hold
+ */
+static int
+test_strings (xi_parse_t *parsep, xi_node_type_t type,
+	      pa_atom_t node_atom UNUSED, xi_node_t *nodep,
+	      const char *data UNUSED, void *opaque UNUSED)
+{
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
+    const char *name;
+
+    switch (type) {
+    case XI_TYPE_TEXT:
+    case XI_TYPE_UNESC:
+	printf("text: [%s]\n", xi_node_string(xwp, nodep));
+	break;
+
+    case XI_TYPE_ATTRIB:
+	name = xi_namepool_string(xwp, nodep->xn_name);
+	printf("attrib: %s=[%s]\n", name, xi_node_string(xwp, nodep));
+	break;
+
+    default:
+	break;
+    }
+
+    return 0;
+}
+
+/*
+ * Print each element with the namespace its prefix resolved to,
+ * indented by depth
+ */
+static int
+test_namespaces (xi_parse_t *parsep, xi_node_type_t type,
+		 pa_atom_t node_atom UNUSED, xi_node_t *nodep,
+		 const char *data, void *opaque UNUSED)
+{
+    xi_workspace_t *xwp = xi_parse_workspace(parsep);
+    xi_ns_map_t *ns_map;
+
+    if (type != XI_TYPE_ELT)
+	return 0;
+
+    printf("%*s%s", (nodep->xn_depth - XI_DEPTH_MIN) * 2, "", data);
+
+    ns_map = xi_ns_map_addr(xwp, nodep->xn_ns_map);
+    if (ns_map) {
+	const char *pref = xi_namepool_string(xwp, ns_map->xnm_prefix);
+	const char *uri = xi_namepool_string(xwp, ns_map->xnm_uri);
+
+	printf(": %s%s%s", pref ?: "", pref ? "=" : "", uri ?: "");
+    }
+
+    printf("\n");
+    return 0;
+}
+
+/*
+ * Auxiliary files (scripts, fixtures) live next to the input file
+ */
+static const char *
+test_path (char *buf, size_t bufsiz, const char *input, const char *name)
+{
+    const char *cp = strrchr(input, '/');
+    int len = cp ? cp - input + 1 : 0;
+
+    snprintf(buf, bufsiz, "%.*s%s", len, input, name);
+    return buf;
+}
+
+/*
+ * Copy a file, giving the copy the given mtime.  If "flip" is set,
+ * the first letter of each text node is flipped to upper case, which
+ * changes the contents but not the size.
+ */
+static void
+test_copy (const char *from, const char *to, time_t mtime, int flip)
+{
+    struct timeval tv[2] = { { mtime, 0 }, { mtime, 0 } };
+    FILE *in, *out;
+    int ch, last = 0;
+
+    in = fopen(from, "r");
+    out = fopen(to, "w");
+    if (in == NULL || out == NULL)
+	err(1, "copy failed: %s", from);
+
+    while ((ch = getc(in)) != EOF) {
+	if (flip && last == '>' && islower(ch))
+	    ch = toupper(ch);
+	putc(ch, out);
+	last = ch;
+    }
+
+    fclose(in);
+    fclose(out);
+
+    if (utimes(to, tv) < 0)
+	err(1, "utimes failed: %s", to);
+}
+
+typedef struct test_drive_s {
+    xi_driver_result_t *tdr_results; /* Results, indexed like the files */
+    char *tdr_xml[TEST_MAX_DRIVE + 1]; /* Each file's tree, as XML */
+    size_t tdr_len[TEST_MAX_DRIVE + 1]; /* Length of each tdr_xml */
+} test_drive_t;
+
+/*
+ * Called in a worker thread; each file has its own slot, so there's
+ * nothing to lock
+ */
+static int
+test_drive_file (xi_parse_t *parsep, xi_driver_result_t *resp, void *opaque)
+{
+    test_drive_t *tdp = opaque;
+    unsigned idx = resp - tdp->tdr_results;
+    FILE *fp;
+
+    fp = open_memstream(&tdp->tdr_xml[idx], &tdp->tdr_len[idx]);
+    if (fp == NULL)
+	return -1;
+
+    xi_parse_emit_xml(parsep, fp);
+    fclose(fp);
+
+    return 0;
+}
+
+/*
+ * Parse the input and the "drive" files with xi_driver, then print
+ * each file's tree in file order, so the output doesn't depend on
+ * which worker got which file
+ */
+static void
+test_drive (const char *filename, const char **drive, unsigned ndrive,
+	    unsigned workers, unsigned drive_flags, xi_source_flags_t flags,
+	    uint32_t workspace_flags, int attribs,
+	    const char **select, unsigned nselect)
+{
+    char paths[TEST_MAX_DRIVE][PATH_MAX];
+    const char *files[TEST_MAX_DRIVE + 1];
+    xi_driver_result_t results[TEST_MAX_DRIVE + 1];
+    test_drive_t drive_data;
+    unsigned i, nfiles = 0;
+
+    files[nfiles++] = filename;
+    for (i = 0; i < ndrive; i++)
+	files[nfiles++] = test_path(paths[i], sizeof(paths[i]),
+				    filename, drive[i]);
+
+    xi_driver_t *drvp = xi_driver_open(workers, drive_flags, flags,
+				       workspace_flags);
+    if (drvp == NULL)
+	errx(1, "could not make driver");
+
+    if (attribs)
+	xi_driver_set_default_rule(drvp, XIA_SAVE_ATTRIB);
+
+    if (nselect && xi_driver_set_select(drvp, select, nselect,
+					XIA_SAVE) < 0)
+	errx(1, "could not compile select paths");
+
+    bzero(&drive_data, sizeof(drive_data));
+    drive_data.tdr_results = results;
+    xi_driver_set_callback(drvp, test_drive_file, &drive_data);
+
+    xi_driver_run(drvp, files, nfiles, results);
+
+    for (i = 0; i < nfiles; i++) {
+	const char *base = strrchr(files[i], '/');
+
+	printf("drive: %s: %s, %llu nodes, %llu bytes\n",
+	       base ? base + 1 : files[i],
+	       results[i].xdr_status ? "failed" : "ok",
+	       (unsigned long long) results[i].xdr_nodes,
+	       (unsigned long long) results[i].xdr_bytes);
+	if (drive_data.tdr_xml[i])
+	    fwrite(drive_data.tdr_xml[i], 1, drive_data.tdr_len[i], stdout);
+	free(drive_data.tdr_xml[i]);
+    }
+
+    const xi_driver_stats_t *statsp = xi_driver_stats(drvp);
+    printf("drive: %llu files, %llu failed, %llu nodes, %llu bytes\n",
+	   (unsigned long long) statsp->xds_files,
+	   (unsigned long long) statsp->xds_failed,
+	   (unsigned long long) statsp->xds_nodes,
+	   (unsigned long long) statsp->xds_bytes);
+    fflush(stdout);
+
+    xi_driver_close(drvp);
+}
+
+/*
+ * Load the input through a cache twice, the second time under a
+ * different spelling of its path, and report whether each one hit.
+ * The cache's budget is a single byte, so anything but the entry
+ * being loaded is evicted.
+ *
+ * With XCF_HASH_CONTENT, we load a copy of the input with a current
+ * mtime, so its contents get hashed and checked.  Then we rewrite
+ * it, keeping the size and mtime, and load it a third time; only
+ * the content hash can tell that it changed.
+ *
+ * Finally we load it twice with XPSF_TRIM_WS flipped, which must
+ * miss (and replace the entry) and then hit.
+ */
+static void
+test_cache (const char *dir, const char *filename, xi_source_flags_t flags,
+	    xi_cache_flags_t cache_flags, int emit_xml)
+{
+    const char *base, *input = filename;
+    char path[PATH_MAX], copy[PATH_MAX];
+    time_t now = time(NULL);
+    xi_cache_doc_t *docp;
+    xi_cache_t *xcp;
+    int i, len;
+
+    xcp = xi_cache_open(dir, 1, cache_flags);
+    if (xcp == NULL)
+	errx(1, "cache open failed: %s", dir);
+
+    /* Start with an empty cache */
+    xi_cache_evict(xcp, 1);
+
+    if (cache_flags & XCF_HASH_CONTENT) {
+	snprintf(copy, sizeof(copy), "%s.in", dir);
+	test_copy(input, copy, now, FALSE);
+	filename = copy;
+    }
+
+    base = strrchr(filename, '/');
+    len = base ? base - filename + 1 : 0;
+    snprintf(path, sizeof(path), "%.*s./%s", len, filename, filename + len);
+
+    for (i = 0; i < 5; i++) {
+	if (i == 2) {
+	    if (!(cache_flags & XCF_HASH_CONTENT))
+		continue;
+	    test_copy(input, copy, now, TRUE);
+	}
+
+	docp = xi_cache_load(xcp, (i == 1) ? path : filename,
+			     (i < 3) ? flags : flags ^ XPSF_TRIM_WS);
+	if (docp == NULL)
+	    errx(1, "cache load failed: %s", filename);
+
+	printf("cache: %s\n", docp->xcd_hit ? "hit" : "miss");
+	fflush(stdout);
+
+	if (emit_xml) {
+	    xi_emit_t *emitp = xi_emit_open(1, 0);
+	    assert(emitp);
+	    xi_emit_xml(emitp, docp->xcd_parse, PA_NULL_ATOM);
+	    xi_emit_close(emitp);
+	}
+
+	xi_cache_doc_close(docp);
+    }
+
+    xi_cache_close(xcp);
+}
+
+/*
+ * Print the preorder numbers of a nodeset's members
+ */
+static void
+test_nodeset_print (xi_workspace_t *workp, const char *what,
+		    xi_nodeset_t *nodeset)
+{
+    xi_nodeset_chunk_t *chunkp;
+    xi_nodeset_chunk_id_t id;
+    xi_node_order_t *orderp;
+    uint32_t i;
+
+    printf("%s: %u nodes", what, xi_nodeset_count(nodeset));
+
+    for (id = nodeset ? nodeset->xns_first : PA_NULL_ATOM;
+	 id != PA_NULL_ATOM; id = chunkp->xnsc_next) {
+	chunkp = xi_nodeset_chunk_addr(nodeset, id);
+	if (chunkp == NULL)
+	    break;
+
+	for (i = 0; i < chunkp->xnsc_count; i++) {
+	    orderp = xi_node_order(workp, chunkp->xnsc_nodes[i]);
+	    printf(" %u", orderp ? orderp->xno_pre : 0);
+	}
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+/*
+ * Print the elements the name index holds for the given name
+ */
+static void
+test_name_index (xi_workspace_t *workp, const char *name)
+{
+    pa_atom_t name_atom = xi_namepool_atom(workp, name, FALSE);
+    char what[BUFSIZ];
+
+    snprintf(what, sizeof(what), "index: %s", name);
+    test_nodeset_print(workp, what, xi_name_index_lookup(workp, name_atom));
+}
+
+/*
+ * Print the layout of the pools that grow with the document, which
+ * is what XWF_LARGE changes
+ */
+static void
+test_geometry (xi_workspace_t *workp, const char *what)
+{
+    printf("%s: nodes shift %u, max %u; text atom shift %u\n", what,
+	   workp->xw_nodes->pf_shift, pa_fixed_max_atoms(workp->xw_nodes),
+	   workp->xw_textpool->pr_atom_shift);
+    fflush(stdout);
+}
+
+#define TEST_MAX_ELEMENTS 1024	/* Max number of elements for "sets" */
+
+typedef struct test_elements_s {
+    unsigned te_count;		/* Number of elements seen */
+    pa_atom_t te_atoms[TEST_MAX_ELEMENTS]; /* Their atoms */
+} test_elements_t;
+
+static int
+test_collect (xi_parse_t *parsep UNUSED, xi_node_type_t type,
+	      pa_atom_t node_atom, xi_node_t *nodep UNUSED,
+	      const char *data UNUSED, void *opaque)
+{
+    test_elements_t *tep = opaque;
+
+    if (type == XI_TYPE_OPEN && tep->te_count < TEST_MAX_ELEMENTS)
+	tep->te_atoms[tep->te_count++] = node_atom;
+
+    return 0;
+}
+
+/*
+ * Return the first element with the given name, or PA_NULL_ATOM
+ */
+static pa_atom_t
+test_find (xi_parse_t *parsep, const char *name)
+{
+    xi_workspace_t *workp = xi_parse_workspace(parsep);
+    static test_elements_t elements;
+    xi_node_t *nodep;
+    const char *cp;
+    unsigned i;
+
+    elements.te_count = 0;
+    xi_parse_emit(parsep, test_collect, &elements);
+
+    for (i = 0; i < elements.te_count; i++) {
+	nodep = xi_node_addr(workp, elements.te_atoms[i]);
+	cp = nodep ? xi_namepool_string(workp, nodep->xn_name) : NULL;
+	if (cp && strcmp(cp, name) == 0)
+	    return elements.te_atoms[i];
+    }
+
+    return PA_NULL_ATOM;
+}
+
+/*
+ * Run the set operations on the given sets and print the results
+ */
+static void
+test_set_ops (xi_workspace_t *workp, const char *tag,
+	      xi_nodeset_t *left, xi_nodeset_t *right)
+{
+    xi_nodeset_t *res;
+    char what[BUFSIZ];
+
+    res = xi_nodeset_union(left, right);
+    snprintf(what, sizeof(what), "%s: union", tag);
+    test_nodeset_print(workp, what, res);
+    xi_nodeset_free(res);
+
+    res = xi_nodeset_intersect(left, right);
+    snprintf(what, sizeof(what), "%s: intersect", tag);
+    test_nodeset_print(workp, what, res);
+    xi_nodeset_free(res);
+
+    res = xi_nodeset_difference(left, right);
+    snprintf(what, sizeof(what), "%s: difference", tag);
+    test_nodeset_print(workp, what, res);
+    xi_nodeset_free(res);
+}
+
+/*
+ * Build two sets from the document's elements: every other element
+ * in reverse order, with a duplicate (so it's unsorted), and every
+ * third element in document order (so it's sorted).  Run the set
+ * operations both ways, then again once the first set is sorted, so
+ * both the merge and bit vector paths get used.
+ *
+ * Last, make a set of nodes with no order information, which all
+ * have a preorder number of zero, and make sure they're kept apart.
+ */
+static void
+test_sets (xi_parse_t *parsep)
+{
+    xi_workspace_t *workp = xi_parse_workspace(parsep);
+    test_elements_t elements = { 0, { PA_NULL_ATOM } };
+    xi_nodeset_t *left, *right, *orphans;
+    pa_atom_t atom;
+    unsigned i;
+
+    xi_parse_emit(parsep, test_collect, &elements);
+
+    left = xi_nodeset_alloc(workp, XI_NSTYPE_NORMAL, 0);
+    right = xi_nodeset_alloc(workp, XI_NSTYPE_NORMAL, 0);
+    orphans = xi_nodeset_alloc(workp, XI_NSTYPE_NORMAL, 0);
+    assert(left && right && orphans);
+
+    for (i = elements.te_count; i > 0; i--)
+	if ((i - 1) % 2 == 0)
+	    xi_nodeset_add(left, elements.te_atoms[i - 1]);
+    if (elements.te_count > 0)
+	xi_nodeset_add(left, elements.te_atoms[0]);
+
+    for (i = 0; i < elements.te_count; i += 3)
+	xi_nodeset_add(right, elements.te_atoms[i]);
+
+    printf("sets: left is %s, right is %s\n",
+	   (left->xns_flags & XI_NSF_SORTED) ? "sorted" : "unsorted",
+	   (right->xns_flags & XI_NSF_SORTED) ? "sorted" : "unsorted");
+
+    test_set_ops(workp, "unsorted/sorted", left, right);
+    test_set_ops(workp, "sorted/unsorted", right, left);
+
+    if (xi_nodeset_sort(left) < 0)
+	errx(1, "nodeset sort failed");
+    test_nodeset_print(workp, "sorted", left);
+    test_set_ops(workp, "sorted/sorted", left, right);
+
+    for (i = 0; i < 3; i++) {
+	if (xi_node_alloc(workp, &atom) == NULL)
+	    errx(1, "node alloc failed");
+	xi_node_order_set(workp, atom, 0, 0);
+	xi_nodeset_add(orphans, atom);
+	xi_nodeset_add(orphans, atom);
+    }
+
+    if (xi_nodeset_sort(orphans) < 0)
+	errx(1, "nodeset sort failed");
+    test_nodeset_print(workp, "orphans", orphans);
+    test_set_ops(workp, "orphans", orphans, orphans);
+
+    xi_nodeset_free(orphans);
+    xi_nodeset_free(right);
+    xi_nodeset_free(left);
+}
+
+/*
+ * Print a node for a diff edit: elements by name, text and attributes
+ * by value
+ */
+static void
+test_diff_node (xi_workspace_t *xwp, const char *tag, pa_atom_t node_atom)
+{
+    xi_node_t *nodep = xi_node_addr(xwp, node_atom);
+    const char *name;
+
+    if (nodep == NULL)
+	return;
+
+    name = xi_namepool_string(xwp, nodep->xn_name);
+
+    switch (nodep->xn_type) {
+    case XI_TYPE_ROOT:
+	printf(" %s /", tag);
+	break;
+
+    case XI_TYPE_ELT:
+	printf(" %s <%s>", tag, name ?: "");
+	break;
+
+    case XI_TYPE_ATTRIB:
+	printf(" %s @%s=[%s]", tag, name ?: "", xi_node_string(xwp, nodep));
+	break;
+
+    default:
+	printf(" %s [%s]", tag, xi_node_string(xwp, nodep) ?: "");
+	break;
+    }
+}
+
+static int
+test_diff_edit (xi_tree_t *old_tree, xi_tree_t *new_tree UNUSED,
+		xi_diff_edit_t *editp, void *opaque UNUSED)
+{
+    static const char *ops[] = { "?", "delete", "insert", "change" };
+    xi_workspace_t *xwp = old_tree->xt_workspace;
+
+    printf("diff: %s (depth %u):",
+	   (editp->xde_op <= XI_DIFF_CHANGE) ? ops[editp->xde_op] : "?",
+	   editp->xde_depth);
+    test_diff_node(xwp, "old", editp->xde_old);
+    test_diff_node(xwp, "new", editp->xde_new);
+    printf("\n");
+
+    return 0;
+}
+
+/*
+ * Parse a second file, from next to the input, into the same
+ * workspace, and print the edits that turn the input into it.
+ * Diffing the input against itself should find nothing.
+ */
+static void
+test_diff (pa_mmap_t *pmp, xi_parse_t *parsep, const char *filename,
+	   const char *other, xi_source_flags_t flags)
+{
+    xi_workspace_t *workp = xi_parse_workspace(parsep);
+    xi_tree_t *old_tree = parsep->xp_insert->xi_tree;
+    char path[PATH_MAX];
+    xi_parse_t *otherp;
+    int rc;
+
+    rc = xi_diff(old_tree, old_tree, test_diff_edit, NULL);
+    printf("diff: self %s\n", (rc < 0) ? "failed" : "done");
+
+    otherp = xi_parse_open(pmp, workp, "other",
+			   test_path(path, sizeof(path), filename, other),
+			   flags);
+    if (otherp == NULL)
+	errx(1, "parse failed: %s", other);
+
+    if (parsep->xp_default_rule.xr_action == XIA_SAVE_ATTRIB)
+	xi_parse_set_default_rule(otherp, XIA_SAVE_ATTRIB);
+
+    xi_parse(otherp);
+
+    rc = xi_diff(old_tree, otherp->xp_insert->xi_tree, test_diff_edit, NULL);
+    printf("diff: %s %s\n", other, (rc < 0) ? "failed" : "done");
+    fflush(stdout);
+
+    xi_parse_destroy(otherp);
+}
+
+/*
+ * Throw away the parse, reset the workspace, and parse the same input
+ * again, returning the new parse.  The second pass should reuse the
+ * first one's pages, so its elements get the same atoms and the mmap
+ * doesn't grow.
+ */
+static xi_parse_t *
+test_reset (pa_mmap_t *pmp, xi_parse_t *parsep, xi_rulebook_t *rulebook,
+	    int attribs, const char *filename, xi_source_flags_t flags)
+{
+    xi_workspace_t *workp = xi_parse_workspace(parsep);
+    static test_elements_t before, after;
+    size_t len = pmp->pm_len;
+    unsigned i;
+
+    before.te_count = after.te_count = 0;
+    xi_parse_emit(parsep, test_collect, &before);
+
+    xi_parse_destroy(parsep);
+    xi_workspace_reset(workp);
+
+    parsep = xi_parse_open(pmp, workp, "test", filename, flags);
+    assert(parsep);
+
+    if (rulebook)
+	xi_parse_set_rulebook(parsep, rulebook);
+    else if (attribs)
+	xi_parse_set_default_rule(parsep, XIA_SAVE_ATTRIB);
+
+    xi_parse(parsep);
+    xi_parse_emit(parsep, test_collect, &after);
+
+    for (i = 0; i < before.te_count && i < after.te_count; i++)
+	if (before.te_atoms[i] != after.te_atoms[i])
+	    break;
+
+    printf("reset: %u elements, then %u; atoms %s; mmap %s\n",
+	   before.te_count, after.te_count,
+	   (i == before.te_count && i == after.te_count) ? "reused" : "differ",
+	   (pmp->pm_len == len) ? "unchanged" : "grew");
+    fflush(stdout);
+
+    return parsep;
+}
+
+/*
+ * Stream the input through a whiffle instead of parsing it: a script
+ * becomes a rules stage, "select" paths a projection, and "rename" a
+ * rename stage, in that order, ending with an XML or JSON serializer.
+ */
+static void
+test_whiffle (xi_workspace_t *workp, const char *filename,
+	      xi_source_flags_t flags, xi_rulebook_t *rulebook,
+	      const char **select, unsigned num_select,
+	      const char *from, const char *to, int json)
+{
+    xi_source_t *srcp;
+    xi_whiffle_t *xwfp;
+    int rc;
+
+    srcp = xi_source_open(filename, flags);
+    if (srcp == NULL)
+	errx(1, "source open failed: %s", filename);
+
+    xwfp = xi_whiffle_open(workp, srcp);
+    if (xwfp == NULL)
+	errx(1, "whiffle open failed");
+
+    if (rulebook && xi_whiffle_add_rules(xwfp, rulebook) < 0)
+	errx(1, "whiffle rules failed");
+
+    if (num_select && xi_whiffle_add_project(xwfp, select, num_select) < 0)
+	errx(1, "whiffle projection failed");
+
+    if (from && to && xi_whiffle_add_rename(xwfp, from, to) < 0)
+	errx(1, "whiffle rename failed");
+
+    if ((json ? xi_whiffle_add_json(xwfp, stdout)
+	 : xi_whiffle_add_xml(xwfp, stdout)) < 0)
+	errx(1, "whiffle serializer failed");
+
+    rc = xi_whiffle_run(xwfp);
+    fflush(stdout);
+    printf("\nwhiffle: %s\n", (rc < 0) ? "failed" : rc ? "stopped" : "done");
+
+    xi_whiffle_close(xwfp);
+    xi_source_destroy(srcp);
+}
+
+/*
+ * Write the parsed tree as a binary file, open it and import it back
+ * into the workspace under a new name, and emit the imported copy so
+ * it can be compared with the original.  Then cut the file in half
+ * and make sure it's rejected.
+ */
+static void
+test_binary (pa_mmap_t *pmp, xi_workspace_t *workp, xi_parse_t *parsep,
+	     const char *filename)
+{
+    xi_binary_header_t *hdr;
+    xi_binary_t *xbp;
+    xi_parse_t *copyp;
+    xi_emit_t *emitp;
+    off_t size;
+
+    if (xi_binary_write(parsep, filename) < 0)
+	errx(1, "binary write failed: %s", filename);
+
+    xbp = xi_binary_open(filename);
+    if (xbp == NULL)
+	errx(1, "binary open failed: %s", filename);
+
+    hdr = xbp->xb_header;
+    printf("binary: nodes %u, names %u, namespaces %u, max depth %u\n",
+	   hdr->xbh_node_count, hdr->xbh_name_count, hdr->xbh_ns_count,
+	   hdr->xbh_max_depth);
+
+    copyp = xi_binary_import(xbp, pmp, workp, "binary");
+    if (copyp == NULL)
+	errx(1, "binary import failed: %s", filename);
+
+    fflush(stdout);
+    emitp = xi_emit_open(1, 0);
+    assert(emitp);
+    xi_emit_xml(emitp, copyp, PA_NULL_ATOM);
+    xi_emit_close(emitp);
+
+    size = hdr->xbh_file_size;
+    xi_parse_destroy(copyp);
+    xi_binary_close(xbp);
+
+    if (truncate(filename, size / 2) < 0)
+	err(1, "truncate failed: %s", filename);
+
+    xbp = xi_binary_open(filename);
+    printf("binary: truncated file %s\n", xbp ? "accepted" : "rejected");
+    xi_binary_close(xbp);
+    unlink(filename);
+}
+
 int
 main (int argc, char **argv)
 {
     const char *opt_filename = NULL;
     const char *opt_database = "test.db";
     const char *opt_config = NULL;
-    int opt_quiet = 0;
+    const char *opt_script = NULL;
+    const char *opt_cache = NULL;
+    const char *opt_binary = NULL;
+    const char *opt_index = NULL;
+    const char *opt_diff = NULL;
+    const char *opt_fixture = NULL;
+    const char *opt_emit_from = NULL;
+    const char *opt_rename_from = NULL, *opt_rename_to = NULL;
+    xi_cache_flags_t opt_cache_flags = 0;
+    const char *opt_select[TEST_MAX_SELECT];
+    unsigned opt_num_select = 0;
+    int opt_log = 0;
     int opt_dump = 0;
+    int opt_attribs = 0;
+    int opt_nodeset = 0;
+    int opt_intern = 0;
+    int opt_reset = 0;
+    int opt_order = 0;
+    int opt_sets = 0;
+    int opt_whiffle = 0;
+    int opt_strings = 0;
+    int opt_namespaces = 0;
+    int opt_rule_chains = 0;
+    int opt_emit_records = 0;
+    const char *opt_drive[TEST_MAX_DRIVE];
+    unsigned opt_num_drive = 0;
+    unsigned opt_workers = 1;
+    unsigned opt_drive_flags = 0;
+    const char *opt_lookup = NULL;
+    int opt_libxml = 0;
     int opt_unescape = 0;
-    int opt_clean = 0;
+    int opt_emit_xml = 0;
+    int opt_emit_json = 0;
+    int opt_stats = 0;
+    int opt_geometry = 0;
+    uint32_t opt_workspace_flags = 0;
     xi_source_flags_t flags = 0;
+    char path[PATH_MAX];
 
     for (argc = 1; argv[argc]; argc++) {
 	if (strcmp(argv[argc], "file") == 0
@@ -84,14 +1014,92 @@ main (int argc, char **argv)
 	} else if (strcmp(argv[argc], "database") == 0) {
 	    if (argv[argc + 1])
 		opt_database = argv[++argc];
+	} else if (strcmp(argv[argc], "script") == 0) {
+	    if (argv[argc + 1])
+		opt_script = argv[++argc];
+	} else if (strcmp(argv[argc], "cache") == 0) {
+	    if (argv[argc + 1])
+		opt_cache = argv[++argc];
+	} else if (strcmp(argv[argc], "index") == 0) {
+	    if (argv[argc + 1])
+		opt_index = argv[++argc];
+	} else if (strcmp(argv[argc], "diff") == 0) {
+	    if (argv[argc + 1])
+		opt_diff = argv[++argc];
+	} else if (strcmp(argv[argc], "fixture") == 0) {
+	    if (argv[argc + 1])
+		opt_fixture = argv[++argc];
+	} else if (strcmp(argv[argc], "emit-from") == 0) {
+	    if (argv[argc + 1])
+		opt_emit_from = argv[++argc];
+	} else if (strcmp(argv[argc], "whiffle") == 0) {
+	    opt_whiffle = 1;
+	} else if (strcmp(argv[argc], "rename") == 0) {
+	    if (argv[argc + 1] && argv[argc + 2]) {
+		opt_rename_from = argv[++argc];
+		opt_rename_to = argv[++argc];
+	    }
+	} else if (strcmp(argv[argc], "sets") == 0) {
+	    opt_sets = 1;
+	} else if (strcmp(argv[argc], "order") == 0) {
+	    opt_order = 1;
+	} else if (strcmp(argv[argc], "reset") == 0) {
+	    opt_reset = 1;
+	} else if (strcmp(argv[argc], "binary") == 0) {
+	    if (argv[argc + 1])
+		opt_binary = argv[++argc];
+	} else if (strcmp(argv[argc], "cache-content") == 0) {
+	    opt_cache_flags |= XCF_HASH_CONTENT;
+	} else if (strcmp(argv[argc], "select") == 0) {
+	    if (argv[argc + 1] && opt_num_select < TEST_MAX_SELECT)
+		opt_select[opt_num_select++] = argv[++argc];
 	} else if (strcmp(argv[argc], "dump") == 0) {
 	    opt_dump = 1;
-	} else if (strcmp(argv[argc], "quiet") == 0) {
-	    opt_quiet = 1;
-	} else if (strcmp(argv[argc], "clean") == 0) {
-	    opt_clean = 1;
+	} else if (strcmp(argv[argc], "log") == 0) {
+	    opt_log = 1;
+	} else if (strcmp(argv[argc], "attribs") == 0) {
+	    opt_attribs = 1;
+	} else if (strcmp(argv[argc], "nodeset") == 0) {
+	    opt_nodeset = 1;
+	} else if (strcmp(argv[argc], "libxml") == 0) {
+	    opt_libxml = 1;
+	} else if (strcmp(argv[argc], "libxml-file") == 0) {
+	    opt_libxml = 2;
+	} else if (strcmp(argv[argc], "emit-records") == 0) {
+	    opt_emit_records = 1;
+	} else if (strcmp(argv[argc], "drive") == 0) {
+	    if (argv[argc + 1] && opt_num_drive < TEST_MAX_DRIVE)
+		opt_drive[opt_num_drive++] = argv[++argc];
+	} else if (strcmp(argv[argc], "workers") == 0) {
+	    if (argv[argc + 1])
+		opt_workers = atoi(argv[++argc]);
+	} else if (strcmp(argv[argc], "keep") == 0) {
+	    opt_drive_flags |= XDF_KEEP_TREES;
+	} else if (strcmp(argv[argc], "lookup") == 0) {
+	    if (argv[argc + 1])
+		opt_lookup = argv[++argc];
+	} else if (strcmp(argv[argc], "rule-chains") == 0) {
+	    opt_rule_chains = 1;
+	} else if (strcmp(argv[argc], "strings") == 0) {
+	    opt_strings = 1;
+	} else if (strcmp(argv[argc], "namespaces") == 0) {
+	    opt_namespaces = 1;
 	} else if (strcmp(argv[argc], "unescape") == 0) {
 	    opt_unescape = 1;
+	} else if (strcmp(argv[argc], "intern") == 0) {
+	    opt_intern = 1;
+	} else if (strcmp(argv[argc], "stats") == 0) {
+	    opt_stats = 1;
+	} else if (strcmp(argv[argc], "large") == 0) {
+	    opt_workspace_flags |= XWF_LARGE;
+	} else if (strcmp(argv[argc], "geometry") == 0) {
+	    opt_geometry = 1;
+	} else if (strcmp(argv[argc], "emit-xml") == 0) {
+	    opt_emit_xml = 1;
+	} else if (strcmp(argv[argc], "emit-json") == 0) {
+	    opt_emit_json = 1;
+	} else if (strcmp(argv[argc], "emit-json-pretty") == 0) {
+	    opt_emit_json = 2;
 	} else if (strcmp(argv[argc], "line") == 0) {
 	    flags |= XPSF_LINE_NO;
 	} else if (strcmp(argv[argc], "trim") == 0) {
@@ -102,49 +1110,247 @@ main (int argc, char **argv)
 	    flags |= XPSF_IGNORE_COMMENTS;
 	} else if (strcmp(argv[argc], "ignore-dtd") == 0) {
 	    flags |= XPSF_IGNORE_DTD;
+	} else if (strcmp(argv[argc], "json") == 0) {
+	    flags |= XPSF_JSON;
 	}
     }
 
-    if (!opt_quiet)
-	slaxLogEnable(1);
-
-    if (opt_clean)
-	unlink(opt_database);
+    if (opt_log)
+	psu_log_enable(TRUE);
 
     assert (opt_database != NULL && opt_filename != NULL);
 
+    /*
+     * A fixture lives next to the input file, which holds the test
+     * arguments; it's for input that can't carry them itself.
+     */
+    char fixture[PATH_MAX];
+    if (opt_fixture)
+	opt_filename = test_path(fixture, sizeof(fixture),
+				 opt_filename, opt_fixture);
+
+    if (opt_cache) {
+	test_cache(opt_cache, opt_filename, flags, opt_cache_flags,
+		   opt_emit_xml);
+	return 0;
+    }
+
+    if (opt_num_drive) {
+	test_drive(opt_filename, opt_drive, opt_num_drive, opt_workers,
+		   opt_drive_flags, flags, opt_workspace_flags, opt_attribs,
+		   opt_select, opt_num_select);
+	return 0;
+    }
+
+    /* Each run starts with a fresh database */
+    unlink(opt_database);
+
     if (opt_config)
-	pa_config_read(opt_config);
+	pa_config_read(test_path(path, sizeof(path), opt_filename, opt_config));
 
-    pa_mmap_t *pmp = pa_mmap_open(opt_database, 0, 0644);
+    pa_mmap_t *pmp = pa_mmap_open(opt_database, "xi02", 0, 0644);
     assert(pmp);
 
-    xi_workspace_t *workp = xi_workspace_open(pmp, "test");
+    xi_workspace_t *workp = xi_workspace_open_flags(pmp, "test",
+						    opt_workspace_flags);
     assert(workp);
 
+    if (opt_geometry)
+	test_geometry(workp, "geometry");
+
+    if (opt_intern)
+	xi_text_intern_enable(workp);
+
+    if (opt_index)
+	xi_name_index_enable(workp);
+
+    xi_rulebook_t *rulebook = NULL;
+    if (opt_script) {
+	/* A script is a rulebook in XML; see xi_rulebook_prep() */
+	xi_parse_t *script = xi_parse_open(pmp, workp, "script",
+		   test_path(path, sizeof(path), opt_filename, opt_script),
+					   flags | XPSF_TRIM_WS);
+	assert(script);
+
+	xi_parse_set_default_rule(script, XIA_SAVE_ATTRIB);
+	xi_parse(script);
+
+	rulebook = xi_rulebook_prep(script, "script");
+	if (rulebook == NULL)
+	    errx(1, "rulebook prep failed: %s", opt_script);
+
+	xi_parse_destroy(script);
+
+    } else if (opt_num_select) {
+	rulebook = xi_rulebook_compile(workp, "select", opt_select,
+				       opt_num_select, XIA_SAVE);
+	if (rulebook == NULL)
+	    errx(1, "rulebook compile failed");
+    }
+
+    /* Turn off the transition table, so we walk the rule chains */
+    if (rulebook && opt_rule_chains)
+	rulebook->xrb_infop->xrsi_table_width = 0;
+
+    if (opt_whiffle) {
+	test_whiffle(workp, opt_filename, flags, opt_script ? rulebook : NULL,
+		     opt_select, opt_num_select,
+		     opt_rename_from, opt_rename_to, opt_emit_json);
+	xi_rulebook_close(rulebook);
+	xi_workspace_close(workp);
+	pa_mmap_close(pmp);
+	return 0;
+    }
+
     xi_parse_t *parsep = xi_parse_open(pmp, workp, "test",
 				       opt_filename, flags);
     assert(parsep);
 
+    if (rulebook)
+	xi_parse_set_rulebook(parsep, rulebook);
+    else if (opt_attribs)
+	xi_parse_set_default_rule(parsep, XIA_SAVE_ATTRIB);
+
+    if (opt_stats)
+	xi_parse_stats_enable(parsep);
+
+    if (opt_unescape)
+	parsep->xp_flags |= XI_PF_UNESCAPE;
+
+    test_record_t record = { 0, 0, 0, FALSE, opt_lookup, 0 };
+    if (opt_emit_records)
+	xi_parse_set_emit(parsep, test_emit_record, &record);
+
     xi_parse(parsep);
 
+    if (opt_index)
+	test_name_index(workp, opt_index);
+
+    /*
+     * Parse the input again in the emptied workspace; the rulebook
+     * and the names it holds should survive the reset.
+     */
+    if (opt_reset) {
+	parsep = test_reset(pmp, parsep, rulebook, opt_attribs,
+			    opt_filename, flags);
+
+	if (opt_index)
+	    test_name_index(workp, opt_index);
+    }
+
+    if (opt_emit_records) {
+	printf("records %u, highest node atom %u\n",
+	       record.tr_count, record.tr_max_atom);
+	if (opt_lookup)
+	    printf("lookups: highest text atom %u\n", record.tr_max_text);
+	fflush(stdout);
+    }
+
+    if (opt_stats) {
+	/* Timings vary from run to run, so only the counters are kept */
+	xi_parse_stats_t *statsp = xi_parse_stats(parsep);
+	statsp->xst_parse_ns = 0;
+	statsp->xst_source.xss_read_ns = 0;
+
+	xi_parse_stats_dump(parsep, stdout);
+	fflush(stdout);
+    }
+
+    if (opt_libxml) {
+	xmlDocPtr docp = (opt_libxml > 1)
+	    ? xi_libxml_read_file(opt_filename, NULL)
+	    : xi_libxml_build(parsep, NULL);
+	if (docp == NULL)
+	    errx(1, "libxml build failed");
+
+	fflush(stdout);
+	xmlDocDump(stdout, docp);
+	xmlFreeDoc(docp);
+    }
+
+    if (opt_order) {
+	test_order_t order = { 0, PA_NULL_ATOM, { PA_NULL_ATOM } };
+	xi_parse_emit(parsep, test_order, &order);
+	fflush(stdout);
+    }
+
+    if (opt_intern) {
+	test_intern_t intern = { 0, 0 };
+	xi_parse_emit(parsep, test_intern, &intern);
+	printf("intern: %u of %u values interned\n",
+	       intern.ti_interned, intern.ti_values);
+	fflush(stdout);
+    }
+
+    if (opt_sets)
+	test_sets(parsep);
+
+    if (opt_diff)
+	test_diff(pmp, parsep, opt_filename, opt_diff, flags);
+
+    if (opt_strings) {
+	xi_parse_emit(parsep, test_strings, NULL);
+	fflush(stdout);
+    }
+
+    if (opt_namespaces) {
+	xi_parse_emit(parsep, test_namespaces, NULL);
+	fflush(stdout);
+    }
+
     if (opt_dump) {
-	if (!opt_quiet)
-	    slaxLogEnable(1);
 	xi_parse_dump(parsep);
 	xi_parse_emit_xml(parsep, stdout);
     }
 
+    if (opt_emit_xml || opt_emit_json) {
+	/* "emit-from" emits just the subtree under the named element */
+	pa_atom_t from = PA_NULL_ATOM;
+	if (opt_emit_from) {
+	    from = test_find(parsep, opt_emit_from);
+	    if (from == PA_NULL_ATOM)
+		errx(1, "element not found: %s", opt_emit_from);
+	}
+
+	fflush(stdout);
+	xi_emit_t *emitp = xi_emit_open(1, (opt_emit_json > 1) ? XEF_PRETTY : 0);
+	assert(emitp);
+
+	if (opt_emit_xml)
+	    xi_emit_xml(emitp, parsep, from);
+	if (opt_emit_json)
+	    xi_emit_json(emitp, parsep, from);
+
+	xi_emit_close(emitp);
+    }
+
+    if (opt_binary)
+	test_binary(pmp, workp, parsep, opt_binary);
+
     /* Test nodesets */
-    xi_nodeset_t *nsp = xi_nodeset_alloc(workp, XI_NSTYPE_NORMAL, 0);
-    if (nsp) {
-	test_data_t test_data = { workp, nsp };
-	xi_parse_emit(parsep, test_node_set, &test_data);
-	xi_nodeset_dump(nsp);
-	xi_nodeset_free(nsp);
+    if (opt_nodeset) {
+	xi_nodeset_t *nsp = xi_nodeset_alloc(workp, XI_NSTYPE_NORMAL, 0);
+	if (nsp) {
+	    test_data_t test_data = { workp, nsp };
+	    xi_parse_emit(parsep, test_node_set, &test_data);
+	    xi_nodeset_dump(nsp);
+	    xi_nodeset_free(nsp);
+	}
     }
 
     xi_parse_destroy(parsep);
+    xi_rulebook_close(rulebook);
+    xi_workspace_close(workp);
+
+    /* A reopened workspace keeps the layout it was created with */
+    if (opt_geometry) {
+	workp = xi_workspace_open(pmp, "test");
+	assert(workp);
+	test_geometry(workp, "reopened");
+	xi_workspace_close(workp);
+    }
+
+    pa_mmap_close(pmp);
 
     return 0;
 }
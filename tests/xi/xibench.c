@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Parser throughput benchmark.  Each input file is parsed by each
+ * engine ("xi", "xi-rules", "libxml2", "json" for the libslax JSON
+ * reader, and "xi-json" for libxi's own) and we report one JSON
+ * object per line:
+ *
+ *   {"file": "wide.xml", "engine": "xi", "run": 1, "bytes": 1048576,
+ *    "seconds": 0.0123, "mb_per_sec": 81.3, "peak_rss_kb": 9012,
+ *    "allocs": 31337, "nodes": 27000, "status": "ok"}
+ *
+ * Every run happens in its own child process, so "peak_rss_kb" is
+ * that run's high water mark (from wait4()) and no run pays for the
+ * leftovers of another.  "allocs" counts calls to malloc/realloc/strdup
+ * for libxml2 and the JSON reader (via xmlMemSetup()); libxi doesn't
+ * use malloc for its trees, so for xi we count the node, text and
+ * name allocations made from the workspace's own pools.
+ *
+ * Usage:
+ *   xibench [engine <name>]... [select <path>]... [repeat <n>]
+ *           input <file> [input <file>]...
+ *
+ * "select" paths feed xi_rulebook_compile() for the "xi-rules" engine,
+ * which is skipped without them.  Files ending in ".json" are only
+ * given to the JSON engines; everything else goes to the XML engines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "slaxconfig.h"
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/xmlmemory.h>
+#include <libslax/slax.h>
+#include <libslax/slaxinternals.h>
+#include <libslax/jsonlexer.h>
+#include <libpsu/psucommon.h>
+#include <libpsu/psutime.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+
+#define XIBENCH_MAX_PATHS	32	/* Max "select" paths */
+#define XIBENCH_MAX_ENGINES	8	/* Max "engine" arguments */
+
+/* What a child hands back to us */
+typedef struct xibench_result_s {
+    int br_status;		/* Zero for success */
+    uint64_t br_bytes;		/* Bytes of input */
+    uint64_t br_nsecs;		/* Time spent parsing */
+    uint64_t br_allocs;		/* Allocations (see above) */
+    uint64_t br_nodes;		/* Nodes built */
+} xibench_result_t;
+
+typedef int (*xibench_func_t)(const char *filename, xibench_result_t *brp);
+
+typedef struct xibench_engine_s {
+    const char *be_name;	/* Engine name */
+    xibench_func_t be_func;	/* Function to run the parse */
+    unsigned be_flags;		/* Flags (BEF_*) */
+} xibench_engine_t;
+
+/* Flags for be_flags: */
+#define BEF_XML		(1<<0)	/* Engine reads XML */
+#define BEF_JSON	(1<<1)	/* Engine reads JSON */
+#define BEF_SELECT	(1<<2)	/* Engine needs "select" paths */
+
+static const char *xibench_paths[XIBENCH_MAX_PATHS];
+static unsigned xibench_npaths;
+
+static uint64_t xibench_allocs; /* Count from our xmlMemSetup hooks */
+
+static void *
+xibench_malloc (size_t size)
+{
+    xibench_allocs += 1;
+    return malloc(size);
+}
+
+static void *
+xibench_realloc (void *ptr, size_t size)
+{
+    xibench_allocs += 1;
+    return realloc(ptr, size);
+}
+
+static char *
+xibench_strdup (const char *str)
+{
+    xibench_allocs += 1;
+    return strdup(str);
+}
+
+static void
+xibench_mem_setup (void)
+{
+    xmlMemSetup(free, xibench_malloc, xibench_realloc, xibench_strdup);
+    xmlInitParser();
+}
+
+/*
+ * Count the nodes in a libxml2 tree, attributes included, so the
+ * number lines up with what libxi builds with XIA_SAVE_ATTRIB.
+ */
+static uint64_t
+xibench_count_nodes (xmlNodePtr nodep)
+{
+    uint64_t count = 0;
+    xmlAttrPtr attrp;
+
+    for ( ; nodep; nodep = nodep->next) {
+	count += 1;
+	if (nodep->type == XML_ELEMENT_NODE)
+	    for (attrp = nodep->properties; attrp; attrp = attrp->next)
+		count += 1;
+	if (nodep->children)
+	    count += xibench_count_nodes(nodep->children);
+    }
+
+    return count;
+}
+
+static int
+xibench_xi_common (const char *filename, xibench_result_t *brp,
+		   int use_rules, xi_source_flags_t flags)
+{
+    psu_time_nsecs_t start;
+    xi_parse_stats_t *statsp;
+    xi_workspace_t *workp = NULL;
+    xi_parse_t *parsep = NULL;
+    xi_rulebook_t *xrbp = NULL;
+    int rc = -1;
+
+    pa_mmap_t *pmp = pa_mmap_open(NULL, "xibench", 0, 0);
+    if (pmp == NULL)
+	return -1;
+
+    workp = xi_workspace_open(pmp, "xibench");
+    if (workp == NULL)
+	goto fail;
+
+    parsep = xi_parse_open(pmp, workp, "xibench", filename, flags);
+    if (parsep == NULL)
+	goto fail;
+
+    xi_parse_set_default_rule(parsep, XIA_SAVE_ATTRIB);
+
+    if (use_rules) {
+	xrbp = xi_rulebook_compile(workp, "xibench", xibench_paths,
+				   xibench_npaths, XIA_SAVE);
+	if (xrbp == NULL)
+	    goto fail;
+	xi_parse_set_rulebook(parsep, xrbp);
+    }
+
+    if (xi_parse_stats_enable(parsep) == NULL)
+	goto fail;
+
+    start = psu_time_now_nsecs();
+    rc = xi_parse(parsep);
+    brp->br_nsecs = psu_time_now_nsecs() - start;
+
+    statsp = xi_parse_stats(parsep);
+    brp->br_bytes = statsp->xst_source.xss_bytes;
+    brp->br_nodes = statsp->xst_workspace.xws_nodes;
+    brp->br_allocs = statsp->xst_workspace.xws_nodes
+	+ statsp->xst_workspace.xws_text + statsp->xst_workspace.xws_names;
+
+ fail:
+    /* The timing is done, so teardown doesn't count against us */
+    xi_parse_destroy(parsep);
+    xi_rulebook_close(xrbp);
+    xi_workspace_close(workp);
+    pa_mmap_close(pmp);
+
+    return rc;
+}
+
+static int
+xibench_xi (const char *filename, xibench_result_t *brp)
+{
+    return xibench_xi_common(filename, brp, FALSE, 0);
+}
+
+static int
+xibench_xi_rules (const char *filename, xibench_result_t *brp)
+{
+    return xibench_xi_common(filename, brp, TRUE, 0);
+}
+
+static int
+xibench_xi_json (const char *filename, xibench_result_t *brp)
+{
+    return xibench_xi_common(filename, brp, FALSE, XPSF_JSON);
+}
+
+static int
+xibench_libxml2 (const char *filename, xibench_result_t *brp)
+{
+    psu_time_nsecs_t start;
+    xmlDocPtr docp;
+
+    xibench_mem_setup();
+
+    start = psu_time_now_nsecs();
+    docp = xmlReadFile(filename, NULL, XML_PARSE_HUGE | XML_PARSE_NONET);
+    brp->br_nsecs = psu_time_now_nsecs() - start;
+    brp->br_allocs = xibench_allocs;
+
+    if (docp == NULL)
+	return -1;
+
+    brp->br_nodes = xibench_count_nodes(docp->children);
+    return 0;
+}
+
+static int
+xibench_json (const char *filename, xibench_result_t *brp)
+{
+    psu_time_nsecs_t start;
+    xmlDocPtr docp;
+
+    xibench_mem_setup();
+
+    start = psu_time_now_nsecs();
+    docp = slaxJsonFileToXml(filename, NULL, 0);
+    brp->br_nsecs = psu_time_now_nsecs() - start;
+    brp->br_allocs = xibench_allocs;
+
+    if (docp == NULL)
+	return -1;
+
+    brp->br_nodes = xibench_count_nodes(docp->children);
+    return 0;
+}
+
+static xibench_engine_t xibench_engines[] = {
+    { "xi", xibench_xi, BEF_XML },
+    { "xi-rules", xibench_xi_rules, BEF_XML | BEF_SELECT },
+    { "libxml2", xibench_libxml2, BEF_XML },
+    { "json", xibench_json, BEF_JSON },
+    { "xi-json", xibench_xi_json, BEF_JSON },
+    { NULL, NULL, 0 }
+};
+
+static xibench_engine_t *
+xibench_find_engine (const char *name)
+{
+    xibench_engine_t *bep;
+
+    for (bep = xibench_engines; bep->be_name; bep++)
+	if (strcmp(bep->be_name, name) == 0)
+	    return bep;
+
+    return NULL;
+}
+
+/*
+ * Write a string as a JSON value; file names are all we need this
+ * for, so quotes and backslashes are the only worry.
+ */
+static void
+xibench_json_string (const char *str)
+{
+    putchar('"');
+    for ( ; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    putchar('\\');
+	putchar(*str);
+    }
+    putchar('"');
+}
+
+/*
+ * Run one engine over one file in a child process and report on it
+ */
+static void
+xibench_run (xibench_engine_t *bep, const char *filename, unsigned run)
+{
+    xibench_result_t result;
+    struct rusage ru;
+    int pipefd[2];
+    int status;
+    pid_t pid;
+    ssize_t len;
+
+    if (pipe(pipefd) < 0)
+	err(1, "pipe");
+
+    fflush(stdout);
+
+    pid = fork();
+    if (pid < 0)
+	err(1, "fork");
+
+    if (pid == 0) {
+	close(pipefd[0]);
+
+	bzero(&result, sizeof(result));
+	result.br_status = bep->be_func(filename, &result);
+
+	if (write(pipefd[1], &result, sizeof(result)) != sizeof(result))
+	    _exit(1);
+	_exit(0);
+    }
+
+    close(pipefd[1]);
+
+    bzero(&result, sizeof(result));
+    len = read(pipefd[0], &result, sizeof(result));
+    close(pipefd[0]);
+
+    bzero(&ru, sizeof(ru));
+    while (wait4(pid, &status, 0, &ru) < 0)
+	if (errno != EINTR)
+	    err(1, "wait4");
+
+    if (len != sizeof(result) || !WIFEXITED(status)
+	|| WEXITSTATUS(status) != 0)
+	result.br_status = -1;
+
+    /* Trust the file size over whatever the engine could tell us */
+    struct stat st;
+    if (stat(filename, &st) == 0)
+	result.br_bytes = st.st_size;
+
+    long rss = ru.ru_maxrss;
+#ifdef __APPLE__
+    rss /= 1024;		/* Darwin reports bytes, not kilobytes */
+#endif /* __APPLE__ */
+
+    double secs = result.br_nsecs / (double) NSEC_PER_SEC;
+    double rate = (secs > 0) ? result.br_bytes / secs / (1024 * 1024) : 0;
+
+    printf("{\"file\": ");
+    xibench_json_string(filename);
+    printf(", \"engine\": \"%s\", \"run\": %u, \"bytes\": %llu, "
+	   "\"seconds\": %.6f, \"mb_per_sec\": %.2f, \"peak_rss_kb\": %ld, "
+	   "\"allocs\": %llu, \"nodes\": %llu, \"status\": \"%s\"}\n",
+	   bep->be_name, run, (unsigned long long) result.br_bytes,
+	   secs, rate, rss, (unsigned long long) result.br_allocs,
+	   (unsigned long long) result.br_nodes,
+	   result.br_status ? "failed" : "ok");
+}
+
+static int
+xibench_is_json (const char *filename)
+{
+    size_t len = strlen(filename);
+
+    return (len > 5 && strcmp(filename + len - 5, ".json") == 0);
+}
+
+int
+main (int argc, char **argv)
+{
+    xibench_engine_t *engines[XIBENCH_MAX_ENGINES];
+    unsigned nengines = 0;
+    const char **files;
+    unsigned nfiles = 0;
+    unsigned opt_repeat = 1;
+    unsigned i, j, run;
+
+    files = calloc(argc, sizeof(*files));
+    if (files == NULL)
+	err(1, "calloc");
+
+    for (argc = 1; argv[argc]; argc++) {
+	if (strcmp(argv[argc], "file") == 0
+	    || strcmp(argv[argc], "input") == 0) {
+	    if (argv[argc + 1])
+		files[nfiles++] = argv[++argc];
+	} else if (strcmp(argv[argc], "engine") == 0) {
+	    if (argv[argc + 1]) {
+		xibench_engine_t *bep = xibench_find_engine(argv[++argc]);
+		if (bep == NULL)
+		    errx(1, "unknown engine: %s", argv[argc]);
+		if (nengines >= XIBENCH_MAX_ENGINES)
+		    errx(1, "too many engines");
+		engines[nengines++] = bep;
+	    }
+	} else if (strcmp(argv[argc], "select") == 0) {
+	    if (argv[argc + 1]) {
+		if (xibench_npaths >= XIBENCH_MAX_PATHS)
+		    errx(1, "too many select paths");
+		xibench_paths[xibench_npaths++] = argv[++argc];
+	    }
+	} else if (strcmp(argv[argc], "repeat") == 0) {
+	    if (argv[argc + 1])
+		opt_repeat = atoi(argv[++argc]);
+	} else {
+	    errx(1, "unknown argument: %s", argv[argc]);
+	}
+    }
+
+    if (nfiles == 0)
+	errx(1, "usage: xibench [engine <name>]... [select <path>]... "
+	     "[repeat <n>] input <file>...");
+
+    /* No engines means all of them */
+    if (nengines == 0) {
+	xibench_engine_t *bep;
+	for (bep = xibench_engines; bep->be_name; bep++)
+	    engines[nengines++] = bep;
+    }
+
+    for (i = 0; i < nfiles; i++) {
+	unsigned want = xibench_is_json(files[i]) ? BEF_JSON : BEF_XML;
+
+	for (j = 0; j < nengines; j++) {
+	    if (!(engines[j]->be_flags & want))
+		continue;
+	    if ((engines[j]->be_flags & BEF_SELECT) && xibench_npaths == 0)
+		continue;
+
+	    for (run = 1; run <= opt_repeat; run++)
+		xibench_run(engines[j], files[i], run);
+	}
+    }
+
+    free(files);
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Parse a pile of files with xi_driver and report on it.  Files come
+ * from "input" arguments and from walking "dir" arguments (keeping
+ * only names ending in a "suffix" given before it).  The last line
+ * of output is a JSON object with the totals; "results" adds a line
+ * per file before it, in the same style as xibench.
+ *
+ * Usage:
+ *   xidrive [workers <n>] [select <path>]... [suffix <ext>] [results]
+ *           [keep] [intern] [large] [json] [trim]
+ *           (input <file> | dir <directory>)...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <err.h>
+#include <fts.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "slaxconfig.h"
+#include <libslax/slax.h>
+#include <libpsu/psucommon.h>
+#include <libpsu/psutime.h>
+#include <parrotdb/pacommon.h>
+#include <parrotdb/paconfig.h>
+#include <parrotdb/pammap.h>
+#include <parrotdb/pafixed.h>
+#include <parrotdb/paarb.h>
+#include <parrotdb/paistr.h>
+#include <parrotdb/papat.h>
+#include <parrotdb/pabitmap.h>
+#include <libxi/xicommon.h>
+#include <libxi/xisource.h>
+#include <libxi/xirules.h>
+#include <libxi/xitree.h>
+#include <libxi/xiworkspace.h>
+#include <libxi/xiparse.h>
+#include <libxi/xidriver.h>
+
+#define XIDRIVE_MAX_PATHS	32	/* Max "select" paths */
+
+static const char **xidrive_files;
+static unsigned xidrive_nfiles;
+static unsigned xidrive_max_files;
+
+static void
+xidrive_add_file (const char *filename)
+{
+    if (xidrive_nfiles >= xidrive_max_files) {
+	unsigned max = xidrive_max_files ? xidrive_max_files * 2 : 1024;
+	const char **files = realloc(xidrive_files, max * sizeof(*files));
+	if (files == NULL)
+	    err(1, "realloc");
+
+	xidrive_files = files;
+	xidrive_max_files = max;
+    }
+
+    xidrive_files[xidrive_nfiles] = strdup(filename);
+    if (xidrive_files[xidrive_nfiles] == NULL)
+	err(1, "strdup");
+    xidrive_nfiles += 1;
+}
+
+static void
+xidrive_add_dir (const char *dir, const char *suffix)
+{
+    char *paths[] = { (char *) dir, NULL };
+    size_t slen = suffix ? strlen(suffix) : 0;
+    FTSENT *entp;
+    FTS *ftsp;
+
+    ftsp = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    if (ftsp == NULL)
+	err(1, "%s", dir);
+
+    while ((entp = fts_read(ftsp)) != NULL) {
+	if (entp->fts_info != FTS_F)
+	    continue;
+
+	if (slen && (entp->fts_pathlen < slen
+		     || strcmp(entp->fts_path + entp->fts_pathlen - slen,
+			       suffix) != 0))
+	    continue;
+
+	xidrive_add_file(entp->fts_path);
+    }
+
+    fts_close(ftsp);
+}
+
+static void
+xidrive_json_string (const char *str)
+{
+    putchar('"');
+    for ( ; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    putchar('\\');
+	putchar(*str);
+    }
+    putchar('"');
+}
+
+int
+main (int argc, char **argv)
+{
+    const char *paths[XIDRIVE_MAX_PATHS];
+    unsigned npaths = 0;
+    const char *opt_suffix = NULL;
+    unsigned opt_workers = 0;
+    int opt_results = FALSE;
+    unsigned flags = 0;
+    xi_source_flags_t source_flags = 0;
+    uint32_t workspace_flags = 0;
+    unsigned i;
+
+    for (argc = 1; argv[argc]; argc++) {
+	if (strcmp(argv[argc], "file") == 0
+	    || strcmp(argv[argc], "input") == 0) {
+	    if (argv[argc + 1])
+		xidrive_add_file(argv[++argc]);
+	} else if (strcmp(argv[argc], "dir") == 0) {
+	    if (argv[argc + 1])
+		xidrive_add_dir(argv[++argc], opt_suffix);
+	} else if (strcmp(argv[argc], "suffix") == 0) {
+	    if (argv[argc + 1])
+		opt_suffix = argv[++argc];
+	} else if (strcmp(argv[argc], "workers") == 0) {
+	    if (argv[argc + 1])
+		opt_workers = atoi(argv[++argc]);
+	} else if (strcmp(argv[argc], "select") == 0) {
+	    if (argv[argc + 1]) {
+		if (npaths >= XIDRIVE_MAX_PATHS)
+		    errx(1, "too many select paths");
+		paths[npaths++] = argv[++argc];
+	    }
+	} else if (strcmp(argv[argc], "results") == 0) {
+	    opt_results = TRUE;
+	} else if (strcmp(argv[argc], "keep") == 0) {
+	    flags |= XDF_KEEP_TREES;
+	} else if (strcmp(argv[argc], "intern") == 0) {
+	    workspace_flags |= XWF_INTERN_TEXT;
+	} else if (strcmp(argv[argc], "large") == 0) {
+	    workspace_flags |= XWF_LARGE;
+	} else if (strcmp(argv[argc], "json") == 0) {
+	    source_flags |= XPSF_JSON;
+	} else if (strcmp(argv[argc], "trim") == 0) {
+	    source_flags |= XPSF_TRIM_WS;
+	} else {
+	    errx(1, "unknown argument: %s", argv[argc]);
+	}
+    }
+
+    if (xidrive_nfiles == 0)
+	errx(1, "no files to parse");
+
+    xi_driver_t *drvp = xi_driver_open(opt_workers, flags,
+				       source_flags, workspace_flags);
+    if (drvp == NULL)
+	errx(1, "could not make driver");
+
+    if (npaths && xi_driver_set_select(drvp, paths, npaths, XIA_SAVE) < 0)
+	errx(1, "could not compile select paths");
+
+    xi_driver_result_t *results = NULL;
+    if (opt_results) {
+	results = calloc(xidrive_nfiles, sizeof(*results));
+	if (results == NULL)
+	    err(1, "calloc");
+    }
+
+    xi_driver_run(drvp, xidrive_files, xidrive_nfiles, results);
+
+    for (i = 0; results && i < xidrive_nfiles; i++) {
+	xi_driver_result_t *resp = &results[i];
+
+	printf("{\"file\": ");
+	xidrive_json_string(resp->xdr_filename);
+	printf(", \"worker\": %u, \"bytes\": %llu, \"seconds\": %.6f, "
+	       "\"nodes\": %llu, \"status\": \"%s\"}\n",
+	       resp->xdr_worker, (unsigned long long) resp->xdr_bytes,
+	       resp->xdr_nsecs / (double) NSEC_PER_SEC,
+	       (unsigned long long) resp->xdr_nodes,
+	       resp->xdr_status ? "failed" : "ok");
+    }
+
+    const xi_driver_stats_t *statsp = xi_driver_stats(drvp);
+    double secs = statsp->xds_wall_nsecs / (double) NSEC_PER_SEC;
+
+    printf("{\"files\": %llu, \"failed\": %llu, \"bytes\": %llu, "
+	   "\"nodes\": %llu, \"workers\": %u, \"steals\": %llu, "
+	   "\"seconds\": %.6f, \"parse_seconds\": %.6f, "
+	   "\"mb_per_sec\": %.2f, \"files_per_sec\": %.1f}\n",
+	   (unsigned long long) statsp->xds_files,
+	   (unsigned long long) statsp->xds_failed,
+	   (unsigned long long) statsp->xds_bytes,
+	   (unsigned long long) statsp->xds_nodes,
+	   statsp->xds_workers,
+	   (unsigned long long) statsp->xds_steals,
+	   secs, statsp->xds_parse_nsecs / (double) NSEC_PER_SEC,
+	   (secs > 0) ? statsp->xds_bytes / secs / (1024 * 1024) : 0,
+	   (secs > 0) ? statsp->xds_files / secs : 0);
+
+    int rc = statsp->xds_failed ? 1 : 0;
+
+    xi_driver_close(drvp);
+    free(results);
+
+    for (i = 0; i < xidrive_nfiles; i++)
+	free((char *) xidrive_files[i]);
+    free(xidrive_files);
+
+    return rc;
+}
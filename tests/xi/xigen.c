@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2026, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ *
+ * agent (agent@) October 2026
+ *
+ * Generate a corpus document for xibench.  Each "shape" leans on a
+ * different part of the parser: "deep" makes long chains of nested
+ * open tags, "wide" makes lots of small siblings, "attrib" loads
+ * every tag with attributes, "text" is mostly character data (with
+ * the occasional entity), and "ns" declares and uses namespaces
+ * everywhere.  "json" makes a document for the JSON readers.
+ *
+ * Usage: xigen shape <shape> size <megabytes> [seed <seed>]
+ * The document is written to stdout.  The same shape, size and seed
+ * always give the same bytes, so runs can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <err.h>
+
+#define XIGEN_MB	(1024 * 1024)
+
+/*
+ * libxi won't nest deeper than XI_DEPTH_MAX (254) levels, so "deep"
+ * chains stop short of that, leaving room for <corpus>.
+ */
+#define XIGEN_DEEP_MAX	240
+
+static uint64_t xigen_seed = 1;
+static unsigned long long xigen_bytes; /* Bytes written so far */
+
+/*
+ * A small, stable generator; we want the same corpus on every host,
+ * which rand() doesn't promise.
+ */
+static unsigned
+xigen_random (unsigned limit)
+{
+    xigen_seed = xigen_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned) (xigen_seed >> 33) % limit;
+}
+
+static void
+xigen_out (const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+static void
+xigen_out (const char *fmt, ...)
+{
+    va_list vap;
+    int rc;
+
+    va_start(vap, fmt);
+    rc = vprintf(fmt, vap);
+    va_end(vap);
+
+    if (rc < 0)
+	err(1, "write failed");
+
+    xigen_bytes += rc;
+}
+
+static const char *xigen_words[] = {
+    "interface", "address", "family", "inet", "unit", "filter", "policy",
+    "route", "next-hop", "protocol", "neighbor", "group", "description",
+    "counter", "bandwidth", "vlan", "member", "system", "login", "class",
+};
+
+#define XIGEN_NWORDS (sizeof(xigen_words) / sizeof(xigen_words[0]))
+
+static const char *
+xigen_word (void)
+{
+    return xigen_words[xigen_random(XIGEN_NWORDS)];
+}
+
+/*
+ * Write a run of text, roughly "len" bytes long, with an entity
+ * thrown in now and then so the unescaping path gets some work.
+ */
+static void
+xigen_text (unsigned len)
+{
+    unsigned done = 0;
+
+    while (done < len) {
+	const char *word = xigen_word();
+
+	switch (xigen_random(16)) {
+	case 0:
+	    xigen_out("&amp; ");
+	    done += 6;
+	    break;
+	case 1:
+	    xigen_out("&lt;%s&gt; ", word);
+	    done += strlen(word) + 9;
+	    break;
+	default:
+	    xigen_out("%s ", word);
+	    done += strlen(word) + 1;
+	}
+    }
+}
+
+static void
+xigen_deep (void)
+{
+    unsigned depth = 16 + xigen_random(XIGEN_DEEP_MAX - 16);
+    unsigned i;
+
+    for (i = 0; i < depth; i++)
+	xigen_out("<%s>", xigen_words[i % XIGEN_NWORDS]);
+
+    xigen_out("%u", xigen_random(100000));
+
+    while (i-- > 0)
+	xigen_out("</%s>", xigen_words[i % XIGEN_NWORDS]);
+    xigen_out("\n");
+}
+
+static void
+xigen_wide (void)
+{
+    unsigned count = 64 + xigen_random(64);
+    unsigned i;
+
+    xigen_out("<list>\n");
+    for (i = 0; i < count; i++) {
+	const char *word = xigen_word();
+	xigen_out("<%s>%u</%s>\n", word, xigen_random(100000), word);
+    }
+    xigen_out("</list>\n");
+}
+
+static void
+xigen_attrib (void)
+{
+    unsigned count = 4 + xigen_random(12);
+    unsigned i, j;
+
+    xigen_out("<entry id=\"%u\">\n", xigen_random(1000000));
+    for (i = 0; i < count; i++) {
+	const char *word = xigen_word();
+	unsigned natt = 4 + xigen_random(16);
+
+	xigen_out("  <%s", word);
+	for (j = 0; j < natt; j++)
+	    xigen_out(" a%u=\"%s-%u\"", j, xigen_word(), xigen_random(1000));
+	xigen_out("/>\n");
+    }
+    xigen_out("</entry>\n");
+}
+
+static void
+xigen_text_shape (void)
+{
+    xigen_out("<para>");
+    xigen_text(1024 + xigen_random(16384));
+    xigen_out("</para>\n");
+}
+
+static void
+xigen_ns (void)
+{
+    unsigned count = 8 + xigen_random(24);
+    unsigned id = xigen_random(64);
+    unsigned i;
+
+    xigen_out("<n%u:block xmlns:n%u=\"urn:xigen:%u\" "
+	      "xmlns=\"urn:xigen:default\">\n", id, id, id);
+    for (i = 0; i < count; i++) {
+	const char *word = xigen_word();
+
+	if (xigen_random(2))
+	    xigen_out("  <n%u:%s n%u:kind=\"%s\">%u</n%u:%s>\n",
+		      id, word, id, xigen_word(), i, id, word);
+	else
+	    xigen_out("  <%s>%u</%s>\n", word, i, word);
+    }
+    xigen_out("</n%u:block>\n", id);
+}
+
+static void
+xigen_json (int first)
+{
+    unsigned count = 4 + xigen_random(12);
+    unsigned i;
+
+    xigen_out("%s  {\"id\": %u, \"name\": \"%s\", \"enabled\": %s, "
+	      "\"values\": [", first ? "" : ",\n",
+	      xigen_random(1000000), xigen_word(),
+	      xigen_random(2) ? "true" : "false");
+    for (i = 0; i < count; i++)
+	xigen_out("%s%u", i ? ", " : "", xigen_random(100000));
+    xigen_out("], \"detail\": {\"%s\": \"%s\", \"%s\": null}}",
+	      xigen_word(), xigen_word(), xigen_word());
+}
+
+int
+main (int argc, char **argv)
+{
+    const char *opt_shape = NULL;
+    unsigned long long opt_size = 0;
+    static char buf[XIGEN_MB];
+
+    for (argc = 1; argv[argc]; argc++) {
+	if (strcmp(argv[argc], "shape") == 0) {
+	    if (argv[argc + 1])
+		opt_shape = argv[++argc];
+	} else if (strcmp(argv[argc], "size") == 0) {
+	    if (argv[argc + 1])
+		opt_size = strtoull(argv[++argc], NULL, 0) * XIGEN_MB;
+	} else if (strcmp(argv[argc], "seed") == 0) {
+	    if (argv[argc + 1])
+		xigen_seed = strtoull(argv[++argc], NULL, 0);
+	} else {
+	    errx(1, "unknown argument: %s", argv[argc]);
+	}
+    }
+
+    if (opt_shape == NULL || opt_size == 0)
+	errx(1, "usage: xigen shape <shape> size <megabytes> [seed <seed>]");
+
+    void (*func)(void) = NULL;
+    int json = 0;
+
+    if (strcmp(opt_shape, "deep") == 0)
+	func = xigen_deep;
+    else if (strcmp(opt_shape, "wide") == 0)
+	func = xigen_wide;
+    else if (strcmp(opt_shape, "attrib") == 0)
+	func = xigen_attrib;
+    else if (strcmp(opt_shape, "text") == 0)
+	func = xigen_text_shape;
+    else if (strcmp(opt_shape, "ns") == 0)
+	func = xigen_ns;
+    else if (strcmp(opt_shape, "json") == 0)
+	json = 1;
+    else
+	errx(1, "unknown shape: %s", opt_shape);
+
+    setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+
+    if (json) {
+	xigen_out("[\n");
+	for (int first = 1; xigen_bytes < opt_size; first = 0)
+	    xigen_json(first);
+	xigen_out("\n]\n");
+
+    } else {
+	xigen_out("<?xml version=\"1.0\"?>\n<corpus shape=\"%s\">\n",
+		  opt_shape);
+	while (xigen_bytes < opt_size)
+	    func();
+	xigen_out("</corpus>\n");
+    }
+
+    if (fflush(stdout) != 0)
+	err(1, "write failed");
+
+    return 0;
+}